@@ -0,0 +1,135 @@
+/** @file bqueue.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "bqueue.h"
+
+/**
+ * Initializes the bounded queue.
+ * Should always be called first.
+ *
+ * @param q A pointer to the bounded queue.
+ * @param capacity Maximum number of items held at once (at least 1).
+ * @return void
+ */
+void bqueue_init(bqueue_t *q, unsigned int capacity) {
+	queue_init(&q->items);
+	q->capacity = capacity > 0 ? capacity : 1;
+	q->closed = 0;
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+}
+
+/**
+ * Frees all associated memory.  Items still queued are not freed.
+ * Should always be called last, when no thread uses the queue.
+ *
+ * @param q A pointer to the bounded queue.
+ * @return void
+ */
+void bqueue_destroy(bqueue_t *q) {
+	queue_destroy(&q->items);
+	pthread_mutex_destroy(&q->mutex);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+}
+
+/**
+ * Stores item at the back of the queue, waiting while the queue is full.
+ *
+ * @param q A pointer to the bounded queue.
+ * @param item Value of item to be stored.
+ * @return 0 on success.
+ * @return -1 if the queue has been closed.
+ */
+int bqueue_put(bqueue_t *q, void *item) {
+	pthread_mutex_lock(&q->mutex);
+	while(!q->closed && queue_size(&q->items) >= q->capacity)
+		pthread_cond_wait(&q->not_full, &q->mutex);
+
+	if(q->closed) {
+		pthread_mutex_unlock(&q->mutex);
+		return -1;
+	}
+
+	queue_enqueue(&q->items, item);
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->mutex);
+	return 0;
+}
+
+/**
+ * Stores item at the back of the queue without waiting.
+ *
+ * @param q A pointer to the bounded queue.
+ * @param item Value of item to be stored.
+ * @return 0 on success.
+ * @return -1 if the queue is full or closed.
+ */
+int bqueue_try_put(bqueue_t *q, void *item) {
+	int ret = -1;
+
+	pthread_mutex_lock(&q->mutex);
+	if(!q->closed && queue_size(&q->items) < q->capacity) {
+		queue_enqueue(&q->items, item);
+		pthread_cond_signal(&q->not_empty);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return ret;
+}
+
+/**
+ * Removes and returns the element at the front of the queue, waiting
+ * while the queue is empty.
+ *
+ * @param q A pointer to the bounded queue.
+ * @return A pointer to the oldest element in the queue.
+ * @return NULL once the queue is closed and empty.
+ */
+void *bqueue_take(bqueue_t *q) {
+	void *item;
+
+	pthread_mutex_lock(&q->mutex);
+	while(!q->closed && queue_size(&q->items) == 0)
+		pthread_cond_wait(&q->not_empty, &q->mutex);
+
+	item = queue_dequeue(&q->items);
+	if(item != NULL)
+		pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->mutex);
+	return item;
+}
+
+/**
+ * Closes the queue.  Blocked producers return -1, consumers drain the
+ * remaining items and then get NULL.
+ *
+ * @param q A pointer to the bounded queue.
+ * @return void
+ */
+void bqueue_close(bqueue_t *q) {
+	pthread_mutex_lock(&q->mutex);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+/**
+ * Returns number of items in the queue.
+ *
+ * @param q A pointer to the bounded queue.
+ * @return The number of items in the queue.
+ */
+unsigned int bqueue_size(bqueue_t *q) {
+	unsigned int size;
+
+	pthread_mutex_lock(&q->mutex);
+	size = queue_size(&q->items);
+	pthread_mutex_unlock(&q->mutex);
+	return size;
+}
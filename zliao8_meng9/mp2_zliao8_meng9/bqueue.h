@@ -0,0 +1,33 @@
+/** @file bqueue.h */
+#ifndef __BQUEUE_H__
+#define __BQUEUE_H__
+
+#include <pthread.h>
+
+#include "queue.h"
+
+/**
+ * Bounded Blocking Queue Data Structure
+ *
+ * A queue_t guarded by a mutex.  Producers wait while it holds
+ * capacity items and consumers wait while it is empty.
+ */
+typedef struct {
+	queue_t items; ///<Queued items, oldest first
+	unsigned int capacity; ///<Maximum number of queued items
+	int closed; ///<Set by bqueue_close(), no more puts accepted
+	pthread_mutex_t mutex; ///<Guards every field above
+	pthread_cond_t not_empty; ///<Signalled when an item is added or on close
+	pthread_cond_t not_full; ///<Signalled when an item is removed or on close
+} bqueue_t;
+
+void bqueue_init(bqueue_t *q, unsigned int capacity);
+void bqueue_destroy(bqueue_t *q);
+
+int bqueue_put(bqueue_t *q, void *item);
+int bqueue_try_put(bqueue_t *q, void *item);
+void *bqueue_take(bqueue_t *q);
+void bqueue_close(bqueue_t *q);
+unsigned int bqueue_size(bqueue_t *q);
+
+#endif
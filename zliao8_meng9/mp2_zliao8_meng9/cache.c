@@ -0,0 +1,486 @@
+/** @file cache.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#include "queue.h"
+#include "cache.h"
+
+#define CACHE_BUCKETS 1024
+
+/* Without inotify an entry is re-stat()ed at most this often */
+#define CACHE_RECHECK_SECONDS 1
+
+/**
+ * Private.  An inotify watch on a directory holding cached files.
+ */
+typedef struct {
+	int wd; ///<Watch descriptor
+	char *dir; ///<Directory, without the trailing '/'
+} cache_watch_t;
+
+/**
+ * Private.  Extra state kept per entry for the mtime fallback.
+ */
+typedef struct {
+	cache_entry_t entry; ///<Must come first
+	struct stat st; ///<File attributes when the entry was filled
+	time_t checked; ///<Last time st was compared with the file
+} cache_item_t;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry_t *buckets[CACHE_BUCKETS];
+static cache_entry_t *lru_head;
+static cache_entry_t *lru_tail;
+static cache_stats_t stats;
+static unsigned long generation;
+
+static int inotify_fd = -1;
+static int stop_fd = -1;
+static pthread_t watcher;
+static queue_t watches;
+
+/** Internal use only. */
+static unsigned int hash(const char *s)
+{
+	unsigned int h = 5381;
+	while(*s)
+		h = (h << 5) + h + (unsigned char)*s++;
+	return h % CACHE_BUCKETS;
+}
+
+/** Internal use only.  Bytes charged to the capacity for an entry. */
+static size_t entry_cost(cache_entry_t *e)
+{
+	return e->body_len + e->header_len[0] + e->header_len[1] + strlen(e->path);
+}
+
+/** Internal use only. */
+static void entry_free(cache_entry_t *e)
+{
+	free(e->path);
+	free(e->body);
+	free(e->header[0]);
+	free(e->header[1]);
+	free(e);
+}
+
+/** Internal use only.  Takes e out of the table, lock held. */
+static void entry_unlink(cache_entry_t *e)
+{
+	cache_entry_t **pp = &buckets[hash(e->path)];
+
+	while(*pp != e)
+		pp = &(*pp)->hnext;
+	*pp = e->hnext;
+
+	if(e->prev)
+		e->prev->next = e->next;
+	else
+		lru_head = e->next;
+	if(e->next)
+		e->next->prev = e->prev;
+	else
+		lru_tail = e->prev;
+
+	stats.bytes -= entry_cost(e);
+	stats.entries--;
+
+	if(--e->refs == 0)
+		entry_free(e);
+}
+
+/** Internal use only.  Finds an entry, lock held. */
+static cache_entry_t *entry_find(const char *path)
+{
+	cache_entry_t *e;
+
+	for(e = buckets[hash(path)]; e != NULL; e = e->hnext){
+		if(strcmp(e->path, path) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/** Internal use only.  Drops the entry for path if there is one, lock held. */
+static void invalidate(const char *path)
+{
+	cache_entry_t *e = entry_find(path);
+
+	generation++;
+	if(e != NULL){
+		entry_unlink(e);
+		stats.invalidations++;
+	}
+}
+
+/** Internal use only.  Drops every entry, lock held. */
+static void invalidate_all(void)
+{
+	generation++;
+	while(lru_head != NULL){
+		entry_unlink(lru_head);
+		stats.invalidations++;
+	}
+}
+
+/** Internal use only.  Watches the directory of path, lock held. */
+static void watch_dir(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir = slash ? strndup(path, slash - path) : strdup(".");
+	unsigned int i;
+
+	for(i = 0; i < queue_size(&watches); i++){
+		cache_watch_t *w = queue_at(&watches, i);
+		if(strcmp(w->dir, dir) == 0){
+			free(dir);
+			return;
+		}
+	}
+
+	int wd = inotify_add_watch(inotify_fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+	                           IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+	                           IN_DELETE_SELF | IN_MOVE_SELF);
+	if(wd < 0){
+		perror("inotify_add_watch");
+		free(dir);
+		return;
+	}
+
+	cache_watch_t *w = malloc(sizeof(cache_watch_t));
+	w->wd = wd;
+	w->dir = dir;
+	queue_enqueue(&watches, w);
+}
+
+/** Internal use only.  Handles one inotify event, lock held. */
+static void handle_event(struct inotify_event *ev)
+{
+	unsigned int i;
+
+	if(ev->mask & IN_Q_OVERFLOW){
+		// events were lost, nothing cached can be trusted
+		invalidate_all();
+		return;
+	}
+
+	for(i = 0; i < queue_size(&watches); i++){
+		cache_watch_t *w = queue_at(&watches, i);
+		if(w->wd != ev->wd)
+			continue;
+
+		if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)){
+			invalidate_all();
+			queue_remove_at(&watches, i);
+			free(w->dir);
+			free(w);
+		}else if(ev->len > 0){
+			char path[PATH_MAX];
+			snprintf(path, sizeof(path), "%s/%s", w->dir, ev->name);
+			invalidate(path);
+		}
+		return;
+	}
+}
+
+/** Internal use only.  Thread turning file changes into invalidations. */
+static void *cache_watcher(void *ptr)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd[2];
+
+	pfd[0].fd = inotify_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stop_fd;
+	pfd[1].events = POLLIN;
+
+	while(1){
+		if(poll(pfd, 2, -1) < 0){
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		if(pfd[1].revents)
+			break;
+
+		ssize_t len = read(inotify_fd, buf, sizeof(buf));
+		if(len <= 0)
+			continue;
+
+		pthread_mutex_lock(&cache_lock);
+		char *p = buf;
+		while(p < buf + len){
+			struct inotify_event *ev = (struct inotify_event *)p;
+			handle_event(ev);
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+		pthread_mutex_unlock(&cache_lock);
+	}
+	return ptr;
+}
+
+/**
+ * Initializes the cache and starts watching for file changes.
+ * Should always be called first.
+ *
+ * @param capacity Maximum number of bytes held, 0 disables the cache.
+ * @return 0 on success.
+ * @return -1 if inotify is unavailable, entries are then revalidated
+ *         by mtime instead.
+ */
+int cache_init(size_t capacity)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.capacity = capacity;
+	queue_init(&watches);
+
+	if(capacity == 0)
+		return 0;
+
+	if((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+	   (stop_fd = eventfd(0, EFD_CLOEXEC)) < 0 ||
+	   pthread_create(&watcher, NULL, cache_watcher, NULL) != 0){
+		perror("cache: inotify unavailable, falling back to mtime checks");
+		if(inotify_fd >= 0)
+			close(inotify_fd);
+		if(stop_fd >= 0)
+			close(stop_fd);
+		inotify_fd = -1;
+		stop_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the watcher and frees every entry not referenced by a reader.
+ * Should always be called last.
+ */
+void cache_destroy(void)
+{
+	uint64_t one = 1;
+
+	if(stop_fd >= 0){
+		if(write(stop_fd, &one, sizeof(one)) < 0)
+			perror("write");
+		pthread_join(watcher, NULL);
+		close(stop_fd);
+		close(inotify_fd);
+		stop_fd = -1;
+		inotify_fd = -1;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	while(lru_head != NULL)
+		entry_unlink(lru_head);
+
+	cache_watch_t *w;
+	while((w = queue_dequeue(&watches)) != NULL){
+		free(w->dir);
+		free(w);
+	}
+	stats.capacity = 0;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Returns the largest body worth caching.  Bigger files are streamed
+ * from the disk every time so one of them cannot flush the whole cache.
+ */
+size_t cache_max_entry(void)
+{
+	return stats.capacity / 16;
+}
+
+/**
+ * Looks up a cached file.  Without inotify the file is re-stat()ed when
+ * the entry has not been checked for CACHE_RECHECK_SECONDS.
+ *
+ * @param path The file path, e.g. "web/index.html".
+ * @return The entry, to be given back with cache_release().
+ * @return NULL on a miss.
+ */
+cache_entry_t *cache_lookup(const char *path)
+{
+	cache_entry_t *e;
+
+	if(stats.capacity == 0)
+		return NULL;
+
+	pthread_mutex_lock(&cache_lock);
+	e = entry_find(path);
+
+	if(e != NULL && inotify_fd < 0){
+		cache_item_t *item = (cache_item_t *)e;
+		time_t now = time(NULL);
+		if(now - item->checked >= CACHE_RECHECK_SECONDS){
+			struct stat st;
+			if(stat(path, &st) < 0 || st.st_mtime != item->st.st_mtime ||
+			   st.st_size != item->st.st_size || st.st_ino != item->st.st_ino){
+				invalidate(path);
+				e = NULL;
+			}else{
+				item->checked = now;
+			}
+		}
+	}
+
+	if(e == NULL){
+		stats.misses++;
+		pthread_mutex_unlock(&cache_lock);
+		return NULL;
+	}
+
+	// move to the front of the LRU list
+	if(e != lru_head){
+		e->prev->next = e->next;
+		if(e->next)
+			e->next->prev = e->prev;
+		else
+			lru_tail = e->prev;
+		e->prev = NULL;
+		e->next = lru_head;
+		lru_head->prev = e;
+		lru_head = e;
+	}
+
+	e->refs++;
+	stats.hits++;
+	pthread_mutex_unlock(&cache_lock);
+	return e;
+}
+
+/**
+ * Gives back an entry obtained from cache_lookup() or cache_insert().
+ *
+ * @param e The entry.
+ */
+void cache_release(cache_entry_t *e)
+{
+	pthread_mutex_lock(&cache_lock);
+	if(--e->refs == 0)
+		entry_free(e);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Prepares to fill an entry for path: starts watching its directory
+ * and returns a counter that changes whenever a file is invalidated.
+ * Call it before opening the file and pass the result to
+ * cache_insert(), so contents that may have changed while they were
+ * read are never cached.
+ *
+ * @param path The file path, e.g. "web/index.html".
+ * @return The current invalidation generation.
+ */
+unsigned long cache_generation(const char *path)
+{
+	unsigned long g;
+
+	pthread_mutex_lock(&cache_lock);
+	if(inotify_fd >= 0)
+		watch_dir(path);
+	g = generation;
+	pthread_mutex_unlock(&cache_lock);
+	return g;
+}
+
+/**
+ * Adds a file to the cache, evicting the least recently used entries
+ * to make room.
+ *
+ * @param path The file path, e.g. "web/index.html".
+ * @param body The file contents, malloc'd.  Owned by the cache on success.
+ * @param body_len Length of body in bytes.
+ * @param header_close Response header used with "Connection: close".
+ * @param header_keep_alive Response header used with Keep-Alive.
+ * @param gen cache_generation() taken before the file was opened.
+ * @return The new entry, to be given back with cache_release().
+ * @return NULL if the file may have changed since gen or does not fit;
+ *         body then still belongs to the caller.
+ */
+cache_entry_t *cache_insert(const char *path, char *body, size_t body_len,
+                            const char *header_close, const char *header_keep_alive,
+                            unsigned long gen)
+{
+	cache_item_t *item;
+	cache_entry_t *e, *old;
+
+	if(body_len > cache_max_entry())
+		return NULL;
+
+	item = calloc(1, sizeof(cache_item_t));
+	e = &item->entry;
+	e->path = strdup(path);
+	e->body = body;
+	e->body_len = body_len;
+	e->header[0] = strdup(header_close);
+	e->header_len[0] = strlen(header_close);
+	e->header[1] = strdup(header_keep_alive);
+	e->header_len[1] = strlen(header_keep_alive);
+	e->refs = 2;
+	if(inotify_fd < 0){
+		stat(path, &item->st);
+		item->checked = time(NULL);
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	if(gen != generation){
+		pthread_mutex_unlock(&cache_lock);
+		e->body = NULL;
+		entry_free(e);
+		return NULL;
+	}
+
+	if((old = entry_find(path)) != NULL)
+		entry_unlink(old);
+
+	while(lru_tail != NULL && stats.bytes + entry_cost(e) > stats.capacity){
+		entry_unlink(lru_tail);
+		stats.evictions++;
+	}
+
+	unsigned int h = hash(path);
+	e->hnext = buckets[h];
+	buckets[h] = e;
+	e->prev = NULL;
+	e->next = lru_head;
+	if(lru_head)
+		lru_head->prev = e;
+	else
+		lru_tail = e;
+	lru_head = e;
+
+	stats.bytes += entry_cost(e);
+	stats.entries++;
+	stats.inserts++;
+	pthread_mutex_unlock(&cache_lock);
+	return e;
+}
+
+/**
+ * Copies the counters.
+ *
+ * @param out Filled with the current values.
+ */
+void cache_get_stats(cache_stats_t *out)
+{
+	pthread_mutex_lock(&cache_lock);
+	*out = stats;
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,51 @@
+/** @file cache.h */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+
+#define CACHE_DEFAULT_CAPACITY (64 * 1024 * 1024)
+
+/**
+ * A cached file: its body plus the response headers built for it.
+ * Entries handed out by cache_lookup() stay valid until cache_release().
+ */
+typedef struct cache_entry {
+	char *path; ///<Key, e.g. "web/index.html"
+	char *body; ///<File contents
+	size_t body_len; ///<Length of body in bytes
+	char *header[2]; ///<Complete response header, [0] close and [1] Keep-Alive
+	size_t header_len[2]; ///<Lengths of the two headers
+	int refs; ///<References held by readers, plus one while in the table
+	struct cache_entry *hnext; ///<Next entry in the same hash bucket
+	struct cache_entry *prev; ///<LRU neighbours, most recently used first
+	struct cache_entry *next;
+} cache_entry_t;
+
+/**
+ * Counters, see cache_get_stats().
+ */
+typedef struct {
+	unsigned long hits; ///<Lookups answered from memory
+	unsigned long misses; ///<Lookups that had to go to the disk
+	unsigned long inserts; ///<Files added
+	unsigned long evictions; ///<Entries dropped to stay under capacity
+	unsigned long invalidations; ///<Entries dropped because the file changed
+	size_t bytes; ///<Bytes currently held
+	size_t capacity; ///<Maximum bytes held
+	unsigned int entries; ///<Number of cached files
+} cache_stats_t;
+
+int cache_init(size_t capacity);
+void cache_destroy(void);
+
+size_t cache_max_entry(void);
+cache_entry_t *cache_lookup(const char *path);
+void cache_release(cache_entry_t *e);
+unsigned long cache_generation(const char *path);
+cache_entry_t *cache_insert(const char *path, char *body, size_t body_len,
+                            const char *header_close, const char *header_keep_alive,
+                            unsigned long generation);
+void cache_get_stats(cache_stats_t *stats);
+
+#endif
@@ -0,0 +1,305 @@
+/** @file connpool.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "connpool.h"
+
+/**
+ * Private.  A connection to a peer waiting for the next request.
+ */
+typedef struct idle_conn {
+	char *host; ///<Peer it is connected to
+	char *port;
+	int fd; ///<The socket
+	struct timespec since; ///<When its last response ended
+	struct idle_conn *next; ///<Next idle connection, most recently used first
+} idle_conn_t;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static idle_conn_t *idle_list;
+static unsigned long idle_ms = CONNPOOL_DEFAULT_IDLE_MS;
+static connpool_stats_t stats;
+
+/** Internal use only.  Milliseconds from since to now. */
+static double age_ms(const struct timespec *since, const struct timespec *now)
+{
+	return (now->tv_sec - since->tv_sec) * 1000.0 + (now->tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/** Internal use only.  Closes and frees one idle connection. */
+static void idle_free(idle_conn_t *c)
+{
+	close(c->fd);
+	free(c->host);
+	free(c->port);
+	free(c);
+}
+
+/**
+ * Internal use only.  Whether an idle connection can still carry a
+ * request.  Nothing is due on it, so anything readable means the peer
+ * closed it, or broke the protocol.
+ */
+static int idle_healthy(int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN | POLLRDHUP;
+	return poll(&pfd, 1, 0) == 0;
+}
+
+/** Internal use only.  Closes the connections idle too long, lock held. */
+static void idle_expire(const struct timespec *now)
+{
+	idle_conn_t **pp = &idle_list, *c;
+
+	while((c = *pp) != NULL){
+		if(age_ms(&c->since, now) >= idle_ms){
+			*pp = c->next;
+			idle_free(c);
+			stats.expired++;
+			stats.idle--;
+		}else{
+			pp = &c->next;
+		}
+	}
+}
+
+/**
+ * Sets how long connections are kept idle.
+ *
+ * @param ms Idle time in milliseconds, 0 to never reuse a connection.
+ * @return void
+ */
+void connpool_set_idle(unsigned long ms)
+{
+	pthread_mutex_lock(&pool_lock);
+	idle_ms = ms;
+	pthread_mutex_unlock(&pool_lock);
+	if(ms == 0)
+		connpool_clear();
+}
+
+/**
+ * Internal use only.  Connects a socket, giving up after timeout_ms
+ * milliseconds rather than the minutes the kernel waits for a host
+ * that does not answer.  The socket stays blocking.
+ *
+ * @return 0, or -1 with errno set, ETIMEDOUT after the timeout.
+ */
+static int connect_within(int fd, const struct sockaddr *addr, socklen_t len, int timeout_ms)
+{
+	int flags = fcntl(fd, F_GETFL), err = 0;
+	socklen_t err_len = sizeof(err);
+	struct pollfd pfd;
+
+	if(timeout_ms < 0)
+		return connect(fd, addr, len);
+
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	if(connect(fd, addr, len) < 0){
+		if(errno != EINPROGRESS)
+			return -1;
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		if(poll(&pfd, 1, timeout_ms) <= 0){
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0){
+			errno = err;
+			return -1;
+		}
+	}
+	fcntl(fd, F_SETFL, flags);
+	return 0;
+}
+
+/**
+ * Opens a new TCP connection to a peer, trying each of its addresses.
+ *
+ * @param host Host name or address.
+ * @param port Port of its HTTP server.
+ * @param timeout_ms Longest time for all addresses together, -1 for
+ *        the kernel's own timeout.
+ * @return The socket, or -1 if the peer cannot be reached in time.
+ */
+int connpool_connect(const char *host, const char *port, int timeout_ms)
+{
+	struct addrinfo hints, *res, *ai;
+	struct timespec start, now;
+	int fd = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host, port, &hints, &res))
+		return -1;
+
+	for(ai = res; ai != NULL; ai = ai->ai_next){
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if(fd < 0)
+			continue;
+		int left = timeout_ms;
+		if(timeout_ms >= 0){
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left = timeout_ms - (int)age_ms(&start, &now);
+		}
+		if(timeout_ms < 0 || left > 0){
+			if(connect_within(fd, ai->ai_addr, ai->ai_addrlen, left) == 0)
+				break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if(fd >= 0){
+		pthread_mutex_lock(&pool_lock);
+		stats.connects++;
+		pthread_mutex_unlock(&pool_lock);
+	}
+	return fd;
+}
+
+/**
+ * Returns a connection to a peer for one request: the most recently
+ * used idle one that passes the health check, or else a new one.  Only
+ * one request may use it at a time, so back-to-back queries share
+ * connections while concurrent ones open more.
+ *
+ * @param host Host name or address.
+ * @param port Port of its HTTP server.
+ * @param timeout_ms Longest wait for a new connection, -1 for no limit.
+ * @param reused Set to 1 if the connection was idle in the pool.  The
+ *        peer may still close it at the very moment the request goes
+ *        out, so a request getting no answer at all on it should be
+ *        sent again on a new one.
+ * @return The socket, or -1 if the peer cannot be reached.
+ */
+int connpool_get(const char *host, const char *port, int timeout_ms, int *reused)
+{
+	idle_conn_t **pp, *c;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&pool_lock);
+	idle_expire(&now);
+	for(pp = &idle_list; (c = *pp) != NULL; ){
+		if(strcmp(c->host, host) != 0 || strcmp(c->port, port) != 0){
+			pp = &c->next;
+			continue;
+		}
+		*pp = c->next;
+		stats.idle--;
+		if(idle_healthy(c->fd)){
+			int fd = c->fd;
+			c->fd = -1;
+			stats.reuses++;
+			pthread_mutex_unlock(&pool_lock);
+			free(c->host);
+			free(c->port);
+			free(c);
+			*reused = 1;
+			return fd;
+		}
+		idle_free(c);
+		stats.stale++;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	*reused = 0;
+	return connpool_connect(host, port, timeout_ms);
+}
+
+/**
+ * Gives back a connection whose last response was read to its very
+ * end, for the next request to the same peer.  Beyond
+ * CONNPOOL_MAX_IDLE idle connections to a peer the oldest is closed.
+ *
+ * @param host Host name or address it is connected to.
+ * @param port Port it is connected to.
+ * @param fd The socket, owned by the pool from now on.
+ * @return void
+ */
+void connpool_put(const char *host, const char *port, int fd)
+{
+	idle_conn_t *c, **pp, **oldest = NULL;
+	int same = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	if(idle_ms == 0){
+		pthread_mutex_unlock(&pool_lock);
+		close(fd);
+		return;
+	}
+
+	c = malloc(sizeof(idle_conn_t));
+	c->host = strdup(host);
+	c->port = strdup(port);
+	c->fd = fd;
+	clock_gettime(CLOCK_MONOTONIC, &c->since);
+	c->next = idle_list;
+	idle_list = c;
+	stats.idle++;
+
+	for(pp = &idle_list; *pp != NULL; pp = &(*pp)->next){
+		if(strcmp((*pp)->host, host) == 0 && strcmp((*pp)->port, port) == 0){
+			same++;
+			oldest = pp;
+		}
+	}
+	if(same > CONNPOOL_MAX_IDLE){
+		c = *oldest;
+		*oldest = c->next;
+		idle_free(c);
+		stats.idle--;
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Closes every idle connection.
+ *
+ * @return void
+ */
+void connpool_clear(void)
+{
+	idle_conn_t *c;
+
+	pthread_mutex_lock(&pool_lock);
+	while((c = idle_list) != NULL){
+		idle_list = c->next;
+		idle_free(c);
+	}
+	stats.idle = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Copies the counters.
+ *
+ * @param out Filled with the current values.
+ * @return void
+ */
+void connpool_get_stats(connpool_stats_t *out)
+{
+	pthread_mutex_lock(&pool_lock);
+	*out = stats;
+	pthread_mutex_unlock(&pool_lock);
+}
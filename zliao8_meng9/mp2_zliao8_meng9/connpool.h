@@ -0,0 +1,29 @@
+/** @file connpool.h */
+#ifndef __CONNPOOL_H__
+#define __CONNPOOL_H__
+
+/* Idle connections to a peer are closed after this long, well before the
+   peer's own idle deadline so a request rarely meets a closing socket */
+#define CONNPOOL_DEFAULT_IDLE_MS 30000
+/* Idle connections kept per peer */
+#define CONNPOOL_MAX_IDLE 4
+
+/**
+ * Counters, see connpool_get_stats().
+ */
+typedef struct {
+	unsigned long connects; ///<New connections opened
+	unsigned long reuses; ///<Requests sent on an idle connection
+	unsigned long stale; ///<Idle connections the peer had closed, found by the health check
+	unsigned long expired; ///<Idle connections closed after the idle time
+	unsigned int idle; ///<Connections idle right now
+} connpool_stats_t;
+
+void connpool_set_idle(unsigned long idle_ms);
+int connpool_get(const char *host, const char *port, int timeout_ms, int *reused);
+int connpool_connect(const char *host, const char *port, int timeout_ms);
+void connpool_put(const char *host, const char *port, int fd);
+void connpool_clear(void);
+void connpool_get_stats(connpool_stats_t *stats);
+
+#endif
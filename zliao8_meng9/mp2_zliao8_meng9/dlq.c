@@ -1,503 +1,1403 @@
-/** @file server.c */
-
-#define _GNU_SOURCE
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <errno.h>
-#include <pthread.h>
-#include <netdb.h>
-#include <unistd.h>
-#include <signal.h>
-#include <assert.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <sys/stat.h> 
-
-#include "queue.h"
-#include "./libs/libhttp.h"
-#include "./libs/libdictionary.h"
-
-// global variables
-int exit_flag;
-struct addrinfo *res;
-int server_sock;
-queue_t *clients;
-queue_t *pids;
-
-
-
-const char *HTTP_404_CONTENT = "<html><head><title>404 Not Found</title></head><body><h1>404 Not Found</h1>The requested resource could not be found but may be available again in the future.<div style=\"color: #eeeeee; font-size: 8pt;\">Actually, it probably won't ever be available unless this is showing up because of a bug in your program. :(</div></html>";
-const char *HTTP_501_CONTENT = "<html><head><title>501 Not Implemented</title></head><body><h1>501 Not Implemented</h1>The server either does not recognise the request method, or it lacks the ability to fulfill the request.</body></html>";
-
-const char *HTTP_200_STRING = "OK";
-const char *HTTP_404_STRING = "Not Found";
-const char *HTTP_501_STRING = "Not Implemented";
-
-char* process_http_header_request(const char *request)
-{
-	//fprintf(stderr, "request is %s\n", request);
-	// Ensure our request type is correct...
-	if (strncmp(request, "GET ", 4) != 0)
-		return NULL;
-    
-	// Ensure the function was called properly...
-	assert( strstr(request, "\r") == NULL );
-	assert( strstr(request, "\n") == NULL );
-    
-	// Find the length, minus "GET "(4) and " HTTP/1.1"(9)...
-	int len = strlen(request) - 4 - 9;
-    
-	// Copy the filename portion to our new string...
-	char *filename = malloc(len + 1);
-	strncpy(filename, request + 4, len);
-	filename[len] = '\0';
-    
-	// Prevent a directory attack...
-	//  (You don't want someone to go to http://server:1234/../server.c to view your source code.)
-	if (strstr(filename, ".."))
-	{
-		free(filename);
-		return NULL;
-	}
-    
-	return filename;
-}
-
-void handler(int sig){
-    
-	exit_flag = 1;
-	close(server_sock);
-    
-	int *ptrc = NULL;
-	while((ptrc = queue_dequeue(clients)) != NULL){
-		if(*ptrc != -1){
-			shutdown(*ptrc, SHUT_RDWR);
-			//close(*ptrc);
-		}
-		free(ptrc);
-	}
-    
-	pthread_t *ptrp = NULL;
-	while((ptrp = queue_dequeue(pids)) != NULL){
-		pthread_join(*ptrp, NULL);
-		free(ptrp);
-	}
-    
-	free(clients);
-	free(pids);
-	freeaddrinfo(res);
-	sig = 0;
-}
-
-
-void *worker(void *ptr){
-    
-	/*
- 	 *  Reading the HTTP Header
- 	 *
- 	 */
-	int *socket = (int*)ptr;
-	fd_set master;
-	fd_set slave;
-	FD_ZERO(&master);
-	FD_SET(*socket, &master);
-    
-	while(1){
-		slave = master;
-		select(*socket+1, &slave, NULL, NULL, NULL);
-        
-		if(exit_flag == 1) break;
-        
-		http_t *new = malloc(sizeof(http_t));
-        
-		if(http_read(new, *socket) <= 0){
-			printf("No HTTP request could be processed... \n");
-			http_free(new);
-			free(new);
-			break;
-		}
-        
-		char *fptr = process_http_header_request(http_get_status(new));
-		int response_code;
-		char *response_header = malloc(1024);;
-		char *content_type = malloc(32);
-		char *content_length = malloc(256);
-		char *connection = malloc(64);
-		int con_flag = 0;
-        
-		if(fptr == NULL){
-            
-			// 501 response
-			response_code = 501;
-			// header
-			sprintf(response_header, "HTTP/1.1 %d %s\r\n", response_code, (char*)HTTP_501_STRING);
-			// content_type
-			sprintf(content_type, "Content-Type: text/html\r\n");
-			strcat(response_header, content_type);
-			// content_length
-			sprintf(content_length, "Content-Length: %d\r\n", (int)strlen((char*)HTTP_501_CONTENT));
-			strcat(response_header, content_length);
-			// connection
-			const char* con = http_get_header(new, "Connection");
-			if(strcasecmp(con, "Keep-Alive") == 0){
-				sprintf(connection, "Connection: Keep-Alive\r\n");
-			}else{
-				sprintf(connection, "Connection: close\r\n");
-				con_flag = 1;
-			}
-			strcat(response_header, connection);
-			strcat(response_header, "\r\n");
-            
-			// communicating over sockets
-			// send(socket descriptor you want to send data to,
-			// 	a pointer to the data you want to send,
-			// 	length of that data in bytes,
-			// 	just set flags to 0)
-			// return number of bytes actually sent out
-			//fprintf(stderr, "\n\n%s\n", response_header);
-			send(*socket, (const void*)response_header, strlen(response_header), 0);
-			send(*socket, HTTP_501_CONTENT, strlen(HTTP_501_CONTENT), 0);
-			
-			
-		}else{
-			// get correct path
-			char *fdir = malloc(256);
-			strcpy(fdir, "web/");
-			if(strcmp(fptr, "/") == 0){
-				// process as /index.html
-				strcat(fdir, "index.html");
-			}else{
-				strcat(fdir, fptr);
-			}
-            
-			// fopen call under the web directory
-			// return 404 response if not exist
-			// if exist return entire contents of the file (200 response)
-            
-			//if(f == NULL){
-			struct stat FileAttrib;
-			FILE *f = fopen(fdir, "r");
-			if(f == NULL){
-				// 404 response code
-				response_code = 404;
-				// header
-				sprintf(response_header, "HTTP/1.1 %d %s\r\n", response_code, (char*)HTTP_404_STRING);
-				// content_type
-				sprintf(content_type, "Content-Type: text/html\r\n");
-				strcat(response_header, content_type);
-				// content_length
-				sprintf(content_length, "Content-Length: %d\r\n", (int)strlen((char*)HTTP_404_CONTENT));
-				strcat(response_header, content_length);
-				// connection
-				const char* con = http_get_header(new, "Connection");
-				if(strcasecmp(con, "Keep-Alive") == 0){
-					sprintf(connection, "Connection: Keep-Alive\r\n");
-				}else{
-					sprintf(connection, "Connection: close\r\n");
-					con_flag = 1;
-				}
-				strcat(response_header, connection);
-				strcat(response_header, "\r\n");
-                
-				// send
-				//fprintf(stderr, "\n\n%s\n", response_header);
-				send(*socket, (const void*)response_header, strlen(response_header), 0);
-				send(*socket, HTTP_404_CONTENT, strlen(HTTP_404_CONTENT), 0);
-                
-			}else{
-				// 200 response
-				response_code = 200;
-				stat(fdir, &FileAttrib);
-				
-				// header
-				sprintf(response_header, "HTTP/1.1 %d %s\r\n", response_code, (char*)HTTP_200_STRING);
-				// content_typerver_sock, res->ai_addr, res->ai_addrlen) == -1){
-				//                 per
-				get_content_type(content_type, fdir);
-				strcat(response_header, content_type);
-				// content_length
-				//sprintf(content_length, "Content-Length: %d\r\n", (int)strlen((char*)HTTP_200_STRING));
-				sprintf(content_length, "Content-Length: %jd\r\n", (intmax_t)FileAttrib.st_size);
-				strcat(response_header, content_length);
-				// connection
-				const char* con = http_get_header(new, "Connection");
-				if(strcasecmp(con, "Keep-Alive") == 0){
-					sprintf(connection, "Connection: Keep-Alive\r\n");
-				}else{
-					sprintf(connection, "Connection: close\r\n");
-					con_flag = 1;
-				}
-				strcat(response_header, connection);
-				strcat(response_header, "\r\n");
-                
-				// send files
-				send(*socket, (const void*)response_header, strlen(response_header), 0);
-                
-				size_t body_size = (intmax_t)FileAttrib.st_size;
-				//fprintf(stderr, "\n\n%s\n", response_header);
-				char *response_body = malloc(body_size);
-				response_body[0] = '\0';
-                
-				fread(response_body, body_size, 1, f);
-                
-				send(*socket, (const void*)response_body, body_size, 0);
-				free(response_body);
-				fclose(f);
-			}
-			free(fdir);
-            
-		}
-		
-		free(response_header);
-		free(content_length);
-		free(connection);
-		free(content_type);
-		free(fptr);
-		http_free(new);
-		free(new);
-		if(con_flag){
-			break;
-		}
-        
-	}
-    
-	return NULL;
-    
-}
-
-
-void *server(void *ptr){
-    
-    char *port = (char*)ptr;
-    
-    struct addrinfo hints;
-    
-    /*
-     clients = malloc(sizeof(queue_t));
-     pids = malloc(sizeof(queue_t));
-     queue_init(clients);
-     queue_init(pids);
-     exit_flag = 0;
-     */
-    
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_flags = AI_PASSIVE;
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = 0;
-    
-	/* getaddrinfo(host name or IP address,
-     port number or the name of a particular service(http, ftp, telnet, or smtp),
-     already filled out struct addrinfo,
-     struct addrinfo gonna to be filled out) */
-	if(getaddrinfo(NULL, port, &hints, &res)){
-		perror("getaddrinfo");
-		return 0;
-	}
-    
-	/* get the file descriptor:
-     socket(IPv4 or IPv6, stream or datagram, TCP or UDP) */
-	server_sock = socket(AF_INET, SOCK_STREAM, 0);
-	if(server_sock < 0){
-		perror("socket");
-		return 0;
-	}
-    
-	/* bind socket to the port number:
-     bind(socket file descriptor, pointer to the port and IP address, length of that address); */
-	if(bind(server_sock, res->ai_addr, res->ai_addrlen) == -1){
-		perror("bind");
-		return 0;
-	}
-    
-	/* wait for incoming connections
-     listen(socket file descriptor from socket(), number of connections allowed on the incoming queue) */
-	if(listen(server_sock, 20) == -1){
-		perror("listen");
-		return 0;
-	}
-    
-	signal(SIGINT, handler);
-	fd_set master;
-	fd_set slave;
-	FD_ZERO(&master);
-	FD_SET(server_sock, &master);
-    
-    while(1){
-		slave = master;
-		if(select(server_sock+1, &slave, NULL, NULL, NULL) < 0){
-			perror("select");
-			break;
-		}
-		if (exit_flag == 1) break;
-        
-		int *client_socket = malloc(sizeof(int));
-		*client_socket = 0;
-		queue_enqueue(clients, client_socket);
-        
-		/* return a brand new socket file descriptor to use
-         accept(listening socket descriptor,
-         pointer to a local struct sockaddr_storage which stores the information about the incoming connection,
-         local integer variable that set to sizeof(struct sockaddr_storage))*/
-		if( (*client_socket = accept(server_sock, NULL, NULL)) < 0){
-			perror("accept");
-			return 0;
-		}else{
-            pthread_t *p = malloc(sizeof(pthread_t));
-			queue_enqueue(pids, p);
-			int rc = pthread_create(p, NULL, worker, (void *)client_socket);
-			if (rc){
-				fprintf(stderr, "---ERROR; pthread_create failed, return code is %d\n", rc);
-				exit(-1);
-			}
-		}
-	}
-    
-}
-
-
-int start_server(char *port){
-    
-    pthread_t *p = malloc(sizeof(pthread_t));
-    int rc = pthread_create(p, NULL, server, (void *)port);
-    if (rc){
-        fprintf(stderr, "---ERROR; pthread_create failed, return code is %d\n", rc);
-        exit(-1);
-    }
-    
-    return 1;
-}
-
-
-int main(int argc, char **argv)
-{
-    
-    
-    /*
-     *  User Interface
-     *
-     *  1. Displaying a menu for user to start running the program
-     *
-     */
-    fprintf(stderr, "\n|***************************************************|\n");
-    fprintf(stderr, "|******        Distributed Log Querier        ******|\n");
-    fprintf(stderr, "|---------------------------------------------------|\n");
-    fprintf(stderr, "|===          Zihan Liao & Qinglei Meng          ===|\n");
-    fprintf(stderr, "|===                06/08/2013                   ===|\n");
-    fprintf(stderr, "|===          CS425 Distributed Systems          ===|\n");
-    fprintf(stderr, "|===                   MP2                       ===|\n");
-    fprintf(stderr, "|===  University of Illinois at Urbana-Champaign ===|\n");
-    fprintf(stderr, "|***************************************************|\n\n");
-    fprintf(stderr, "|***************************************************|\n");
-    fprintf(stderr, "|-------------------    Menu   ---------------------|\n");
-    fprintf(stderr, "|-------  1. Mannual                        --------|\n");
-    fprintf(stderr, "|-------  2. Start local server             --------|\n");
-    fprintf(stderr, "|-------  3. Generating local log file      --------|\n");
-    fprintf(stderr, "|-------  4. Grep                           --------|\n");
-    fprintf(stderr, "|-------  5. Exit                           --------|\n");
-    fprintf(stderr, "|***************************************************|\n");
-    
-    while (1) {
-        fprintf(stderr, "\n$ Please choose (1-5) from the menu: ");
-        char in[64];
-        fgets(in, 64, stdin);
-        int choice = atoi(in);
-        
-        if (choice == 1) {
-            fprintf(stderr, "your choice is 1\n");
-        }else if(choice == 2){
-            fprintf(stderr, "your choice is 2\n");
-            fprintf(stderr, "\n-- select a port number for the server: ");
-            char *port_in = malloc(32);
-            fgets(port_in, 32, stdin);
-            int port = atoi(port_in);
-            if(port <= 0 || port >= 65536){
-                fprintf(stderr, "-- Illegal port number.\n");
-            }else{
-                if(start_server(port_in)){
-                    fprintf(stderr, "-- Congratulations! The server has been started!\n");
-                }else{
-                    fprintf(stderr, "-- Sorry! Starting server failed, please try again!\n");
-                }
-            }
-        }else if(choice == 3){
-            fprintf(stderr, "your choice is 3\n");
-        }else if(choice == 4){
-            fprintf(stderr, "your choice is 4\n");
-        }else if(choice == 5){
-            fprintf(stderr, "your choice is 5\n");
-            exit(0);
-        }else{
-            fprintf(stderr, "-- error, not in the choice range\n");
-        }
-        
-    }
-    
-    /*
-     *  Incoming message handler
-     *
-     *  1. To start the program, run ./mp2 [port number]
-     *  2. The program will create a new thread to run a server and
-     *      listen to incoming HTTP requests
-     *  3. The server will create a worker thread to handle each
-     *      incoming requests, run the commands and send back data
-     *
-     */
-    
-    if(argc != 2){
-		fprintf(stderr, "Usage: %s [port number]\n", argv[0]);
-		return 1;
-	}
-    
-	int port = atoi(argv[1]);
-	if(port <= 0 || port >= 65536){
-		fprintf(stderr, "Illegal port number.\n");
-		return 1;
-	}
-    
-    /*pthread_t *p = malloc(sizeof(pthread_t));
-    int rc = pthread_create(p, NULL, server, (void *)&port);
-    if (rc){
-        fprintf(stderr, "---ERROR; pthread_create failed, return code is %d\n", rc);
-        exit(-1);
-    }*/
-    
-
-
-    
-    
-    /*
-     *  Terminal monitor
-     *
-     *  1. Monitoring new commands on the terminal
-     *  2. Giving corresponding responses or starting to run the Querier
-     *
-     */
-    
-    
-    /*
-     *  Querier
-     *
-     *  1. It will handle the new commands and send requests to other
-     *      distributed machines
-     *  2. It waits for data from other machines
-     *
-     */
-    
-    /*
-     *  Output processor
-     *
-     *  1. After successfully getting messages from other distributed 
-     *      machines, it processes data and prints it out
-     *
-     */
-
-
-
-
-	return 0;
-}
-
-
-
+/** @file server.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <signal.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h> 
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+
+#include "queue.h"
+#include "pool.h"
+#include "cache.h"
+#include "rcache.h"
+#include "reactor.h"
+#include "response.h"
+#include "listener.h"
+#include "query.h"
+#include "grep.h"
+#include "matcher.h"
+#include "querier.h"
+#include "loggen.h"
+#include "logindex.h"
+#include "logwatch.h"
+#include "connpool.h"
+#include "member.h"
+#include "segment.h"
+#include "./libs/libhttp.h"
+#include "./libs/libdictionary.h"
+
+/* Parts of the server, in the order server() starts them */
+#define SERVER_CACHES 0x01
+#define SERVER_GREP 0x02
+#define SERVER_LOGINDEX 0x04
+#define SERVER_SEGMENT 0x08
+#define SERVER_LOGWATCH 0x10
+#define SERVER_WORKERS 0x20
+#define SERVER_FOLLOWERS 0x40
+#define SERVER_REACTORS 0x80
+#define SERVER_MEMBER 0x100
+
+// global variables
+int exit_flag;
+int server_running; // set by server(), a second start fails until server_stop()
+int server_parts; // SERVER_* parts started so far, all server_stop() tears down
+int sig_fd = -1; // Ctrl-C, read by the menu on the main thread
+struct addrinfo *res;
+int *listen_socks;
+int num_listen;
+int num_reactors; // 0 means one per core
+int listen_backlog = LISTENER_DEFAULT_BACKLOG;
+int reuseport; // one SO_REUSEPORT listener per pinned reactor
+listener_overflows_t overflow_base; // host counters when the server started
+const char *log_path = "dlq.log"; // local log answered by /grep
+int use_segment; // /grep reads the log from its compressed segment
+const char *peers_path = QUERIER_DEFAULT_PEERS; // nodes asked by menu option 4
+int grep_merge = 1; // option 4 orders the lines of all nodes by time
+unsigned long grep_deadline_ms = QUERIER_DEFAULT_DEADLINE_MS; // option 4 gives up on slower nodes
+unsigned long grep_hedge_ms = QUERIER_DEFAULT_HEDGE_MS; // option 4 asks replicas of nodes silent this long
+member_opts_t member_opts; // heartbeat timing of the failure detector
+int member_enabled = 1; // the server watches the nodes of the peer list
+int grep_threads; // 0 means one per core
+loggen_opts_t gen_opts; // what menu option 3 writes
+int num_workers = POOL_DEFAULT_THREADS;
+unsigned int queue_depth = POOL_DEFAULT_DEPTH;
+pool_t workers;
+int num_followers = LOGWATCH_DEFAULT_FOLLOWERS;
+pool_t followers; // workers of follow queries, which never end by themselves
+size_t cache_capacity = CACHE_DEFAULT_CAPACITY;
+size_t rcache_capacity = RCACHE_DEFAULT_CAPACITY;
+
+
+
+const char *HTTP_400_CONTENT = "<html><head><title>400 Bad Request</title></head><body><h1>400 Bad Request</h1>The server cannot process the request, the grep pattern is not a valid regular expression.</body></html>";
+const char *HTTP_404_CONTENT = "<html><head><title>404 Not Found</title></head><body><h1>404 Not Found</h1>The requested resource could not be found but may be available again in the future.<div style=\"color: #eeeeee; font-size: 8pt;\">Actually, it probably won't ever be available unless this is showing up because of a bug in your program. :(</div></html>";
+const char *HTTP_501_CONTENT = "<html><head><title>501 Not Implemented</title></head><body><h1>501 Not Implemented</h1>The server either does not recognise the request method, or it lacks the ability to fulfill the request.</body></html>";
+
+const char *HTTP_503_CONTENT = "<html><head><title>503 Service Unavailable</title></head><body><h1>503 Service Unavailable</h1>The server is currently overloaded, please try again later.</body></html>";
+
+const char *HTTP_200_STRING = "OK";
+const char *HTTP_400_STRING = "Bad Request";
+const char *HTTP_404_STRING = "Not Found";
+const char *HTTP_501_STRING = "Not Implemented";
+const char *HTTP_503_STRING = "Service Unavailable";
+
+char* process_http_header_request(const char *request)
+{
+	//fprintf(stderr, "request is %s\n", request);
+	// Ensure our request type is correct...
+	if (strncmp(request, "GET ", 4) != 0)
+		return NULL;
+    
+	// Ensure the function was called properly...
+	assert( strstr(request, "\r") == NULL );
+	assert( strstr(request, "\n") == NULL );
+    
+	// Find the length, minus "GET "(4) and " HTTP/1.1"(9)...
+	int len = strlen(request) - 4 - 9;
+    
+	// Copy the filename portion to our new string...
+	char *filename = malloc(len + 1);
+	strncpy(filename, request + 4, len);
+	filename[len] = '\0';
+    
+	// Prevent a directory attack...
+	//  (You don't want someone to go to http://server:1234/../server.c to view your source code.)
+	if (strstr(filename, ".."))
+	{
+		free(filename);
+		return NULL;
+	}
+    
+	return filename;
+}
+
+/**
+ * Stops the server: followers end their responses, running jobs
+ * finish, then the reactors close every client.  Runs on the main
+ * thread, never from a signal handler, since it takes locks and joins
+ * the threads it stops.  Only the parts server() started are torn
+ * down, so it also undoes a start that failed half way.
+ *
+ * @return void
+ */
+void server_stop(void){
+    
+	if(res == NULL)
+		return;
+	exit_flag = 1;
+    
+	int i;
+	for(i = 0; i < num_listen; i++)
+		close(listen_socks[i]);
+	if(server_parts & SERVER_MEMBER)
+		member_stop();
+	if(server_parts & SERVER_LOGWATCH)
+		logwatch_destroy();
+	// jobs stuck on clients that do not read give up at once
+	if(server_parts & SERVER_REACTORS)
+		reactor_cancel_jobs();
+	if(server_parts & SERVER_FOLLOWERS)
+		pool_destroy(&followers);
+	if(server_parts & SERVER_WORKERS)
+		pool_destroy(&workers);
+	if(server_parts & SERVER_REACTORS){
+		reactor_stop_all();
+		matcher_cache_destroy();
+	}
+	if(server_parts & SERVER_GREP)
+		grep_destroy();
+	if(server_parts & SERVER_LOGINDEX)
+		logindex_destroy();
+	if(server_parts & SERVER_SEGMENT)
+		segment_destroy();
+	if(server_parts & SERVER_CACHES){
+		rcache_destroy();
+		cache_destroy();
+		response_canned_free();
+	}
+	server_parts = 0;
+	freeaddrinfo(res);
+	res = NULL;
+	free(listen_socks);
+	listen_socks = NULL;
+	num_listen = 0;
+	server_running = 0;
+}
+
+/**
+ * Internal use only.  Reads a line of input like fgets(), unless Ctrl-C
+ * comes first: SIGINT is blocked in every thread and read from sig_fd
+ * here, so the server is stopped on the main thread before exiting.
+ *
+ * @return buf, or NULL at the end of the input.
+ */
+static char *menu_gets(char *buf, int size){
+	struct pollfd pfd[2];
+    
+	pfd[0].fd = STDIN_FILENO;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sig_fd;
+	pfd[1].events = POLLIN;
+	pfd[0].revents = pfd[1].revents = 0;
+	while(poll(pfd, 2, -1) < 0 && errno == EINTR)
+		;
+	if(pfd[1].revents & POLLIN){
+		struct signalfd_siginfo si;
+		if(read(sig_fd, &si, sizeof(si)) < 0)
+			perror("read");
+		fprintf(stderr, "\n-- interrupted, stopping\n");
+		server_stop();
+		exit(0);
+	}
+	return fgets(buf, size, stdin);
+}
+
+/**
+ * Picks the Content-Type from the file extension.
+ *
+ * @param fdir Path of the file.
+ * @return A static MIME type string.
+ */
+const char *get_content_type(const char *fdir){
+	const char* dot = strrchr(fdir, '.');
+	dot = dot ? dot + 1 : "";
+	if(strcmp(dot, "html") == 0){
+		return "text/html";
+	}else if(strcmp(dot, "css") == 0){
+		return "text/css";
+	}else if(strcmp(dot, "jpg") == 0){
+		return "image/jpeg";
+	}else if(strcmp(dot, "png") == 0){
+		return "image/png";
+	}
+	return "text/plain";
+}
+
+/**
+ * Checks whether the client asked to keep the connection open.
+ *
+ * @param req The parsed request.
+ * @return 1 for "Connection: Keep-Alive", 0 otherwise.
+ */
+int keep_alive(http_t *req){
+	const char* con = http_get_header(req, "Connection");
+	return con != NULL && strcasecmp(con, "Keep-Alive") == 0;
+}
+
+/**
+ * Checks whether the request line ends in HTTP/1.1, so the client
+ * understands "Transfer-Encoding: chunked".
+ *
+ * @param req The parsed request.
+ * @return 1 for HTTP/1.1, 0 otherwise.
+ */
+int accepts_chunked(http_t *req){
+	const char *status = http_get_status(req);
+	size_t len = status ? strlen(status) : 0;
+	return len >= 8 && strcmp(status + len - 8, "HTTP/1.1") == 0;
+}
+
+/**
+ * A static file request handed to the worker pool.
+ */
+typedef struct {
+	char *fdir; ///<Path under web/
+	int keep_alive; ///<Client asked for Keep-Alive
+} file_request_t;
+
+/**
+ * Sends a file under web/, or a 404 if it cannot be opened, and caches
+ * small files for the reactors.  Runs on a pool worker through
+ * conn_defer() because open/read/sendfile may block on the disk, which
+ * must never stall a reactor.
+ *
+ * @param c The client connection.
+ * @param arg The file_request_t, freed here.
+ * @return 1 if the connection must be closed, -1 if it is broken.
+ */
+int serve_file(conn_t *c, void *arg){
+    
+	file_request_t *req = arg;
+	char *fdir = req->fdir;
+	response_t resp;
+	int rc = 0;
+    
+	// open call under the web directory
+	// return 404 response if not exist
+	// if exist stream the file with sendfile (200 response)
+    
+	struct stat FileAttrib;
+	unsigned long gen = cache_generation(fdir);
+	int f = open(fdir, O_RDONLY | O_CLOEXEC);
+	if(f >= 0 && (fstat(f, &FileAttrib) < 0 || !S_ISREG(FileAttrib.st_mode))){
+		close(f);
+		f = -1;
+	}
+	if(f < 0){
+		// 404 response, preassembled
+		size_t len;
+		const char *msg = response_canned(404, req->keep_alive, &len);
+		if(conn_send_all(c, msg, len, 0) < 0)
+			rc = -1;
+        
+	}else{
+		// 200 response
+		size_t body_size = (size_t)FileAttrib.st_size;
+		char *body = NULL;
+		cache_entry_t *e = NULL;
+        
+		response_init(&resp, 200, HTTP_200_STRING);
+		response_header(&resp, "Content-Type", get_content_type(fdir));
+		response_header_num(&resp, "Content-Length", (long long)FileAttrib.st_size);
+        
+		// small files are read once and kept in the cache together
+		// with both variants of their header
+		if(body_size <= cache_max_entry() && (body = malloc(body_size + 1)) != NULL){
+			size_t got = 0;
+			while(got < body_size){
+				ssize_t n = pread(f, body + got, body_size - got, got);
+				if(n < 0 && errno == EINTR)
+					continue;
+				if(n <= 0)
+					break;
+				got += n;
+			}
+			if(got == body_size){
+				response_t close_resp = resp;
+				response_t keep_alive_resp = resp;
+				response_connection(&close_resp, 0);
+				response_connection(&keep_alive_resp, 1);
+				if(response_end(&close_resp, NULL, 0) > 0 &&
+				   response_end(&keep_alive_resp, NULL, 0) > 0)
+					e = cache_insert(fdir, body, body_size, close_resp.header,
+					                 keep_alive_resp.header, gen);
+			}else{
+				free(body);
+				body = NULL;
+			}
+		}
+        
+		response_connection(&resp, req->keep_alive);
+        
+		if(e != NULL){
+			struct iovec iov[2];
+			iov[0].iov_base = e->header[req->keep_alive];
+			iov[0].iov_len = e->header_len[req->keep_alive];
+			iov[1].iov_base = e->body;
+			iov[1].iov_len = e->body_len;
+			if(conn_sendv_all(c, iov, 2, 0) < 0)
+				rc = -1;
+			cache_release(e);
+		}else if(body != NULL){
+			response_end(&resp, body, body_size);
+			if(conn_sendv_all(c, resp.iov, resp.iovcnt, 0) < 0)
+				rc = -1;
+			free(body);
+		}else{
+			// send files: the body goes from the page cache straight to
+			// the socket, MSG_MORE keeps the header in the same segment
+			if(response_end(&resp, NULL, 0) < 0 ||
+			   conn_sendv_all(c, resp.iov, resp.iovcnt, MSG_MORE) < 0 ||
+			   conn_send_file(c, f, 0, body_size) < 0)
+				rc = -1;
+		}
+		close(f);
+	}
+	
+	free(fdir);
+	rc = rc < 0 ? rc : !req->keep_alive;
+	free(req);
+    
+	return rc;
+    
+}
+
+/**
+ * A grep request handed to the worker pool.
+ */
+typedef struct {
+	query_t q; ///<What to look for
+	conn_t *c; ///<Where the lines go
+	int chunked; ///<Body framed with Transfer-Encoding: chunked
+	int keep_alive; ///<Client asked for Keep-Alive, kept unless the body ends with the connection
+	unsigned long seen; ///<Generation of the log a follow query last looked at
+	grep_mark_t mark; ///<Where a follow query starts, taken with the first generation
+} grep_request_t;
+
+/** Pool job emit callback, streams a batch of matching lines. */
+static int grep_send(const char *buf, size_t len, void *arg){
+	grep_request_t *req = arg;
+	struct iovec iov[3];
+	char size[24];
+    
+	if(!req->chunked)
+		return conn_send_all(req->c, buf, len, 0);
+    
+	// one chunk per batch, size line, lines and CRLF in one sendmsg
+	iov[0].iov_base = size;
+	iov[0].iov_len = snprintf(size, sizeof(size), "%zx\r\n", len);
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = len;
+	iov[2].iov_base = "\r\n";
+	iov[2].iov_len = 2;
+	return conn_sendv_all(req->c, iov, 3, 0);
+}
+
+/**
+ * Follow query wait callback.  Returns once the log changed, or -1 when
+ * the client has left or the server stops.  While the log is quiet the
+ * client is checked every LOGWATCH_IDLE_MS, as nothing is sent that
+ * could fail.
+ */
+static int follow_wait(void *arg){
+	grep_request_t *req = arg;
+	struct pollfd pfd;
+	int rc;
+    
+	pfd.fd = req->c->fd;
+	pfd.events = POLLRDHUP;
+	do{
+		rc = logwatch_wait(&req->seen, LOGWATCH_IDLE_MS);
+		if(exit_flag || (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR))))
+			return -1;
+	}while(rc == 0);
+	return rc < 0 ? -1 : 0;
+}
+
+/**
+ * Answers GET /grep?q=pattern with every line of the local log that
+ * holds the pattern.  Runs on a pool worker through conn_defer()
+ * because it reads the whole log.  Lines are sent as they are found,
+ * so the body length is never known up front: HTTP/1.1 clients get
+ * one chunk per batch of lines and may keep the connection, older
+ * ones get a body that ends when the connection is closed.  A chunked
+ * body cut short by an error lacks its last chunk, so the client can
+ * tell it from a complete one.  A count query is answered with just
+ * the number, so its length is known and any client may keep the
+ * connection.  A follow query sends the lines appended to the log
+ * from now on, as they are written, until the client leaves, its
+ * limit is reached or the server stops; it runs on the followers pool
+ * and the log need not exist yet.
+ *
+ * @param c The client connection.
+ * @param arg The grep_request_t, freed here.
+ * @return 1 if the connection must be closed, -1 if it is broken.
+ */
+int serve_grep(conn_t *c, void *arg){
+	grep_request_t *req = arg;
+	response_t resp;
+	int rc = 0;
+	int fd = open(log_path, O_RDONLY | O_CLOEXEC);
+	long count = 0;
+    
+	req->c = c;
+	if(fd >= 0)
+		close(fd);
+	// a log converted with -z may be removed, its segment still answers
+	else if(segment_covered(log_path) > 0)
+		fd = 0;
+	if(fd >= 0){
+		// a count is one number, known only once the scan is over
+		if(req->q.count && (count = grep_file(log_path, &req->q, grep_send, req)) < 0)
+			fd = -1;
+	}
+    
+	if(fd < 0 && !req->q.follow){
+		size_t len;
+		const char *msg = response_canned(404, req->keep_alive, &len);
+		if(conn_send_all(c, msg, len, 0) < 0)
+			rc = -1;
+	}else if(req->q.count){
+		char body[32];
+		int body_len = snprintf(body, sizeof(body), "%ld\n", count);
+		response_init(&resp, 200, HTTP_200_STRING);
+		response_header(&resp, "Content-Type", "text/plain");
+		response_header_num(&resp, "Content-Length", body_len);
+		response_connection(&resp, req->keep_alive);
+		response_end(&resp, body, body_len);
+		if(conn_sendv_all(c, resp.iov, resp.iovcnt, 0) < 0)
+			rc = -1;
+	}else{
+		// without chunks only closing the connection ends the body
+		req->keep_alive = req->keep_alive && req->chunked;
+		response_init(&resp, 200, HTTP_200_STRING);
+		response_header(&resp, "Content-Type", "text/plain");
+		if(req->chunked)
+			response_header(&resp, "Transfer-Encoding", "chunked");
+		response_connection(&resp, req->keep_alive);
+		response_end(&resp, NULL, 0);
+		if(req->q.follow){
+			// the headers go out at once, the first line may be long in coming
+			if(conn_sendv_all(c, resp.iov, resp.iovcnt, 0) < 0 ||
+			   grep_follow(log_path, &req->mark, &req->q, grep_send, follow_wait, req) < 0 ||
+			   (req->chunked && conn_send_all(c, "0\r\n\r\n", 5, 0) < 0))
+				rc = -1;
+		}else if(conn_sendv_all(c, resp.iov, resp.iovcnt, MSG_MORE) < 0 ||
+		         grep_file(log_path, &req->q, grep_send, req) < 0 ||
+		         (req->chunked && conn_send_all(c, "0\r\n\r\n", 5, 0) < 0)){
+			rc = -1;
+		}
+	}
+    
+	rc = rc < 0 ? rc : !req->keep_alive;
+	if(req->mark.fd >= 0)
+		close(req->mark.fd);
+	query_free(&req->q);
+	free(req);
+	return rc;
+}
+
+/**
+ * Formats the server counters served at /stats, one "name value" per line.
+ *
+ * @return A malloc'd string, to be free'd by the caller.
+ */
+char *server_stats(void){
+	cache_stats_t cs;
+	reactor_stats_t rs;
+	listener_overflows_t lo;
+	grep_stats_t gs;
+	matcher_stats_t ms;
+	logindex_stats_t is;
+	rcache_stats_t rcs;
+	member_stats_t mbs;
+	segment_stats_t ss;
+	size_t size = 8192;
+	char *buf = malloc(size);
+	int len = 0;
+    
+	cache_get_stats(&cs);
+	len += snprintf(buf + len, size - len,
+	         "cache_hits %lu\n"
+	         "cache_misses %lu\n"
+	         "cache_inserts %lu\n"
+	         "cache_evictions %lu\n"
+	         "cache_invalidations %lu\n"
+	         "cache_entries %u\n"
+	         "cache_bytes %zu\n"
+	         "cache_capacity %zu\n",
+	         cs.hits, cs.misses, cs.inserts, cs.evictions, cs.invalidations,
+	         cs.entries, cs.bytes, cs.capacity);
+    
+	// overflows are host-wide, only report what happened since start
+	reactor_get_stats(&rs);
+	listener_get_overflows(&lo);
+	len += snprintf(buf + len, size - len,
+	         "reactors %d\n"
+	         "listeners %d\n"
+	         "accepted %lu\n"
+	         "accept_queue_peak %u\n"
+	         "accept_queue_max %u\n"
+	         "listen_overflows %lu\n"
+	         "listen_drops %lu\n"
+	         "timeouts_idle %lu\n"
+	         "timeouts_header %lu\n"
+	         "timeouts_body %lu\n",
+	         rs.reactors, rs.listeners, rs.accepted, rs.queue_peak, rs.queue_max,
+	         lo.overflows - overflow_base.overflows, lo.drops - overflow_base.drops,
+	         rs.timeouts_idle, rs.timeouts_header, rs.timeouts_body);
+    
+	grep_get_stats(&gs);
+	len += snprintf(buf + len, size - len,
+	         "grep_threads %d\n"
+	         "grep_queries %lu\n"
+	         "grep_bytes %lu\n"
+	         "grep_lines %lu\n"
+	         "grep_follows %lu\n"
+	         "grep_following %d\n",
+	         gs.threads, gs.queries, gs.bytes, gs.lines, gs.follows, gs.following);
+    
+	matcher_get_stats(&ms);
+	len += snprintf(buf + len, size - len,
+	         "regex_compiles %lu\n"
+	         "regex_hits %lu\n"
+	         "regex_failures %lu\n"
+	         "regex_evictions %lu\n"
+	         "regex_entries %u\n"
+	         "regex_dfa_states %lu\n",
+	         ms.compiles, ms.hits, ms.failures, ms.evictions, ms.entries, ms.states);
+    
+	logindex_get_stats(&is);
+	len += snprintf(buf + len, size - len,
+	         "index_covered %llu\n"
+	         "index_blocks %u\n"
+	         "index_terms %u\n"
+	         "index_updates %lu\n"
+	         "index_rebuilds %lu\n"
+	         "index_lookups %lu\n"
+	         "index_fallbacks %lu\n"
+	         "index_bytes_skipped %llu\n",
+	         is.covered, is.blocks, is.terms, is.updates, is.rebuilds,
+	         is.lookups, is.fallbacks, is.bytes_skipped);
+    
+	rcache_get_stats(&rcs);
+	len += snprintf(buf + len, size - len,
+	         "result_cache_hits %lu\n"
+	         "result_cache_misses %lu\n"
+	         "result_cache_hit_ratio %.3f\n"
+	         "result_cache_bytes_saved %llu\n"
+	         "result_cache_inserts %lu\n"
+	         "result_cache_evictions %lu\n"
+	         "result_cache_invalidations %lu\n"
+	         "result_cache_entries %u\n"
+	         "result_cache_bytes %zu\n"
+	         "result_cache_capacity %zu\n",
+	         rcs.hits, rcs.misses,
+	         rcs.hits + rcs.misses ? (double)rcs.hits / (rcs.hits + rcs.misses) : 0.0,
+	         rcs.bytes_saved, rcs.inserts, rcs.evictions, rcs.invalidations,
+	         rcs.entries, rcs.bytes, rcs.capacity);
+    
+	// bytes of log the queries answered from the segment against the
+	// compressed bytes they actually read for them
+	segment_get_stats(&ss);
+	len += snprintf(buf + len, size - len,
+	         "segment_covered %llu\n"
+	         "segment_blocks %u\n"
+	         "segment_file_bytes %llu\n"
+	         "segment_compression_ratio %.2f\n"
+	         "segment_builds %lu\n"
+	         "segment_appends %lu\n"
+	         "segment_queries %lu\n"
+	         "segment_blocks_read %llu\n"
+	         "segment_blocks_skipped %llu\n"
+	         "segment_bytes_read %llu\n"
+	         "segment_read_reduction %.2f\n",
+	         ss.covered, ss.blocks, ss.file_size,
+	         ss.file_size ? (double)ss.covered / ss.file_size : 0.0,
+	         ss.builds, ss.appends, ss.queries, ss.blocks_read, ss.blocks_skipped, ss.bytes_read,
+	         ss.bytes_read ? (double)ss.bytes_covered / ss.bytes_read : 0.0);
+    
+	// detection time is the silence of a node when it was declared
+	// dead, the rates are what the heartbeats cost this node
+	member_get_stats(&mbs);
+	len += snprintf(buf + len, size - len,
+	         "member_alive %u\n"
+	         "member_suspect %u\n"
+	         "member_dead %u\n"
+	         "member_joined %u\n"
+	         "member_joins_refused %lu\n"
+	         "member_expired %lu\n"
+	         "member_interval_ms %lu\n"
+	         "member_suspect_ms %lu\n"
+	         "member_dead_ms %lu\n"
+	         "member_heartbeats_sent %lu\n"
+	         "member_heartbeats_received %lu\n"
+	         "member_heartbeats_lost %lu\n"
+	         "member_bytes_sent %llu\n"
+	         "member_bytes_received %llu\n"
+	         "member_bytes_per_sec_sent %.1f\n"
+	         "member_bytes_per_sec_received %.1f\n"
+	         "member_suspicions %lu\n"
+	         "member_false_suspicions %lu\n"
+	         "member_deaths %lu\n"
+	         "member_recoveries %lu\n"
+	         "member_detection_ms_last %.1f\n"
+	         "member_detection_ms_avg %.1f\n"
+	         "member_detection_ms_max %.1f\n",
+	         mbs.alive, mbs.suspect, mbs.dead, mbs.joined, mbs.joins_refused, mbs.expired,
+	         mbs.opts.interval_ms, mbs.opts.suspect_ms, mbs.opts.dead_ms,
+	         mbs.sent, mbs.received, mbs.lost, mbs.bytes_sent, mbs.bytes_received,
+	         mbs.seconds > 0 ? mbs.bytes_sent / mbs.seconds : 0.0,
+	         mbs.seconds > 0 ? mbs.bytes_received / mbs.seconds : 0.0,
+	         mbs.suspicions, mbs.false_suspicions, mbs.deaths, mbs.recoveries,
+	         mbs.detect_ms_last, mbs.deaths ? mbs.detect_ms_sum / mbs.deaths : 0.0,
+	         mbs.detect_ms_max);
+	return buf;
+}
+
+/**
+ * Builds the response for one parsed request.  Runs on the reactor
+ * thread that owns the connection, so it must never block: answers
+ * that need the disk are deferred to the worker pool.
+ *
+ * @param c The client connection.
+ * @param new The parsed request.
+ * @return 1 if the connection must be closed after this response.
+ */
+int handle_request(conn_t *c, http_t *new){
+    
+	char *fptr = process_http_header_request(http_get_status(new));
+	int con_flag = !keep_alive(new);
+	int response_code = 501;
+	const char *msg;
+	size_t len;
+    
+	if(fptr != NULL && strcmp(fptr, "/stats") == 0){
+		// server counters, status line, headers and body in one sendmsg
+		char *stats = server_stats();
+		size_t stats_len = strlen(stats);
+		response_t resp;
+        
+		response_init(&resp, 200, HTTP_200_STRING);
+		response_header(&resp, "Content-Type", "text/plain");
+		response_header_num(&resp, "Content-Length", stats_len);
+		response_connection(&resp, !con_flag);
+		response_end(&resp, stats, stats_len);
+		conn_writev(c, resp.iov, resp.iovcnt);
+        
+		free(stats);
+		free(fptr);
+		return con_flag;
+        
+	}else if(fptr != NULL && strncmp(fptr, QUERY_PATH, strlen(QUERY_PATH)) == 0){
+		// grep the local log on a worker
+		grep_request_t *req = malloc(sizeof(grep_request_t));
+		query_t *q = &req->q;
+		query_init(q);
+		// without a length the body can only be delimited by chunks,
+		// or else by closing the connection
+		req->chunked = accepts_chunked(new);
+		req->keep_alive = !con_flag;
+		req->mark.fd = -1;
+		// regular expressions are compiled here, or found in the
+		// matcher cache, so a bad one is refused before any scanning
+		if(query_parse(q, fptr) == 0 && query_compile(q) == 0){
+			if(q->follow){
+				// changes made from now on are the ones a follow
+				// query sends: the generation and the end of the log
+				// are taken together, and the log stays open, so a
+				// rotation before a follower gets to it loses nothing
+				req->seen = logwatch_generation();
+				grep_follow_mark(log_path, &req->mark);
+			}
+			if((q->follow ? conn_defer_on(c, &followers, serve_grep, req)
+			              : conn_defer(c, serve_grep, req)) == 0){
+				free(fptr);
+				return 0;
+			}
+		}
+		if(req->mark.fd >= 0)
+			close(req->mark.fd);
+		// no pattern, an invalid expression, or every worker or
+		// follower is busy
+		if(q->pattern == NULL && q->field == NULL)
+			response_code = 501;
+		else if(q->regex && q->matcher == NULL)
+			response_code = 400;
+		else
+			response_code = 503;
+		query_free(q);
+		free(req);
+		free(fptr);
+        
+	}else if(fptr != NULL){
+		// get correct path
+		file_request_t *req = malloc(sizeof(file_request_t));
+		req->fdir = malloc(256);
+		req->keep_alive = !con_flag;
+		strcpy(req->fdir, "web/");
+		if(strcmp(fptr, "/") == 0){
+			// process as /index.html
+			strcat(req->fdir, "index.html");
+		}else{
+			strncat(req->fdir, fptr, 256 - strlen(req->fdir) - 1);
+		}
+		free(fptr);
+        
+		// cached files are sent straight from memory
+		cache_entry_t *e = cache_lookup(req->fdir);
+		if(e != NULL){
+			struct iovec iov[2];
+			iov[0].iov_base = e->header[req->keep_alive];
+			iov[0].iov_len = e->header_len[req->keep_alive];
+			iov[1].iov_base = e->body;
+			iov[1].iov_len = e->body_len;
+			conn_writev(c, iov, 2);
+			cache_release(e);
+            
+			free(req->fdir);
+			free(req);
+			return con_flag;
+		}
+        
+		if(conn_defer(c, serve_file, req) == 0)
+			return 0;
+        
+		// every worker is busy and the queue is full
+		free(req->fdir);
+		free(req);
+		response_code = 503;
+	}
+    
+	// errors are preassembled, one lookup and one write; the reactor
+	// queues whatever the socket cannot take right now
+	msg = response_canned(response_code, !con_flag, &len);
+	conn_write(c, msg, len);
+    
+	return con_flag;
+    
+}
+
+
+/**
+ * Starts the failure detector on the nodes of the peer list, replicas
+ * included.  Without a peer list every node is asked, dead or not.
+ *
+ * @param port Port of this server, its heartbeats use the same UDP port.
+ * @return void
+ */
+void member_watch_peers(const char *port){
+	peer_t *peers, *p;
+	int n, count = 0, i;
+    
+	if((n = querier_load_peers(peers_path, &peers)) <= 0){
+		if(n == 0)
+			querier_free_peers(peers, n);
+		return;
+	}
+	for(i = 0; i < n; i++){
+		for(p = &peers[i]; p != NULL; p = p->replica)
+			count++;
+	}
+	const char **hosts = malloc(count * sizeof(char *));
+	const char **ports = malloc(count * sizeof(char *));
+	count = 0;
+	for(i = 0; i < n; i++){
+		for(p = &peers[i]; p != NULL; p = p->replica){
+			hosts[count] = p->host;
+			ports[count] = p->port;
+			count++;
+		}
+	}
+	member_start(port, hosts, ports, count, &member_opts);
+	free(hosts);
+	free(ports);
+	querier_free_peers(peers, n);
+}
+
+
+void *server(void *ptr){
+    
+    char *port = (char*)ptr;
+    
+    struct addrinfo hints;
+    
+	// the pools, caches and reactors of a running server are in use,
+	// starting them again would pull them from under its threads
+	if(server_running){
+		fprintf(stderr, "-- the server is already running\n");
+		return NULL;
+	}
+    exit_flag = 0;
+    
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = 0;
+    
+	/* getaddrinfo(host name or IP address,
+     port number or the name of a particular service(http, ftp, telnet, or smtp),
+     already filled out struct addrinfo,
+     struct addrinfo gonna to be filled out) */
+	if(getaddrinfo(NULL, port, &hints, &res)){
+		perror("getaddrinfo");
+		return NULL;
+	}
+    
+	/* get the listening sockets: one shared by every reactor, or with
+     -s one SO_REUSEPORT socket per reactor so the kernel spreads new
+     connections across cores */
+	num_listen = 1;
+	if(reuseport){
+		num_listen = num_reactors > 0 ? num_reactors : sysconf(_SC_NPROCESSORS_ONLN);
+		if(num_listen <= 0)
+			num_listen = 1;
+	}
+	listen_socks = malloc(num_listen * sizeof(int));
+	int i;
+	for(i = 0; i < num_listen; i++){
+		if((listen_socks[i] = listener_open(res, listen_backlog, reuseport)) < 0){
+			num_listen = i;
+			server_stop();
+			return NULL;
+		}
+	}
+	listener_get_overflows(&overflow_base);
+    
+	/* hand the listening sockets to the epoll reactors, one per core;
+     each reactor accepts and serves its own clients without
+     creating a thread per connection */
+	cache_init(cache_capacity);
+	rcache_init(rcache_capacity);
+	// error responses never change, build them once
+	response_canned_add(400, HTTP_400_STRING, "text/html", HTTP_400_CONTENT);
+	response_canned_add(404, HTTP_404_STRING, "text/html", HTTP_404_CONTENT);
+	response_canned_add(501, HTTP_501_STRING, "text/html", HTTP_501_CONTENT);
+	response_canned_add(503, HTTP_503_STRING, "text/html", HTTP_503_CONTENT);
+	server_parts |= SERVER_CACHES;
+	// scan threads shared by every /grep, each query splits its log
+	if(grep_init(grep_threads) < 0){
+		server_stop();
+		return NULL;
+	}
+	server_parts |= SERVER_GREP;
+	// bring the index of the log up to date before serving field
+	// queries, without a log it is built once there is one
+	if(logindex_init(log_path) < 0){
+		fprintf(stderr, "-- no log to index at %s yet\n", log_path);
+	}
+	server_parts |= SERVER_LOGINDEX;
+	// with -z the log is read from compressed blocks, converted now
+	if(use_segment){
+		segment_stats_t ss;
+		if(segment_init(log_path) < 0)
+			fprintf(stderr, "-- no log to convert at %s yet\n", log_path);
+		server_parts |= SERVER_SEGMENT;
+		segment_get_stats(&ss);
+		if(ss.blocks > 0)
+			fprintf(stderr, "-- %s%s: %llu bytes of log in %u blocks, %llu bytes on disk\n",
+			        log_path, SEGMENT_SUFFIX, ss.covered, ss.blocks, ss.file_size);
+	}
+	// followers sleep until the log changes, woken by one inotify
+	// watch, or by polling the log if there is none
+	logwatch_init(log_path);
+	server_parts |= SERVER_LOGWATCH;
+	// a pool that fails to start has already torn itself down
+	if(pool_init(&workers, num_workers, queue_depth) < 0){
+		server_stop();
+		return NULL;
+	}
+	server_parts |= SERVER_WORKERS;
+	if(pool_init(&followers, num_followers, 1) < 0){
+		server_stop();
+		return NULL;
+	}
+	server_parts |= SERVER_FOLLOWERS;
+	if(reactor_start_all(listen_socks, num_listen, num_reactors, handle_request, &workers) < 0){
+		fprintf(stderr, "---ERROR; starting the reactors failed\n");
+		server_stop();
+		return NULL;
+	}
+	server_parts |= SERVER_REACTORS;
+	// heartbeats to every node and replica of the peer list, so
+	// option 4 skips the dead ones without waiting for them
+	if(member_enabled){
+		member_watch_peers(port);
+		server_parts |= SERVER_MEMBER;
+	}
+    
+	server_running = 1;
+	return ptr;
+}
+
+
+int start_server(char *port){
+    
+    return server((void *)port) != NULL;
+}
+
+
+/**
+ * Internal use only.  Reads a size such as "512M" or "10G", in bytes.
+ *
+ * @return The size, or 0 if it is not one.
+ */
+static unsigned long long parse_size(const char *s){
+	char *end;
+	double n = strtod(s, &end);
+    
+	switch(*end){
+		case 'k': case 'K': n *= 1024; end++; break;
+		case 'm': case 'M': n *= 1024 * 1024; end++; break;
+		case 'g': case 'G': n *= 1024.0 * 1024 * 1024; end++; break;
+	}
+	if(end == s || (*end != 0 && *end != 'B' && *end != 'b') || n < 1)
+		return 0;
+	return (unsigned long long)n;
+}
+
+/**
+ * Menu option 3: asks for a size and a seed and writes a synthetic log
+ * to the file /grep answers from.  The same size and seed give the same
+ * file on every node, the pattern mix comes from -m.
+ */
+void generate_menu(void){
+	char in[256];
+	loggen_result_t r;
+    
+	fprintf(stderr, "\n-- log size, e.g. 512M or 10G: ");
+	if(menu_gets(in, sizeof(in)) == NULL)
+		return;
+	in[strcspn(in, "\r\n")] = '\0';
+	if((gen_opts.size = parse_size(in)) == 0){
+		fprintf(stderr, "-- Illegal size.\n");
+		return;
+	}
+    
+	fprintf(stderr, "-- seed [%lu]: ", gen_opts.seed);
+	if(menu_gets(in, sizeof(in)) == NULL)
+		return;
+	in[strcspn(in, "\r\n")] = '\0';
+	if(in[0] != '\0')
+		gen_opts.seed = strtoul(in, NULL, 10);
+    
+	if(loggen_write(log_path, &gen_opts, &r) < 0){
+		perror("-- generating the log failed");
+		return;
+	}
+	fprintf(stderr, "-- %s: %llu bytes, %llu lines in %.2f s (%.0f MB/s)\n",
+	        log_path, r.bytes, r.lines, r.ms / 1000,
+	        r.ms > 0 ? r.bytes / 1048576.0 / (r.ms / 1000) : 0);
+}
+
+/**
+ * Menu option 4: asks for a pattern and greps the logs of every node
+ * in the peer list at once.  Matching lines go to stdout, prefixed with
+ * the node name and merged by time unless -u was given, the per-node
+ * summary and the connection pool counters to stderr.  Like grep and head, "-c" in front of the pattern
+ * only counts the lines and "-n N" prints the first N; "-o N" leaves
+ * out the first N.  Like tail -f, "-f" follows the logs instead: the
+ * lines written to them from now on are printed as they come, until
+ * Enter is pressed.  "-d MS" sets the deadline of this query; nodes
+ * that miss it are listed, and the result is then partial.  Nodes the
+ * server's failure detector declared dead are not asked, their
+ * replicas are; a node with no live replica is listed as down.
+ */
+void grep_menu(void){
+	char pattern[1024];
+	peer_t *peers;
+	query_t q;
+	int n, i;
+    
+	if((n = querier_load_peers(peers_path, &peers)) <= 0){
+		fprintf(stderr, "-- No peers in %s.\n", peers_path);
+		if(n == 0)
+			querier_free_peers(peers, n);
+		return;
+	}
+    
+	fprintf(stderr, "\n-- pattern to grep for ([-c|-f] [-n limit] [-o offset] [-d ms] [@key:value] text or /regex/): ");
+	if(menu_gets(pattern, sizeof(pattern)) == NULL){
+		querier_free_peers(peers, n);
+		return;
+	}
+	pattern[strcspn(pattern, "\r\n")] = '\0';
+	if(pattern[0] == '\0'){
+		fprintf(stderr, "-- Empty pattern.\n");
+		querier_free_peers(peers, n);
+		return;
+	}
+    
+	// "@key:value rest" asks for lines holding that field, answered
+	// from the log index; "/expr/" is a regular expression, anything
+	// else a fixed string
+	query_init(&q);
+	querier_opts_t opts;
+	opts.merge = grep_merge;
+	opts.deadline_ms = grep_deadline_ms;
+	opts.hedge_ms = grep_hedge_ms;
+	char *rest = pattern;
+	while(rest[0] == '-'){
+		char *end;
+		long value;
+		if((rest[1] == 'c' || rest[1] == 'f') && (rest[2] == ' ' || rest[2] == '\0')){
+			if(rest[1] == 'c')
+				q.count = 1;
+			else
+				q.follow = 1;
+			rest += 2;
+		}else if((rest[1] == 'n' || rest[1] == 'o' || rest[1] == 'd') && rest[2] == ' ' &&
+		         (value = strtol(rest + 3, &end, 10)) >= 0 && end > rest + 3){
+			if(rest[1] == 'n')
+				q.limit = value;
+			else if(rest[1] == 'o')
+				q.offset = value;
+			else
+				opts.deadline_ms = value;
+			rest = end;
+		}else{
+			// "--" ends the options, anything else starts the pattern
+			if(rest[1] == '-' && (rest[2] == ' ' || rest[2] == '\0'))
+				rest += 2;
+			rest += strspn(rest, " \t");
+			break;
+		}
+		rest += strspn(rest, " \t");
+	}
+	if(rest[0] == '@'){
+		size_t flen = strcspn(rest + 1, " \t");
+		q.field = strndup(rest + 1, flen);
+		rest += 1 + flen;
+		rest += strspn(rest, " \t");
+	}
+	size_t plen = strlen(rest);
+	if(plen > 2 && rest[0] == '/' && rest[plen - 1] == '/'){
+		rest[plen - 1] = '\0';
+		q.pattern = strdup(rest + 1);
+		q.regex = 1;
+	}else if(plen > 0){
+		q.pattern = strdup(rest);
+	}
+	if(q.pattern == NULL && q.field == NULL){
+		fprintf(stderr, "-- Empty pattern.\n");
+		query_free(&q);
+		querier_free_peers(peers, n);
+		return;
+	}
+	if(q.count && q.follow){
+		fprintf(stderr, "-- -c and -f cannot be used together.\n");
+		query_free(&q);
+		querier_free_peers(peers, n);
+		return;
+	}
+	peer_result_t *results = calloc(n, sizeof(peer_result_t));
+	long total;
+	if(q.follow){
+		struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+		char line[64];
+		fprintf(stderr, "-- following, press Enter to stop\n");
+		total = querier_follow(peers, n, &q, stdout, STDIN_FILENO, results);
+		// the Enter that stopped it is no menu choice
+		if(poll(&pfd, 1, 0) > 0 && fgets(line, sizeof(line), stdin) == NULL)
+			clearerr(stdin);
+	}else{
+		total = querier_grep(peers, n, &q, &opts, stdout, results);
+	}
+    
+	connpool_stats_t cps;
+	int late = 0, down = 0;
+	for(i = 0; i < n; i++){
+		const peer_result_t *r = &results[i];
+		double silent = 0;
+		char how[320];
+		int hl = snprintf(how, sizeof(how), "%.1f ms", r->ms);
+		if(r->reused)
+			hl += snprintf(how + hl, sizeof(how) - hl, ", kept-alive connection");
+		if(r->source != NULL && r->source != &peers[i])
+			hl += snprintf(how + hl, sizeof(how) - hl, ", answered by replica %s:%s", r->source->host, r->source->port);
+		else if(r->hedged > 0)
+			hl += snprintf(how + hl, sizeof(how) - hl, ", %d replica(s) asked too", r->hedged);
+		if(r->skipped > 0)
+			hl += snprintf(how + hl, sizeof(how) - hl, ", %d dead node(s) skipped", r->skipped);
+        
+		if(q.count && r->status == 200 && r->complete)
+			printf("%s: %ld\n", peers[i].name, r->lines);
+		if(r->late){
+			late++;
+			fprintf(stderr, "-- %s: missed the deadline, %ld lines in time (%s)\n", peers[i].name, r->lines, how);
+		}else if(r->status == 200 && !r->complete && !q.follow)
+			fprintf(stderr, "-- %s: %ld lines, cut short (%s)\n", peers[i].name, r->lines, how);
+		else if(r->status == 200)
+			fprintf(stderr, "-- %s: %ld lines (%s)\n", peers[i].name, r->lines, how);
+		else if(r->down){
+			member_state(peers[i].host, peers[i].port, &silent);
+			down++;
+			fprintf(stderr, "-- %s: down, no heartbeat for %.0f ms, skipped (%s)\n", peers[i].name, silent, how);
+		}else if(r->status == 0)
+			fprintf(stderr, "-- %s: unreachable\n", peers[i].name);
+		else
+			fprintf(stderr, "-- %s: failed with status %d\n", peers[i].name, r->status);
+	}
+	if(q.count)
+		printf("total: %ld%s\n", total, late || down ? " (partial)" : "");
+	fprintf(stderr, "-- total: %ld lines\n", total);
+	// connections to the peers since the start, kept across queries
+	connpool_get_stats(&cps);
+	fprintf(stderr, "-- connections: %lu opened, %lu reused, %lu stale, %lu expired, %u idle\n",
+	        cps.connects, cps.reuses, cps.stale, cps.expired, cps.idle);
+	if(late){
+		// say which nodes the result lacks, on stdout as well so it
+		// stays with the lines
+		printf("-- partial result, missed the %lu ms deadline:", opts.deadline_ms);
+		for(i = 0; i < n; i++){
+			if(results[i].late)
+				printf(" %s", peers[i].name);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+	if(down){
+		printf("-- partial result, down with no live replica:");
+		for(i = 0; i < n; i++){
+			if(results[i].down)
+				printf(" %s", peers[i].name);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+    
+	free(results);
+	query_free(&q);
+	querier_free_peers(peers, n);
+}
+
+int main(int argc, char **argv)
+{
+    
+    /*
+     *  Command line options
+     *
+     *  -r reactors   event loops serving clients (default: one per core)
+     *  -w workers    threads running blocking requests (default: 8)
+     *  -f followers  clients following the log at once (default: 32)
+     *  -q depth      requests allowed to wait for a worker (default: 256)
+     *  -c megabytes  static file cache size, 0 disables it (default: 64)
+     *  -k megabytes  grep result cache size, 0 disables it (default: 64)
+     *  -b backlog    accept queue length of each listening socket (default: 1024)
+     *  -s            one SO_REUSEPORT listener per reactor, reactors pinned to cores
+     *  -t i:h:b      idle, header and body deadlines in seconds, 0 disables (default: 60:10:30)
+     *  -l file       local log answered by /grep and written by option 3 (default: dlq.log)
+     *  -p file       peer list for option 4, "host:port [name [replica host:port ...]]" per line (default: peers.conf)
+     *  -g threads    threads scanning the log for /grep (default: one per core)
+     *  -u            option 4 prints lines as they arrive instead of merged by time
+     *  -a seconds    option 4 keeps idle connections to peers this long, 0 disables (default: 30)
+     *  -d ms         option 4 gives up on nodes still sending after this long, 0 disables (default: 30000)
+     *  -e ms         option 4 also asks the replicas of a node silent this long, 0 disables (default: 500)
+     *  -H i[:s[:d]]  heartbeat interval, then silences before a node is suspected and dead, in ms;
+     *                option 4 skips dead nodes, 0 disables (default: 1000:3000:6000)
+     *  -z            /grep reads the log from <log>.seg, compressed blocks with a block index,
+     *                converted at start and extended as the log grows; the log may then be removed
+     *  -m f:i:r      percent of frequent, infrequent and rare lines option 3 writes (default: 60:5:0.01)
+     *
+     */
+    /* Ctrl-C is taken by the menu on the main thread, see menu_gets():
+     blocked here before any thread starts, so every thread inherits the
+     mask and none of them is interrupted by it.  stdin is unbuffered so
+     polling its descriptor never misses a line stdio already read. */
+    sigset_t sigint;
+    sigemptyset(&sigint);
+    sigaddset(&sigint, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint, NULL);
+    if((sig_fd = signalfd(-1, &sigint, SFD_CLOEXEC)) < 0){
+        perror("signalfd");
+        return 1;
+    }
+    setvbuf(stdin, NULL, _IONBF, 0);
+    
+    int opt;
+    loggen_init(&gen_opts);
+    member_opts_init(&member_opts);
+    while((opt = getopt(argc, argv, "r:w:f:q:c:k:b:st:l:p:g:ua:d:e:H:zm:")) != -1){
+        switch(opt){
+            case 'r': num_reactors = atoi(optarg); break;
+            case 'w': num_workers = atoi(optarg); break;
+            case 'f': num_followers = atoi(optarg); break;
+            case 'q': queue_depth = (unsigned int)atoi(optarg); break;
+            case 'c': cache_capacity = (size_t)atoi(optarg) * 1024 * 1024; break;
+            case 'k': rcache_capacity = (size_t)atoi(optarg) * 1024 * 1024; break;
+            case 'b': listen_backlog = atoi(optarg); break;
+            case 's': reuseport = 1; break;
+            case 't': {
+                unsigned long idle, header, body;
+                if(sscanf(optarg, "%lu:%lu:%lu", &idle, &header, &body) != 3){
+                    fprintf(stderr, "-t expects idle:header:body in seconds\n");
+                    return 1;
+                }
+                reactor_set_timeouts(idle * 1000, header * 1000, body * 1000);
+                break;
+            }
+            case 'l': log_path = optarg; break;
+            case 'p': peers_path = optarg; break;
+            case 'g': grep_threads = atoi(optarg); break;
+            case 'u': grep_merge = 0; break;
+            case 'a': connpool_set_idle(strtoul(optarg, NULL, 10) * 1000); break;
+            case 'd': grep_deadline_ms = strtoul(optarg, NULL, 10); break;
+            case 'e': grep_hedge_ms = strtoul(optarg, NULL, 10); break;
+            case 'H':
+                if(strcmp(optarg, "0") == 0){
+                    member_enabled = 0;
+                }else if(member_opts_parse(&member_opts, optarg) < 0){
+                    fprintf(stderr, "-H expects interval[:suspect[:dead]] in ms, interval < suspect <= dead\n");
+                    return 1;
+                }
+                break;
+            case 'z': use_segment = 1; break;
+            case 'm':
+                if(loggen_parse_mix(&gen_opts, optarg) < 0){
+                    fprintf(stderr, "-m expects frequent:infrequent:rare in percent\n");
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r reactors] [-w workers] [-f followers] [-q depth] [-c megabytes] [-k megabytes] [-b backlog] [-s] [-t idle:header:body] [-l log] [-p peers] [-g grep threads] [-u] [-a seconds] [-d ms] [-e ms] [-H interval:suspect:dead] [-z] [-m frequent:infrequent:rare]\n", argv[0]);
+                return 1;
+        }
+    }
+    
+    /*
+     *  User Interface
+     *
+     *  1. Displaying a menu for user to start running the program
+     *
+     */
+    fprintf(stderr, "\n|***************************************************|\n");
+    fprintf(stderr, "|******        Distributed Log Querier        ******|\n");
+    fprintf(stderr, "|---------------------------------------------------|\n");
+    fprintf(stderr, "|===          Zihan Liao & Qinglei Meng          ===|\n");
+    fprintf(stderr, "|===                06/08/2013                   ===|\n");
+    fprintf(stderr, "|===          CS425 Distributed Systems          ===|\n");
+    fprintf(stderr, "|===                   MP2                       ===|\n");
+    fprintf(stderr, "|===  University of Illinois at Urbana-Champaign ===|\n");
+    fprintf(stderr, "|***************************************************|\n\n");
+    fprintf(stderr, "|***************************************************|\n");
+    fprintf(stderr, "|-------------------    Menu   ---------------------|\n");
+    fprintf(stderr, "|-------  1. Mannual                        --------|\n");
+    fprintf(stderr, "|-------  2. Start local server             --------|\n");
+    fprintf(stderr, "|-------  3. Generating local log file      --------|\n");
+    fprintf(stderr, "|-------  4. Grep                           --------|\n");
+    fprintf(stderr, "|-------  5. Exit                           --------|\n");
+    fprintf(stderr, "|***************************************************|\n");
+    
+    while (1) {
+        fprintf(stderr, "\n$ Please choose (1-5) from the menu: ");
+        char in[64];
+        menu_gets(in, 64);
+        int choice = atoi(in);
+        
+        if (choice == 1) {
+            fprintf(stderr, "your choice is 1\n");
+        }else if(choice == 2){
+            fprintf(stderr, "your choice is 2\n");
+            fprintf(stderr, "\n-- select a port number for the server: ");
+            char *port_in = malloc(32);
+            menu_gets(port_in, 32);
+            port_in[strcspn(port_in, "\r\n")] = '\0';
+            int port = atoi(port_in);
+            if(port <= 0 || port >= 65536){
+                fprintf(stderr, "-- Illegal port number.\n");
+            }else{
+                if(start_server(port_in)){
+                    fprintf(stderr, "-- Congratulations! The server has been started!\n");
+                }else{
+                    fprintf(stderr, "-- Sorry! Starting server failed, please try again!\n");
+                }
+            }
+        }else if(choice == 3){
+            fprintf(stderr, "your choice is 3\n");
+            generate_menu();
+        }else if(choice == 4){
+            fprintf(stderr, "your choice is 4\n");
+            grep_menu();
+        }else if(choice == 5){
+            fprintf(stderr, "your choice is 5\n");
+            server_stop();
+            exit(0);
+        }else{
+            fprintf(stderr, "-- error, not in the choice range\n");
+        }
+        
+    }
+    
+    /*
+     *  Incoming message handler
+     *
+     *  1. To start the program, run ./mp2 [port number]
+     *  2. The program will create a new thread to run a server and
+     *      listen to incoming HTTP requests
+     *  3. The server will create a worker thread to handle each
+     *      incoming requests, run the commands and send back data
+     *
+     */
+    
+    if(argc != 2){
+		fprintf(stderr, "Usage: %s [port number]\n", argv[0]);
+		return 1;
+	}
+    
+	int port = atoi(argv[1]);
+	if(port <= 0 || port >= 65536){
+		fprintf(stderr, "Illegal port number.\n");
+		return 1;
+	}
+    
+    /*pthread_t *p = malloc(sizeof(pthread_t));
+    int rc = pthread_create(p, NULL, server, (void *)&port);
+    if (rc){
+        fprintf(stderr, "---ERROR; pthread_create failed, return code is %d\n", rc);
+        exit(-1);
+    }*/
+    
+
+
+    
+    
+    /*
+     *  Terminal monitor
+     *
+     *  1. Monitoring new commands on the terminal
+     *  2. Giving corresponding responses or starting to run the Querier
+     *
+     */
+    
+    
+    /*
+     *  Querier
+     *
+     *  1. It will handle the new commands and send requests to other
+     *      distributed machines
+     *  2. It waits for data from other machines
+     *
+     */
+    
+    /*
+     *  Output processor
+     *
+     *  1. After successfully getting messages from other distributed 
+     *      machines, it processes data and prints it out
+     *  2. The lines of all machines are merged into one time-ordered
+     *      stream as they arrive, see querier_grep()
+     *
+     */
+
+
+
+
+	return 0;
+}
+
+
+
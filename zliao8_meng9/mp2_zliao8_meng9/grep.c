@@ -0,0 +1,845 @@
+/** @file grep.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "needle.h"
+#include "matcher.h"
+#include "logindex.h"
+#include "rcache.h"
+#include "segment.h"
+#include "mapguard.h"
+#include "pool.h"
+#include "grep.h"
+
+/**
+ * Private.  Matching lines of one chunk, in file order.
+ */
+typedef struct {
+	char *buf; ///<Lines, each terminated by '\n'
+	size_t len; ///<Bytes used in buf
+	size_t cap; ///<Allocated size of buf
+	long lines; ///<Number of lines in buf
+} grep_out_t;
+
+struct grep_scan;
+
+/**
+ * Private.  One line-aligned piece of the log, scanned by one thread.
+ */
+typedef struct {
+	const char *start; ///<First byte, at the start of a line
+	const char *end; ///<One past the last byte, after a '\n' or at EOF
+	grep_out_t out; ///<What the scan found
+	int done; ///<Set once out is complete
+	int skipped; ///<Not scanned, the query had enough lines already
+	segment_t *seg; ///<Segment whose blocks it covers, NULL for bytes of the log
+	uint32_t block; ///<First block it covers
+	uint32_t nblocks; ///<Number of blocks it covers
+	size_t searched; ///<Bytes of log scanned
+	int failed; ///<A block could not be read
+	struct grep_scan *scan; ///<Query this chunk belongs to
+} grep_chunk_t;
+
+/**
+ * Private.  State of one grep_file() call shared with the scan threads.
+ */
+typedef struct grep_scan {
+	const char *field; ///<key:value token every matching line holds, or NULL
+	size_t field_len; ///<Length of field
+	const char *literal; ///<Every matching line holds this, may be empty
+	size_t literal_len; ///<Length of literal
+	matcher_t *matcher; ///<Checks the candidate lines, NULL to take them all
+	int count_only; ///<Only count the matching lines, do not copy them
+	int stop; ///<Set once the query has enough lines, chunks not started are skipped
+	pthread_mutex_t lock; ///<Guards done of every chunk
+	pthread_cond_t cond; ///<Signalled when a chunk is done
+} grep_scan_t;
+
+/* Blocks of a segment scanned as one chunk */
+#define SEGMENT_CHUNK_BLOCKS (GREP_CHUNK_SIZE / SEGMENT_BLOCK_SIZE)
+
+static pool_t scan_pool;
+static int scan_threads;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static grep_stats_t stats;
+
+/** Internal use only.  Adds one line, newline appended if missing. */
+static void out_line(grep_out_t *out, const char *line, size_t len)
+{
+	int newline = len == 0 || line[len - 1] != '\n';
+
+	if(out->len + len + newline > out->cap){
+		while(out->len + len + newline > out->cap)
+			out->cap = out->cap ? out->cap * 2 : GREP_OUT_SIZE;
+		out->buf = realloc(out->buf, out->cap);
+	}
+	memcpy(out->buf + out->len, line, len);
+	out->len += len;
+	if(newline)
+		out->buf[out->len++] = '\n';
+	out->lines++;
+}
+
+/** Internal use only.  Appends the lines of another buffer. */
+static void out_append(grep_out_t *out, const grep_out_t *more)
+{
+	if(out->len + more->len > out->cap){
+		while(out->len + more->len > out->cap)
+			out->cap = out->cap ? out->cap * 2 : GREP_OUT_SIZE;
+		out->buf = realloc(out->buf, out->cap);
+	}
+	memcpy(out->buf + out->len, more->buf, more->len);
+	out->len += more->len;
+	out->lines += more->lines;
+}
+
+/**
+ * Internal use only.  Limits ranges to the bytes from from on, and cuts
+ * the one holding split in two, so no chunk spans split.
+ *
+ * @param out Room for n + 1 ranges.
+ * @return The number of ranges in out.
+ */
+static int clip_ranges(const logindex_range_t *in, int n, uint64_t from, uint64_t split,
+                       logindex_range_t *out)
+{
+	int i, k = 0;
+
+	for(i = 0; i < n; i++){
+		uint64_t start = in[i].start > from ? in[i].start : from;
+		if(start >= in[i].end)
+			continue;
+		out[k].start = start;
+		out[k].end = in[i].end;
+		if(start < split && split < in[i].end){
+			out[k].end = split;
+			out[++k].start = split;
+			out[k].end = in[i].end;
+		}
+		k++;
+	}
+	return k;
+}
+
+/** Internal use only.  Returns where the line n lines after p starts. */
+static const char *skip_lines(const char *p, const char *end, long n)
+{
+	while(n-- > 0)
+		p = (const char *)memchr(p, '\n', end - p) + 1;
+	return p;
+}
+
+/**
+ * Internal use only.  Cuts the lines found in one piece of the log down
+ * to what is left of the offset and limit of the query.
+ *
+ * @param skip Lines still to leave out, updated.
+ * @param left Lines still wanted, -1 without a limit, updated.
+ * @param from Set to the first line kept.
+ * @param to Set to the end of the last line kept.
+ * @return The number of lines kept.
+ */
+static long out_cut(const grep_out_t *out, int count_only, long *skip, long *left,
+                    const char **from, const char **to)
+{
+	long n = out->lines;
+
+	*from = out->buf;
+	*to = out->buf + out->len;
+	if(*skip > 0){
+		long k = n < *skip ? n : *skip;
+		if(!count_only)
+			*from = skip_lines(*from, *to, k);
+		*skip -= k;
+		n -= k;
+	}
+	if(*left >= 0 && n > *left){
+		if(!count_only)
+			*to = skip_lines(*from, *to, *left);
+		n = *left;
+	}
+	if(*left >= 0)
+		*left -= n;
+	return n;
+}
+
+/** Internal use only.  Whether c separates the tokens of a line. */
+static int is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * Internal use only.  Whether a line holds the field as a whole token,
+ * not just as part of a longer one.
+ */
+static int line_has_field(const grep_scan_t *scan, const char *line, size_t len)
+{
+	const char *p = line, *end = line + len, *m;
+
+	while((m = needle_find(p, end - p, scan->field, scan->field_len)) != NULL){
+		const char *after = m + scan->field_len;
+		if((m == line || is_blank(m[-1])) && (after == end || is_blank(*after)))
+			return 1;
+		p = m + 1;
+	}
+	return 0;
+}
+
+/**
+ * Internal use only.  Whether a line found by the prefilter matches.
+ * The prefilter looks for the field if there is one, else for the
+ * literal, so only what it did not already check is left.
+ */
+static int line_matches(const grep_scan_t *scan, const char *line, size_t len)
+{
+	if(scan->field != NULL){
+		if(!line_has_field(scan, line, len))
+			return 0;
+		if(scan->matcher == NULL && scan->literal_len > 0)
+			return needle_find(line, len, scan->literal, scan->literal_len) != NULL;
+	}
+	return scan->matcher == NULL || matcher_line(scan->matcher, line, len);
+}
+
+/**
+ * Internal use only.  Finds every matching line of [start, end).
+ * Searching the whole region for the field or literal, rather than
+ * line by line, lets the search skip over lines that cannot match
+ * without looking for their ends; only the lines holding it are
+ * checked further.
+ */
+static void scan_region(grep_out_t *out, const char *start, const char *end, const grep_scan_t *scan)
+{
+	const char *prefilter = scan->field ? scan->field : scan->literal;
+	size_t prefilter_len = scan->field ? scan->field_len : scan->literal_len;
+	const char *p = start;
+
+	while(p < end){
+		const char *line = p, *eol;
+
+		if(prefilter_len > 0){
+			const char *m = needle_find(p, end - p, prefilter, prefilter_len);
+			if(m == NULL)
+				break;
+			line = memrchr(p, '\n', m - p);
+			line = line ? line + 1 : p;
+			eol = memchr(m, '\n', end - m);
+		}else{
+			eol = memchr(p, '\n', end - p);
+		}
+		eol = eol ? eol + 1 : end;
+		p = eol;
+
+		if(!line_matches(scan, line, eol - line - (eol[-1] == '\n')))
+			continue;
+		if(scan->count_only)
+			out->lines++;
+		else
+			out_line(out, line, eol - line);
+	}
+}
+
+/**
+ * Internal use only.  Sets up the search for a query.  A fixed string,
+ * or an expression that is just one, needs no DFA.
+ */
+static void scan_prepare(grep_scan_t *scan, const query_t *q, matcher_t *m)
+{
+	scan->field = q->field;
+	scan->field_len = q->field ? strlen(q->field) : 0;
+	scan->literal = m ? m->literal : q->pattern;
+	scan->literal_len = m ? m->literal_len : q->pattern ? strlen(q->pattern) : 0;
+	scan->matcher = m && !m->literal_only ? m : NULL;
+	scan->count_only = q->count;
+	scan->stop = 0;
+}
+
+/**
+ * Internal use only.  Scans the blocks of a segment chunk, each one
+ * decompressed on its own.  Blocks whose trigram filter lacks the
+ * field or the literal cannot hold a matching line and are not even
+ * read.
+ */
+static void scan_blocks(grep_chunk_t *chunk)
+{
+	const segment_t *seg = chunk->seg;
+	const grep_scan_t *scan = chunk->scan;
+	char *raw = malloc(seg->max_raw + 1), *comp = malloc(seg->max_comp + 1);
+	uint32_t i;
+
+	for(i = chunk->block; i < chunk->block + chunk->nblocks; i++){
+		if(!segment_may_hold(seg, i, scan->field, scan->field_len) ||
+		   !segment_may_hold(seg, i, scan->literal, scan->literal_len))
+			continue;
+		ssize_t n = segment_read(seg, i, raw, comp);
+		if(n < 0){
+			chunk->failed = 1;
+			break;
+		}
+		scan_region(&chunk->out, raw, raw + n, scan);
+		chunk->searched += n;
+	}
+	free(raw);
+	free(comp);
+}
+
+/** Internal use only.  Scans one chunk, run by a scan thread or inline. */
+static void scan_chunk(void *ptr)
+{
+	grep_chunk_t *chunk = ptr;
+	grep_scan_t *scan = chunk->scan;
+
+	if(__atomic_load_n(&scan->stop, __ATOMIC_RELAXED)){
+		chunk->skipped = 1;
+	}else if(chunk->seg != NULL){
+		scan_blocks(chunk);
+	}else{
+		scan_region(&chunk->out, chunk->start, chunk->end, scan);
+		chunk->searched = chunk->end - chunk->start;
+	}
+
+	pthread_mutex_lock(&scan->lock);
+	chunk->done = 1;
+	pthread_cond_broadcast(&scan->cond);
+	pthread_mutex_unlock(&scan->lock);
+}
+
+/** Internal use only.  Waits until a scan thread has finished chunk. */
+static void chunk_wait(grep_chunk_t *chunk)
+{
+	grep_scan_t *scan = chunk->scan;
+
+	pthread_mutex_lock(&scan->lock);
+	while(!chunk->done)
+		pthread_cond_wait(&scan->cond, &scan->lock);
+	pthread_mutex_unlock(&scan->lock);
+}
+
+/**
+ * Internal use only.  Returns the end of the chunk starting at start:
+ * GREP_CHUNK_SIZE bytes on, moved forward to the end of that line.
+ */
+static const char *chunk_end(const char *start, const char *end)
+{
+	const char *nl;
+
+	if((size_t)(end - start) <= GREP_CHUNK_SIZE)
+		return end;
+	nl = memchr(start + GREP_CHUNK_SIZE, '\n', end - start - GREP_CHUNK_SIZE);
+	return nl ? nl + 1 : end;
+}
+
+/**
+ * Starts the threads that scan the chunks of a log in parallel.  Until
+ * then, and after grep_destroy(), grep_file() scans in the caller.
+ * Also guards the mapped logs, see mapguard_add(): a log truncated
+ * while it is read fails the query instead of the server.
+ *
+ * @param threads Number of scan threads, <= 0 for one per online core.
+ * @return 0 on success, -1 if the threads could not be created.
+ */
+int grep_init(int threads)
+{
+	if(mapguard_init() < 0)
+		return -1;
+	if(threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads <= 0)
+		threads = 1;
+	if(pool_init(&scan_pool, threads, threads * GREP_WINDOW) < 0)
+		return -1;
+	scan_threads = threads;
+	return 0;
+}
+
+/**
+ * Stops the scan threads.  No grep_file() may be running.
+ *
+ * @return void
+ */
+void grep_destroy(void)
+{
+	if(scan_threads > 0)
+		pool_destroy(&scan_pool);
+	scan_threads = 0;
+}
+
+/**
+ * Searches a log file for lines containing the query pattern.
+ *
+ * The file is mapped and cut into line-aligned chunks of about
+ * GREP_CHUNK_SIZE bytes that the scan threads search in parallel.  The
+ * chunks are handed to emit strictly in file order, each one as soon as
+ * it and all before it are done, so the first lines go out while the
+ * rest of the log is still being scanned.  At most GREP_WINDOW chunks
+ * per scan thread are in flight, which bounds the memory a query holds.
+ * When the scan queue is full, e.g. under many concurrent queries, the
+ * caller scans the chunk itself instead of waiting.
+ *
+ * A regular expression query is compiled here unless query_compile()
+ * already did.  Its required literal picks the candidate lines and the
+ * DFA only runs on those.
+ *
+ * A field query only scans the blocks the log index lists for its
+ * key:value token, plus the lines written since the index was updated.
+ *
+ * A count query only counts the matching lines, and emit is never
+ * called.  offset leaves out the first matching lines and limit stops
+ * the search once it has that many: no more chunks are cut and the
+ * queued ones are skipped, so asking for the first lines of a large
+ * log only scans its beginning.
+ *
+ * When the log was converted to a segment, see segment_init(), the
+ * lines it holds are scanned block by block instead, each block read
+ * and decompressed on its own, and blocks whose trigram filter rules
+ * out the field or the literal are not read at all.  Only the lines
+ * appended since are scanned in the log, and the log may even be gone.
+ *
+ * Results of queries without limit or offset are kept in the result cache with the length of log they
+ * cover.  When the same query comes again, the cached lines go out at
+ * once and only the bytes appended since are scanned, then the cached
+ * result is extended with what they held.  A last line still missing
+ * its newline is scanned every time and never cached, as it may grow.
+ *
+ * @param path The log file.
+ * @param q The query.
+ * @param emit Receives the matching lines, in file order, in batches.
+ * @param arg Pass through variable to emit.
+ * @return The number of matching lines, after offset and limit.
+ * @return -1 if the file cannot be read or was truncated while it was
+ * read, the pattern is invalid or emit asked to stop.
+ */
+long grep_file(const char *path, const query_t *q, grep_emit_t emit, void *arg)
+{
+	struct stat st;
+	grep_scan_t scan;
+	grep_chunk_t *window;
+	const char *map, *next, *end, *last_nl;
+	matcher_t *m = q->matcher;
+	logindex_range_t whole, *ranges = &whole, *found = NULL, *clipped;
+	size_t size, nwindow, head = 0, tail = 0, scanned = 0;
+	int nranges = 1, r = 0;
+	long lines = 0;
+	int rc = 0;
+	int fd;
+	char key[QUERY_MAX_TARGET + PATH_MAX];
+	rcache_entry_t *hit = NULL;
+	segment_t *seg = NULL;
+	uint32_t sb = 0, seg_blocks = 0;
+	uint64_t covered = 0;
+	grep_out_t keep;
+	uint64_t from = 0, aligned;
+	int caching;
+	long skip = q->offset, left = q->limit > 0 ? q->limit : -1;
+
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0){
+		// a log converted to a segment may have been removed since
+		if((seg = segment_acquire(path, NULL, NULL)) == NULL)
+			return -1;
+		map = NULL;
+		size = 0;
+	}else{
+		if(fstat(fd, &st) < 0){
+			close(fd);
+			return -1;
+		}
+		if((size = st.st_size) == 0){
+			close(fd);
+			return 0;
+		}
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(map == MAP_FAILED)
+			return -1;
+		// the log may be truncated under the scan, e.g. rotated in place
+		mapguard_add(map, size);
+		seg = segment_acquire(path, &st, map);
+	}
+	if(q->regex && m == NULL && q->pattern != NULL && (m = matcher_get(q->pattern)) == NULL){
+		if(seg != NULL)
+			segment_release(seg);
+		if(map != NULL){
+			mapguard_remove(map);
+			munmap((void *)map, size);
+		}
+		return -1;
+	}
+	if(map != NULL)
+		madvise((void *)map, size, MADV_SEQUENTIAL);
+
+	scan_prepare(&scan, q, m);
+
+	// the segment holds the first lines, the log only the rest
+	if(seg != NULL){
+		covered = seg->covered;
+		seg_blocks = seg->nblocks;
+	}
+	whole.start = covered;
+	whole.end = size;
+	if(seg == NULL && q->field != NULL && (nranges = logindex_lookup(path, map, size, q->field, &found)) >= 0)
+		ranges = found;
+	else
+		nranges = 1;
+
+	// the cached lines go out first, then only what follows them is
+	// scanned; the lines up to the last newline are kept to be cached
+	memset(&keep, 0, sizeof(keep));
+	last_nl = map != NULL ? memrchr(map, '\n', size) : NULL;
+	aligned = last_nl ? (uint64_t)(last_nl + 1 - map) : 0;
+	caching = map != NULL && rcache_max_entry() > 0 && q->limit == 0 && q->offset == 0 &&
+	          query_format(q, key, QUERY_MAX_TARGET) >= 0;
+	if(caching){
+		strcat(key, " ");
+		strncat(key, path, PATH_MAX - 1);
+		hit = rcache_lookup(key, st.st_dev, st.st_ino, map, size);
+	}
+	if(hit != NULL && hit->covered < covered){
+		// blocks cannot be scanned from the middle, the segment grew
+		// past the cached lines: scan it all again
+		rcache_release(hit);
+		hit = NULL;
+	}
+	if(hit != NULL){
+		from = hit->covered;
+		sb = seg_blocks;
+		if(hit->len > 0 && emit(hit->data, hit->len, arg) < 0)
+			rc = -1;
+		lines += hit->lines;
+	}
+	clipped = malloc((nranges + 1) * sizeof(logindex_range_t));
+	nranges = clip_ranges(ranges, nranges, from, aligned, clipped);
+	ranges = clipped;
+	pthread_mutex_init(&scan.lock, NULL);
+	pthread_cond_init(&scan.cond, NULL);
+
+	// a ring of chunks: head is the next to emit, tail the next to cut
+	nwindow = scan_threads > 0 ? (size_t)scan_threads * GREP_WINDOW : 1;
+	window = calloc(nwindow, sizeof(grep_chunk_t));
+	next = nranges > 0 ? map + ranges[0].start : NULL;
+	end = nranges > 0 ? map + ranges[0].end : NULL;
+
+	while(rc == 0 && (sb < seg_blocks || r < nranges || head < tail)){
+		while((sb < seg_blocks || r < nranges) && tail - head < nwindow){
+			grep_chunk_t *chunk = &window[tail++ % nwindow];
+			memset(chunk, 0, sizeof(*chunk));
+			chunk->scan = &scan;
+			if(sb < seg_blocks){
+				// blocks of the segment first, a chunk's worth at a time
+				chunk->seg = seg;
+				chunk->block = sb;
+				chunk->nblocks = seg_blocks - sb < SEGMENT_CHUNK_BLOCKS ? seg_blocks - sb : SEGMENT_CHUNK_BLOCKS;
+				sb += chunk->nblocks;
+				if(map != NULL){
+					const segment_block_t *last = &seg->blocks[sb - 1];
+					chunk->start = map + seg->blocks[chunk->block].raw_off;
+					chunk->end = map + last->raw_off + last->raw_len;
+				}
+			}else{
+				chunk->start = next;
+				chunk->end = next = chunk_end(next, end);
+				// chunks never span two ranges
+				if(next == end && ++r < nranges){
+					next = map + ranges[r].start;
+					end = map + ranges[r].end;
+				}
+			}
+			if(scan_threads == 0 || pool_try_submit(&scan_pool, scan_chunk, chunk) < 0)
+				scan_chunk(chunk);
+		}
+		if(head == tail)
+			break;
+
+		grep_chunk_t *chunk = &window[head++ % nwindow];
+		chunk_wait(chunk);
+		scanned += chunk->searched;
+		if(chunk->failed){
+			fprintf(stderr, "-- %s%s: damaged block, query failed\n", path, SEGMENT_SUFFIX);
+			free(chunk->out.buf);
+			rc = -1;
+			break;
+		}
+
+		const char *out, *out_end;
+		long n = out_cut(&chunk->out, scan.count_only, &skip, &left, &out, &out_end);
+		if(left == 0){
+			// enough lines: cut no more chunks, skip the queued ones
+			__atomic_store_n(&scan.stop, 1, __ATOMIC_RELAXED);
+			sb = seg_blocks;
+			r = nranges;
+		}
+		if(out < out_end && emit(out, out_end - out, arg) < 0)
+			rc = -1;
+		lines += n;
+		if(caching && chunk->end <= map + aligned){
+			if((hit ? hit->len : 0) + keep.len + chunk->out.len <= rcache_max_entry())
+				out_append(&keep, &chunk->out);
+			else
+				caching = 0;
+		}
+		free(chunk->out.buf);
+	}
+
+	// the old lines and the new ones make the result up to aligned,
+	// unless the log was cut meanwhile and the scan read zeros
+	if(caching && rc == 0 && aligned > from && !mapguard_cut(map)){
+		size_t old = hit ? hit->len : 0;
+		char *data = malloc(old + keep.len + 1);
+		if(old > 0)
+			memcpy(data, hit->data, old);
+		if(keep.len > 0)
+			memcpy(data + old, keep.buf, keep.len);
+		rcache_insert(key, st.st_dev, st.st_ino, map, aligned, data, old + keep.len,
+		              (hit ? hit->lines : 0) + keep.lines);
+	}
+	free(keep.buf);
+	if(hit != NULL)
+		rcache_release(hit);
+
+	// emit gave up, the chunks still queued must finish before unmapping
+	while(head < tail){
+		grep_chunk_t *chunk = &window[head++ % nwindow];
+		chunk_wait(chunk);
+		free(chunk->out.buf);
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	stats.queries++;
+	stats.bytes += scanned;
+	stats.lines += lines;
+	pthread_mutex_unlock(&stats_lock);
+
+	free(window);
+	free(found);
+	free(clipped);
+	pthread_cond_destroy(&scan.cond);
+	pthread_mutex_destroy(&scan.lock);
+	if(seg != NULL)
+		segment_release(seg);
+	if(map != NULL){
+		if(mapguard_remove(map)){
+			fprintf(stderr, "-- %s: truncated while it was read, query failed\n", path);
+			rc = -1;
+		}
+		munmap((void *)map, size);
+	}
+	if(m != q->matcher)
+		matcher_release(m);
+	return rc < 0 ? -1 : lines;
+}
+
+/**
+ * Internal use only.  Where following a log starts: after its last
+ * whole line, so a line still being written is sent once complete.
+ *
+ * @param drop Set if that line starts too far back to be found, its
+ *        rest is then left out.
+ */
+static off_t follow_start(int fd, off_t size, int *drop)
+{
+	char buf[GREP_OUT_SIZE];
+	off_t from = size > GREP_OUT_SIZE ? size - GREP_OUT_SIZE : 0;
+	ssize_t n = size > 0 ? pread(fd, buf, size - from, from) : 0;
+	const char *nl = n > 0 ? memrchr(buf, '\n', n) : NULL;
+
+	*drop = 0;
+	if(nl != NULL)
+		return from + (nl + 1 - buf);
+	if(from == 0)
+		return 0;
+	*drop = 1;
+	return size;
+}
+
+/**
+ * Marks where a follow query starts: opens the log and notes its end.
+ * Nothing is read, so it may run where the query arrives, together
+ * with whatever else must be taken at that moment.  The open file
+ * keeps the lines appended until grep_follow() reads them, even if the
+ * log is rotated away in between.
+ *
+ * @param path The log file.
+ * @param mark Filled in, its fd is -1 if the log does not exist.
+ * @return 0 on success, -1 if the log cannot be opened.
+ */
+int grep_follow_mark(const char *path, grep_mark_t *mark)
+{
+	struct stat st;
+
+	mark->size = 0;
+	if((mark->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	if(fstat(mark->fd, &st) < 0){
+		close(mark->fd);
+		mark->fd = -1;
+		return -1;
+	}
+	mark->size = st.st_size;
+	return 0;
+}
+
+/**
+ * Follows a log like tail -f, sending the matching lines appended to
+ * it until wait asks to stop.  Lines already in the log when following
+ * starts are not sent.
+ *
+ * Only the bytes appended since the last look are read, never the
+ * whole log again, in pieces of at most GREP_CHUNK_SIZE scanned by the
+ * caller: appends are small, and a follower must not hold scan threads
+ * the one-shot queries need.  A last line still missing its newline is
+ * left for the next look.  A log that is truncated is followed again
+ * from its start, and so is a new file at the same path, e.g. after
+ * rotation or if the log did not exist yet, once the old one was read
+ * to its end.
+ *
+ * offset leaves out the first matching lines and limit stops following
+ * once that many were sent.  count is not supported here.
+ *
+ * @param path The log file.
+ * @param mark Where following starts, see grep_follow_mark(), its fd is
+ *        closed here.  NULL starts at the end of the log as it is now.
+ * @param q The query.
+ * @param emit Receives the matching lines, in file order, in batches.
+ * @param wait Called whenever everything appended so far was sent.
+ * @param arg Pass through variable to emit and wait.
+ * @return The number of matching lines sent.
+ * @return -1 if the pattern is invalid or emit asked to stop.
+ */
+long grep_follow(const char *path, grep_mark_t *mark, const query_t *q, grep_emit_t emit, grep_wait_t wait, void *arg)
+{
+	struct stat st, now;
+	grep_mark_t here;
+	grep_scan_t scan;
+	matcher_t *m = q->matcher;
+	char *buf = NULL;
+	size_t cap = 0;
+	off_t pos = 0;
+	long lines = 0, skip = q->offset, left = q->limit > 0 ? q->limit : -1;
+	int fd = -1, drop = 0, rc = 0;
+
+	if(mark == NULL){
+		grep_follow_mark(path, &here);
+		mark = &here;
+	}
+	fd = mark->fd;
+	mark->fd = -1;
+	if(q->regex && m == NULL && q->pattern != NULL && (m = matcher_get(q->pattern)) == NULL){
+		if(fd >= 0)
+			close(fd);
+		return -1;
+	}
+	scan_prepare(&scan, q, m);
+	scan.count_only = 0;
+
+	if(fd >= 0 && fstat(fd, &st) < 0){
+		close(fd);
+		fd = -1;
+	}
+	if(fd >= 0)
+		pos = follow_start(fd, mark->size, &drop);
+
+	pthread_mutex_lock(&stats_lock);
+	stats.follows++;
+	stats.following++;
+	pthread_mutex_unlock(&stats_lock);
+
+	while(rc == 0 && left != 0){
+		if(fd >= 0 && fstat(fd, &st) == 0 && st.st_size < pos){
+			pos = 0;
+			drop = 0;
+		}
+
+		while(fd >= 0 && rc == 0 && left != 0 && pos < st.st_size){
+			size_t want = st.st_size - pos > GREP_CHUNK_SIZE ? GREP_CHUNK_SIZE : st.st_size - pos;
+			if(want > cap){
+				cap = want;
+				buf = realloc(buf, cap);
+			}
+			ssize_t n = pread(fd, buf, want, pos);
+			if(n <= 0)
+				break;
+
+			// whole lines only, unless one fills a whole piece
+			const char *start = buf, *end = memrchr(buf, '\n', n);
+			if(end == NULL && n < GREP_CHUNK_SIZE)
+				break;
+			end = end ? end + 1 : buf + n;
+			pos += end - buf;
+			if(drop){
+				const char *nl = memchr(start, '\n', end - start);
+				start = nl ? nl + 1 : end;
+				drop = nl == NULL;
+			}
+
+			grep_out_t out;
+			const char *from, *to;
+			memset(&out, 0, sizeof(out));
+			scan_region(&out, start, end, &scan);
+			long k = out_cut(&out, 0, &skip, &left, &from, &to);
+			if(from < to && emit(from, to - from, arg) < 0)
+				rc = -1;
+			free(out.buf);
+			lines += k;
+
+			pthread_mutex_lock(&stats_lock);
+			stats.bytes += end - start;
+			stats.lines += k;
+			pthread_mutex_unlock(&stats_lock);
+		}
+
+		if(rc != 0 || left == 0)
+			break;
+		// a new file at the path, the old one was rotated away and
+		// everything written to it is sent
+		if(stat(path, &now) == 0 && (fd < 0 || now.st_dev != st.st_dev || now.st_ino != st.st_ino)){
+			if(fd >= 0)
+				close(fd);
+			if((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0 && fstat(fd, &st) < 0){
+				close(fd);
+				fd = -1;
+			}
+			pos = 0;
+			drop = 0;
+			if(fd >= 0)
+				continue;
+		}
+		if(wait(arg) < 0)
+			break;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	stats.following--;
+	pthread_mutex_unlock(&stats_lock);
+
+	if(fd >= 0)
+		close(fd);
+	free(buf);
+	if(m != q->matcher)
+		matcher_release(m);
+	return rc < 0 ? -1 : lines;
+}
+
+/**
+ * Reads the grep counters.
+ *
+ * @param s Filled with a copy of the counters.
+ * @return void
+ */
+void grep_get_stats(grep_stats_t *s)
+{
+	pthread_mutex_lock(&stats_lock);
+	*s = stats;
+	s->threads = scan_threads;
+	pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,60 @@
+/** @file grep.h */
+#ifndef __GREP_H__
+#define __GREP_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "query.h"
+
+/* A log is searched in line-aligned chunks of about this size */
+#define GREP_CHUNK_SIZE (4 * 1024 * 1024)
+/* Chunks in flight per scan thread */
+#define GREP_WINDOW 2
+/* Initial size of the buffer holding the matching lines of a chunk */
+#define GREP_OUT_SIZE (64 * 1024)
+
+/**
+ * Receives a batch of matching lines, each terminated by '\n'.
+ *
+ * @return 0 to go on, -1 to stop the search (e.g. the client left).
+ */
+typedef int (*grep_emit_t)(const char *buf, size_t len, void *arg);
+
+/**
+ * Called by grep_follow() once it sent everything appended to the log,
+ * until the log changes again.
+ *
+ * @return 0 to look at the log again, -1 to stop following.
+ */
+typedef int (*grep_wait_t)(void *arg);
+
+/**
+ * Where a follow query starts, taken by grep_follow_mark() when the
+ * query arrives rather than when a follower gets to it.
+ */
+typedef struct {
+	int fd; ///<The log as it was then, -1 if there was none
+	off_t size; ///<Its length then, lines past it are sent
+} grep_mark_t;
+
+/**
+ * Counters reported by /stats.
+ */
+typedef struct {
+	unsigned long queries; ///<Files searched
+	unsigned long bytes; ///<Bytes of log searched
+	unsigned long lines; ///<Matching lines found
+	unsigned long follows; ///<Follow queries started
+	int following; ///<Follow queries still running
+	int threads; ///<Scan threads
+} grep_stats_t;
+
+int grep_init(int threads);
+void grep_destroy(void);
+long grep_file(const char *path, const query_t *q, grep_emit_t emit, void *arg);
+int grep_follow_mark(const char *path, grep_mark_t *mark);
+long grep_follow(const char *path, grep_mark_t *mark, const query_t *q, grep_emit_t emit, grep_wait_t wait, void *arg);
+void grep_get_stats(grep_stats_t *s);
+
+#endif
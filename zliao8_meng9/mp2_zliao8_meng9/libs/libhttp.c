@@ -1,191 +1,540 @@
-/* 
- * CS 241
- * The University of Illinois
- */
- 
-/** @file libhttp.c*/
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/types.h>
-
-#include "libhttp.h"
-
-#define MAX_SIZE 4096
-
-/* Allows up to 10 MB requests */
-#define MAX_BODY_LEN (10 * 1024 * 1024) 
-
-static const int INITIAL_BUFFER_SIZE = 1024;
-
-/** 
- *   Reads an HTTP request from the file descriptor fd and parses it
- *   filling the http_t structure with: request status; request
- *   headers; request body (if any).
- *
- *   @param http an pointer to an http_t structure to be filled with
- *   the data of the HTTP request.
- *
- *   @param fd a file descriptor where the HTTP stream is read from.
- *
- *   @return the total length of the HTTP request in bytes or -1 if no
- *   HTTP request could be processed. This happens in case: the
- *   connection has been closed; the length of the request exceeds the
- *   limits or the data stream ends prematurely.
- */
-int http_read(http_t *http, int fd)
-{
-
-	int size = INITIAL_BUFFER_SIZE;
-	char * buf = (char *)malloc(size + 1);
-	int bread = 0;
-	char * body = NULL, * status;
-	char * pair;
-	long body_len = 0;
-	const char * len_key;
-
-	/* Init http fields */
-	http->body = NULL;
-	http->status = NULL;
-	http->len = 0;
-	dictionary_init(&http->header);
-
-	/* Read until the end of the header */
-	do{
-		if(size - bread == 0)
-			buf = realloc(buf, (size <<= 1) + 1); 
-		int bytes = read(fd, buf + bread, size - bread);
-		if(bytes <= 0) break;
-		bread += bytes;
-		buf[bread] = 0;
-	} while(!(body = strstr(buf, "\r\n\r\n")) && size <= MAX_SIZE);
-
-	if(!body){
-		bread = -1;
-		goto out;
-	}
-
-	*body = 0;
-	body += 4;
-	
-	status = strstr(buf, "\r\n");
-	http->status = strndup(buf, status - buf);
-
-	for(pair = strtok(buf, "\r"); (pair = strtok(NULL, "\r")) != NULL; ){
-		char * col;
-		++pair;
-		col = strchr(pair, ':');
-		if(col){
-			char * key, * value;
-			*(col++) = 0;
-			if(*col == ' ') ++col;
-			if(dictionary_add(&http->header, 
-				       (key = strdup(pair)),
-				       (value = strdup(col))
-				   ) == KEY_EXISTS)
-			{
-				free(key);
-				free(value);
-			}
-		}
-	}
-
-	len_key = dictionary_get(&http->header, "Content-Length");
-	if(!len_key)
-		goto out;
-
-	body_len = strtol(len_key, NULL, 10);
-
-	/* Now read the body */
-	while((bread - (body - buf)) < body_len && size <= MAX_BODY_LEN){
-		if(size - bread == 0)
-			buf = realloc(buf, (size <<= 1)); 
-		int bytes = read(fd, buf + bread, size - bread);
-		if(bytes <= 0) break;
-		bread += bytes;
-	} 
-
-	if(bread < body_len){
-		http_free(http);
-		bread = -1;
-		goto out;
-	}
-
-	http->len = body_len;
-	http->body = strndup(body, body_len);
-
-out:
-	free(buf);
-
-	return bread;
-}
-
-/**
- *   Returns the value of a HTTP header with the given key.
- *
- *   @param http a pointer to an http_t structure to retrieve the headers from.
- *
- *   @param key the searched key.
- *
- *   @return a null-terminated string containing the value for the
- *   given key, or NULL if the HTTP request did not contain the
- *   searched header.
- */
-const char *http_get_header(http_t *http, char *key)
-{
-	return dictionary_get(&http->header, key);
-}
-
-/**
- *   Returns the status of a HTTP request, i.e. the fist line which
- *   terminates with "\r\n".
- *
- *   @param http a pointer to an http_t structure to retrieve the
- *   status from.
- *
- *   @return a null-terminated string containing the value of the HTTP
- *   status, or NULL if it was unable to retrieve the status of the
- *   HTTP request.
- */
-const char *http_get_status(http_t *http)
-{
-	return http->status;
-}
-
-/**
- *   Returns the body of a HTTP request.
- *
- *   @param http a pointer to an http_t structure to retrieve the body
- *   from.
- *
- *   @param length if specified, *length gets filled with the total
- *   length in bytes of the HTTP body
- *
- *   @return a null-terminated string containing the value of the body
- *   of a HTTP request, or NULL if the HTTP request did not contain a
- *   body.
- */
-const char *http_get_body(http_t *http, size_t *length)
-{
-	if(length) *length = http->len;
-	return http->body;
-}
-
-/**
- *   Deallocates the resources used for a HTTP request.
- *
- *   @param http a pointer to an http_t structure to deallocate.
- */
-void http_free(http_t *http)
-{
-	if(http->body) {
-		free(http->body);
-		http->body = NULL;
-	}
-	if(http->status) {
-		free(http->status);
-		http->status = NULL;
-	}
-	dictionary_destroy_all(&http->header);
-}
+/* 
+ * CS 241
+ * The University of Illinois
+ */
+ 
+/** @file libhttp.c*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "libhttp.h"
+
+#define MAX_SIZE 4096
+
+/* Allows up to 10 MB requests */
+#define MAX_BODY_LEN (10 * 1024 * 1024) 
+
+static const int INITIAL_BUFFER_SIZE = 1024;
+
+/** Internal use only.  Case-insensitive match of a slice against key. */
+static int slice_is(const char *base, http_slice_t *s, const char *key)
+{
+	return strlen(key) == s->len && strncasecmp(base + s->off, key, s->len) == 0;
+}
+
+/** Internal use only.  Records one "Key: value" line. */
+static int parse_header_line(http_t *http, char *buf, size_t start, size_t end)
+{
+	char * col = memchr(buf + start, ':', end - start);
+	size_t v;
+	http_header_t * h;
+
+	/* Lines without a colon are ignored, as before */
+	if(!col)
+		return 0;
+	if(http->nheader == HTTP_MAX_HEADERS)
+		return -1;
+
+	h = &http->header[http->nheader++];
+	h->key.off = start;
+	h->key.len = (col - buf) - start;
+
+	v = (col - buf) + 1;
+	while(v < end && (buf[v] == ' ' || buf[v] == '\t'))
+		++v;
+	while(end > v && (buf[end - 1] == ' ' || buf[end - 1] == '\t'))
+		--end;
+	h->value.off = v;
+	h->value.len = end - v;
+
+	/* Terminate the value in place, the byte was part of the line end */
+	buf[end] = 0;
+
+	if(slice_is(buf, &h->key, "Content-Length")){
+		char * stop;
+		http->len = strtol(buf + v, &stop, 10);
+		if(stop == buf + v || http->len < 0 || http->len > MAX_BODY_LEN)
+			return -1;
+	}
+	return 0;
+}
+
+/** 
+ *   Parses one HTTP request out of an in-memory buffer, filling the
+ *   http_t structure with: request status; request headers; request
+ *   body (if any). The http_t structure must have been initialized by
+ *   http_init().
+ *
+ *   Parsing is incremental: if buf does not hold the whole request yet
+ *   the state is kept in http and the next call, with the same bytes
+ *   plus whatever arrived since, resumes where this one stopped.  buf
+ *   may have moved in between.  Nothing is allocated: the status, keys
+ *   and values are recorded as (offset, length) slices of buf, and line
+ *   ends are overwritten with '\0' so they can be returned as strings.
+ *
+ *   @param http an pointer to an http_t structure to be filled with
+ *   the data of the HTTP request.
+ *
+ *   @param buf the bytes received so far on the connection, starting
+ *   at the first byte of the request.
+ *
+ *   @param len the number of valid bytes in buf.
+ *
+ *   @return the total length of the HTTP request in bytes, 0 if buf
+ *   does not hold a complete request yet, or -1 if the request
+ *   exceeds the limits.
+ */
+int http_parse(http_t *http, char *buf, size_t len)
+{
+	http->base = buf;
+
+	while(http->state != HTTP_STATE_BODY){
+		char * nl = memchr(buf + http->pos, '\n', len - http->pos);
+		size_t start = http->line, end;
+
+		if(!nl){
+			http->pos = len;
+			return len > MAX_SIZE ? -1 : 0;
+		}
+
+		end = nl - buf;
+		http->pos = http->line = end + 1;
+		if(end > start && buf[end - 1] == '\r')
+			--end;
+
+		if(http->pos > MAX_SIZE)
+			return -1;
+
+		if(http->state == HTTP_STATE_STATUS){
+			/* Tolerate empty lines before the request line */
+			if(end == start)
+				continue;
+			http->status.off = start;
+			http->status.len = end - start;
+			buf[end] = 0;
+			http->state = HTTP_STATE_HEADER;
+		}else if(end == start){
+			/* Empty line, end of the header */
+			http->body.off = http->pos;
+			http->body.len = http->len;
+			http->state = HTTP_STATE_BODY;
+		}else if(parse_header_line(http, buf, start, end) < 0){
+			return -1;
+		}
+	}
+
+	/* The body has not fully arrived yet */
+	if(len - http->body.off < (size_t)http->len)
+		return 0;
+
+	return http->body.off + http->len;
+}
+
+/**
+ *   Initializes an empty http_t structure. Must be called before
+ *   http_parse().
+ *
+ *   @param http a pointer to the http_t structure to initialize.
+ */
+void http_init(http_t *http)
+{
+	http->base = NULL;
+	http->own = NULL;
+	http->body_copy = NULL;
+	http->status.off = http->status.len = 0;
+	http->body.off = http->body.len = 0;
+	http->len = 0;
+	http->nheader = 0;
+	http->state = HTTP_STATE_STATUS;
+	http->pos = 0;
+	http->line = 0;
+}
+
+/**
+ *   Initializes an empty connection buffer.
+ *
+ *   @param buf a pointer to the http_buf_t structure to initialize.
+ */
+void http_buf_init(http_buf_t *buf)
+{
+	buf->data = NULL;
+	buf->off = 0;
+	buf->len = 0;
+	buf->cap = 0;
+}
+
+/**
+ *   Deallocates the memory of a connection buffer.
+ *
+ *   @param buf a pointer to the http_buf_t structure to deallocate.
+ */
+void http_buf_free(http_buf_t *buf)
+{
+	free(buf->data);
+	http_buf_init(buf);
+}
+
+/**
+ *   Grows the connection buffer to hold at least size bytes, so that
+ *   each http_buf_fill() can take up to that much of a long stream.
+ *
+ *   @param buf a pointer to the connection buffer.
+ *
+ *   @param size the capacity wanted.
+ *
+ *   @return 0 on success, -1 if out of memory.
+ */
+int http_buf_reserve(http_buf_t *buf, size_t size)
+{
+	char * data;
+
+	if(buf->cap >= size)
+		return 0;
+	if(!(data = realloc(buf->data, size)))
+		return -1;
+	buf->data = data;
+	buf->cap = size;
+	return 0;
+}
+
+/**
+ *   Returns the number of received bytes not yet consumed by a request.
+ *
+ *   @param buf a pointer to the connection buffer.
+ */
+size_t http_buf_pending(http_buf_t *buf)
+{
+	return buf->len - buf->off;
+}
+
+/**
+ *   Performs one read() from fd into the connection buffer.  Consumed
+ *   bytes are dropped and the buffer grows only when the unparsed
+ *   bytes fill it, so a keep-alive connection reuses one allocation.
+ *
+ *   @param buf a pointer to the connection buffer.
+ *
+ *   @param fd a file descriptor where the HTTP stream is read from.
+ *
+ *   @return the value returned by read(): the number of bytes added,
+ *   0 at end of stream, or -1 with errno set.
+ */
+ssize_t http_buf_fill(http_buf_t *buf, int fd)
+{
+	ssize_t bytes;
+
+	if(buf->cap - buf->len < (size_t)INITIAL_BUFFER_SIZE){
+		if(buf->off > 0){
+			buf->len -= buf->off;
+			memmove(buf->data, buf->data + buf->off, buf->len);
+			buf->off = 0;
+		}
+		if(buf->cap - buf->len < (size_t)INITIAL_BUFFER_SIZE){
+			size_t size = buf->cap ? buf->cap << 1 : (size_t)INITIAL_BUFFER_SIZE;
+			char * data = realloc(buf->data, size);
+			if(!data)
+				return -1;
+			buf->data = data;
+			buf->cap = size;
+		}
+	}
+
+	bytes = read(fd, buf->data + buf->len, buf->cap - buf->len);
+	if(bytes > 0)
+		buf->len += bytes;
+	return bytes;
+}
+
+/**
+ *   Parses the next request already held in the connection buffer and
+ *   consumes its bytes.  Several pipelined requests that arrived in
+ *   one read() are returned by consecutive calls, in order.  A partial
+ *   request is remembered in http, so call again with the same http
+ *   after http_buf_fill().  The strings returned for the request point
+ *   into buf and stay valid until the next http_buf_fill().
+ *
+ *   @param http an pointer to an http_t structure initialized by
+ *   http_init(), to be filled with the data of the HTTP request.
+ *
+ *   @param buf a pointer to the connection buffer.
+ *
+ *   @return the total length of the HTTP request in bytes, 0 if the
+ *   buffer does not hold a complete request yet, or -1 if the request
+ *   exceeds the limits.
+ */
+int http_next(http_t *http, http_buf_t *buf)
+{
+	int ret = http_parse(http, buf->data + buf->off, buf->len - buf->off);
+
+	if(ret > 0){
+		buf->off += ret;
+		if(buf->off == buf->len)
+			buf->off = buf->len = 0;
+	}
+	return ret;
+}
+
+/** 
+ *   Reads the next HTTP request of a connection, using the bytes left
+ *   over in buf by the previous call before reading from fd.
+ *
+ *   @param http an pointer to an http_t structure to be filled with
+ *   the data of the HTTP request.
+ *
+ *   @param buf the connection buffer, kept across calls.
+ *
+ *   @param fd a file descriptor where the HTTP stream is read from.
+ *
+ *   @return the total length of the HTTP request in bytes or -1 if no
+ *   HTTP request could be processed.
+ */
+int http_read_buf(http_t *http, http_buf_t *buf, int fd)
+{
+	int ret;
+
+	/* Init http fields */
+	http_init(http);
+
+	while((ret = http_next(http, buf)) == 0){
+		ssize_t bytes = http_buf_fill(buf, fd);
+		if(bytes < 0 && errno == EINTR)
+			continue;
+		if(bytes <= 0){
+			ret = -1;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ *   Initializes a decoder for a chunked body that starts at the first
+ *   unconsumed byte of a connection buffer.
+ *
+ *   @param chunked a pointer to the decoder.
+ */
+void http_chunked_init(http_chunked_t *chunked)
+{
+	chunked->state = HTTP_CHUNK_SIZE;
+	chunked->left = 0;
+	chunked->avail = 0;
+}
+
+/**
+ *   Decodes the bytes of a chunked body received so far.  Chunk sizes,
+ *   extensions, CRLFs and trailers are removed from buf in place, so
+ *   body bytes are moved down to join the ones already decoded and the
+ *   caller sees one contiguous run of chunk->avail bytes at
+ *   buf->data + buf->off, whatever the chunk boundaries were.  A size
+ *   or trailer line split across reads is kept and parsed again once
+ *   its end arrives.  Bytes past the end of the body, such as the next
+ *   response on the connection, are left undecoded behind the body.
+ *
+ *   @param chunked a pointer to the decoder of this body.
+ *
+ *   @param buf the connection buffer, after http_buf_fill().
+ *
+ *   @return 1 once the last chunk and the trailer have been decoded, 0
+ *   if more bytes are needed, or -1 if the framing is malformed.
+ */
+int http_chunked_decode(http_chunked_t *chunked, http_buf_t *buf)
+{
+	char * w = buf->data + buf->off + chunked->avail;
+	char * r = w;
+	char * end = buf->data + buf->len;
+
+	while(r < end && chunked->state != HTTP_CHUNK_DONE){
+		char * nl;
+		size_t len;
+
+		if(chunked->state == HTTP_CHUNK_DATA){
+			size_t n = (size_t)(end - r) < chunked->left ? (size_t)(end - r) : chunked->left;
+			if(w != r)
+				memmove(w, r, n);
+			w += n;
+			r += n;
+			if((chunked->left -= n) == 0)
+				chunked->state = HTTP_CHUNK_DATA_END;
+			continue;
+		}
+
+		/* Everything else is a line */
+		nl = memchr(r, '\n', end - r);
+		if(!nl){
+			if(end - r > MAX_SIZE)
+				return -1;
+			break;
+		}
+		len = nl - r;
+		if(len > 0 && r[len - 1] == '\r')
+			--len;
+
+		if(chunked->state == HTTP_CHUNK_SIZE){
+			size_t size = 0, i;
+			for(i = 0; i < len && isxdigit((unsigned char)r[i]); i++){
+				int c = tolower((unsigned char)r[i]);
+				if(size >> (sizeof(size_t) * 8 - 4))
+					return -1;
+				size = size * 16 + (isdigit(c) ? c - '0' : c - 'a' + 10);
+			}
+			/* Extensions after ';' are ignored */
+			if(i == 0 || (i < len && r[i] != ';' && r[i] != ' ' && r[i] != '\t'))
+				return -1;
+			chunked->left = size;
+			chunked->state = size ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER;
+		}else if(chunked->state == HTTP_CHUNK_DATA_END){
+			if(len != 0)
+				return -1;
+			chunked->state = HTTP_CHUNK_SIZE;
+		}else if(len == 0){
+			/* Empty line, end of the trailer */
+			chunked->state = HTTP_CHUNK_DONE;
+		}
+		r = nl + 1;
+	}
+
+	/* Close the gap left by the framing */
+	if(w != r)
+		memmove(w, r, end - r);
+	buf->len -= r - w;
+	chunked->avail = w - (buf->data + buf->off);
+
+	return chunked->state == HTTP_CHUNK_DONE;
+}
+
+/**
+ *   Consumes decoded body bytes.
+ *
+ *   @param chunked a pointer to the decoder.
+ *
+ *   @param buf the connection buffer.
+ *
+ *   @param len the number of bytes used, at most chunked->avail.
+ */
+void http_chunked_consume(http_chunked_t *chunked, http_buf_t *buf, size_t len)
+{
+	buf->off += len;
+	chunked->avail -= len;
+}
+
+/** 
+ *   Reads an HTTP request from the file descriptor fd and parses it
+ *   filling the http_t structure with: request status; request
+ *   headers; request body (if any).  Bytes read past the end of the
+ *   request are discarded, use http_read_buf() on connections that
+ *   may pipeline requests.
+ *
+ *   @param http an pointer to an http_t structure to be filled with
+ *   the data of the HTTP request.
+ *
+ *   @param fd a file descriptor where the HTTP stream is read from.
+ *
+ *   @return the total length of the HTTP request in bytes or -1 if no
+ *   HTTP request could be processed. This happens in case: the
+ *   connection has been closed; the length of the request exceeds the
+ *   limits or the data stream ends prematurely.
+ */
+int http_read(http_t *http, int fd)
+{
+	http_buf_t buf;
+	int ret;
+
+	http_buf_init(&buf);
+	ret = http_read_buf(http, &buf, fd);
+
+	/* The request points into the buffer, it goes with the request */
+	http->own = buf.data;
+
+	return ret;
+}
+
+/**
+ *   Returns the value of a HTTP header with the given key.
+ *
+ *   @param http a pointer to an http_t structure to retrieve the headers from.
+ *
+ *   @param key the searched key.
+ *
+ *   @return a null-terminated string containing the value for the
+ *   given key, or NULL if the HTTP request did not contain the
+ *   searched header.
+ */
+const char *http_get_header(http_t *http, char *key)
+{
+	int i;
+
+	for(i = 0; i < http->nheader; i++){
+		if(slice_is(http->base, &http->header[i].key, key))
+			return http->base + http->header[i].value.off;
+	}
+	return NULL;
+}
+
+/**
+ *   Returns the status of a HTTP request, i.e. the fist line which
+ *   terminates with "\r\n".
+ *
+ *   @param http a pointer to an http_t structure to retrieve the
+ *   status from.
+ *
+ *   @return a null-terminated string containing the value of the HTTP
+ *   status, or NULL if it was unable to retrieve the status of the
+ *   HTTP request.
+ */
+const char *http_get_status(http_t *http)
+{
+	if(http->state == HTTP_STATE_STATUS)
+		return NULL;
+	return http->base + http->status.off;
+}
+
+/**
+ *   Returns the body of a HTTP request.  The body is the only part
+ *   that is copied, on the first call, because it cannot be
+ *   null-terminated in place without touching the next request.
+ *
+ *   @param http a pointer to an http_t structure to retrieve the body
+ *   from.
+ *
+ *   @param length if specified, *length gets filled with the total
+ *   length in bytes of the HTTP body
+ *
+ *   @return a null-terminated string containing the value of the body
+ *   of a HTTP request, or NULL if the HTTP request did not contain a
+ *   body.
+ */
+const char *http_get_body(http_t *http, size_t *length)
+{
+	if(length) *length = http->len;
+	if(http->state != HTTP_STATE_BODY || http->len == 0)
+		return NULL;
+	if(!http->body_copy)
+		http->body_copy = strndup(http->base + http->body.off, http->len);
+	return http->body_copy;
+}
+
+/**
+ *   Deallocates the resources used for a HTTP request.
+ *
+ *   @param http a pointer to an http_t structure to deallocate.
+ */
+void http_free(http_t *http)
+{
+	if(http->body_copy) {
+		free(http->body_copy);
+		http->body_copy = NULL;
+	}
+	if(http->own) {
+		free(http->own);
+		http->own = NULL;
+	}
+	http->base = NULL;
+}
@@ -1,26 +1,105 @@
-#ifndef _LIBHTTP_H_
-#define _LIBHTTP_H_
-
-#include "libdictionary.h"
-
-typedef struct 
-{
-	
-	char * status;
-	char * body;
-	long len;
-	dictionary_t header;
-	
-} http_t;
-
-
-int http_read(http_t *http, int fd);
-
-const char *http_get_body(http_t *http, size_t *length);
-const char *http_get_header(http_t *http, char *key);
-const char *http_get_status(http_t *http);
-
-void http_free(http_t *http);
-
-
-#endif
+#ifndef _LIBHTTP_H_
+#define _LIBHTTP_H_
+
+#include <sys/types.h>
+
+
+#define HTTP_MAX_HEADERS 32
+
+/* Parser states, see http_t.state */
+#define HTTP_STATE_STATUS 0
+#define HTTP_STATE_HEADER 1
+#define HTTP_STATE_BODY 2
+
+/* A part of the request: offset and length relative to its first byte */
+typedef struct
+{
+	
+	size_t off;
+	size_t len;
+	
+} http_slice_t;
+
+typedef struct
+{
+	
+	http_slice_t key;
+	http_slice_t value;
+	
+} http_header_t;
+
+typedef struct 
+{
+	
+	char * base;
+	http_slice_t status;
+	http_slice_t body;
+	long len;
+	http_header_t header[HTTP_MAX_HEADERS];
+	int nheader;
+	char * body_copy;
+	char * own;
+	
+	/* Parser state, kept across calls on a partial request */
+	int state;
+	size_t pos;
+	size_t line;
+	
+} http_t;
+
+/* Connection-scoped input buffer.  Bytes past the end of one request
+   stay here for the next call, so pipelined requests are not lost. */
+typedef struct
+{
+	
+	char * data;
+	size_t off;
+	size_t len;
+	size_t cap;
+	
+} http_buf_t;
+
+/* Decoder states, see http_chunked_t.state */
+#define HTTP_CHUNK_SIZE 0
+#define HTTP_CHUNK_DATA 1
+#define HTTP_CHUNK_DATA_END 2
+#define HTTP_CHUNK_TRAILER 3
+#define HTTP_CHUNK_DONE 4
+
+/* Decoder of a "Transfer-Encoding: chunked" body read into an
+   http_buf_t.  The framing is stripped in place: the first avail bytes
+   at data + off are body bytes, the rest still has to be decoded. */
+typedef struct
+{
+	
+	int state;
+	size_t left;
+	size_t avail;
+	
+} http_chunked_t;
+
+
+void http_init(http_t *http);
+int http_parse(http_t *http, char *buf, size_t len);
+int http_read(http_t *http, int fd);
+
+void http_buf_init(http_buf_t *buf);
+void http_buf_free(http_buf_t *buf);
+int http_buf_reserve(http_buf_t *buf, size_t size);
+ssize_t http_buf_fill(http_buf_t *buf, int fd);
+size_t http_buf_pending(http_buf_t *buf);
+int http_next(http_t *http, http_buf_t *buf);
+int http_read_buf(http_t *http, http_buf_t *buf, int fd);
+
+void http_chunked_init(http_chunked_t *chunked);
+int http_chunked_decode(http_chunked_t *chunked, http_buf_t *buf);
+void http_chunked_consume(http_chunked_t *chunked, http_buf_t *buf, size_t len);
+
+const char *http_get_body(http_t *http, size_t *length);
+const char *http_get_header(http_t *http, char *key);
+const char *http_get_status(http_t *http);
+
+void http_free(http_t *http);
+
+
+#endif
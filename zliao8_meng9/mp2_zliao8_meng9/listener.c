@@ -0,0 +1,119 @@
+/** @file listener.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "listener.h"
+
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT 15
+#endif
+
+/**
+ * Creates a listening TCP socket bound to ai.
+ *
+ * @param ai Address to bind, from getaddrinfo() with AI_PASSIVE.
+ * @param backlog Length of the accept queue, or <= 0 for
+ *                LISTENER_DEFAULT_BACKLOG.  The kernel caps it at
+ *                net.core.somaxconn.
+ * @param reuseport Nonzero to set SO_REUSEPORT, so that several
+ *                  sockets can listen on the same port and the kernel
+ *                  spreads new connections across them.
+ * @return The socket.
+ * @return -1 on error, with the reason printed.
+ */
+int listener_open(const struct addrinfo *ai, int backlog, int reuseport)
+{
+	int yes = 1;
+	int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+
+	if(fd < 0){
+		perror("socket");
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	if(reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0){
+		perror("setsockopt");
+		close(fd);
+		return -1;
+	}
+	if(bind(fd, ai->ai_addr, ai->ai_addrlen) == -1){
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+	if(listen(fd, backlog > 0 ? backlog : LISTENER_DEFAULT_BACKLOG) == -1){
+		perror("listen");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Reads how full the accept queue of a listening socket is.
+ *
+ * @param fd A listening TCP socket.
+ * @param len Filled with the connections waiting for accept().
+ * @param max Filled with the effective backlog.
+ * @return 0 on success, -1 if the kernel does not report it.
+ */
+int listener_queue(int fd, unsigned int *len, unsigned int *max)
+{
+	struct tcp_info info;
+	socklen_t size = sizeof(info);
+
+	if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &size) < 0)
+		return -1;
+	// for a listener the kernel reports the queue in these two fields
+	*len = info.tcpi_unacked;
+	*max = info.tcpi_sacked;
+	return 0;
+}
+
+/**
+ * Reads the host-wide accept queue overflow counters from
+ * /proc/net/netstat.  Linux keeps no per-socket count, so callers
+ * should report the difference from a value read at startup.
+ *
+ * @param o Filled with the counters.
+ * @return 0 on success, -1 if they are not available.
+ */
+int listener_get_overflows(listener_overflows_t *o)
+{
+	FILE *f = fopen("/proc/net/netstat", "r");
+	char names[4096], values[4096];
+	int rc = -1;
+
+	memset(o, 0, sizeof(*o));
+	if(f == NULL)
+		return -1;
+
+	// the file holds pairs of lines, "TcpExt: names..." then "TcpExt: values..."
+	while(fgets(names, sizeof(names), f) && fgets(values, sizeof(values), f)){
+		char *nsave, *vsave;
+		char *n, *v;
+
+		if(strncmp(names, "TcpExt:", 7) != 0)
+			continue;
+		n = strtok_r(names, " \n", &nsave);
+		v = strtok_r(values, " \n", &vsave);
+		while((n = strtok_r(NULL, " \n", &nsave)) && (v = strtok_r(NULL, " \n", &vsave))){
+			if(strcmp(n, "ListenOverflows") == 0)
+				o->overflows = strtoul(v, NULL, 10);
+			else if(strcmp(n, "ListenDrops") == 0)
+				o->drops = strtoul(v, NULL, 10);
+		}
+		rc = 0;
+		break;
+	}
+	fclose(f);
+	return rc;
+}
@@ -0,0 +1,23 @@
+/** @file listener.h */
+#ifndef __LISTENER_H__
+#define __LISTENER_H__
+
+#include <netdb.h>
+
+/* Accept queue length used unless -b says otherwise */
+#define LISTENER_DEFAULT_BACKLOG 1024
+
+/**
+ * Kernel counters of connections lost because an accept queue was full.
+ * They cover every listener on the host, see listener_get_overflows().
+ */
+typedef struct {
+	unsigned long overflows; ///<TcpExt ListenOverflows
+	unsigned long drops; ///<TcpExt ListenDrops
+} listener_overflows_t;
+
+int listener_open(const struct addrinfo *ai, int backlog, int reuseport);
+int listener_queue(int fd, unsigned int *len, unsigned int *max);
+int listener_get_overflows(listener_overflows_t *o);
+
+#endif
@@ -0,0 +1,364 @@
+/** @file loggen.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "loggen.h"
+
+/* Time of line 0: 2013-06-08T12:00:00 UTC */
+#define LOGGEN_EPOCH 1370692800
+/* Lines per second of log time */
+#define LOGGEN_LINES_PER_SEC 100
+
+/**
+ * Private.  One kind of line: its level and the messages it picks from.
+ */
+typedef struct {
+	const char *level;
+	const char **msg;
+	int nmsg;
+} loggen_kind_t;
+
+static const char *debug_msg[] = {
+	"cache lookup", "parsed request header", "scheduling job", "heartbeat sent",
+	"timer expired", "buffer resized", "connection reused", "config reloaded",
+};
+static const char *info_msg[] = {
+	"request served", "user logged in", "file uploaded", "session started",
+	"session ended", "query finished", "page rendered", "record updated",
+};
+static const char *warn_msg[] = {
+	"slow response", "retrying connection", "disk usage high", "queue almost full",
+};
+static const char *error_msg[] = {
+	"disk failure", "connection refused by peer", "out of memory", "checksum mismatch",
+};
+
+static const loggen_kind_t kinds[] = {
+	{ "DEBUG", debug_msg, sizeof(debug_msg) / sizeof(debug_msg[0]) },
+	{ "INFO", info_msg, sizeof(info_msg) / sizeof(info_msg[0]) },
+	{ "WARN", warn_msg, sizeof(warn_msg) / sizeof(warn_msg[0]) },
+	{ "ERROR", error_msg, sizeof(error_msg) / sizeof(error_msg[0]) },
+};
+
+/**
+ * Private.  State shared by the formatting threads of one file.
+ */
+typedef struct {
+	const loggen_opts_t *o; ///<What to generate
+	uint32_t limit[3]; ///<Cumulative per-million thresholds of INFO, WARN, ERROR
+	int fd; ///<The file
+	unsigned long long next_block; ///<Next block to format, taken atomically
+	pthread_mutex_t lock; ///<Guards the fields below
+	pthread_cond_t turn; ///<Signalled when next_write moves
+	unsigned long long next_write; ///<Block whose place in the file comes next
+	unsigned long long off; ///<Where that block goes
+	unsigned long long lines; ///<Lines placed so far
+	int done; ///<The size is reached, or a write failed
+	int error; ///<errno of a failed write, 0 if none
+} loggen_t;
+
+/** Internal use only.  Mixes a 64-bit value, splitmix64's finalizer. */
+static uint64_t mix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/** Internal use only.  Appends an unsigned number. */
+static char *put_num(char *p, unsigned long long n)
+{
+	char tmp[20];
+	int i = 0;
+
+	do{
+		tmp[i++] = '0' + n % 10;
+		n /= 10;
+	}while(n);
+	while(i)
+		*p++ = tmp[--i];
+	return p;
+}
+
+/** Internal use only.  Appends a number padded with zeros to width. */
+static char *put_pad(char *p, unsigned int n, int width)
+{
+	int i;
+
+	for(i = width - 1; i >= 0; i--){
+		p[i] = '0' + n % 10;
+		n /= 10;
+	}
+	return p + width;
+}
+
+/** Internal use only.  Appends a string. */
+static char *put_str(char *p, const char *s)
+{
+	while(*s)
+		*p++ = *s++;
+	return p;
+}
+
+/** Internal use only.  Formats "YYYY-MM-DDTHH:MM:SS" for a time. */
+static void format_time(char *buf, time_t t)
+{
+	struct tm tm;
+	char *p = buf;
+
+	gmtime_r(&t, &tm);
+	p = put_pad(p, tm.tm_year + 1900, 4);
+	*p++ = '-';
+	p = put_pad(p, tm.tm_mon + 1, 2);
+	*p++ = '-';
+	p = put_pad(p, tm.tm_mday, 2);
+	*p++ = 'T';
+	p = put_pad(p, tm.tm_hour, 2);
+	*p++ = ':';
+	p = put_pad(p, tm.tm_min, 2);
+	*p++ = ':';
+	p = put_pad(p, tm.tm_sec, 2);
+}
+
+/**
+ * Internal use only.  Formats the lines of one block.
+ *
+ * @return The number of bytes written to buf.
+ */
+static size_t format_block(loggen_t *g, unsigned long long block, char *buf)
+{
+	unsigned long long i = block * LOGGEN_BLOCK_LINES;
+	unsigned long long end = i + LOGGEN_BLOCK_LINES;
+	char stamp[20];
+	time_t sec = -1;
+	char *p = buf;
+
+	for(; i < end; i++){
+		uint64_t r = mix64(g->o->seed * 0x100000001b3ULL ^ mix64(i));
+		uint32_t pick = (uint32_t)(r % 1000000);
+		const loggen_kind_t *kind;
+
+		if(pick < g->limit[0])
+			kind = &kinds[1];
+		else if(pick < g->limit[1])
+			kind = &kinds[2];
+		else if(pick < g->limit[2])
+			kind = &kinds[3];
+		else
+			kind = &kinds[0];
+		r = mix64(r);
+
+		// the date only changes every LOGGEN_LINES_PER_SEC lines
+		if((time_t)(LOGGEN_EPOCH + i / LOGGEN_LINES_PER_SEC) != sec){
+			sec = LOGGEN_EPOCH + i / LOGGEN_LINES_PER_SEC;
+			format_time(stamp, sec);
+		}
+		memcpy(p, stamp, 19);
+		p += 19;
+		*p++ = '.';
+		p = put_pad(p, (i % LOGGEN_LINES_PER_SEC) * (1000 / LOGGEN_LINES_PER_SEC), 3);
+		p = put_str(p, " level:");
+		p = put_str(p, kind->level);
+		p = put_str(p, " id:");
+		p = put_num(p, i);
+		p = put_str(p, " user:u");
+		p = put_pad(p, r % 1000, 3);
+		p = put_str(p, " latency_ms:");
+		p = put_num(p, (r >> 10) % 2000);
+		p = put_str(p, " msg:");
+		p = put_str(p, kind->msg[(r >> 21) % kind->nmsg]);
+		*p++ = '\n';
+	}
+	return p - buf;
+}
+
+/** Internal use only.  Writes all of buf at off. */
+static int pwrite_all(int fd, const char *buf, size_t len, unsigned long long off)
+{
+	while(len > 0){
+		ssize_t n = pwrite(fd, buf, len, off);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			return -1;
+		buf += n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+/**
+ * Internal use only.  Thread body.  Blocks are formatted in parallel;
+ * only picking a block's place in the file goes in block order, since
+ * it depends on the sizes of all blocks before it.  The write itself
+ * runs in parallel again.
+ */
+static void *loggen_run(void *ptr)
+{
+	loggen_t *g = ptr;
+	char *buf = malloc(LOGGEN_BLOCK_LINES * LOGGEN_MAX_LINE);
+
+	while(1){
+		unsigned long long block = __atomic_fetch_add(&g->next_block, 1, __ATOMIC_RELAXED);
+		unsigned long long off, lines = LOGGEN_BLOCK_LINES;
+		size_t len;
+
+		if(__atomic_load_n(&g->done, __ATOMIC_RELAXED))
+			break;
+		len = format_block(g, block, buf);
+
+		pthread_mutex_lock(&g->lock);
+		while(g->next_write != block && !g->done)
+			pthread_cond_wait(&g->turn, &g->lock);
+		if(g->done){
+			pthread_mutex_unlock(&g->lock);
+			break;
+		}
+		off = g->off;
+		if(off + len >= g->o->size){
+			// stop at the end of the line reaching the size
+			const char *nl = memchr(buf + (g->o->size - off - 1), '\n',
+			                        len - (g->o->size - off - 1));
+			len = nl + 1 - buf;
+			lines = 0;
+			for(nl = buf; (nl = memchr(nl, '\n', buf + len - nl)) != NULL; nl++)
+				lines++;
+			g->done = 1;
+		}
+		g->off += len;
+		g->lines += lines;
+		g->next_write++;
+		pthread_cond_broadcast(&g->turn);
+		pthread_mutex_unlock(&g->lock);
+
+		if(pwrite_all(g->fd, buf, len, off) < 0){
+			pthread_mutex_lock(&g->lock);
+			g->error = errno;
+			g->done = 1;
+			pthread_cond_broadcast(&g->turn);
+			pthread_mutex_unlock(&g->lock);
+			break;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/**
+ * Fills in the default options: 64 MB, seed 1, one thread per core and
+ * the LOGGEN_DEFAULT_* pattern mix.
+ *
+ * @param o The options.
+ * @return void
+ */
+void loggen_init(loggen_opts_t *o)
+{
+	o->size = 64ULL * 1024 * 1024;
+	o->seed = 1;
+	o->threads = 0;
+	o->frequent = LOGGEN_DEFAULT_FREQUENT;
+	o->infrequent = LOGGEN_DEFAULT_INFREQUENT;
+	o->rare = LOGGEN_DEFAULT_RARE;
+}
+
+/**
+ * Reads a pattern mix given as "frequent:infrequent:rare" percentages,
+ * e.g. "60:5:0.01".
+ *
+ * @param o The options, updated.
+ * @param mix The string.
+ * @return 0 on success, -1 if it is malformed or adds up past 100.
+ */
+int loggen_parse_mix(loggen_opts_t *o, const char *mix)
+{
+	double f, i, r;
+
+	if(sscanf(mix, "%lf:%lf:%lf", &f, &i, &r) != 3 ||
+	   f < 0 || i < 0 || r < 0 || f + i + r > 100)
+		return -1;
+	o->frequent = f;
+	o->infrequent = i;
+	o->rare = r;
+	return 0;
+}
+
+/**
+ * Writes a synthetic log.  Threads format blocks of LOGGEN_BLOCK_LINES
+ * lines into their own large buffers and write each with one pwrite()
+ * at its place in the file, so neither formatting nor writing is
+ * serialized.
+ *
+ * @param path The file, replaced if it exists.
+ * @param o What to generate.
+ * @param result Filled with what was written.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int loggen_write(const char *path, const loggen_opts_t *o, loggen_result_t *result)
+{
+	struct timespec start, end;
+	pthread_t *threads;
+	loggen_t g;
+	int n = o->threads, i, started = 0;
+
+	if(o->size == 0){
+		errno = EINVAL;
+		return -1;
+	}
+	if(n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n <= 0)
+		n = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(&g, 0, sizeof(g));
+	if((g.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+		return -1;
+	g.o = o;
+	g.limit[0] = o->frequent * 10000;
+	g.limit[1] = g.limit[0] + o->infrequent * 10000;
+	g.limit[2] = g.limit[1] + o->rare * 10000;
+	pthread_mutex_init(&g.lock, NULL);
+	pthread_cond_init(&g.turn, NULL);
+
+	threads = malloc(n * sizeof(pthread_t));
+	for(i = 0; i < n; i++){
+		if(pthread_create(&threads[i], NULL, loggen_run, &g) != 0)
+			break;
+		started++;
+	}
+	// without any thread, format in this one
+	if(started == 0)
+		loggen_run(&g);
+	for(i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	if(g.error == 0 && ftruncate(g.fd, g.off) < 0)
+		g.error = errno;
+	if(close(g.fd) < 0 && g.error == 0)
+		g.error = errno;
+	pthread_cond_destroy(&g.turn);
+	pthread_mutex_destroy(&g.lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	result->bytes = g.off;
+	result->lines = g.lines;
+	result->ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+	if(g.error){
+		errno = g.error;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,47 @@
+/** @file loggen.h */
+#ifndef __LOGGEN_H__
+#define __LOGGEN_H__
+
+/* Lines formatted by one thread at a time */
+#define LOGGEN_BLOCK_LINES 8192
+/* No generated line is longer than this */
+#define LOGGEN_MAX_LINE 256
+
+/* Default share of lines, in percent, for each kind of pattern */
+#define LOGGEN_DEFAULT_FREQUENT 60.0
+#define LOGGEN_DEFAULT_INFREQUENT 5.0
+#define LOGGEN_DEFAULT_RARE 0.01
+
+/**
+ * What to generate.  The lines are key:value fields:
+ *
+ *   2013-06-08T12:00:00.120 level:INFO id:12 user:u042 latency_ms:17 msg:request served
+ *
+ * level:INFO lines are the frequent pattern, level:WARN the infrequent
+ * and level:ERROR the rare one, every other line is level:DEBUG.  Line
+ * i depends only on seed and i, so the same options give the same file
+ * whatever the number of threads.
+ */
+typedef struct {
+	unsigned long long size; ///<Bytes to write, the last line is completed
+	unsigned long seed; ///<Picks the content
+	int threads; ///<Formatting threads, <= 0 for one per online core
+	double frequent; ///<Percent of level:INFO lines
+	double infrequent; ///<Percent of level:WARN lines
+	double rare; ///<Percent of level:ERROR lines
+} loggen_opts_t;
+
+/**
+ * What loggen_write() did.
+ */
+typedef struct {
+	unsigned long long bytes; ///<Size of the file
+	unsigned long long lines; ///<Lines written
+	double ms; ///<Time taken
+} loggen_result_t;
+
+void loggen_init(loggen_opts_t *o);
+int loggen_parse_mix(loggen_opts_t *o, const char *mix);
+int loggen_write(const char *path, const loggen_opts_t *o, loggen_result_t *result);
+
+#endif
@@ -0,0 +1,816 @@
+/** @file logindex.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logindex.h"
+#include "mapguard.h"
+
+#define LOGINDEX_MAGIC "DLQIDX1\n"
+
+/* Bytes hashed at each end of the indexed part to tell if the log changed */
+#define FINGERPRINT_SIZE 4096
+
+/* Header flag: some keys were not indexed, unknown keys prove nothing */
+#define INDEX_KEYS_DROPPED 1
+
+/* Term flags */
+#define TERM_KEY 1 ///<The term is a key, not a key:value token
+#define TERM_DROPPED 2 ///<Key whose values are not indexed
+
+#define BUILD_BUCKETS (64 * 1024)
+
+/**
+ * Private.  Start of the index file.  It is followed by the block
+ * offsets, the terms sorted by name, the postings and the names.
+ */
+typedef struct {
+	char magic[8]; ///<LOGINDEX_MAGIC
+	uint64_t covered; ///<Bytes of log indexed, always whole lines
+	uint64_t head_hash; ///<Hash of the first bytes of the log
+	uint64_t tail_hash; ///<Hash of the last bytes before covered
+	uint32_t block_size; ///<LOGINDEX_BLOCK_SIZE when it was built
+	uint32_t nblocks; ///<Number of blocks
+	uint32_t nterms; ///<Number of terms
+	uint32_t nkeys; ///<Number of terms that are keys
+	uint32_t flags; ///<INDEX_* flags
+	uint32_t pad;
+	uint64_t npostings; ///<Number of block numbers in all posting lists
+	uint64_t names_size; ///<Bytes of names
+} idx_header_t;
+
+/**
+ * Private.  A key, or a key:value token, and the blocks holding it.
+ */
+typedef struct {
+	uint32_t name_off; ///<Offset of the name in the names
+	uint32_t name_len; ///<Length of the name
+	uint64_t post_off; ///<First of its block numbers in the postings
+	uint32_t post_len; ///<Number of blocks, in increasing order
+	uint32_t values; ///<Key: distinct values seen
+	uint32_t flags; ///<TERM_* flags
+	uint32_t pad;
+} idx_term_t;
+
+/**
+ * Private.  An index file mapped into memory.
+ */
+typedef struct {
+	char *map; ///<The whole file, NULL if there is no index
+	size_t map_size; ///<Its size
+	const idx_header_t *h;
+	const uint64_t *blocks; ///<Start offset of each block
+	const idx_term_t *terms;
+	const uint32_t *postings;
+	const char *names;
+} idx_view_t;
+
+/**
+ * Private.  A term found in lines not yet indexed.
+ */
+typedef struct build_term {
+	char *name; ///<Key, or key:value
+	size_t len; ///<Length of name
+	uint32_t *post; ///<Blocks holding it, in increasing order
+	uint32_t npost; ///<Number of blocks
+	uint32_t cap; ///<Room in post
+	struct build_term *key; ///<key:value: its key, NULL for a key
+	uint32_t values; ///<Key: new distinct values
+	int dropped; ///<Key: values are not indexed
+	int ignored; ///<Key: past LOGINDEX_MAX_KEYS, not indexed at all
+	struct build_term *hnext; ///<Next term in the same hash bucket
+} build_term_t;
+
+/**
+ * Private.  Terms and blocks of the lines being added to an index.
+ */
+typedef struct {
+	build_term_t **buckets;
+	size_t nterms;
+	uint64_t *blocks; ///<Start offsets of the new blocks
+	uint32_t nblocks;
+	uint32_t cap;
+	uint32_t new_keys; ///<Keys not in the old index
+	int keys_dropped; ///<Some key was ignored
+} builder_t;
+
+/* index_lock guards view and the counters and is only ever held for a
+   moment, /stats takes it on a reactor.  build_lock lets one lookup at
+   a time bring the index up to date: it reads view without index_lock,
+   as nothing else changes it, and only swaps in the new one under it. */
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t build_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *log_file; ///<The indexed log, NULL before logindex_init()
+static char *idx_file; ///<Its index
+static idx_view_t view;
+static logindex_stats_t stats;
+
+/** Internal use only.  FNV-1a. */
+static uint64_t hash_bytes(const char *s, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+
+	for(i = 0; i < len; i++){
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/** Internal use only.  Hashes both ends of the first covered bytes. */
+static void fingerprint(const char *map, uint64_t covered, uint64_t *head, uint64_t *tail)
+{
+	size_t n = covered < FINGERPRINT_SIZE ? covered : FINGERPRINT_SIZE;
+
+	*head = hash_bytes(map, n);
+	*tail = hash_bytes(map + covered - n, n);
+}
+
+/** Internal use only.  Whether s is a key: a letter or '_', then [A-Za-z0-9_.-]. */
+static int key_valid(const char *s, size_t len)
+{
+	size_t i;
+
+	if(len == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_'))
+		return 0;
+	for(i = 1; i < len; i++)
+		if(!(isalnum((unsigned char)s[i]) || s[i] == '_' || s[i] == '.' || s[i] == '-'))
+			return 0;
+	return 1;
+}
+
+/** Internal use only.  Whether c ends a token. */
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/*
+ * Reading an index
+ */
+
+/** Internal use only.  Orders names as the terms of an index are sorted. */
+static int name_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	int rc = memcmp(a, b, alen < blen ? alen : blen);
+
+	if(rc != 0)
+		return rc;
+	return alen < blen ? -1 : alen > blen;
+}
+
+/** Internal use only.  Binary search for a term, or NULL. */
+static const idx_term_t *view_find(const idx_view_t *v, const char *name, size_t len)
+{
+	size_t lo = 0, hi = v->h ? v->h->nterms : 0;
+
+	while(lo < hi){
+		size_t mid = (lo + hi) / 2;
+		const idx_term_t *t = &v->terms[mid];
+		int rc = name_cmp(v->names + t->name_off, t->name_len, name, len);
+		if(rc == 0)
+			return t;
+		if(rc < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/** Internal use only. */
+static void view_close(idx_view_t *v)
+{
+	if(v->map != NULL)
+		munmap(v->map, v->map_size);
+	memset(v, 0, sizeof(*v));
+}
+
+/**
+ * Internal use only.  Maps an index file and checks it is whole.
+ *
+ * @return 0, or -1 if there is no usable index.
+ */
+static int view_open(idx_view_t *v, const char *path)
+{
+	struct stat st;
+	const idx_header_t *h;
+	uint64_t need;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	memset(v, 0, sizeof(*v));
+	if(fd < 0)
+		return -1;
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(idx_header_t)){
+		close(fd);
+		return -1;
+	}
+	v->map_size = st.st_size;
+	v->map = mmap(NULL, v->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(v->map == MAP_FAILED){
+		v->map = NULL;
+		return -1;
+	}
+
+	h = (const idx_header_t *)v->map;
+	need = sizeof(idx_header_t) + h->nblocks * sizeof(uint64_t) + h->nterms * sizeof(idx_term_t) +
+	       h->npostings * sizeof(uint32_t) + h->names_size;
+	if(memcmp(h->magic, LOGINDEX_MAGIC, 8) != 0 || h->block_size != LOGINDEX_BLOCK_SIZE ||
+	   need != v->map_size){
+		view_close(v);
+		return -1;
+	}
+	v->h = h;
+	v->blocks = (const uint64_t *)(h + 1);
+	v->terms = (const idx_term_t *)(v->blocks + h->nblocks);
+	v->postings = (const uint32_t *)(v->terms + h->nterms);
+	v->names = (const char *)(v->postings + h->npostings);
+	return 0;
+}
+
+/*
+ * Indexing new lines
+ */
+
+/** Internal use only. */
+static void builder_init(builder_t *b)
+{
+	memset(b, 0, sizeof(*b));
+	b->buckets = calloc(BUILD_BUCKETS, sizeof(build_term_t *));
+}
+
+/** Internal use only. */
+static void builder_free(builder_t *b)
+{
+	size_t i;
+
+	for(i = 0; i < BUILD_BUCKETS; i++){
+		build_term_t *t = b->buckets[i];
+		while(t != NULL){
+			build_term_t *next = t->hnext;
+			free(t->name);
+			free(t->post);
+			free(t);
+			t = next;
+		}
+	}
+	free(b->buckets);
+	free(b->blocks);
+}
+
+/** Internal use only.  Finds a term, adding it if create is set. */
+static build_term_t *builder_term(builder_t *b, const char *name, size_t len, int create, int *created)
+{
+	size_t h = hash_bytes(name, len) % BUILD_BUCKETS;
+	build_term_t *t;
+
+	for(t = b->buckets[h]; t != NULL; t = t->hnext)
+		if(t->len == len && memcmp(t->name, name, len) == 0)
+			return t;
+	if(!create)
+		return NULL;
+
+	t = calloc(1, sizeof(build_term_t));
+	t->name = malloc(len);
+	memcpy(t->name, name, len);
+	t->len = len;
+	t->hnext = b->buckets[h];
+	b->buckets[h] = t;
+	b->nterms++;
+	*created = 1;
+	return t;
+}
+
+/** Internal use only.  Records that block holds t. */
+static void post_add(build_term_t *t, uint32_t block)
+{
+	if(t->npost > 0 && t->post[t->npost - 1] == block)
+		return;
+	if(t->npost == t->cap){
+		t->cap = t->cap ? t->cap * 2 : 4;
+		t->post = realloc(t->post, t->cap * sizeof(uint32_t));
+	}
+	t->post[t->npost++] = block;
+}
+
+/** Internal use only.  Indexes one token of a line in block. */
+static void builder_token(builder_t *b, const idx_view_t *old, const char *tok, size_t len, uint32_t block)
+{
+	const char *colon = memchr(tok, ':', len);
+	build_term_t *key, *val;
+	int created = 0;
+
+	if(colon == NULL || !key_valid(tok, colon - tok))
+		return;
+
+	key = builder_term(b, tok, colon - tok, 1, &created);
+	if(created && view_find(old, tok, colon - tok) == NULL){
+		uint32_t keys = (old->h ? old->h->nkeys : 0) + b->new_keys;
+		if(keys >= LOGINDEX_MAX_KEYS){
+			key->ignored = 1;
+			b->keys_dropped = 1;
+		}else{
+			b->new_keys++;
+		}
+	}
+	if(key->ignored)
+		return;
+	post_add(key, block);
+	if(key->dropped)
+		return;
+	if(len > LOGINDEX_MAX_TOKEN){
+		key->dropped = 1;
+		return;
+	}
+
+	created = 0;
+	val = builder_term(b, tok, len, 1, &created);
+	if(created){
+		val->key = key;
+		if(++key->values > LOGINDEX_MAX_VALUES)
+			key->dropped = 1;
+	}
+	post_add(val, block);
+}
+
+/**
+ * Internal use only.  Indexes the whole lines of [from, to), cut into
+ * blocks numbered from first on.
+ */
+static void builder_scan(builder_t *b, const idx_view_t *old, const char *map,
+                         uint64_t from, uint64_t to, uint32_t first)
+{
+	uint64_t start = from;
+
+	while(start < to){
+		uint64_t end = to;
+		uint32_t block = first + b->nblocks;
+		const char *p, *stop;
+
+		if(to - start > LOGINDEX_BLOCK_SIZE){
+			const char *nl = memchr(map + start + LOGINDEX_BLOCK_SIZE, '\n',
+			                        to - start - LOGINDEX_BLOCK_SIZE);
+			end = nl ? (uint64_t)(nl + 1 - map) : to;
+		}
+		if(b->nblocks == b->cap){
+			b->cap = b->cap ? b->cap * 2 : 64;
+			b->blocks = realloc(b->blocks, b->cap * sizeof(uint64_t));
+		}
+		b->blocks[b->nblocks++] = start;
+
+		// tokens are runs of anything but blanks and newlines
+		p = map + start;
+		stop = map + end;
+		while(p < stop){
+			const char *tok;
+			while(p < stop && is_space(*p))
+				p++;
+			tok = p;
+			while(p < stop && !is_space(*p))
+				p++;
+			if(p > tok)
+				builder_token(b, old, tok, p - tok, block);
+		}
+		start = end;
+	}
+}
+
+/** Internal use only.  qsort() order of new terms. */
+static int build_cmp(const void *a, const void *b)
+{
+	const build_term_t *x = *(build_term_t *const *)a;
+	const build_term_t *y = *(build_term_t *const *)b;
+
+	return name_cmp(x->name, x->len, y->name, y->len);
+}
+
+/**
+ * Private.  The new index while it is put together.
+ */
+typedef struct {
+	idx_term_t *terms;
+	uint32_t nterms;
+	uint32_t *postings;
+	uint64_t npostings;
+	uint64_t post_cap;
+	char *names;
+	uint64_t names_size;
+	uint64_t names_cap;
+	uint32_t nkeys;
+} merge_t;
+
+/** Internal use only.  Appends a term and its postings. */
+static void merge_emit(merge_t *m, const char *name, size_t len, uint32_t flags, uint32_t values,
+                       const uint32_t *a, uint32_t na, const uint32_t *b, uint32_t nb)
+{
+	idx_term_t *t = &m->terms[m->nterms++];
+
+	while(m->names_size + len > m->names_cap){
+		m->names_cap = m->names_cap ? m->names_cap * 2 : 64 * 1024;
+		m->names = realloc(m->names, m->names_cap);
+	}
+	while(m->npostings + na + nb > m->post_cap){
+		m->post_cap = m->post_cap ? m->post_cap * 2 : 64 * 1024;
+		m->postings = realloc(m->postings, m->post_cap * sizeof(uint32_t));
+	}
+	memset(t, 0, sizeof(*t));
+	t->name_off = m->names_size;
+	t->name_len = len;
+	t->post_off = m->npostings;
+	t->post_len = na + nb;
+	t->values = values;
+	t->flags = flags;
+	memcpy(m->names + m->names_size, name, len);
+	m->names_size += len;
+	memcpy(m->postings + m->npostings, a, na * sizeof(uint32_t));
+	memcpy(m->postings + m->npostings + na, b, nb * sizeof(uint32_t));
+	m->npostings += na + nb;
+	if(flags & TERM_KEY)
+		m->nkeys++;
+}
+
+/** Internal use only.  Writes all of buf. */
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while(len > 0){
+		ssize_t n = write(fd, p, len);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Internal use only.  Writes the old index merged with the new lines
+ * to a temporary file and renames it over the index, so readers of the
+ * old file are never disturbed.
+ *
+ * @return 0, or -1 if the file could not be written.
+ */
+static int index_write(const idx_view_t *old, builder_t *b, const char *map, uint64_t covered)
+{
+	build_term_t **terms = malloc((b->nterms + 1) * sizeof(build_term_t *));
+	uint32_t nold = old->h ? old->h->nterms : 0, i = 0, j = 0, n = 0;
+	uint32_t nold_blocks = old->h ? old->h->nblocks : 0;
+	size_t k;
+	merge_t m;
+	idx_header_t h;
+	char *tmp;
+	int fd, rc = 0, cut = 0;
+
+	for(k = 0; k < BUILD_BUCKETS; k++){
+		build_term_t *t;
+		for(t = b->buckets[k]; t != NULL; t = t->hnext)
+			if(!(t->key ? t->key->ignored : t->ignored))
+				terms[n++] = t;
+	}
+	qsort(terms, n, sizeof(build_term_t *), build_cmp);
+
+	// count the values each key gains, a key past the limit loses them all
+	for(k = 0; k < n; k++){
+		build_term_t *t = terms[k];
+		if(t->key == NULL){
+			const idx_term_t *ot = view_find(old, t->name, t->len);
+			t->values = ot ? ot->values : 0;
+			if(ot && (ot->flags & TERM_DROPPED))
+				t->dropped = 1;
+		}
+	}
+	for(k = 0; k < n; k++){
+		build_term_t *t = terms[k];
+		if(t->key != NULL && view_find(old, t->name, t->len) == NULL)
+			t->key->values++;
+	}
+	for(k = 0; k < n; k++)
+		if(terms[k]->key == NULL && terms[k]->values > LOGINDEX_MAX_VALUES)
+			terms[k]->dropped = 1;
+
+	memset(&m, 0, sizeof(m));
+	m.terms = malloc((nold + n + 1) * sizeof(idx_term_t));
+	while(i < nold || j < n){
+		const idx_term_t *ot = i < nold ? &old->terms[i] : NULL;
+		build_term_t *nt = j < n ? terms[j] : NULL;
+		const char *oname = ot ? old->names + ot->name_off : NULL;
+		int cmp = ot == NULL ? 1 : nt == NULL ? -1 : name_cmp(oname, ot->name_len, nt->name, nt->len);
+
+		if(cmp < 0){
+			// only in the old index, unless its key just lost its values
+			if(!(ot->flags & TERM_KEY)){
+				const char *colon = memchr(oname, ':', ot->name_len);
+				build_term_t *key = builder_term(b, oname, colon - oname, 0, NULL);
+				if(key != NULL && key->dropped){
+					i++;
+					continue;
+				}
+			}
+			merge_emit(&m, oname, ot->name_len, ot->flags, ot->values,
+			           old->postings + ot->post_off, ot->post_len, NULL, 0);
+			i++;
+			continue;
+		}
+
+		if(nt->key != NULL && nt->key->dropped){
+			if(cmp == 0)
+				i++;
+			j++;
+			continue;
+		}
+		merge_emit(&m, nt->name, nt->len,
+		           nt->key ? 0 : TERM_KEY | (nt->dropped ? TERM_DROPPED : 0),
+		           nt->key ? 0 : nt->values,
+		           cmp == 0 ? old->postings + ot->post_off : NULL, cmp == 0 ? ot->post_len : 0,
+		           nt->post, nt->npost);
+		if(cmp == 0)
+			i++;
+		j++;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, LOGINDEX_MAGIC, 8);
+	h.covered = covered;
+	fingerprint(map, covered, &h.head_hash, &h.tail_hash);
+	h.block_size = LOGINDEX_BLOCK_SIZE;
+	h.nblocks = nold_blocks + b->nblocks;
+	h.nterms = m.nterms;
+	h.nkeys = m.nkeys;
+	h.flags = (old->h ? old->h->flags : 0) | (b->keys_dropped ? INDEX_KEYS_DROPPED : 0);
+	h.npostings = m.npostings;
+	h.names_size = m.names_size;
+
+	tmp = malloc(strlen(idx_file) + 5);
+	sprintf(tmp, "%s.tmp", idx_file);
+	if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0 ||
+	   write_all(fd, &h, sizeof(h)) < 0 ||
+	   write_all(fd, old->blocks, nold_blocks * sizeof(uint64_t)) < 0 ||
+	   write_all(fd, b->blocks, b->nblocks * sizeof(uint64_t)) < 0 ||
+	   write_all(fd, m.terms, m.nterms * sizeof(idx_term_t)) < 0 ||
+	   write_all(fd, m.postings, m.npostings * sizeof(uint32_t)) < 0 ||
+	   write_all(fd, m.names, m.names_size) < 0 ||
+	   (cut = mapguard_cut(map)) || rename(tmp, idx_file) < 0){
+		// a log truncated under us was read as zeros
+		if(cut)
+			fprintf(stderr, "-- %s: truncated while it was indexed\n", log_file);
+		else
+			perror("-- writing the log index failed");
+		unlink(tmp);
+		rc = -1;
+	}
+	if(fd >= 0)
+		close(fd);
+
+	free(tmp);
+	free(m.terms);
+	free(m.postings);
+	free(m.names);
+	free(terms);
+	return rc;
+}
+
+/**
+ * Internal use only.  Tells whether the view indexes the first lines of
+ * the log mapped at map, and not those of a log since truncated or
+ * generated anew.
+ */
+static int view_matches(const idx_view_t *v, const char *map, uint64_t size)
+{
+	uint64_t head, tail;
+
+	if(v->h->covered > size)
+		return 0;
+	fingerprint(map, v->h->covered, &head, &tail);
+	return head == v->h->head_hash && tail == v->h->tail_hash;
+}
+
+/**
+ * Internal use only.  Brings the index up to date with the log mapped
+ * at map.  If the indexed part of the log changed, e.g. it was
+ * truncated or generated anew, the index is built again from scratch.
+ * New lines are only added once there are at least min_new bytes of
+ * them, until then lookups scan them.
+ *
+ * Called with build_lock held.  The lines are indexed and the file
+ * written without index_lock, lookups go on with the index as it was,
+ * and the new one replaces it only once it is written.
+ */
+static void index_sync(const char *map, uint64_t size, uint64_t min_new)
+{
+	uint64_t covered = view.h ? view.h->covered : 0, whole;
+	idx_view_t empty, next;
+	builder_t b;
+
+	if(view.h != NULL && !view_matches(&view, map, size)){
+		// no lookup may be answered from it while the new one is built
+		pthread_mutex_lock(&index_lock);
+		view_close(&view);
+		stats.rebuilds++;
+		pthread_mutex_unlock(&index_lock);
+		covered = 0;
+	}
+
+	// only whole lines are indexed
+	const char *nl = size > covered ? memrchr(map + covered, '\n', size - covered) : NULL;
+	whole = nl ? (uint64_t)(nl + 1 - map) : covered;
+	if(whole == covered || whole - covered < min_new)
+		return;
+
+	memset(&empty, 0, sizeof(empty));
+	builder_init(&b);
+	builder_scan(&b, view.h ? &view : &empty, map, covered, whole, view.h ? view.h->nblocks : 0);
+	if(index_write(view.h ? &view : &empty, &b, map, whole) == 0 && view_open(&next, idx_file) == 0){
+		pthread_mutex_lock(&index_lock);
+		view_close(&view);
+		view = next;
+		stats.updates++;
+		pthread_mutex_unlock(&index_lock);
+	}
+	builder_free(&b);
+}
+
+/**
+ * Opens the index of a log, building it or adding the lines written
+ * since it was last updated.  Lookups for other logs are not answered.
+ *
+ * @param log_path The log.
+ * @return 0 on success, -1 if the log cannot be read.
+ */
+int logindex_init(const char *log_path)
+{
+	struct stat st;
+	char *map = NULL;
+	int fd, rc = 0;
+
+	pthread_mutex_lock(&build_lock);
+	pthread_mutex_lock(&index_lock);
+	log_file = strdup(log_path);
+	idx_file = malloc(strlen(log_path) + strlen(LOGINDEX_SUFFIX) + 1);
+	sprintf(idx_file, "%s%s", log_path, LOGINDEX_SUFFIX);
+	view_open(&view, idx_file);
+	pthread_mutex_unlock(&index_lock);
+
+	if((fd = open(log_path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0){
+		rc = -1;
+	}else if(st.st_size > 0){
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map != MAP_FAILED){
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			mapguard_add(map, st.st_size);
+			index_sync(map, st.st_size, 0);
+			mapguard_remove(map);
+			munmap(map, st.st_size);
+		}else{
+			rc = -1;
+		}
+	}
+	if(fd >= 0)
+		close(fd);
+	pthread_mutex_unlock(&build_lock);
+	return rc;
+}
+
+/**
+ * Unmaps the index.
+ *
+ * @return void
+ */
+void logindex_destroy(void)
+{
+	pthread_mutex_lock(&index_lock);
+	view_close(&view);
+	free(log_file);
+	free(idx_file);
+	log_file = idx_file = NULL;
+	pthread_mutex_unlock(&index_lock);
+}
+
+/**
+ * Tells whether a field query can be answered: "key:value" with a key
+ * as the index knows them and no blanks.
+ *
+ * @param field The field.
+ * @return 1 if it is valid, 0 if not.
+ */
+int logindex_field_valid(const char *field)
+{
+	const char *colon = strchr(field, ':');
+	const char *p;
+
+	if(colon == NULL || !key_valid(field, colon - field))
+		return 0;
+	for(p = field; *p; p++)
+		if(is_space(*p))
+			return 0;
+	return 1;
+}
+
+/**
+ * Finds the parts of a log that may hold lines with a key:value token.
+ * The index is first brought up to date with the log, then the blocks
+ * listed for the token are returned, or for its key if the key has too
+ * many values to index them, followed by the lines not indexed yet.
+ *
+ * @param log_path The log, must be the one given to logindex_init().
+ * @param map The log, mapped by the caller.
+ * @param size Size of the log.
+ * @param field The key:value token, see logindex_field_valid().
+ * @param ranges Filled with a malloc'd array of ranges in file order.
+ * @return The number of ranges, possibly 0.
+ * @return -1 if the index cannot narrow the search, the whole log must be scanned.
+ */
+int logindex_lookup(const char *log_path, const char *map, uint64_t size, const char *field,
+                    logindex_range_t **ranges)
+{
+	const idx_term_t *key, *t;
+	const uint32_t *post = NULL;
+	uint32_t npost = 0, i;
+	uint64_t covered, kept = 0;
+	int n = 0;
+
+	*ranges = NULL;
+	if(log_file == NULL || strcmp(log_path, log_file) != 0 || !logindex_field_valid(field))
+		return -1;
+
+	// while another lookup indexes new lines, this one scans them
+	if(pthread_mutex_trylock(&build_lock) == 0){
+		index_sync(map, size, LOGINDEX_BLOCK_SIZE);
+		pthread_mutex_unlock(&build_lock);
+	}
+	pthread_mutex_lock(&index_lock);
+	// the log may have changed and not been indexed again yet
+	if(view.h == NULL || !view_matches(&view, map, size)){
+		stats.fallbacks++;
+		pthread_mutex_unlock(&index_lock);
+		return -1;
+	}
+	key = view_find(&view, field, strchr(field, ':') - field);
+	if(key == NULL && (view.h->flags & INDEX_KEYS_DROPPED)){
+		stats.fallbacks++;
+		pthread_mutex_unlock(&index_lock);
+		return -1;
+	}
+
+	if(key != NULL && (key->flags & TERM_DROPPED)){
+		post = view.postings + key->post_off;
+		npost = key->post_len;
+	}else if(key != NULL && (t = view_find(&view, field, strlen(field))) != NULL){
+		post = view.postings + t->post_off;
+		npost = t->post_len;
+	}
+
+	// neighbouring blocks become one range, plus one for the tail
+	covered = view.h->covered;
+	*ranges = malloc((npost + 1) * sizeof(logindex_range_t));
+	for(i = 0; i < npost; i++){
+		uint64_t start = view.blocks[post[i]];
+		uint64_t end = post[i] + 1 < view.h->nblocks ? view.blocks[post[i] + 1] : covered;
+		if(n > 0 && (*ranges)[n - 1].end == start){
+			(*ranges)[n - 1].end = end;
+		}else{
+			(*ranges)[n].start = start;
+			(*ranges)[n].end = end;
+			n++;
+		}
+		kept += end - start;
+	}
+	if(size > covered){
+		(*ranges)[n].start = covered;
+		(*ranges)[n].end = size;
+		n++;
+	}
+	stats.lookups++;
+	stats.bytes_skipped += covered - kept;
+	pthread_mutex_unlock(&index_lock);
+	return n;
+}
+
+/**
+ * Reads the index counters.
+ *
+ * @param s Filled with a copy of the counters.
+ * @return void
+ */
+void logindex_get_stats(logindex_stats_t *s)
+{
+	pthread_mutex_lock(&index_lock);
+	*s = stats;
+	s->covered = view.h ? view.h->covered : 0;
+	s->blocks = view.h ? view.h->nblocks : 0;
+	s->terms = view.h ? view.h->nterms : 0;
+	pthread_mutex_unlock(&index_lock);
+}
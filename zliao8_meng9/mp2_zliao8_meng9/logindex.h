@@ -0,0 +1,48 @@
+/** @file logindex.h */
+#ifndef __LOGINDEX_H__
+#define __LOGINDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The index of a log lives next to it, in <log><LOGINDEX_SUFFIX> */
+#define LOGINDEX_SUFFIX ".idx"
+/* Logs are indexed in line-aligned blocks of about this size */
+#define LOGINDEX_BLOCK_SIZE (64 * 1024)
+/* A key with more distinct values is indexed by key alone */
+#define LOGINDEX_MAX_VALUES 4096
+/* Keys indexed at most, later ones are not indexed at all */
+#define LOGINDEX_MAX_KEYS 4096
+/* Longest key:value token indexed, longer ones are indexed by key alone */
+#define LOGINDEX_MAX_TOKEN 256
+
+/**
+ * A byte range of the log that may hold matching lines.
+ */
+typedef struct {
+	uint64_t start; ///<First byte, at the start of a line
+	uint64_t end; ///<One past the last byte
+} logindex_range_t;
+
+/**
+ * Counters, see logindex_get_stats().
+ */
+typedef struct {
+	unsigned long lookups; ///<Field queries answered from the index
+	unsigned long fallbacks; ///<Field queries the index could not narrow down
+	unsigned long updates; ///<Times new lines were added
+	unsigned long rebuilds; ///<Times the log was replaced and indexed anew
+	unsigned long long bytes_skipped; ///<Bytes of log lookups ruled out
+	unsigned long long covered; ///<Bytes of log indexed
+	unsigned int blocks; ///<Blocks indexed
+	unsigned int terms; ///<Keys and key:value terms indexed
+} logindex_stats_t;
+
+int logindex_init(const char *log_path);
+void logindex_destroy(void);
+int logindex_field_valid(const char *field);
+int logindex_lookup(const char *log_path, const char *map, uint64_t size, const char *field,
+                    logindex_range_t **ranges);
+void logindex_get_stats(logindex_stats_t *stats);
+
+#endif
@@ -0,0 +1,202 @@
+/** @file logwatch.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#include "logwatch.h"
+
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed;
+static unsigned long generation;
+static int stopped;
+
+static char *dir;
+static char *name;
+static int inotify_fd = -1;
+static int stop_fd = -1;
+static pthread_t watcher;
+
+/** Internal use only.  Tells every follower the log may have changed. */
+static void bump(void)
+{
+	pthread_mutex_lock(&watch_lock);
+	generation++;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&watch_lock);
+}
+
+/**
+ * Internal use only.  Thread turning changes of the log into new
+ * generations.  The directory is watched rather than the file, so a
+ * log that is rotated, or created after the server started, is seen
+ * as well.
+ */
+static void *logwatch_thread(void *ptr)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd[2];
+
+	pfd[0].fd = inotify_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stop_fd;
+	pfd[1].events = POLLIN;
+
+	while(1){
+		if(poll(pfd, 2, -1) < 0){
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		if(pfd[1].revents)
+			break;
+
+		ssize_t len = read(inotify_fd, buf, sizeof(buf));
+		if(len <= 0)
+			continue;
+
+		// one wakeup for a whole batch of writes to the log
+		int hit = 0;
+		char *p = buf;
+		while(p < buf + len){
+			struct inotify_event *ev = (struct inotify_event *)p;
+			if(ev->len > 0 && strcmp(ev->name, name) == 0)
+				hit = 1;
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+		if(hit)
+			bump();
+	}
+	return ptr;
+}
+
+/**
+ * Starts watching a log for appends, truncation and rotation.  Should
+ * always be called first.
+ *
+ * @param path The log.
+ * @return 0 on success.
+ * @return -1 if inotify is unavailable, the log is then polled every
+ *         LOGWATCH_POLL_MS instead.
+ */
+int logwatch_init(const char *path)
+{
+	pthread_condattr_t attr;
+	const char *slash = strrchr(path, '/');
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&changed, &attr);
+	pthread_condattr_destroy(&attr);
+	stopped = 0;
+
+	dir = slash ? (slash == path ? strdup("/") : strndup(path, slash - path)) : strdup(".");
+	name = strdup(slash ? slash + 1 : path);
+
+	if((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+	   inotify_add_watch(inotify_fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO) < 0 ||
+	   (stop_fd = eventfd(0, EFD_CLOEXEC)) < 0 ||
+	   pthread_create(&watcher, NULL, logwatch_thread, NULL) != 0){
+		perror("logwatch: inotify unavailable, polling the log instead");
+		if(inotify_fd >= 0)
+			close(inotify_fd);
+		if(stop_fd >= 0)
+			close(stop_fd);
+		inotify_fd = -1;
+		stop_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the watcher.  Every follower waiting, and every later call to
+ * logwatch_wait(), returns -1 so the followers end their responses.
+ */
+void logwatch_destroy(void)
+{
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&watch_lock);
+	stopped = 1;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&watch_lock);
+
+	if(stop_fd >= 0){
+		if(write(stop_fd, &one, sizeof(one)) < 0)
+			perror("write");
+		pthread_join(watcher, NULL);
+		close(stop_fd);
+		close(inotify_fd);
+		stop_fd = -1;
+		inotify_fd = -1;
+	}
+	free(dir);
+	free(name);
+	dir = NULL;
+	name = NULL;
+}
+
+/**
+ * Returns the current generation of the log, to be handed to the
+ * first logwatch_wait() of a follower before it first reads the log.
+ */
+unsigned long logwatch_generation(void)
+{
+	pthread_mutex_lock(&watch_lock);
+	unsigned long g = generation;
+	pthread_mutex_unlock(&watch_lock);
+	return g;
+}
+
+/**
+ * Waits until the log changed since the generation a follower last
+ * saw.  Changes made while the follower was reading the log are not
+ * missed, as they already moved the generation on.
+ *
+ * @param seen Generation last seen, updated.
+ * @param timeout_ms Longest wait.
+ * @return 1 if the log may have changed, 0 on timeout.
+ * @return -1 once logwatch_destroy() was called.
+ */
+int logwatch_wait(unsigned long *seen, int timeout_ms)
+{
+	struct timespec until;
+	int rc = 0;
+
+	// without inotify every poll interval may have brought new lines
+	if(inotify_fd < 0 && timeout_ms > LOGWATCH_POLL_MS)
+		timeout_ms = LOGWATCH_POLL_MS;
+
+	clock_gettime(CLOCK_MONOTONIC, &until);
+	until.tv_sec += timeout_ms / 1000;
+	until.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if(until.tv_nsec >= 1000000000L){
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&watch_lock);
+	while(!stopped && generation == *seen && rc == 0)
+		rc = pthread_cond_timedwait(&changed, &watch_lock, &until);
+	if(stopped){
+		rc = -1;
+	}else if(generation != *seen){
+		*seen = generation;
+		rc = 1;
+	}else{
+		rc = inotify_fd < 0;
+	}
+	pthread_mutex_unlock(&watch_lock);
+	return rc;
+}
@@ -0,0 +1,18 @@
+/** @file logwatch.h */
+#ifndef __LOGWATCH_H__
+#define __LOGWATCH_H__
+
+/* Clients following the log at once unless -f says otherwise */
+#define LOGWATCH_DEFAULT_FOLLOWERS 32
+/* Longest a follower waits for the log before checking on its client */
+#define LOGWATCH_IDLE_MS 1000
+/* Without inotify the log is looked at this often */
+#define LOGWATCH_POLL_MS 200
+
+int logwatch_init(const char *path);
+void logwatch_destroy(void);
+
+unsigned long logwatch_generation(void);
+int logwatch_wait(unsigned long *seen, int timeout_ms);
+
+#endif
@@ -0,0 +1,149 @@
+/** @file mapguard.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mapguard.h"
+
+/**
+ * Private.  A mapped file whose pages may vanish under its readers.
+ */
+typedef struct {
+	int used; ///<Taken by mapguard_add(), claimed atomically
+	const char *base; ///<The mapping, NULL while the slot is filled or emptied
+	size_t size; ///<Its length
+	int cut; ///<Some page lay past the end of the file when it was read
+} guard_t;
+
+static guard_t guards[MAPGUARD_SLOTS];
+static uintptr_t page_mask;
+static int installed;
+
+/**
+ * Internal use only.  SIGBUS handler.  Reading a page of a mapped file
+ * past its end, once it was truncated, raises SIGBUS on the thread that
+ * reads it.  If the page belongs to a guarded mapping, zero pages are
+ * mapped over the rest of it and the read is retried, so the reader,
+ * whatever it is and whatever locks it holds, sees zeros and goes on.
+ * Anything else dies of the signal, as without a handler.
+ */
+static void mapguard_fault(int sig, siginfo_t *si, void *ctx)
+{
+	const char *addr = si->si_addr;
+	int i;
+
+	(void)ctx;
+	for(i = 0; i < MAPGUARD_SLOTS; i++){
+		const char *base = __atomic_load_n(&guards[i].base, __ATOMIC_ACQUIRE);
+		if(base == NULL || addr < base || addr >= base + guards[i].size)
+			continue;
+		char *page = (char *)((uintptr_t)addr & page_mask);
+		char *end = (char *)(((uintptr_t)(base + guards[i].size) + ~page_mask) & page_mask);
+		if(mmap(page, end - page, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED){
+			__atomic_store_n(&guards[i].cut, 1, __ATOMIC_RELEASE);
+			return;
+		}
+		break;
+	}
+	signal(sig, SIG_DFL);
+}
+
+/**
+ * Installs the SIGBUS handler.  Call before the first mapping is
+ * guarded, calling it again does nothing.
+ *
+ * @return 0 on success, -1 if the handler could not be installed.
+ */
+int mapguard_init(void)
+{
+	struct sigaction sa;
+
+	if(installed)
+		return 0;
+	page_mask = ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = mapguard_fault;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	if(sigaction(SIGBUS, &sa, NULL) < 0){
+		perror("sigaction");
+		return -1;
+	}
+	installed = 1;
+	return 0;
+}
+
+/**
+ * Guards a read-only mapping of a file that may be truncated while it
+ * is read, e.g. a log rotated in place.  Its pages past the new end of
+ * the file then read as zeros instead of killing the process, and
+ * mapguard_cut() tells that whatever was read from it is wrong.
+ *
+ * @param map The mapping.
+ * @param size Its length.
+ * @return void
+ */
+void mapguard_add(const void *map, size_t size)
+{
+	int i;
+
+	for(i = 0; i < MAPGUARD_SLOTS; i++){
+		int expected = 0;
+		if(__atomic_compare_exchange_n(&guards[i].used, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			guards[i].size = size;
+			guards[i].cut = 0;
+			__atomic_store_n(&guards[i].base, (const char *)map, __ATOMIC_RELEASE);
+			return;
+		}
+	}
+	// every slot is taken: the mapping is read unguarded
+}
+
+/** Internal use only.  Finds the slot of a mapping, or -1. */
+static int guard_find(const void *map)
+{
+	int i;
+
+	for(i = 0; i < MAPGUARD_SLOTS; i++){
+		if(__atomic_load_n(&guards[i].base, __ATOMIC_ACQUIRE) == map)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * Tells whether a guarded mapping was read past the end of its file.
+ *
+ * @param map The mapping.
+ * @return 1 if it was, 0 if not or if it is not guarded.
+ */
+int mapguard_cut(const void *map)
+{
+	int i = guard_find(map);
+
+	return i >= 0 && __atomic_load_n(&guards[i].cut, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Stops guarding a mapping, before it is unmapped.  Nobody may read it
+ * any more.
+ *
+ * @param map The mapping.
+ * @return 1 if it was read past the end of its file, 0 otherwise.
+ */
+int mapguard_remove(const void *map)
+{
+	int i = guard_find(map), cut;
+
+	if(i < 0)
+		return 0;
+	cut = __atomic_load_n(&guards[i].cut, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&guards[i].base, NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&guards[i].used, 0, __ATOMIC_RELEASE);
+	return cut;
+}
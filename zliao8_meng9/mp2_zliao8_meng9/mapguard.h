@@ -0,0 +1,15 @@
+/** @file mapguard.h */
+#ifndef __MAPGUARD_H__
+#define __MAPGUARD_H__
+
+#include <stddef.h>
+
+/* Mappings guarded at once, more are left unguarded */
+#define MAPGUARD_SLOTS 256
+
+int mapguard_init(void);
+void mapguard_add(const void *map, size_t size);
+int mapguard_cut(const void *map);
+int mapguard_remove(const void *map);
+
+#endif
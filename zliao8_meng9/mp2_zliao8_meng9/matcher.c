@@ -0,0 +1,1147 @@
+/** @file matcher.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "needle.h"
+#include "matcher.h"
+
+#define DFA_BUCKETS 1024
+
+/* Repeat counts above this are refused, x{1000} alone is 1000 copies */
+#define RX_MAX_REPEAT 255
+
+/**
+ * Private.  Kinds of syntax tree nodes.
+ */
+enum { RX_CHARS, RX_BOL, RX_EOL, RX_EMPTY, RX_CAT, RX_ALT, RX_REPEAT };
+
+/**
+ * Private.  A node of the parsed pattern.
+ */
+typedef struct rx_node {
+	int type; ///<One of RX_*
+	unsigned char set[32]; ///<RX_CHARS: bitmap of the bytes matched
+	int min; ///<RX_REPEAT: least number of copies
+	int max; ///<RX_REPEAT: most number of copies, -1 for no limit
+	struct rx_node *left; ///<RX_CAT, RX_ALT: first operand, RX_REPEAT: the operand
+	struct rx_node *right; ///<RX_CAT, RX_ALT: second operand
+} rx_node_t;
+
+/**
+ * Private.  Parser state.
+ */
+typedef struct {
+	const char *p; ///<Next character of the pattern
+	int error; ///<Set on a syntax error
+} rx_parser_t;
+
+/**
+ * Private.  A string known to appear in every match of a node, cut to
+ * MATCHER_MAX_LITERAL bytes.
+ */
+typedef struct {
+	char s[MATCHER_MAX_LITERAL];
+	size_t len;
+} rx_str_t;
+
+/**
+ * Private.  Literal facts about a node: prefix starts and suffix ends
+ * every match, must is inside every match.  If exact, the node only
+ * ever matches that one string and prefix, suffix and must all hold it.
+ */
+typedef struct {
+	int exact;
+	rx_str_t prefix;
+	rx_str_t suffix;
+	rx_str_t must;
+} rx_lit_t;
+
+/**
+ * Private.  Kinds of NFA states.
+ */
+enum { NFA_CHARS, NFA_SPLIT, NFA_EPS, NFA_BOL, NFA_EOL, NFA_MATCH };
+
+/**
+ * Private.  One state of the Thompson NFA.
+ */
+typedef struct {
+	int type; ///<One of NFA_*
+	int out; ///<Next state
+	int out1; ///<NFA_SPLIT: the other next state
+	unsigned char set[32]; ///<NFA_CHARS: bitmap of the bytes accepted
+} nfa_state_t;
+
+/**
+ * Private.  The compiled program.
+ */
+struct matcher_nfa {
+	nfa_state_t *states;
+	int n; ///<States used
+	int start; ///<First state
+	int error; ///<Set if the program grew past MATCHER_MAX_NFA
+};
+
+/**
+ * Private.  A DFA state: the set of NFA states the matcher can be in,
+ * after following every empty transition.  Only the states that
+ * consume a byte, the match state and end-of-line assertions not yet
+ * passed are kept, sorted, as they alone decide what happens next.
+ */
+typedef struct dfa_state {
+	struct dfa_state *next[256]; ///<Transitions built so far, NULL if not yet
+	int *nfa; ///<The NFA states
+	int n; ///<Number of NFA states
+	int bol; ///<Set for the state at the start of a line
+	int match; ///<A match ended here, the line matches
+	int match_eol; ///<The line matches if it ends here
+	int dead; ///<No match is possible any more on this line
+	struct dfa_state *hnext; ///<Next state in the same hash bucket
+} dfa_state_t;
+
+/**
+ * Private.  Scratch space for computing sets of NFA states.
+ */
+typedef struct {
+	unsigned int *mark; ///<Generation in which each state was added
+	unsigned int gen; ///<Current generation
+	int *stack; ///<States still to follow
+} nfa_scratch_t;
+
+/**
+ * Private.  The lazily built DFA.  States are never freed before the
+ * matcher so readers follow next[] without a lock; only building a
+ * missing transition takes lock.
+ */
+struct matcher_dfa {
+	pthread_mutex_t lock; ///<Guards building states and transitions
+	dfa_state_t *buckets[DFA_BUCKETS]; ///<States by NFA set
+	dfa_state_t *initial; ///<State at the start of every line
+	int n; ///<Number of states
+	nfa_scratch_t scratch; ///<Used under lock
+	int *set; ///<Used under lock for the next set
+	int *tmp; ///<Used under lock for the end of line closure
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static matcher_t *lru_head;
+static matcher_t *lru_tail;
+static matcher_stats_t stats;
+
+/*
+ * Parsing
+ */
+
+/** Internal use only. */
+static rx_node_t *rx_new(int type)
+{
+	rx_node_t *node = calloc(1, sizeof(rx_node_t));
+	node->type = type;
+	return node;
+}
+
+/** Internal use only. */
+static rx_node_t *rx_pair(int type, rx_node_t *left, rx_node_t *right)
+{
+	rx_node_t *node = rx_new(type);
+	node->left = left;
+	node->right = right;
+	return node;
+}
+
+/** Internal use only. */
+static void rx_free(rx_node_t *node)
+{
+	if(node == NULL)
+		return;
+	rx_free(node->left);
+	rx_free(node->right);
+	free(node);
+}
+
+/** Internal use only. */
+static void set_add(unsigned char *set, int c)
+{
+	set[c >> 3] |= 1 << (c & 7);
+}
+
+/** Internal use only. */
+static int set_has(const unsigned char *set, int c)
+{
+	return set[c >> 3] & (1 << (c & 7));
+}
+
+/** Internal use only.  Adds the bytes for which is(c) holds. */
+static void set_add_ctype(unsigned char *set, int (*is)(int))
+{
+	int c;
+
+	for(c = 0; c < 256; c++)
+		if(is(c))
+			set_add(set, c);
+}
+
+/** Internal use only. */
+static void set_negate(unsigned char *set)
+{
+	int i;
+
+	for(i = 0; i < 32; i++)
+		set[i] = ~set[i];
+	// lines never hold their newline
+	set['\n' >> 3] &= ~(1 << ('\n' & 7));
+}
+
+/** Internal use only.  '_' and alphanumerics, as \w matches. */
+static int is_word(int c)
+{
+	return isalnum(c) || c == '_';
+}
+
+/**
+ * Internal use only.  Adds the class of a \d \w \s \D \W \S escape.
+ *
+ * @return 0, or -1 if c is not a class escape.
+ */
+static int set_add_escape(unsigned char *set, int c)
+{
+	unsigned char tmp[32];
+
+	memset(tmp, 0, sizeof(tmp));
+	switch(tolower(c)){
+		case 'd': set_add_ctype(tmp, isdigit); break;
+		case 'w': set_add_ctype(tmp, is_word); break;
+		case 's': set_add_ctype(tmp, isspace); break;
+		default: return -1;
+	}
+	if(isupper(c))
+		set_negate(tmp);
+
+	int i;
+	for(i = 0; i < 32; i++)
+		set[i] |= tmp[i];
+	return 0;
+}
+
+/** Internal use only.  The byte a plain or escaped character stands for. */
+static int escape_char(int c)
+{
+	switch(c){
+		case 'n': return '\n';
+		case 't': return '\t';
+		case 'r': return '\r';
+		default: return c;
+	}
+}
+
+/**
+ * Internal use only.  Parses "[:name:]" inside a bracket expression.
+ *
+ * @return 0 if one was added to set, -1 otherwise.
+ */
+static int parse_named_class(rx_parser_t *ps, unsigned char *set)
+{
+	static const struct {
+		const char *name;
+		int (*is)(int);
+	} classes[] = {
+		{ "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum },
+		{ "upper", isupper }, { "lower", islower }, { "space", isspace },
+		{ "punct", ispunct }, { "xdigit", isxdigit }, { "print", isprint },
+		{ "graph", isgraph }, { "cntrl", iscntrl }, { "blank", isblank },
+	};
+	size_t i;
+
+	for(i = 0; i < sizeof(classes) / sizeof(classes[0]); i++){
+		size_t len = strlen(classes[i].name);
+		if(strncmp(ps->p + 2, classes[i].name, len) == 0 && strncmp(ps->p + 2 + len, ":]", 2) == 0){
+			set_add_ctype(set, classes[i].is);
+			ps->p += len + 4;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/** Internal use only.  Parses a bracket expression, after the '['. */
+static rx_node_t *parse_class(rx_parser_t *ps)
+{
+	rx_node_t *node = rx_new(RX_CHARS);
+	int negate = 0, first = 1;
+
+	if(*ps->p == '^'){
+		negate = 1;
+		ps->p++;
+	}
+	while(*ps->p && (*ps->p != ']' || first)){
+		int lo, hi;
+
+		first = 0;
+		if(ps->p[0] == '[' && ps->p[1] == ':' && parse_named_class(ps, node->set) == 0)
+			continue;
+		if(ps->p[0] == '\\' && ps->p[1]){
+			if(set_add_escape(node->set, (unsigned char)ps->p[1]) == 0){
+				ps->p += 2;
+				continue;
+			}
+			lo = escape_char((unsigned char)ps->p[1]);
+			ps->p += 2;
+		}else{
+			lo = (unsigned char)*ps->p++;
+		}
+
+		hi = lo;
+		if(ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']'){
+			if(ps->p[1] == '\\' && ps->p[2]){
+				hi = escape_char((unsigned char)ps->p[2]);
+				ps->p += 3;
+			}else{
+				hi = (unsigned char)ps->p[1];
+				ps->p += 2;
+			}
+			if(hi < lo)
+				ps->error = 1;
+		}
+		for(; lo <= hi; lo++)
+			set_add(node->set, lo);
+	}
+	if(*ps->p != ']')
+		ps->error = 1;
+	else
+		ps->p++;
+	if(negate)
+		set_negate(node->set);
+	return node;
+}
+
+static rx_node_t *parse_alt(rx_parser_t *ps);
+
+/** Internal use only.  Parses a single character, class, group or anchor. */
+static rx_node_t *parse_atom(rx_parser_t *ps)
+{
+	rx_node_t *node;
+	int c = (unsigned char)*ps->p++;
+
+	switch(c){
+		case '(':
+			node = parse_alt(ps);
+			if(*ps->p != ')')
+				ps->error = 1;
+			else
+				ps->p++;
+			return node;
+		case '[':
+			return parse_class(ps);
+		case '^':
+			return rx_new(RX_BOL);
+		case '$':
+			return rx_new(RX_EOL);
+		case '.':
+			node = rx_new(RX_CHARS);
+			set_negate(node->set);
+			return node;
+		case '*':
+		case '+':
+		case '?':
+			// nothing to repeat
+			ps->error = 1;
+			return rx_new(RX_EMPTY);
+		case '\\':
+			if(*ps->p == 0){
+				ps->error = 1;
+				return rx_new(RX_EMPTY);
+			}
+			node = rx_new(RX_CHARS);
+			c = (unsigned char)*ps->p++;
+			if(set_add_escape(node->set, c) < 0)
+				set_add(node->set, escape_char(c));
+			return node;
+		default:
+			node = rx_new(RX_CHARS);
+			set_add(node->set, c);
+			return node;
+	}
+}
+
+/**
+ * Internal use only.  Parses "{m}", "{m,}" or "{m,n}", leaving the
+ * parser on the closing brace.
+ *
+ * @return 0, or -1 if the brace does not start a bound and is a literal.
+ */
+static int parse_bound(rx_parser_t *ps, int *min, int *max)
+{
+	const char *p = ps->p + 1;
+	char *end;
+
+	if(!isdigit((unsigned char)*p))
+		return -1;
+	*min = strtol(p, &end, 10);
+	p = end;
+	*max = *min;
+	if(*p == ','){
+		p++;
+		*max = -1;
+		if(isdigit((unsigned char)*p)){
+			*max = strtol(p, &end, 10);
+			p = end;
+		}
+	}
+	if(*p != '}')
+		return -1;
+	if(*min > RX_MAX_REPEAT || *max > RX_MAX_REPEAT || (*max >= 0 && *max < *min))
+		ps->error = 1;
+	ps->p = p;
+	return 0;
+}
+
+/** Internal use only.  Parses an atom and the repetitions following it. */
+static rx_node_t *parse_repeat(rx_parser_t *ps)
+{
+	rx_node_t *node = parse_atom(ps);
+
+	while(1){
+		int min, max;
+
+		if(*ps->p == '*'){
+			min = 0;
+			max = -1;
+		}else if(*ps->p == '+'){
+			min = 1;
+			max = -1;
+		}else if(*ps->p == '?'){
+			min = 0;
+			max = 1;
+		}else if(*ps->p != '{' || parse_bound(ps, &min, &max) < 0){
+			return node;
+		}
+		ps->p++;
+
+		rx_node_t *rep = rx_new(RX_REPEAT);
+		rep->left = node;
+		rep->min = min;
+		rep->max = max;
+		node = rep;
+	}
+}
+
+/** Internal use only.  Parses a sequence up to '|', ')' or the end. */
+static rx_node_t *parse_cat(rx_parser_t *ps)
+{
+	rx_node_t *node = NULL;
+
+	while(*ps->p && *ps->p != '|' && *ps->p != ')' && !ps->error){
+		rx_node_t *next = parse_repeat(ps);
+		node = node ? rx_pair(RX_CAT, node, next) : next;
+	}
+	return node ? node : rx_new(RX_EMPTY);
+}
+
+/** Internal use only.  Parses alternatives separated by '|'. */
+static rx_node_t *parse_alt(rx_parser_t *ps)
+{
+	rx_node_t *node = parse_cat(ps);
+
+	while(*ps->p == '|' && !ps->error){
+		ps->p++;
+		node = rx_pair(RX_ALT, node, parse_cat(ps));
+	}
+	return node;
+}
+
+/*
+ * Required literals
+ */
+
+/** Internal use only.  The longer of two strings. */
+static void str_longest(rx_str_t *dst, const rx_str_t *a, const rx_str_t *b)
+{
+	*dst = a->len >= b->len ? *a : *b;
+}
+
+/**
+ * Internal use only.  Joins two strings.  If they do not fit, keep_end
+ * says whether the start or the end of the result is kept.
+ */
+static void str_join(rx_str_t *dst, const rx_str_t *a, const rx_str_t *b, int keep_end)
+{
+	char s[2 * MATCHER_MAX_LITERAL];
+	size_t len = a->len + b->len;
+
+	memcpy(s, a->s, a->len);
+	memcpy(s + a->len, b->s, b->len);
+	if(len > MATCHER_MAX_LITERAL){
+		if(keep_end)
+			memmove(s, s + len - MATCHER_MAX_LITERAL, MATCHER_MAX_LITERAL);
+		len = MATCHER_MAX_LITERAL;
+	}
+	memcpy(dst->s, s, len);
+	dst->len = len;
+}
+
+/**
+ * Internal use only.  Works out what literal text every match of node
+ * holds.  has_anchor is set if node uses ^ or $.
+ */
+static void rx_literal(const rx_node_t *node, rx_lit_t *lit, int *has_anchor)
+{
+	rx_lit_t l, r;
+	int c, count = 0, last = 0;
+
+	memset(lit, 0, sizeof(*lit));
+	switch(node->type){
+		case RX_CHARS:
+			for(c = 0; c < 256; c++)
+				if(set_has(node->set, c)){
+					count++;
+					last = c;
+				}
+			if(count == 1){
+				lit->exact = 1;
+				lit->prefix.s[0] = last;
+				lit->prefix.len = 1;
+				lit->suffix = lit->must = lit->prefix;
+			}
+			break;
+		case RX_BOL:
+		case RX_EOL:
+			*has_anchor = 1;
+			lit->exact = 1;
+			break;
+		case RX_EMPTY:
+			lit->exact = 1;
+			break;
+		case RX_CAT:
+			rx_literal(node->left, &l, has_anchor);
+			rx_literal(node->right, &r, has_anchor);
+			// the end of the left side runs straight into the right
+			str_join(&lit->must, &l.suffix, &r.prefix, 0);
+			str_longest(&lit->must, &lit->must, &l.must);
+			str_longest(&lit->must, &lit->must, &r.must);
+			if(l.exact)
+				str_join(&lit->prefix, &l.prefix, &r.prefix, 0);
+			else
+				lit->prefix = l.prefix;
+			if(r.exact)
+				str_join(&lit->suffix, &l.suffix, &r.suffix, 1);
+			else
+				lit->suffix = r.suffix;
+			lit->exact = l.exact && r.exact && l.prefix.len + r.prefix.len <= MATCHER_MAX_LITERAL;
+			break;
+		case RX_ALT:
+			rx_literal(node->left, &l, has_anchor);
+			rx_literal(node->right, &r, has_anchor);
+			if(l.exact && r.exact && l.prefix.len == r.prefix.len &&
+			   memcmp(l.prefix.s, r.prefix.s, l.prefix.len) == 0)
+				*lit = l;
+			break;
+		case RX_REPEAT:
+			rx_literal(node->left, &l, has_anchor);
+			if(node->min == 1 && node->max == 1)
+				*lit = l;
+			else if(node->min >= 1){
+				lit->prefix = l.prefix;
+				lit->suffix = l.suffix;
+				lit->must = l.must;
+			}
+			break;
+	}
+}
+
+/*
+ * NFA
+ */
+
+/**
+ * Private.  A piece of NFA under construction: start is its first
+ * state, end an NFA_EPS state whose out is still to be filled in.
+ */
+typedef struct {
+	int start;
+	int end;
+} nfa_frag_t;
+
+/** Internal use only.  Adds a state, or flags the program as too big. */
+static int nfa_add(struct matcher_nfa *nfa, int type)
+{
+	if(nfa->n == MATCHER_MAX_NFA){
+		nfa->error = 1;
+		return 0;
+	}
+	memset(&nfa->states[nfa->n], 0, sizeof(nfa_state_t));
+	nfa->states[nfa->n].type = type;
+	nfa->states[nfa->n].out = -1;
+	nfa->states[nfa->n].out1 = -1;
+	return nfa->n++;
+}
+
+/** Internal use only.  A fragment matching the empty string. */
+static nfa_frag_t nfa_empty(struct matcher_nfa *nfa)
+{
+	nfa_frag_t f;
+
+	f.start = nfa_add(nfa, NFA_EPS);
+	f.end = nfa_add(nfa, NFA_EPS);
+	nfa->states[f.start].out = f.end;
+	return f;
+}
+
+/** Internal use only.  Builds the NFA states for a syntax tree node. */
+static nfa_frag_t nfa_build(struct matcher_nfa *nfa, const rx_node_t *node)
+{
+	nfa_frag_t f, a, b;
+	int i, split;
+
+	if(nfa->error)
+		return nfa_empty(nfa);
+
+	switch(node->type){
+		case RX_CHARS:
+		case RX_BOL:
+		case RX_EOL:
+			f.start = nfa_add(nfa, node->type == RX_CHARS ? NFA_CHARS :
+			                       node->type == RX_BOL ? NFA_BOL : NFA_EOL);
+			f.end = nfa_add(nfa, NFA_EPS);
+			memcpy(nfa->states[f.start].set, node->set, 32);
+			nfa->states[f.start].out = f.end;
+			return f;
+		case RX_CAT:
+			a = nfa_build(nfa, node->left);
+			b = nfa_build(nfa, node->right);
+			nfa->states[a.end].out = b.start;
+			f.start = a.start;
+			f.end = b.end;
+			return f;
+		case RX_ALT:
+			a = nfa_build(nfa, node->left);
+			b = nfa_build(nfa, node->right);
+			f.start = nfa_add(nfa, NFA_SPLIT);
+			f.end = nfa_add(nfa, NFA_EPS);
+			nfa->states[f.start].out = a.start;
+			nfa->states[f.start].out1 = b.start;
+			nfa->states[a.end].out = f.end;
+			nfa->states[b.end].out = f.end;
+			return f;
+		case RX_REPEAT:
+			// x{2,4} is built as x x x? x?, x{2,} as x x x*
+			f = nfa_empty(nfa);
+			for(i = 0; i < node->min || (node->max < 0 ? i == node->min : i < node->max); i++){
+				if(nfa->error)
+					break;
+				a = nfa_build(nfa, node->left);
+				if(i >= node->min){
+					split = nfa_add(nfa, NFA_SPLIT);
+					b.end = nfa_add(nfa, NFA_EPS);
+					nfa->states[split].out = a.start;
+					nfa->states[split].out1 = b.end;
+					nfa->states[a.end].out = node->max < 0 ? split : b.end;
+					a.start = split;
+					a.end = b.end;
+				}
+				nfa->states[f.end].out = a.start;
+				f.end = a.end;
+			}
+			return f;
+		default:
+			return nfa_empty(nfa);
+	}
+}
+
+/** Internal use only.  Compiles a syntax tree, or returns NULL. */
+static struct matcher_nfa *nfa_compile(const rx_node_t *root)
+{
+	struct matcher_nfa *nfa = malloc(sizeof(struct matcher_nfa));
+	nfa_frag_t f;
+
+	nfa->states = malloc(MATCHER_MAX_NFA * sizeof(nfa_state_t));
+	nfa->n = 0;
+	nfa->error = 0;
+	f = nfa_build(nfa, root);
+	nfa->start = f.start;
+	nfa->states[f.end].out = nfa_add(nfa, NFA_MATCH);
+	if(nfa->error){
+		free(nfa->states);
+		free(nfa);
+		return NULL;
+	}
+	nfa->states = realloc(nfa->states, nfa->n * sizeof(nfa_state_t));
+	return nfa;
+}
+
+/** Internal use only. */
+static void scratch_init(nfa_scratch_t *scr, int n)
+{
+	scr->mark = calloc(n, sizeof(unsigned int));
+	scr->gen = 0;
+	// every state is followed once and has at most two successors
+	scr->stack = malloc((n * 2 + 1) * sizeof(int));
+}
+
+/** Internal use only. */
+static void scratch_free(nfa_scratch_t *scr)
+{
+	free(scr->mark);
+	free(scr->stack);
+}
+
+/** Internal use only.  Starts a new set. */
+static void scratch_reset(nfa_scratch_t *scr, int n)
+{
+	if(++scr->gen == 0){
+		memset(scr->mark, 0, n * sizeof(unsigned int));
+		scr->gen = 1;
+	}
+}
+
+/**
+ * Internal use only.  Adds state s and everything reachable from it
+ * without consuming a byte to set.  bol and eol say whether the ^ and
+ * $ assertions hold at this point.
+ */
+static void nfa_closure(const struct matcher_nfa *nfa, nfa_scratch_t *scr, int s,
+                        int bol, int eol, int *set, int *n)
+{
+	int top = 0;
+
+	scr->stack[top++] = s;
+	while(top > 0){
+		const nfa_state_t *st;
+
+		s = scr->stack[--top];
+		if(s < 0 || scr->mark[s] == scr->gen)
+			continue;
+		scr->mark[s] = scr->gen;
+		st = &nfa->states[s];
+		switch(st->type){
+			case NFA_CHARS:
+			case NFA_MATCH:
+				set[(*n)++] = s;
+				break;
+			case NFA_EOL:
+				if(eol)
+					scr->stack[top++] = st->out;
+				else
+					set[(*n)++] = s;
+				break;
+			case NFA_BOL:
+				if(bol)
+					scr->stack[top++] = st->out;
+				break;
+			case NFA_SPLIT:
+				scr->stack[top++] = st->out1;
+				scr->stack[top++] = st->out;
+				break;
+			default:
+				scr->stack[top++] = st->out;
+				break;
+		}
+	}
+}
+
+/** Internal use only. */
+static int int_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * Internal use only.  The set reached from set by consuming byte c,
+ * with a new match allowed to start right after it.
+ *
+ * @return The size of the new set, written to out.
+ */
+static int nfa_step(const struct matcher_nfa *nfa, nfa_scratch_t *scr,
+                    const int *set, int n, int c, int *out)
+{
+	int i, nout = 0;
+
+	scratch_reset(scr, nfa->n);
+	for(i = 0; i < n; i++){
+		const nfa_state_t *st = &nfa->states[set[i]];
+		if(st->type == NFA_CHARS && set_has(st->set, c))
+			nfa_closure(nfa, scr, st->out, 0, 0, out, &nout);
+	}
+	nfa_closure(nfa, scr, nfa->start, 0, 0, out, &nout);
+	qsort(out, nout, sizeof(int), int_cmp);
+	return nout;
+}
+
+/** Internal use only.  Whether set holds the match state. */
+static int nfa_has_match(const struct matcher_nfa *nfa, const int *set, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+		if(nfa->states[set[i]].type == NFA_MATCH)
+			return 1;
+	return 0;
+}
+
+/** Internal use only.  Whether set matches if the line ends here. */
+static int nfa_match_eol(const struct matcher_nfa *nfa, nfa_scratch_t *scr,
+                         const int *set, int n, int bol, int *tmp)
+{
+	int i, ntmp = 0;
+
+	scratch_reset(scr, nfa->n);
+	for(i = 0; i < n; i++)
+		nfa_closure(nfa, scr, set[i], bol, 1, tmp, &ntmp);
+	return nfa_has_match(nfa, tmp, ntmp);
+}
+
+/*
+ * DFA
+ */
+
+/** Internal use only. */
+static unsigned int dfa_hash(const int *set, int n, int bol)
+{
+	unsigned int h = 5381 + bol;
+	int i;
+
+	for(i = 0; i < n; i++)
+		h = (h << 5) + h + set[i];
+	return h % DFA_BUCKETS;
+}
+
+/**
+ * Internal use only.  Finds or builds the state for a set of NFA
+ * states.  Called with the DFA lock held.
+ *
+ * @return The state, or NULL once MATCHER_MAX_STATES are built.
+ */
+static dfa_state_t *dfa_state(matcher_t *m, const int *set, int n, int bol)
+{
+	struct matcher_dfa *dfa = m->dfa;
+	unsigned int h = dfa_hash(set, n, bol);
+	dfa_state_t *s;
+
+	for(s = dfa->buckets[h]; s != NULL; s = s->hnext)
+		if(s->n == n && s->bol == bol && memcmp(s->nfa, set, n * sizeof(int)) == 0)
+			return s;
+	if(dfa->n == MATCHER_MAX_STATES)
+		return NULL;
+
+	s = calloc(1, sizeof(dfa_state_t));
+	s->nfa = malloc((n ? n : 1) * sizeof(int));
+	memcpy(s->nfa, set, n * sizeof(int));
+	s->n = n;
+	s->bol = bol;
+	s->match = nfa_has_match(m->nfa, set, n);
+	s->match_eol = s->match || nfa_match_eol(m->nfa, &dfa->scratch, set, n, bol, dfa->tmp);
+	s->dead = n == 0;
+	s->hnext = dfa->buckets[h];
+	dfa->buckets[h] = s;
+	dfa->n++;
+	__atomic_fetch_add(&stats.states, 1, __ATOMIC_RELAXED);
+	return s;
+}
+
+/**
+ * Internal use only.  Builds the transition of s on byte c.  Other
+ * threads may be reading s->next meanwhile, so the new state is
+ * complete before it is published.
+ *
+ * @return The next state, or NULL if the DFA is full.
+ */
+static dfa_state_t *dfa_next(matcher_t *m, dfa_state_t *s, unsigned char c)
+{
+	struct matcher_dfa *dfa = m->dfa;
+	dfa_state_t *t;
+
+	pthread_mutex_lock(&dfa->lock);
+	t = s->next[c];
+	if(t == NULL){
+		int n = nfa_step(m->nfa, &dfa->scratch, s->nfa, s->n, c, dfa->set);
+		t = dfa_state(m, dfa->set, n, 0);
+		if(t != NULL)
+			__atomic_store_n(&s->next[c], t, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&dfa->lock);
+	return t;
+}
+
+/** Internal use only. */
+static struct matcher_dfa *dfa_create(matcher_t *m)
+{
+	struct matcher_dfa *dfa = calloc(1, sizeof(struct matcher_dfa));
+	int n = 0;
+
+	pthread_mutex_init(&dfa->lock, NULL);
+	scratch_init(&dfa->scratch, m->nfa->n);
+	dfa->set = malloc(m->nfa->n * sizeof(int));
+	dfa->tmp = malloc(m->nfa->n * sizeof(int));
+	m->dfa = dfa;
+
+	scratch_reset(&dfa->scratch, m->nfa->n);
+	nfa_closure(m->nfa, &dfa->scratch, m->nfa->start, 1, 0, dfa->set, &n);
+	qsort(dfa->set, n, sizeof(int), int_cmp);
+	dfa->initial = dfa_state(m, dfa->set, n, 1);
+	return dfa;
+}
+
+/** Internal use only. */
+static void dfa_free(struct matcher_dfa *dfa)
+{
+	int i;
+
+	for(i = 0; i < DFA_BUCKETS; i++){
+		dfa_state_t *s = dfa->buckets[i];
+		while(s != NULL){
+			dfa_state_t *next = s->hnext;
+			free(s->nfa);
+			free(s);
+			s = next;
+		}
+	}
+	scratch_free(&dfa->scratch);
+	free(dfa->set);
+	free(dfa->tmp);
+	pthread_mutex_destroy(&dfa->lock);
+	free(dfa);
+}
+
+/**
+ * Internal use only.  Finishes a line on the NFA alone, starting from
+ * the set of DFA state s, once the DFA has no room for more states.
+ */
+static int nfa_line(matcher_t *m, const dfa_state_t *s, const unsigned char *p,
+                    const unsigned char *end)
+{
+	const struct matcher_nfa *nfa = m->nfa;
+	nfa_scratch_t scr;
+	int *cur = malloc(nfa->n * sizeof(int));
+	int *next = malloc(nfa->n * sizeof(int));
+	int n = s->n, bol = s->bol, rc = 0;
+
+	scratch_init(&scr, nfa->n);
+	memcpy(cur, s->nfa, n * sizeof(int));
+	for(; p < end; p++){
+		int *tmp;
+		if(nfa_has_match(nfa, cur, n)){
+			rc = 1;
+			break;
+		}
+		n = nfa_step(nfa, &scr, cur, n, *p, next);
+		tmp = cur;
+		cur = next;
+		next = tmp;
+		bol = 0;
+	}
+	if(p == end)
+		rc = nfa_has_match(nfa, cur, n) || nfa_match_eol(nfa, &scr, cur, n, bol, next);
+
+	scratch_free(&scr);
+	free(cur);
+	free(next);
+	return rc;
+}
+
+/*
+ * Cache
+ */
+
+/** Internal use only.  Parses and compiles a pattern, or returns NULL. */
+static matcher_t *matcher_compile(const char *pattern)
+{
+	rx_parser_t ps;
+	rx_node_t *root;
+	rx_lit_t lit;
+	int has_anchor = 0;
+	matcher_t *m;
+
+	ps.p = pattern;
+	ps.error = 0;
+	root = parse_alt(&ps);
+	// a ')' without its '(' stops the parse early
+	if(ps.error || *ps.p != 0){
+		rx_free(root);
+		return NULL;
+	}
+
+	m = calloc(1, sizeof(matcher_t));
+	if((m->nfa = nfa_compile(root)) == NULL){
+		rx_free(root);
+		free(m);
+		return NULL;
+	}
+	rx_literal(root, &lit, &has_anchor);
+	rx_free(root);
+
+	m->pattern = strdup(pattern);
+	memcpy(m->literal, lit.must.s, lit.must.len);
+	m->literal[lit.must.len] = 0;
+	m->literal_len = lit.must.len;
+	m->literal_only = lit.exact && !has_anchor && lit.must.len > 0;
+	dfa_create(m);
+	return m;
+}
+
+/** Internal use only. */
+static void matcher_free(matcher_t *m)
+{
+	dfa_free(m->dfa);
+	free(m->nfa->states);
+	free(m->nfa);
+	free(m->pattern);
+	free(m);
+}
+
+/** Internal use only.  Unlinks m from the LRU list. */
+static void lru_unlink(matcher_t *m)
+{
+	if(m->prev)
+		m->prev->next = m->next;
+	else
+		lru_head = m->next;
+	if(m->next)
+		m->next->prev = m->prev;
+	else
+		lru_tail = m->prev;
+	m->prev = m->next = NULL;
+}
+
+/** Internal use only.  Links m at the front of the LRU list. */
+static void lru_push(matcher_t *m)
+{
+	m->prev = NULL;
+	m->next = lru_head;
+	if(lru_head)
+		lru_head->prev = m;
+	lru_head = m;
+	if(lru_tail == NULL)
+		lru_tail = m;
+}
+
+/**
+ * Returns the compiled form of an extended regular expression, from
+ * the cache if the pattern was used before.
+ *
+ * Supported are literals, '.', bracket expressions with ranges and
+ * [:class:] names, \d \w \s and their negations, ( ) grouping, '|',
+ * '*' '+' '?' and {m,n} repetition, and the ^ $ line anchors.
+ *
+ * @param pattern The regular expression.
+ * @return The matcher, to be handed back with matcher_release().
+ * @return NULL if pattern is not a valid expression.
+ */
+matcher_t *matcher_get(const char *pattern)
+{
+	matcher_t *m;
+
+	pthread_mutex_lock(&cache_lock);
+	for(m = lru_head; m != NULL; m = m->next){
+		if(strcmp(m->pattern, pattern) == 0){
+			lru_unlink(m);
+			lru_push(m);
+			m->refs++;
+			stats.hits++;
+			pthread_mutex_unlock(&cache_lock);
+			return m;
+		}
+	}
+
+	if((m = matcher_compile(pattern)) == NULL){
+		stats.failures++;
+		pthread_mutex_unlock(&cache_lock);
+		return NULL;
+	}
+	stats.compiles++;
+	m->refs = 2;
+	lru_push(m);
+	if(++stats.entries > MATCHER_CACHE_SIZE){
+		matcher_t *old = lru_tail;
+		lru_unlink(old);
+		stats.entries--;
+		stats.evictions++;
+		if(--old->refs == 0)
+			matcher_free(old);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return m;
+}
+
+/**
+ * Hands back a matcher from matcher_get().
+ *
+ * @param m The matcher.
+ * @return void
+ */
+void matcher_release(matcher_t *m)
+{
+	int refs;
+
+	pthread_mutex_lock(&cache_lock);
+	refs = --m->refs;
+	pthread_mutex_unlock(&cache_lock);
+	if(refs == 0)
+		matcher_free(m);
+}
+
+/**
+ * Tells whether a line holds a match.  Runs the DFA, building the
+ * states it reaches on the way, and stops as soon as the outcome is
+ * known.
+ *
+ * @param m The matcher.
+ * @param line The line, without its '\n'.
+ * @param len Length of line.
+ * @return 1 if the line matches, 0 if not.
+ */
+int matcher_line(matcher_t *m, const char *line, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)line;
+	const unsigned char *end = p + len;
+	dfa_state_t *s = m->dfa->initial, *t;
+
+	if(m->literal_only)
+		return needle_find(line, len, m->literal, m->literal_len) != NULL;
+
+	for(; p < end; p++){
+		if(s->match)
+			return 1;
+		if(s->dead)
+			return 0;
+		t = __atomic_load_n(&s->next[*p], __ATOMIC_ACQUIRE);
+		if(t == NULL && (t = dfa_next(m, s, *p)) == NULL)
+			return nfa_line(m, s, p, end);
+		s = t;
+	}
+	return s->match_eol;
+}
+
+/**
+ * Frees every cached matcher not in use.
+ *
+ * @return void
+ */
+void matcher_cache_destroy(void)
+{
+	pthread_mutex_lock(&cache_lock);
+	while(lru_head != NULL){
+		matcher_t *m = lru_head;
+		lru_unlink(m);
+		stats.entries--;
+		if(--m->refs == 0)
+			matcher_free(m);
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Reads the matcher counters.
+ *
+ * @param s Filled with a copy of the counters.
+ * @return void
+ */
+void matcher_get_stats(matcher_stats_t *s)
+{
+	pthread_mutex_lock(&cache_lock);
+	*s = stats;
+	s->states = __atomic_load_n(&stats.states, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&cache_lock);
+}
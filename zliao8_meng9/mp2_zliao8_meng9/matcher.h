@@ -0,0 +1,61 @@
+/** @file matcher.h */
+#ifndef __MATCHER_H__
+#define __MATCHER_H__
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* Longest literal kept for the prefilter */
+#define MATCHER_MAX_LITERAL 64
+/* Patterns needing more NFA states than this are refused */
+#define MATCHER_MAX_NFA 4096
+/* DFA states built per pattern before falling back to the NFA */
+#define MATCHER_MAX_STATES 1024
+/* Compiled patterns kept for later queries */
+#define MATCHER_CACHE_SIZE 32
+
+struct matcher_nfa;
+struct matcher_dfa;
+
+/**
+ * A compiled extended regular expression.
+ *
+ * Lines are matched by a DFA built lazily from the NFA, one state at a
+ * time as the lines need it, so a pattern only ever pays for the states
+ * it reaches.  literal is a string every match contains: lines without
+ * it cannot match and need not be run through the DFA at all.
+ *
+ * Matchers handed out by matcher_get() stay valid until
+ * matcher_release() and may be used by several threads at once.
+ */
+typedef struct matcher {
+	char *pattern; ///<Source, the key in the cache
+	char literal[MATCHER_MAX_LITERAL + 1]; ///<Substring of every match, may be empty
+	size_t literal_len; ///<Length of literal
+	int literal_only; ///<The pattern is literal itself, no DFA needed
+	struct matcher_nfa *nfa; ///<Compiled program
+	struct matcher_dfa *dfa; ///<States built so far
+	int refs; ///<References held by users, plus one while in the cache
+	struct matcher *prev; ///<LRU neighbours, most recently used first
+	struct matcher *next;
+} matcher_t;
+
+/**
+ * Counters, see matcher_get_stats().
+ */
+typedef struct {
+	unsigned long compiles; ///<Patterns compiled
+	unsigned long hits; ///<Lookups answered by the cache
+	unsigned long failures; ///<Patterns refused as invalid
+	unsigned long evictions; ///<Patterns dropped to stay under MATCHER_CACHE_SIZE
+	unsigned long states; ///<DFA states built
+	unsigned int entries; ///<Patterns in the cache
+} matcher_stats_t;
+
+matcher_t *matcher_get(const char *pattern);
+void matcher_release(matcher_t *m);
+int matcher_line(matcher_t *m, const char *line, size_t len);
+void matcher_cache_destroy(void);
+void matcher_get_stats(matcher_stats_t *stats);
+
+#endif
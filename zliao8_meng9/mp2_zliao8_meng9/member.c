@@ -0,0 +1,597 @@
+/** @file member.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "member.h"
+
+/* Longest heartbeat, "DLQHB <incarnation> <seq>\n" */
+#define MEMBER_MSG_SIZE 64
+/* Nodes that do not resolve are looked up again this often */
+#define MEMBER_RESOLVE_MS 10000
+
+/**
+ * Private.  What this node knows about one other node.
+ */
+typedef struct {
+	char *host; ///<Host name or address, as in the peers file
+	char *port; ///<Port of its HTTP server, its heartbeats use the same UDP port
+	struct sockaddr_in addr; ///<Where heartbeats go and come from
+	int resolved; ///<addr is set
+	int state; ///<MEMBER_ALIVE, MEMBER_SUSPECT or MEMBER_DEAD
+	int heard; ///<A heartbeat arrived since the start
+	struct timespec last; ///<Last heartbeat, or the start until one arrives
+	unsigned long incarnation; ///<Run of the node the last heartbeat came from
+	unsigned long seq; ///<Number of that heartbeat
+	int joined; ///<Not in the peers file, added by member_join()
+} member_t;
+
+static pthread_mutex_t member_lock = PTHREAD_MUTEX_INITIALIZER;
+static member_t *members;
+static int num_members;
+static int cap_members;
+static int num_joined;
+static member_opts_t opts;
+static member_stats_t stats;
+static int udp_fd = -1;
+static int stop_fd = -1;
+static pthread_t heartbeat;
+static unsigned long incarnation;
+static unsigned long seq;
+static struct timespec started;
+
+/** Internal use only.  Milliseconds from since to now. */
+static double age_ms(const struct timespec *since, const struct timespec *now)
+{
+	return (now->tv_sec - since->tv_sec) * 1000.0 + (now->tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/**
+ * Fills a timing with the defaults.
+ *
+ * @param o The timing.
+ * @return void
+ */
+void member_opts_init(member_opts_t *o)
+{
+	o->interval_ms = MEMBER_DEFAULT_INTERVAL_MS;
+	o->suspect_ms = MEMBER_DEFAULT_SUSPECT_MS;
+	o->dead_ms = MEMBER_DEFAULT_DEAD_MS;
+}
+
+/**
+ * Parses a timing written interval[:suspect[:dead]] in milliseconds.
+ * A missing suspicion timeout is three intervals, a missing dead
+ * timeout twice the suspicion timeout.
+ *
+ * @param o The timing, left alone on error.
+ * @param s The text.
+ * @return 0 on success, -1 unless 0 < interval < suspect <= dead.
+ */
+int member_opts_parse(member_opts_t *o, const char *s)
+{
+	unsigned long v[3] = {0, 0, 0};
+	char *end;
+	int n = 0;
+
+	while(n < 3){
+		v[n++] = strtoul(s, &end, 10);
+		if(end == s)
+			return -1;
+		if(*end == '\0')
+			break;
+		if(*end != ':')
+			return -1;
+		s = end + 1;
+	}
+	if(*end != '\0')
+		return -1;
+	if(n < 2)
+		v[1] = v[0] * 3;
+	if(n < 3)
+		v[2] = v[1] * 2;
+	if(v[0] == 0 || v[1] <= v[0] || v[2] < v[1])
+		return -1;
+
+	o->interval_ms = v[0];
+	o->suspect_ms = v[1];
+	o->dead_ms = v[2];
+	return 0;
+}
+
+/**
+ * Internal use only.  Looks up where the heartbeats of the nodes that
+ * do not resolve yet go.  The lookups may be slow, so they run on
+ * copies of the names without the lock, which member_state() and
+ * /stats need meanwhile.  Lock not held.
+ */
+static void member_resolve(void)
+{
+	struct addrinfo hints, *res;
+	struct sockaddr_in *addrs;
+	char **names;
+	int i, j, n = 0;
+
+	pthread_mutex_lock(&member_lock);
+	for(i = 0; i < num_members; i++)
+		n += !members[i].resolved;
+	if(n == 0){
+		pthread_mutex_unlock(&member_lock);
+		return;
+	}
+	names = calloc(2 * n, sizeof(char *));
+	addrs = calloc(n, sizeof(struct sockaddr_in));
+	for(i = 0, j = 0; i < num_members && names != NULL; i++){
+		if(members[i].resolved)
+			continue;
+		names[2 * j] = strdup(members[i].host);
+		names[2 * j + 1] = strdup(members[i].port);
+		j++;
+	}
+	pthread_mutex_unlock(&member_lock);
+	if(names == NULL || addrs == NULL){
+		free(names);
+		free(addrs);
+		return;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	for(j = 0; j < n; j++){
+		if(names[2 * j] == NULL || names[2 * j + 1] == NULL ||
+		   getaddrinfo(names[2 * j], names[2 * j + 1], &hints, &res)){
+			addrs[j].sin_family = AF_UNSPEC;
+			continue;
+		}
+		memcpy(&addrs[j], res->ai_addr, sizeof(addrs[j]));
+		freeaddrinfo(res);
+	}
+
+	// the table may have changed meanwhile, match the nodes by name
+	pthread_mutex_lock(&member_lock);
+	for(j = 0; j < n; j++){
+		if(addrs[j].sin_family != AF_INET)
+			continue;
+		for(i = 0; i < num_members; i++){
+			member_t *m = &members[i];
+			if(!m->resolved && strcmp(m->host, names[2 * j]) == 0 && strcmp(m->port, names[2 * j + 1]) == 0){
+				m->addr = addrs[j];
+				m->resolved = 1;
+			}
+		}
+	}
+	pthread_mutex_unlock(&member_lock);
+
+	for(j = 0; j < 2 * n; j++)
+		free(names[j]);
+	free(names);
+	free(addrs);
+}
+
+/** Internal use only.  Counts the nodes in each state, lock held. */
+static void member_count(void)
+{
+	int i;
+
+	stats.alive = stats.suspect = stats.dead = 0;
+	stats.joined = num_joined;
+	for(i = 0; i < num_members; i++){
+		if(members[i].state == MEMBER_ALIVE)
+			stats.alive++;
+		else if(members[i].state == MEMBER_SUSPECT)
+			stats.suspect++;
+		else
+			stats.dead++;
+	}
+}
+
+/** Internal use only.  Sends one heartbeat to every node, lock held. */
+static void member_send(void)
+{
+	char msg[MEMBER_MSG_SIZE];
+	int i, len;
+
+	len = snprintf(msg, sizeof(msg), "DLQHB %lu %lu\n", incarnation, ++seq);
+	for(i = 0; i < num_members; i++){
+		member_t *m = &members[i];
+		// not found yet, member_resolve() tries again later
+		if(!m->resolved)
+			continue;
+		if(sendto(udp_fd, msg, len, MSG_DONTWAIT, (struct sockaddr *)&m->addr, sizeof(m->addr)) == len){
+			stats.sent++;
+			stats.bytes_sent += len + MEMBER_HEADER_BYTES;
+		}
+	}
+}
+
+/**
+ * Internal use only.  Adds a node heard from that is not in the list,
+ * such as a querier started with a peer list of its own, so that it
+ * gets heartbeats back.  Anyone can send a heartbeat, so at most
+ * MEMBER_MAX_JOINED nodes join, and member_check() forgets them once
+ * they are declared dead.  Lock held.
+ *
+ * @return The new node, NULL if it may not join.
+ */
+static member_t *member_join(const struct sockaddr_in *from, const struct timespec *now)
+{
+	char host[INET_ADDRSTRLEN], port[16];
+	member_t *m;
+
+	if(num_joined >= MEMBER_MAX_JOINED){
+		stats.joins_refused++;
+		return NULL;
+	}
+	if(num_members == cap_members){
+		int cap = cap_members ? cap_members * 2 : 8;
+		member_t *grown = realloc(members, cap * sizeof(member_t));
+		if(grown == NULL)
+			return NULL;
+		members = grown;
+		cap_members = cap;
+	}
+	inet_ntop(AF_INET, &from->sin_addr, host, sizeof(host));
+	snprintf(port, sizeof(port), "%u", ntohs(from->sin_port));
+
+	m = &members[num_members];
+	memset(m, 0, sizeof(member_t));
+	if((m->host = strdup(host)) == NULL || (m->port = strdup(port)) == NULL){
+		free(m->host);
+		return NULL;
+	}
+	m->addr = *from;
+	m->resolved = 1;
+	m->state = MEMBER_ALIVE;
+	m->last = *now;
+	m->joined = 1;
+	num_members++;
+	num_joined++;
+	fprintf(stderr, "-- member %s:%s joined\n", m->host, m->port);
+	return m;
+}
+
+/** Internal use only.  Takes in the heartbeats waiting on the socket, lock held. */
+static void member_receive(const struct timespec *now)
+{
+	char msg[MEMBER_MSG_SIZE];
+	struct sockaddr_in from;
+	socklen_t from_len;
+	unsigned long inc, n;
+	member_t *m;
+	ssize_t len;
+	int i;
+
+	while(1){
+		from_len = sizeof(from);
+		len = recvfrom(udp_fd, msg, sizeof(msg) - 1, MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+		if(len < 0)
+			break;
+		msg[len] = '\0';
+		if(sscanf(msg, "DLQHB %lu %lu", &inc, &n) != 2)
+			continue;
+
+		for(i = 0; i < num_members; i++){
+			if(members[i].resolved && members[i].addr.sin_port == from.sin_port &&
+			   members[i].addr.sin_addr.s_addr == from.sin_addr.s_addr)
+				break;
+		}
+		m = i < num_members ? &members[i] : member_join(&from, now);
+		if(m == NULL)
+			continue;
+
+		stats.received++;
+		stats.bytes_received += len + MEMBER_HEADER_BYTES;
+		if(m->heard && m->incarnation == inc){
+			if(n <= m->seq)
+				continue;  // late duplicate, already counted as lost
+			stats.lost += n - m->seq - 1;
+		}
+		m->heard = 1;
+		m->incarnation = inc;
+		m->seq = n;
+		m->last = *now;
+
+		if(m->state == MEMBER_SUSPECT){
+			stats.false_suspicions++;
+			fprintf(stderr, "-- member %s:%s alive again, it was only suspected\n", m->host, m->port);
+		}else if(m->state == MEMBER_DEAD){
+			stats.recoveries++;
+			fprintf(stderr, "-- member %s:%s rejoined\n", m->host, m->port);
+		}
+		m->state = MEMBER_ALIVE;
+	}
+}
+
+/**
+ * Internal use only.  Moves silent nodes to suspected, then dead, lock
+ * held.  A node that joined is forgotten when it is declared dead, it
+ * joins again if it comes back.
+ *
+ * @return Milliseconds until the next node may change state, at most
+ *         one heartbeat interval.
+ */
+static long member_check(const struct timespec *now)
+{
+	long next = opts.interval_ms;
+	int i;
+
+	for(i = 0; i < num_members; i++){
+		member_t *m = &members[i];
+		double silent = age_ms(&m->last, now);
+
+		if(m->state == MEMBER_ALIVE && silent >= opts.suspect_ms){
+			m->state = MEMBER_SUSPECT;
+			stats.suspicions++;
+			fprintf(stderr, "-- member %s:%s suspected, silent for %.0f ms\n", m->host, m->port, silent);
+		}
+		if(m->state == MEMBER_SUSPECT && silent >= opts.dead_ms){
+			m->state = MEMBER_DEAD;
+			stats.deaths++;
+			stats.detect_ms_last = silent;
+			stats.detect_ms_sum += silent;
+			if(silent > stats.detect_ms_max)
+				stats.detect_ms_max = silent;
+			fprintf(stderr, "-- member %s:%s declared dead, silent for %.0f ms\n", m->host, m->port, silent);
+			if(m->joined){
+				// joined ones come after the listed ones, the last
+				// one takes its place
+				free(m->host);
+				free(m->port);
+				members[i--] = members[--num_members];
+				num_joined--;
+				stats.expired++;
+				continue;
+			}
+		}
+
+		long due = -1;
+		if(m->state == MEMBER_ALIVE)
+			due = (long)(opts.suspect_ms - silent) + 1;
+		else if(m->state == MEMBER_SUSPECT)
+			due = (long)(opts.dead_ms - silent) + 1;
+		if(due >= 0 && due < next)
+			next = due;
+	}
+	member_count();
+	return next;
+}
+
+/**
+ * Internal use only.  Thread sending the heartbeats and watching for
+ * those of the other nodes.  It wakes up for the next heartbeat to
+ * send and for the next node due to be suspected or declared dead, so
+ * a failure is detected when the timeout runs out rather than at the
+ * next heartbeat.
+ */
+static void *member_thread(void *ptr)
+{
+	struct timespec now, next_send, last_resolve;
+	struct pollfd pfd[2];
+
+	pfd[0].fd = udp_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stop_fd;
+	pfd[1].events = POLLIN;
+
+	clock_gettime(CLOCK_MONOTONIC, &next_send);
+	last_resolve = next_send;
+	while(1){
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		pthread_mutex_lock(&member_lock);
+		member_receive(&now);
+		if(age_ms(&next_send, &now) >= 0){
+			member_send();
+			next_send = now;
+			next_send.tv_sec += opts.interval_ms / 1000;
+			next_send.tv_nsec += (opts.interval_ms % 1000) * 1000000L;
+			if(next_send.tv_nsec >= 1000000000L){
+				next_send.tv_sec++;
+				next_send.tv_nsec -= 1000000000L;
+			}
+		}
+		long wait = member_check(&now);
+		pthread_mutex_unlock(&member_lock);
+
+		// right after a send, so a slow lookup delays the next one
+		// as little as possible
+		if(age_ms(&last_resolve, &now) >= MEMBER_RESOLVE_MS){
+			member_resolve();
+			last_resolve = now;
+		}
+
+		long to_send = (long)-age_ms(&next_send, &now) + 1;
+		if(to_send < wait)
+			wait = to_send;
+		if(wait < 0)
+			wait = 0;
+
+		if(poll(pfd, 2, wait) < 0 && errno != EINTR){
+			perror("poll");
+			break;
+		}
+		if(pfd[1].revents)
+			break;
+	}
+	return ptr;
+}
+
+/**
+ * Starts the failure detector: every node in the list gets a heartbeat
+ * each interval over UDP, on the port number of its HTTP server, and
+ * is suspected, then declared dead, when its own heartbeats stop.
+ * Nodes count as alive until dead_ms after the start, giving them time
+ * to come up.  A name that does not resolve is looked up again every
+ * MEMBER_RESOLVE_MS.  Several nodes on one machine, on different ports,
+ * form a cluster of their own for testing.
+ *
+ * @param port Port of this node's HTTP server, bound for UDP as well.
+ * @param hosts Host of each node, duplicates are watched once.
+ * @param ports Port of each node.
+ * @param n Number of nodes.
+ * @param o Timing.
+ * @return 0 on success, -1 if the UDP port cannot be bound.
+ */
+int member_start(const char *port, const char **hosts, const char **ports, int n, const member_opts_t *o)
+{
+	struct sockaddr_in addr;
+	struct timespec now;
+	int i, j;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(atoi(port));
+
+	if((udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 ||
+	   bind(udp_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	   (stop_fd = eventfd(0, EFD_CLOEXEC)) < 0){
+		perror("member: cannot bind the heartbeat port, membership is off");
+		if(udp_fd >= 0)
+			close(udp_fd);
+		udp_fd = -1;
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&member_lock);
+	started = now;
+	opts = *o;
+	memset(&stats, 0, sizeof(stats));
+	stats.opts = opts;
+	incarnation = (unsigned long)time(NULL) ^ ((unsigned long)getpid() << 16);
+	seq = 0;
+	num_joined = 0;
+	cap_members = n > 0 ? n : 1;
+	members = calloc(cap_members, sizeof(member_t));
+	num_members = 0;
+	for(i = 0; i < n; i++){
+		for(j = 0; j < num_members; j++){
+			if(strcmp(members[j].host, hosts[i]) == 0 && strcmp(members[j].port, ports[i]) == 0)
+				break;
+		}
+		if(j < num_members)
+			continue;
+		member_t *m = &members[num_members++];
+		m->host = strdup(hosts[i]);
+		m->port = strdup(ports[i]);
+		m->state = MEMBER_ALIVE;
+		m->last = now;
+	}
+	member_count();
+	pthread_mutex_unlock(&member_lock);
+	member_resolve();
+
+	if(pthread_create(&heartbeat, NULL, member_thread, NULL) != 0){
+		perror("pthread_create");
+		member_stop();
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the failure detector.  member_state() says MEMBER_UNKNOWN for
+ * every node afterwards.
+ *
+ * @return void
+ */
+void member_stop(void)
+{
+	uint64_t one = 1;
+	int i;
+
+	if(stop_fd >= 0){
+		if(write(stop_fd, &one, sizeof(one)) < 0)
+			perror("write");
+		pthread_join(heartbeat, NULL);
+		close(stop_fd);
+		stop_fd = -1;
+	}
+	if(udp_fd >= 0){
+		close(udp_fd);
+		udp_fd = -1;
+	}
+
+	pthread_mutex_lock(&member_lock);
+	for(i = 0; i < num_members; i++){
+		free(members[i].host);
+		free(members[i].port);
+	}
+	free(members);
+	members = NULL;
+	num_members = 0;
+	cap_members = 0;
+	num_joined = 0;
+	pthread_mutex_unlock(&member_lock);
+}
+
+/**
+ * Says whether a node is worth a request.  The state follows from the
+ * silence right now, so it is exact even between two runs of the
+ * heartbeat thread.
+ *
+ * @param host Host of the node, as in the peers file.
+ * @param port Port of its HTTP server.
+ * @param silent_ms If not NULL, set to the time since its last
+ *        heartbeat, or since the start if none came yet.
+ * @return MEMBER_ALIVE, MEMBER_SUSPECT or MEMBER_DEAD.
+ * @return MEMBER_UNKNOWN if the detector is not running or does not
+ *         watch that node; such nodes should be asked anyway.
+ */
+int member_state(const char *host, const char *port, double *silent_ms)
+{
+	struct timespec now;
+	int i, state = MEMBER_UNKNOWN;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&member_lock);
+	for(i = 0; i < num_members; i++){
+		member_t *m = &members[i];
+		if(strcmp(m->host, host) != 0 || strcmp(m->port, port) != 0)
+			continue;
+		double silent = age_ms(&m->last, &now);
+		if(silent >= opts.dead_ms)
+			state = MEMBER_DEAD;
+		else if(silent >= opts.suspect_ms)
+			state = MEMBER_SUSPECT;
+		else
+			state = MEMBER_ALIVE;
+		if(silent_ms != NULL)
+			*silent_ms = silent;
+		break;
+	}
+	pthread_mutex_unlock(&member_lock);
+	return state;
+}
+
+/**
+ * Copies the counters.
+ *
+ * @param out Filled with the current values.
+ * @return void
+ */
+void member_get_stats(member_stats_t *out)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&member_lock);
+	*out = stats;
+	out->seconds = members != NULL ? age_ms(&started, &now) / 1000 : 0;
+	pthread_mutex_unlock(&member_lock);
+}
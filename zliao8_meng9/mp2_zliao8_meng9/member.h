@@ -0,0 +1,65 @@
+/** @file member.h */
+#ifndef __MEMBER_H__
+#define __MEMBER_H__
+
+/* Heartbeat period and silences before a node is suspected, then
+   declared dead, unless -H says otherwise */
+#define MEMBER_DEFAULT_INTERVAL_MS 1000
+#define MEMBER_DEFAULT_SUSPECT_MS 3000
+#define MEMBER_DEFAULT_DEAD_MS 6000
+/* Bytes of UDP and IPv4 header carried by every heartbeat */
+#define MEMBER_HEADER_BYTES 28
+/* Nodes outside the peers file that may join by sending heartbeats,
+   the heartbeats of any more are ignored */
+#define MEMBER_MAX_JOINED 64
+
+/* What the table says about a node, see member_state() */
+#define MEMBER_UNKNOWN 0
+#define MEMBER_ALIVE 1
+#define MEMBER_SUSPECT 2
+#define MEMBER_DEAD 3
+
+/**
+ * Timing of the failure detector.
+ */
+typedef struct {
+	unsigned long interval_ms; ///<Time between two heartbeats to every node
+	unsigned long suspect_ms; ///<Silence after which a node is suspected
+	unsigned long dead_ms; ///<Silence after which a node is declared dead
+} member_opts_t;
+
+/**
+ * Counters reported by /stats.
+ */
+typedef struct {
+	unsigned long sent; ///<Heartbeats sent
+	unsigned long received; ///<Heartbeats received from known nodes
+	unsigned long lost; ///<Heartbeats of known nodes that never arrived
+	unsigned long long bytes_sent; ///<Bytes sent, headers included
+	unsigned long long bytes_received; ///<Bytes received, headers included
+	unsigned long suspicions; ///<Nodes suspected
+	unsigned long false_suspicions; ///<Suspected nodes heard from again before dead_ms
+	unsigned long deaths; ///<Nodes declared dead
+	unsigned long recoveries; ///<Dead nodes heard from again
+	double detect_ms_last; ///<Silence of the last node declared dead, when declared
+	double detect_ms_max; ///<Longest such silence
+	double detect_ms_sum; ///<Sum of them, for the average
+	unsigned int alive; ///<Nodes alive right now
+	unsigned int suspect; ///<Nodes suspected right now
+	unsigned int dead; ///<Nodes dead right now
+	unsigned int joined; ///<Nodes in the table that joined rather than being listed
+	unsigned long joins_refused; ///<Heartbeats of unknown nodes ignored, MEMBER_MAX_JOINED having joined
+	unsigned long expired; ///<Joined nodes forgotten once declared dead
+	double seconds; ///<Time since the start, for the rates
+	member_opts_t opts; ///<Timing in use
+} member_stats_t;
+
+void member_opts_init(member_opts_t *opts);
+int member_opts_parse(member_opts_t *opts, const char *s);
+
+int member_start(const char *port, const char **hosts, const char **ports, int n, const member_opts_t *opts);
+void member_stop(void);
+int member_state(const char *host, const char *port, double *silent_ms);
+void member_get_stats(member_stats_t *stats);
+
+#endif
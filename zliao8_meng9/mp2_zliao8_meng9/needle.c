@@ -0,0 +1,223 @@
+/** @file needle.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NEEDLE_X86 1
+#endif
+
+#include "needle.h"
+
+/**
+ * Private.  One implementation of needle_find().
+ */
+typedef struct {
+	const char *name; ///<Name given to needle_use()
+	needle_func_t func; ///<The implementation
+	int (*supported)(void); ///<Whether this CPU can run it
+} needle_kernel_t;
+
+/** Internal use only. */
+static int always(void)
+{
+	return 1;
+}
+
+#ifdef NEEDLE_X86
+/** Internal use only. */
+static int has_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+/** Internal use only. */
+static int has_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/* Fastest first, the first one the CPU supports is used */
+static const needle_kernel_t kernels[] = {
+#ifdef NEEDLE_X86
+	{ "avx2", needle_avx2, has_avx2 },
+	{ "sse2", needle_sse2, has_sse2 },
+#endif
+	{ "generic", needle_generic, always },
+};
+
+#define NEEDLE_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const needle_kernel_t *active;
+static pthread_once_t active_once = PTHREAD_ONCE_INIT;
+
+/** Internal use only.  Picks the best kernel for this CPU. */
+static void needle_pick(void)
+{
+	size_t i;
+
+	__builtin_cpu_init();
+	for(i = 0; i < NEEDLE_KERNELS; i++){
+		if(kernels[i].supported()){
+			active = &kernels[i];
+			return;
+		}
+	}
+}
+
+/**
+ * Portable fallback, memmem() from the C library.
+ *
+ * @param haystack Where to search.
+ * @param n Length of haystack.
+ * @param needle What to search for.
+ * @param m Length of needle.
+ * @return The first occurrence, or NULL.
+ */
+const char *needle_generic(const char *haystack, size_t n, const char *needle, size_t m)
+{
+	return memmem(haystack, n, needle, m);
+}
+
+#ifdef NEEDLE_X86
+
+/*
+ * The vector kernels compare a whole block of positions at once: the
+ * first byte of the needle is broadcast and compared against the block,
+ * the last byte against the same block shifted by m - 1.  Only
+ * positions where both match are verified with memcmp(), which on log
+ * text leaves very few candidates.  The tail shorter than a block goes
+ * to needle_generic().
+ */
+
+/**
+ * SSE2 kernel, 16 positions per step.
+ *
+ * @param haystack Where to search.
+ * @param n Length of haystack.
+ * @param needle What to search for.
+ * @param m Length of needle.
+ * @return The first occurrence, or NULL.
+ */
+__attribute__((target("sse2")))
+const char *needle_sse2(const char *haystack, size_t n, const char *needle, size_t m)
+{
+	size_t i = 0;
+
+	if(m < 2 || n < m)
+		return needle_generic(haystack, n, needle, m);
+
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[m - 1]);
+
+	for(; i + m - 1 + 16 <= n; i += 16){
+		__m128i block_first = _mm_loadu_si128((const __m128i *)(haystack + i));
+		__m128i block_last = _mm_loadu_si128((const __m128i *)(haystack + i + m - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+		                                                _mm_cmpeq_epi8(block_last, last)));
+		while(mask != 0){
+			int bit = __builtin_ctz(mask);
+			if(memcmp(haystack + i + bit + 1, needle + 1, m - 2) == 0)
+				return haystack + i + bit;
+			mask &= mask - 1;
+		}
+	}
+	return needle_generic(haystack + i, n - i, needle, m);
+}
+
+/**
+ * AVX2 kernel, 64 positions per step.
+ *
+ * @param haystack Where to search.
+ * @param n Length of haystack.
+ * @param needle What to search for.
+ * @param m Length of needle.
+ * @return The first occurrence, or NULL.
+ */
+__attribute__((target("avx2")))
+const char *needle_avx2(const char *haystack, size_t n, const char *needle, size_t m)
+{
+	size_t i = 0;
+
+	if(m < 2 || n < m)
+		return needle_generic(haystack, n, needle, m);
+
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+
+	// two blocks per step, one branch while nothing matches
+	for(; i + m - 1 + 64 <= n; i += 64){
+		const char *h = haystack + i;
+		__m256i eq0 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)h), first),
+		                               _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(h + m - 1)), last));
+		__m256i eq1 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(h + 32)), first),
+		                               _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(h + 32 + m - 1)), last));
+		if(_mm256_testz_si256(_mm256_or_si256(eq0, eq1), _mm256_or_si256(eq0, eq1)))
+			continue;
+
+		unsigned long long mask = (unsigned)_mm256_movemask_epi8(eq0) |
+		                          ((unsigned long long)(unsigned)_mm256_movemask_epi8(eq1) << 32);
+		while(mask != 0){
+			int bit = __builtin_ctzll(mask);
+			if(memcmp(h + bit + 1, needle + 1, m - 2) == 0)
+				return h + bit;
+			mask &= mask - 1;
+		}
+	}
+	return needle_generic(haystack + i, n - i, needle, m);
+}
+
+#endif
+
+/**
+ * Finds the first occurrence of needle in haystack with the fastest
+ * kernel the CPU supports, chosen on the first call.
+ *
+ * @param haystack Where to search.
+ * @param n Length of haystack.
+ * @param needle What to search for.
+ * @param m Length of needle.
+ * @return The first occurrence, or NULL.
+ */
+const char *needle_find(const char *haystack, size_t n, const char *needle, size_t m)
+{
+	pthread_once(&active_once, needle_pick);
+	return active->func(haystack, n, needle, m);
+}
+
+/**
+ * Tells which kernel needle_find() uses.
+ *
+ * @return "avx2", "sse2" or "generic".
+ */
+const char *needle_impl(void)
+{
+	pthread_once(&active_once, needle_pick);
+	return active->name;
+}
+
+/**
+ * Forces a kernel, e.g. for benchmarks.  Not thread-safe.
+ *
+ * @param name "avx2", "sse2" or "generic".
+ * @return 0 on success.
+ * @return -1 if the kernel is unknown or the CPU cannot run it.
+ */
+int needle_use(const char *name)
+{
+	size_t i;
+
+	pthread_once(&active_once, needle_pick);
+	for(i = 0; i < NEEDLE_KERNELS; i++){
+		if(strcmp(kernels[i].name, name) == 0 && kernels[i].supported()){
+			active = &kernels[i];
+			return 0;
+		}
+	}
+	return -1;
+}
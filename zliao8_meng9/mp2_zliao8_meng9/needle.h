@@ -0,0 +1,25 @@
+/** @file needle.h */
+#ifndef __NEEDLE_H__
+#define __NEEDLE_H__
+
+#include <stddef.h>
+
+/**
+ * Finds the first occurrence of needle in haystack.
+ *
+ * @return A pointer to it, or NULL.
+ */
+typedef const char *(*needle_func_t)(const char *haystack, size_t n,
+                                      const char *needle, size_t m);
+
+const char *needle_find(const char *haystack, size_t n, const char *needle, size_t m);
+const char *needle_impl(void);
+int needle_use(const char *name);
+
+const char *needle_generic(const char *haystack, size_t n, const char *needle, size_t m);
+#if defined(__x86_64__) || defined(__i386__)
+const char *needle_sse2(const char *haystack, size_t n, const char *needle, size_t m);
+const char *needle_avx2(const char *haystack, size_t n, const char *needle, size_t m);
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+/** @file needle_bench.c */
+
+/*
+ *  Scan speed of the search kernels against strstr() and memmem().
+ *
+ *  Usage: needle_bench [needle] [megabytes | log file]
+ *
+ *  Every method counts all occurrences of the needle in the same
+ *  buffer, the counts must agree.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "needle.h"
+
+#define BENCH_ROUNDS 5
+
+/** Counts occurrences with a needle_func_t. */
+static long count_func(needle_func_t find, const char *buf, size_t n, const char *needle, size_t m)
+{
+	const char *p = buf, *end = buf + n;
+	long count = 0;
+
+	while((p = find(p, end - p, needle, m)) != NULL){
+		count++;
+		p++;
+	}
+	return count;
+}
+
+/** Counts occurrences with strstr(), buf must be null-terminated. */
+static long count_strstr(const char *buf, size_t n, const char *needle, size_t m)
+{
+	const char *p = buf;
+	long count = 0;
+
+	(void)n;
+	(void)m;
+	while((p = strstr(p, needle)) != NULL){
+		count++;
+		p++;
+	}
+	return count;
+}
+
+/** memmem() as a needle_func_t. */
+static const char *find_memmem(const char *buf, size_t n, const char *needle, size_t m)
+{
+	return memmem(buf, n, needle, m);
+}
+
+/** Seconds on a monotonic clock. */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Fills buf with log-like lines, deterministic. */
+static void fill_log(char *buf, size_t n)
+{
+	static const char *levels[] = { "INFO", "WARN", "DEBUG" };
+	unsigned long x = 42;
+	size_t len = 0;
+
+	while(len < n){
+		char line[128];
+		int k;
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+		k = snprintf(line, sizeof(line), "2013-06-08T12:%02lu:%02lu level:%s id:%lu msg:request served in %lu us\n",
+		             (x >> 20) % 60, (x >> 26) % 60, (x >> 33) % 64 ? levels[(x >> 40) % 3] : "ERROR",
+		             (x >> 8) % 1000000, (x >> 44) % 5000);
+		if(len + k > n)
+			k = n - len;
+		memcpy(buf + len, line, k);
+		len += k;
+	}
+}
+
+/** Loads a whole file, or returns NULL. */
+static char *load_file(const char *path, size_t *n)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf;
+	long size;
+
+	if(f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(size + 1);
+	*n = fread(buf, 1, size, f);
+	fclose(f);
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	const char *needle = argc > 1 ? argv[1] : "level:ERROR";
+	size_t m = strlen(needle), n;
+	char *buf = NULL;
+	int i;
+
+	if(argc > 2)
+		buf = load_file(argv[2], &n);
+	if(buf == NULL){
+		n = (size_t)(argc > 2 ? atoi(argv[2]) : 256) * 1024 * 1024;
+		buf = malloc(n + 1);
+		fill_log(buf, n);
+	}
+	buf[n] = 0;
+
+	printf("%zu MB, needle \"%s\", best of %d rounds, needle_find() uses %s\n",
+	       n >> 20, needle, BENCH_ROUNDS, needle_impl());
+
+	static const char *kernels[] = { "generic", "sse2", "avx2" };
+	const int nkernels = sizeof(kernels) / sizeof(kernels[0]);
+
+	for(i = -2; i < nkernels; i++){
+		const char *name = i == -2 ? "strstr" : i == -1 ? "memmem" : kernels[i];
+		double best = 1e9;
+		long count = 0;
+		int r;
+
+		if(i >= 0 && needle_use(kernels[i]) < 0){
+			printf("%-8s not supported by this CPU\n", name);
+			continue;
+		}
+		for(r = 0; r < BENCH_ROUNDS; r++){
+			double t = now();
+			if(i == -2)
+				count = count_strstr(buf, n, needle, m);
+			else if(i == -1)
+				count = count_func(find_memmem, buf, n, needle, m);
+			else
+				count = count_func(needle_find, buf, n, needle, m);
+			t = now() - t;
+			if(t < best)
+				best = t;
+		}
+		printf("%-8s %8ld matches %8.2f GB/s\n", name, count, n / best / 1e9);
+	}
+
+	free(buf);
+	return 0;
+}
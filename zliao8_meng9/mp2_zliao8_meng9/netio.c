@@ -0,0 +1,200 @@
+/** @file netio.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+#include "netio.h"
+
+/**
+ * Waits until the socket can take more data.  Works for blocking and
+ * non-blocking sockets alike.
+ *
+ * @param sock The socket.
+ * @param limit How long to wait, NULL for as long as it takes.
+ * @return 0 when the socket is writable.
+ * @return -1 if the connection is broken, or with errno ETIMEDOUT if
+ *         the timeout passed or the wait was cancelled.
+ */
+int net_wait_writable(int sock, const net_limit_t *limit)
+{
+	struct pollfd pfd[2];
+	int rc, n = 1;
+
+	pfd[0].fd = sock;
+	pfd[0].events = POLLOUT;
+	if(limit != NULL && limit->cancel_fd >= 0){
+		pfd[1].fd = limit->cancel_fd;
+		pfd[1].events = POLLIN;
+		n = 2;
+	}
+	while((rc = poll(pfd, n, limit != NULL ? limit->timeout_ms : -1)) < 0 && errno == EINTR)
+		;
+	if(rc == 0 || (n == 2 && pfd[1].revents)){
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	if(rc < 0 || (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL)))
+		return -1;
+	return 0;
+}
+
+/**
+ * Sends the whole buffer, retrying after short writes and waiting
+ * whenever a non-blocking socket is full.
+ *
+ * @param sock The socket.
+ * @param buf The data to send.
+ * @param len Length of that data in bytes.
+ * @param flags Extra send() flags, e.g. MSG_MORE when a body follows.
+ * @param limit How long to wait for a full socket, see net_wait_writable().
+ * @return 0 on success.
+ * @return -1 if the connection is broken or a wait timed out.
+ */
+int net_send_all(int sock, const void *buf, size_t len, int flags, const net_limit_t *limit)
+{
+	const char *p = buf;
+
+	while(len > 0){
+		ssize_t n = send(sock, p, len, flags | MSG_NOSIGNAL);
+		if(n > 0){
+			p += n;
+			len -= n;
+		}else if(n < 0 && errno == EINTR){
+			continue;
+		}else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+			if(net_wait_writable(sock, limit) < 0)
+				return -1;
+		}else{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Sends several buffers back to back with sendmsg(), so a header and
+ * its body leave in one system call and, usually, one segment.  Short
+ * writes resume inside whichever buffer was cut.
+ *
+ * @param sock The socket.
+ * @param iov The buffers to send, in order.  Left untouched.
+ * @param iovcnt Number of buffers, at most NETIO_MAX_IOV.
+ * @param flags Extra sendmsg() flags, e.g. MSG_MORE when a body follows.
+ * @param limit How long to wait for a full socket, see net_wait_writable().
+ * @return 0 on success.
+ * @return -1 if the connection is broken or a wait timed out.
+ */
+int net_sendv_all(int sock, const struct iovec *iov, int iovcnt, int flags, const net_limit_t *limit)
+{
+	struct iovec vec[NETIO_MAX_IOV];
+	struct msghdr msg;
+	int i = 0;
+
+	if(iovcnt > NETIO_MAX_IOV)
+		return -1;
+	memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+	memset(&msg, 0, sizeof(msg));
+
+	while(i < iovcnt){
+		ssize_t n;
+
+		if(vec[i].iov_len == 0){
+			i++;
+			continue;
+		}
+		msg.msg_iov = vec + i;
+		msg.msg_iovlen = iovcnt - i;
+		n = sendmsg(sock, &msg, flags | MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+			if(net_wait_writable(sock, limit) < 0)
+				return -1;
+			continue;
+		}
+		if(n <= 0)
+			return -1;
+
+		// skip what went out, the first buffer left may be partial
+		while(i < iovcnt && (size_t)n >= vec[i].iov_len){
+			n -= vec[i].iov_len;
+			i++;
+		}
+		if(i < iovcnt){
+			vec[i].iov_base = (char *)vec[i].iov_base + n;
+			vec[i].iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Fallback for net_sendfile_all(): copies through one fixed-size
+ * buffer with pread() so memory use does not depend on the file size.
+ */
+static int net_copy_all(int sock, int fd, off_t offset, size_t count, const net_limit_t *limit)
+{
+	char buf[NETIO_CHUNK_SIZE];
+
+	while(count > 0){
+		size_t want = count < sizeof(buf) ? count : sizeof(buf);
+		ssize_t n = pread(fd, buf, want, offset);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return -1;
+		if(net_send_all(sock, buf, n, 0, limit) < 0)
+			return -1;
+		offset += n;
+		count -= n;
+	}
+	return 0;
+}
+
+/**
+ * Streams count bytes of a file straight to a socket with sendfile(),
+ * so the data never passes through user space.  Short transfers are
+ * resumed and EAGAIN on a non-blocking socket waits for POLLOUT.  If
+ * the kernel cannot sendfile() from this fd the rest is copied through
+ * a NETIO_CHUNK_SIZE buffer instead.
+ *
+ * @param sock The socket.
+ * @param fd A file opened for reading.
+ * @param offset Where in the file to start.
+ * @param count Number of bytes to send.
+ * @param limit How long to wait for a full socket, see net_wait_writable().
+ * @return 0 on success.
+ * @return -1 if the connection is broken, a wait timed out or the file
+ *         ended early.
+ */
+int net_sendfile_all(int sock, int fd, off_t offset, size_t count, const net_limit_t *limit)
+{
+	while(count > 0){
+		ssize_t n = sendfile(sock, fd, &offset, count);
+		if(n > 0){
+			count -= n;
+		}else if(n == 0){
+			// the file shrank under us
+			return -1;
+		}else if(errno == EINTR){
+			continue;
+		}else if(errno == EAGAIN || errno == EWOULDBLOCK){
+			if(net_wait_writable(sock, limit) < 0)
+				return -1;
+		}else if(errno == EINVAL || errno == ENOSYS){
+			return net_copy_all(sock, fd, offset, count, limit);
+		}else{
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,29 @@
+/** @file netio.h */
+#ifndef __NETIO_H__
+#define __NETIO_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Size of the bounce buffer used when sendfile() is not available */
+#define NETIO_CHUNK_SIZE (16 * 1024)
+
+/* Most buffers net_sendv_all() takes at once */
+#define NETIO_MAX_IOV 8
+
+struct iovec;
+
+/**
+ * How long a send may wait for a full socket.  NULL waits forever.
+ */
+typedef struct {
+	int timeout_ms; ///<Longest wait without progress, -1 for none
+	int cancel_fd; ///<Ends every wait once readable, -1 for none
+} net_limit_t;
+
+int net_wait_writable(int sock, const net_limit_t *limit);
+int net_send_all(int sock, const void *buf, size_t len, int flags, const net_limit_t *limit);
+int net_sendv_all(int sock, const struct iovec *iov, int iovcnt, int flags, const net_limit_t *limit);
+int net_sendfile_all(int sock, int fd, off_t offset, size_t count, const net_limit_t *limit);
+
+#endif
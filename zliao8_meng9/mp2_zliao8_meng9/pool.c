@@ -0,0 +1,124 @@
+/** @file pool.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+/**
+ * Private.  One unit of work.
+ */
+typedef struct {
+	void (*func)(void *); ///<Function to run
+	void *arg; ///<Pass through variable to func
+} pool_task_t;
+
+/** Internal use only.  Body of every worker thread. */
+static void *pool_worker(void *ptr) {
+	pool_t *p = ptr;
+	pool_task_t *task;
+
+	while((task = bqueue_take(&p->tasks)) != NULL) {
+		task->func(task->arg);
+		free(task);
+	}
+	return NULL;
+}
+
+/**
+ * Creates the worker threads.
+ * Should always be called first.
+ *
+ * @param p A pointer to the pool.
+ * @param size Number of worker threads, or <= 0 for POOL_DEFAULT_THREADS.
+ * @param depth Maximum number of queued tasks, or 0 for POOL_DEFAULT_DEPTH.
+ * @return 0 on success.
+ * @return -1 if a thread could not be created.
+ */
+int pool_init(pool_t *p, int size, unsigned int depth) {
+	int i;
+
+	if(size <= 0)
+		size = POOL_DEFAULT_THREADS;
+	if(depth == 0)
+		depth = POOL_DEFAULT_DEPTH;
+
+	bqueue_init(&p->tasks, depth);
+	p->threads = malloc(size * sizeof(pthread_t));
+	p->size = 0;
+
+	for(i = 0; i < size; i++) {
+		int rc = pthread_create(&p->threads[i], NULL, pool_worker, p);
+		if(rc) {
+			fprintf(stderr, "---ERROR; pthread_create failed, return code is %d\n", rc);
+			pool_destroy(p);
+			return -1;
+		}
+		p->size++;
+	}
+	return 0;
+}
+
+/**
+ * Lets the workers finish every queued task, then joins them and frees
+ * all associated memory.  Should always be called last.
+ *
+ * @param p A pointer to the pool.
+ * @return void
+ */
+void pool_destroy(pool_t *p) {
+	int i;
+
+	bqueue_close(&p->tasks);
+	for(i = 0; i < p->size; i++)
+		pthread_join(p->threads[i], NULL);
+
+	free(p->threads);
+	p->threads = NULL;
+	p->size = 0;
+	bqueue_destroy(&p->tasks);
+}
+
+/**
+ * Queues func(arg) to run on a worker, waiting while the queue is full.
+ *
+ * @param p A pointer to the pool.
+ * @param func Function to run.
+ * @param arg Pass through variable to func.
+ * @return 0 on success.
+ * @return -1 if the pool is shutting down.
+ */
+int pool_submit(pool_t *p, void (*func)(void *), void *arg) {
+	pool_task_t *task = malloc(sizeof(pool_task_t));
+
+	task->func = func;
+	task->arg = arg;
+	if(bqueue_put(&p->tasks, task) < 0) {
+		free(task);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Queues func(arg) to run on a worker without waiting.  For callers
+ * that must not block, such as a reactor thread.
+ *
+ * @param p A pointer to the pool.
+ * @param func Function to run.
+ * @param arg Pass through variable to func.
+ * @return 0 on success.
+ * @return -1 if the queue is full or the pool is shutting down.
+ */
+int pool_try_submit(pool_t *p, void (*func)(void *), void *arg) {
+	pool_task_t *task = malloc(sizeof(pool_task_t));
+
+	task->func = func;
+	task->arg = arg;
+	if(bqueue_try_put(&p->tasks, task) < 0) {
+		free(task);
+		return -1;
+	}
+	return 0;
+}
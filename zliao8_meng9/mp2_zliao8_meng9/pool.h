@@ -0,0 +1,30 @@
+/** @file pool.h */
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <pthread.h>
+
+#include "bqueue.h"
+
+#define POOL_DEFAULT_THREADS 8
+#define POOL_DEFAULT_DEPTH 256
+
+/**
+ * Fixed-size Thread Pool
+ *
+ * size threads created once by pool_init() run the tasks handed to
+ * pool_submit() in FIFO order.  At most depth tasks wait in the queue.
+ */
+typedef struct {
+	bqueue_t tasks; ///<Pending tasks
+	pthread_t *threads; ///<Worker threads
+	int size; ///<Number of worker threads
+} pool_t;
+
+int pool_init(pool_t *p, int size, unsigned int depth);
+void pool_destroy(pool_t *p);
+
+int pool_submit(pool_t *p, void (*func)(void *), void *arg);
+int pool_try_submit(pool_t *p, void (*func)(void *), void *arg);
+
+#endif
@@ -0,0 +1,1094 @@
+/** @file querier.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "libhttp.h"
+#include "bqueue.h"
+#include "netio.h"
+#include "connpool.h"
+#include "member.h"
+#include "querier.h"
+
+/**
+ * Private.  Whole lines of one peer on their way to the merge.
+ */
+typedef struct {
+	size_t len; ///<Bytes used in data
+	size_t cap; ///<Size of data
+	char data[]; ///<The lines, each ending in '\n'
+} batch_t;
+
+/**
+ * Private.  The lines of one peer as the time merge sees them.
+ */
+typedef struct {
+	bqueue_t queue; ///<Batches from the peer thread, closed when it is done
+	const char *name; ///<Label printed in front of its lines
+	batch_t *batch; ///<Batch being merged, NULL before the first and at the end
+	size_t pos; ///<Offset of the current line in batch
+	size_t line_len; ///<Length of the current line, newline included
+	char key[QUERIER_KEY_SIZE]; ///<Timestamp the current line is ordered by
+	size_t key_len; ///<Bytes used in key
+} stream_t;
+
+/**
+ * Private.  The offset and limit of a query applied to the lines of all
+ * peers together.
+ */
+typedef struct {
+	long skip; ///<Lines still to leave out
+	long left; ///<Lines still to print, -1 without a limit
+	long printed; ///<Lines printed so far
+} output_t;
+
+/**
+ * Private.  Everything one peer thread needs.
+ */
+typedef struct {
+	peer_t *peer; ///<Who to ask
+	const query_t *q; ///<What to ask
+	FILE *out; ///<Where matching lines go, unless they are merged
+	pthread_mutex_t *out_lock; ///<Keeps lines of different peers apart, guards output
+	output_t *output; ///<Shared by every peer printing unmerged
+	stream_t *stream; ///<Where matching lines go when merged by time, or NULL
+	batch_t *batch; ///<Batch being filled for stream
+	int stopped; ///<Enough lines were printed, stop reading the peer
+	int fd; ///<Socket to the peer, -1 when not connected, guarded by out_lock
+	int running; ///<The thread has not finished yet, guarded by out_lock
+	unsigned long deadline_ms; ///<Time allowed since start, 0 for no limit
+	unsigned long hedge_ms; ///<Silence before a replica is asked too, 0 for never
+	peer_result_t *result; ///<Filled in by the thread
+	struct timespec start; ///<When the query was started
+} peer_job_t;
+
+/**
+ * Private.  One copy of a request in flight, to a peer or a replica.
+ */
+typedef struct {
+	peer_t *node; ///<Where it was sent
+	int fd; ///<Connection, -1 once the copy failed
+	int reused; ///<fd came from the connection pool
+	http_buf_t in; ///<What came back so far
+	http_t resp; ///<Response header being parsed
+} attempt_t;
+
+/** Internal use only.  Milliseconds elapsed since start. */
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/** Internal use only.  Milliseconds left until the deadline, -1 without one. */
+static int time_left(const peer_job_t *job)
+{
+	double left;
+
+	if(job->deadline_ms == 0)
+		return -1;
+	left = job->deadline_ms - elapsed_ms(&job->start);
+	return left > 0 ? (int)left : 0;
+}
+
+/**
+ * Internal use only.  Waits until the peer sent something, but no
+ * longer than the deadline.
+ *
+ * @return 0 if fd is readable, -1 once the deadline passed.
+ */
+static int peer_wait(peer_job_t *job, int fd)
+{
+	struct pollfd pfd;
+	int left;
+
+	if(job->deadline_ms == 0)
+		return 0;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while((left = time_left(job)) != 0){
+		int n = poll(&pfd, 1, left);
+		if(n > 0 || (n < 0 && errno != EINTR))
+			return 0;
+	}
+	job->result->late = 1;
+	return -1;
+}
+
+/** Internal use only.  Returns where the line n lines after p starts. */
+static const char *skip_lines(const char *p, const char *end, long n)
+{
+	while(n-- > 0)
+		p = (const char *)memchr(p, '\n', end - p) + 1;
+	return p;
+}
+
+/**
+ * Internal use only.  Cuts n lines down to what the offset and limit
+ * still allow, and counts the ones kept as printed.
+ *
+ * @param first Set to the number of lines to leave out first.
+ * @return The number of lines to print after those.
+ */
+static long output_take(output_t *output, long n, long *first)
+{
+	*first = n < output->skip ? n : output->skip;
+	output->skip -= *first;
+	n -= *first;
+	if(output->left >= 0){
+		if(n > output->left)
+			n = output->left;
+		output->left -= n;
+	}
+	output->printed += n;
+	return n;
+}
+
+/**
+ * Internal use only.  Prints whole lines, each prefixed with the peer
+ * name, with one locked write so lines of different peers never mix.
+ * Lines before the offset or past the limit are left out.
+ *
+ * @return The number of lines received.
+ */
+static long print_lines(peer_job_t *job, const char *buf, size_t len)
+{
+	size_t name_len = strlen(job->peer->name);
+	const char *p = buf, *end = buf + len;
+	long lines = 0;
+	char *block, *o;
+
+	for(p = buf; p < end && (p = memchr(p, '\n', end - p)) != NULL; p++)
+		lines++;
+	if(lines == 0)
+		return 0;
+
+	o = block = malloc(len + lines * (name_len + 2));
+	for(p = buf; p < end; ){
+		const char *eol = memchr(p, '\n', end - p) + 1;
+		memcpy(o, job->peer->name, name_len);
+		o += name_len;
+		*o++ = ':';
+		*o++ = ' ';
+		memcpy(o, p, eol - p);
+		o += eol - p;
+		p = eol;
+	}
+
+	pthread_mutex_lock(job->out_lock);
+	long first, n = output_take(job->output, lines, &first);
+	const char *from = skip_lines(block, o, first);
+	if(n > 0){
+		fwrite(from, 1, skip_lines(from, o, n) - from, job->out);
+		fflush(job->out);
+	}
+	if(job->output->left == 0)
+		job->stopped = 1;
+	pthread_mutex_unlock(job->out_lock);
+
+	free(block);
+	return lines;
+}
+
+/**
+ * Internal use only.  Hands the batch being filled to the merge,
+ * waiting while the merge still holds QUERIER_STREAM_BATCHES of this
+ * peer.  The thread then stops reading the socket, and TCP flow
+ * control slows the peer down to the pace of the merge.
+ */
+static void stream_flush(peer_job_t *job)
+{
+	if(job->batch == NULL || job->batch->len == 0)
+		return;
+	// closed by the merge once it printed enough lines
+	if(bqueue_put(&job->stream->queue, job->batch) < 0){
+		free(job->batch);
+		job->stopped = 1;
+	}
+	job->batch = NULL;
+}
+
+/**
+ * Internal use only.  Copies whole lines into the batch being filled
+ * for the merge, handing it over once it is full.
+ *
+ * @return The number of lines queued.
+ */
+static long queue_lines(peer_job_t *job, const char *buf, size_t len)
+{
+	const char *p, *end = buf + len;
+	long lines = 0;
+
+	for(p = buf; p < end && (p = memchr(p, '\n', end - p)) != NULL; p++)
+		lines++;
+
+	if(job->batch != NULL && job->batch->cap - job->batch->len < len)
+		stream_flush(job);
+	if(job->batch == NULL){
+		size_t cap = len > QUERIER_BATCH_SIZE ? len : QUERIER_BATCH_SIZE;
+		job->batch = malloc(sizeof(batch_t) + cap);
+		job->batch->len = 0;
+		job->batch->cap = cap;
+	}
+	memcpy(job->batch->data + job->batch->len, buf, len);
+	job->batch->len += len;
+	return lines;
+}
+
+/**
+ * Internal use only.  Before a read that would wait for the peer, hands
+ * over the lines batched so far, so a quiet peer never holds the merge
+ * back with lines it already sent.
+ */
+static void stream_idle(peer_job_t *job, int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if(job->stream != NULL && job->batch != NULL && poll(&pfd, 1, 0) == 0)
+		stream_flush(job);
+}
+
+/**
+ * Internal use only.  Prints the whole lines at the start of a body,
+ * or queues them for the merge.  At its end, a last line without its
+ * newline is taken as well.
+ *
+ * @return The number of bytes printed.
+ */
+static size_t print_body(peer_job_t *job, const char *data, size_t len, int end)
+{
+	const char *last = memrchr(data, '\n', len);
+	size_t used = last != NULL ? (size_t)(last + 1 - data) : 0;
+
+	if(used > 0)
+		job->result->lines += job->stream ? queue_lines(job, data, used) : print_lines(job, data, used);
+	if(end && used < len){
+		size_t rest = len - used;
+		char *line = malloc(rest + 1);
+		memcpy(line, data + used, rest);
+		line[rest] = '\n';
+		job->result->lines += job->stream ? queue_lines(job, line, rest + 1) : print_lines(job, line, rest + 1);
+		free(line);
+		used = len;
+	}
+	return used;
+}
+
+/**
+ * Internal use only.  Prints a chunked body line by line as its chunks
+ * arrive.  A partial line of a body cut short is dropped.
+ *
+ * @return 1 if the last chunk arrived or no more lines are wanted, 0 if
+ * the body was cut short.
+ */
+static int read_chunked(peer_job_t *job, int fd, http_buf_t *in)
+{
+	http_chunked_t chunked;
+
+	http_chunked_init(&chunked);
+	while(1){
+		int done = http_chunked_decode(&chunked, in);
+		if(done < 0)
+			return 0;
+		http_chunked_consume(&chunked, in,
+		                     print_body(job, in->data + in->off, chunked.avail, done));
+		if(done || job->stopped)
+			return 1;
+
+		stream_idle(job, fd);
+		if(peer_wait(job, fd) < 0)
+			return 0;
+		ssize_t n = http_buf_fill(in, fd);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return 0;
+	}
+}
+
+/**
+ * Internal use only.  Prints a body that ends when the peer closes the
+ * connection, line by line as it arrives.
+ *
+ * @return 1 at the end of the stream or when no more lines are wanted,
+ * 0 on a read error.
+ */
+static int read_to_close(peer_job_t *job, int fd, http_buf_t *in)
+{
+	while(1){
+		in->off += print_body(job, in->data + in->off, in->len - in->off, 0);
+		if(job->stopped)
+			return 1;
+
+		stream_idle(job, fd);
+		if(peer_wait(job, fd) < 0)
+			return 0;
+		ssize_t n = http_buf_fill(in, fd);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0){
+			print_body(job, in->data + in->off, in->len - in->off, 1);
+			return n == 0;
+		}
+	}
+}
+
+/**
+ * Internal use only.  Publishes the socket of a job, so querier_follow()
+ * can cut the stream short, or hides it again with fd -1.
+ */
+static void peer_set_fd(peer_job_t *job, int fd)
+{
+	pthread_mutex_lock(job->out_lock);
+	job->fd = fd;
+	if(fd >= 0 && job->stopped)
+		shutdown(fd, SHUT_RDWR);
+	pthread_mutex_unlock(job->out_lock);
+}
+
+/**
+ * Internal use only.  Sends the request of one copy, on a connection
+ * from the pool or, with fresh, on a new one.  A reused connection the
+ * peer closed at that very moment cannot take the request, it is then
+ * sent again on a new one.
+ *
+ * @param target Request target of the query.
+ * @return 0, or -1 if the node cannot be reached in time.
+ */
+static int attempt_send(attempt_t *a, const char *target, int fresh, int timeout_ms)
+{
+	char request[QUERY_MAX_TARGET + 512];
+	int len = snprintf(request, sizeof(request),
+	                   "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: Keep-Alive\r\n\r\n",
+	                   target, a->node->host);
+
+	if(fresh){
+		a->reused = 0;
+		a->fd = connpool_connect(a->node->host, a->node->port, timeout_ms);
+	}else{
+		a->fd = connpool_get(a->node->host, a->node->port, timeout_ms, &a->reused);
+	}
+	while(a->fd >= 0 && net_send_all(a->fd, request, len, 0, NULL) < 0){
+		close(a->fd);
+		a->fd = a->reused ? connpool_connect(a->node->host, a->node->port, timeout_ms) : -1;
+		a->reused = 0;
+	}
+	http_init(&a->resp);
+	return a->fd >= 0 ? 0 : -1;
+}
+
+/**
+ * Internal use only.  Reads what arrived for one copy.
+ *
+ * @return 1 once its response header is complete, 0 if more is to
+ * come, -1 if the copy failed.
+ */
+static int attempt_read(attempt_t *a, const char *target, int timeout_ms)
+{
+	ssize_t n = http_buf_fill(&a->in, a->fd);
+	int ret;
+
+	if(n < 0 && errno == EINTR)
+		return 0;
+	if(n <= 0){
+		// nothing at all came back on a reused connection, the peer
+		// was closing it: same again on a new one
+		int retry = a->reused && a->in.len == 0;
+		close(a->fd);
+		a->fd = -1;
+		if(retry && attempt_send(a, target, 1, timeout_ms) == 0)
+			return 0;
+		return -1;
+	}
+	if((ret = http_next(&a->resp, &a->in)) < 0){
+		close(a->fd);
+		a->fd = -1;
+	}
+	return ret > 0 ? 1 : ret;
+}
+
+/**
+ * Internal use only.  Sends the request to a peer and reads the header
+ * of its response, within the deadline.
+ *
+ * A peer that has not answered after the hedge delay, or cannot be
+ * reached at all, is a straggler: the same request then goes to its
+ * next replica as well, and so on down the list, without giving up on
+ * the copies already sent.  The first copy whose header arrives wins
+ * and the others are closed.  Only headers race, so lines are never
+ * printed twice.  Copies that cannot even be waited for count as
+ * failed.
+ *
+ * @return The socket of the winning copy, with the response header in
+ * resp and what followed it in in, or -1.
+ */
+static int peer_request(peer_job_t *job, const char *target, http_buf_t *in, http_t *resp)
+{
+	attempt_t copies[QUERIER_MAX_COPIES];
+	struct pollfd pfd[QUERIER_MAX_COPIES];
+	peer_t *next = job->peer;
+	double hedge_at = 0;
+	int n = 0, live = 0, winner = -1, i;
+
+	while(winner < 0 && !job->stopped){
+		int left = time_left(job);
+		if(left == 0){
+			job->result->late = 1;
+			break;
+		}
+
+		// nodes the failure detector declared dead are not waited for
+		while(next != NULL && member_state(next->host, next->port, NULL) == MEMBER_DEAD){
+			job->result->skipped++;
+			next = next->replica;
+		}
+
+		// one copy at first, one more after each hedge delay, or as
+		// soon as every copy so far failed
+		if(next != NULL && n < QUERIER_MAX_COPIES &&
+		   (live == 0 || (job->hedge_ms > 0 && elapsed_ms(&job->start) >= hedge_at))){
+			attempt_t *a = &copies[n++];
+			int timeout = left;
+			int suspect = member_state(next->host, next->port, NULL) == MEMBER_SUSPECT;
+			a->node = next;
+			next = next->replica;
+			http_buf_init(&a->in);
+			// with a replica left to try, a node slow to accept is a
+			// straggler like any other
+			if(next != NULL && job->hedge_ms > 0 && (timeout < 0 || (unsigned long)timeout > job->hedge_ms))
+				timeout = job->hedge_ms;
+			if(attempt_send(a, target, 0, timeout) == 0){
+				peer_set_fd(job, a->fd);
+				live++;
+			}
+			if(n > 1)
+				job->result->hedged++;
+			// a suspected node is likely dead, its replica is asked
+			// right away
+			hedge_at = elapsed_ms(&job->start) + (suspect ? 0 : job->hedge_ms);
+			continue;
+		}
+		if(live == 0)
+			break;
+
+		// wait for a header, the deadline or the next hedge
+		int wait = left;
+		if(next != NULL && n < QUERIER_MAX_COPIES && job->hedge_ms > 0){
+			double until = hedge_at - elapsed_ms(&job->start);
+			int hedge_wait = until > 0 ? (int)until + 1 : 0;
+			if(wait < 0 || hedge_wait < wait)
+				wait = hedge_wait;
+		}
+		int k = 0;
+		for(i = 0; i < n; i++){
+			if(copies[i].fd >= 0){
+				pfd[k].fd = copies[i].fd;
+				pfd[k].events = POLLIN;
+				k++;
+			}
+		}
+		int ready = poll(pfd, k, wait);
+		if(ready < 0 && errno != EINTR){
+			// the copies cannot be waited for, they failed: the next
+			// replica is asked if there is one, else the peer failed
+			perror("poll");
+			for(i = 0; i < n; i++){
+				if(copies[i].fd >= 0){
+					close(copies[i].fd);
+					copies[i].fd = -1;
+				}
+			}
+			peer_set_fd(job, -1);
+			live = 0;
+			continue;
+		}
+		if(ready <= 0)
+			continue;
+		for(i = 0, k = 0; i < n && winner < 0; i++){
+			attempt_t *a = &copies[i];
+			if(a->fd < 0 || !(pfd[k++].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)))
+				continue;
+			int ret = attempt_read(a, target, left);
+			if(ret > 0)
+				winner = i;
+			else if(a->fd >= 0)
+				peer_set_fd(job, a->fd);
+			else
+				live--;
+		}
+	}
+
+	for(i = 0; i < n; i++){
+		if(i == winner)
+			continue;
+		// a copy still in flight cannot carry another request
+		if(copies[i].fd >= 0)
+			close(copies[i].fd);
+		http_buf_free(&copies[i].in);
+	}
+	if(winner < 0){
+		job->result->down = n == 0 && job->result->skipped > 0;
+		peer_set_fd(job, -1);
+		return -1;
+	}
+	peer_set_fd(job, copies[winner].fd);
+	*in = copies[winner].in;
+	*resp = copies[winner].resp;
+	job->result->reused = copies[winner].reused;
+	job->result->source = copies[winner].node;
+	return copies[winner].fd;
+}
+
+/**
+ * Internal use only.  Thread body asking one peer.  The connection goes
+ * back to the pool if the whole response was read, so the next query
+ * to the same peer skips the TCP handshake and slow start.
+ */
+static void *peer_run(void *ptr)
+{
+	peer_job_t *job = ptr;
+	peer_result_t *result = job->result;
+	char target[QUERY_MAX_TARGET];
+	http_buf_t in;
+	http_t resp;
+	int fd, framed = 0, keep = 0;
+
+	result->lines = 0;
+	result->status = 0;
+	result->complete = 0;
+	result->reused = 0;
+	result->late = 0;
+	result->hedged = 0;
+	result->skipped = 0;
+	result->down = 0;
+	result->source = NULL;
+	if(query_format(job->q, target, sizeof(target)) < 0){
+		result->ms = elapsed_ms(&job->start);
+		return NULL;
+	}
+
+	http_buf_init(&in);
+	if((fd = peer_request(job, target, &in, &resp)) >= 0){
+		const char *status = http_get_status(&resp);
+		const char *encoding = http_get_header(&resp, "Transfer-Encoding");
+		const char *connection = http_get_header(&resp, "Connection");
+		int chunked = encoding != NULL && strcasecmp(encoding, "chunked") == 0;
+		result->status = (status && strlen(status) > 9) ? atoi(status + 9) : -1;
+
+		// a body delimited by its length was read along with the header
+		if(chunked)
+			framed = result->status == 200 && !job->q->count;
+		else
+			framed = http_get_header(&resp, "Content-Length") != NULL &&
+			         (result->status != 200 || job->q->count);
+		keep = framed && (connection == NULL || strcasecmp(connection, "close") != 0);
+
+		if(result->status == 200 && job->q->count){
+			// the body is just the number of matching lines
+			const char *body = http_get_body(&resp, NULL);
+			result->lines = body ? atol(body) : 0;
+			result->complete = body != NULL;
+		}
+		http_free(&resp);
+
+		// the body is printed line by line as it arrives instead of
+		// after all of it, chunked bodies tell when they are complete
+		http_buf_reserve(&in, QUERIER_BATCH_SIZE);
+		if(result->status == 200 && !job->q->count)
+			result->complete = chunked ? read_chunked(job, fd, &in) : read_to_close(job, fd, &in);
+
+		// a body left unread, e.g. after the limit, would be taken
+		// for the next response
+		if(chunked && (!result->complete || job->stopped))
+			keep = 0;
+		if(in.off != in.len)
+			keep = 0;
+
+		peer_set_fd(job, -1);
+		if(keep)
+			connpool_put(result->source->host, result->source->port, fd);
+		else
+			close(fd);
+	}
+	http_buf_free(&in);
+	result->ms = elapsed_ms(&job->start);
+	return NULL;
+}
+
+/** Internal use only.  Thread body following one peer. */
+static void *peer_follow_run(void *ptr)
+{
+	peer_job_t *job = ptr;
+
+	peer_run(job);
+	pthread_mutex_lock(job->out_lock);
+	job->running = 0;
+	pthread_mutex_unlock(job->out_lock);
+	return NULL;
+}
+
+/** Internal use only.  Thread body asking one peer for the merge. */
+static void *peer_stream_run(void *ptr)
+{
+	peer_job_t *job = ptr;
+
+	peer_run(job);
+	stream_flush(job);
+	free(job->batch);
+	job->batch = NULL;
+	bqueue_close(&job->stream->queue);
+	return NULL;
+}
+
+/**
+ * Internal use only.  Moves a stream to its next line, taking the next
+ * batch of the peer when the current one runs out.  A line that does
+ * not start with a timestamp, such as the rest of a stack trace, keeps
+ * the key of the line before it so it stays right behind that line.
+ *
+ * @return 0, or -1 once the peer has no more lines.
+ */
+static int stream_next(stream_t *s, FILE *out)
+{
+	const char *line;
+	size_t n = 0;
+
+	if(s->batch != NULL){
+		s->pos += s->line_len;
+		if(s->pos == s->batch->len){
+			free(s->batch);
+			s->batch = NULL;
+		}
+	}
+	if(s->batch == NULL){
+		// nothing can be printed until this peer answers, show what
+		// is merged so far instead of keeping it buffered
+		if(bqueue_size(&s->queue) == 0)
+			fflush(out);
+		if((s->batch = bqueue_take(&s->queue)) == NULL)
+			return -1;
+		s->pos = 0;
+	}
+
+	line = s->batch->data + s->pos;
+	s->line_len = (const char *)memchr(line, '\n', s->batch->len - s->pos) + 1 - line;
+	if(line[0] >= '0' && line[0] <= '9'){
+		while(n < QUERIER_KEY_SIZE && line[n] != ' ' && line[n] != '\t' && line[n] != '\n')
+			n++;
+		memcpy(s->key, line, n);
+		s->key_len = n;
+	}
+	return 0;
+}
+
+/**
+ * Internal use only.  Orders streams by the timestamp of their current
+ * line.  ISO 8601 timestamps sort as strings, and a shorter one that is
+ * a prefix of the other comes first.  Ties go to the earlier peer.
+ */
+static int stream_before(const stream_t *a, const stream_t *b)
+{
+	size_t n = a->key_len < b->key_len ? a->key_len : b->key_len;
+	int cmp = memcmp(a->key, b->key, n);
+
+	if(cmp == 0)
+		cmp = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	return cmp < 0 || (cmp == 0 && a < b);
+}
+
+/** Internal use only.  Restores the heap below index i. */
+static void heap_down(stream_t **heap, int size, int i)
+{
+	while(1){
+		int min = i, l = 2 * i + 1, r = l + 1;
+		stream_t *tmp;
+
+		if(l < size && stream_before(heap[l], heap[min]))
+			min = l;
+		if(r < size && stream_before(heap[r], heap[min]))
+			min = r;
+		if(min == i)
+			return;
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/**
+ * Internal use only.  k-way merge: prints the lines of every stream as
+ * one sequence ordered by time.  Each peer greps its log in file order,
+ * so its own lines arrive sorted, and a min-heap of the current line
+ * of each stream gives the next line overall in O(log n).  Once the
+ * limit is reached every queue is closed, which stops the peer threads.
+ */
+static void merge_streams(stream_t *streams, int n, FILE *out, output_t *output)
+{
+	stream_t **heap = malloc(n * sizeof(stream_t *));
+	int size = 0, i;
+	long first;
+
+	for(i = 0; i < n; i++)
+		if(stream_next(&streams[i], out) == 0)
+			heap[size++] = &streams[i];
+	for(i = size / 2 - 1; i >= 0; i--)
+		heap_down(heap, size, i);
+
+	while(size > 0 && output->left != 0){
+		stream_t *s = heap[0];
+
+		// only this thread writes to out while merging
+		if(output_take(output, 1, &first) > 0){
+			fputs_unlocked(s->name, out);
+			fputs_unlocked(": ", out);
+			fwrite_unlocked(s->batch->data + s->pos, 1, s->line_len, out);
+		}
+		if(stream_next(s, out) < 0)
+			heap[0] = heap[--size];
+		heap_down(heap, size, 0);
+	}
+	fflush(out);
+	free(heap);
+
+	for(i = 0; i < n; i++){
+		bqueue_close(&streams[i].queue);
+		free(streams[i].batch);
+		streams[i].batch = NULL;
+	}
+}
+
+/** Internal use only.  Fills a peer from "host:port", or returns -1. */
+static int peer_parse(peer_t *peer, const char *addr, const char *name)
+{
+	const char *colon = strrchr(addr, ':');
+
+	if(colon == NULL)
+		return -1;
+	peer->host = strndup(addr, colon - addr);
+	peer->port = strdup(colon + 1);
+	peer->name = strdup(name);
+	peer->replica = NULL;
+	return 0;
+}
+
+/**
+ * Reads a peer list: one "host:port [name [host:port ...]]" per line,
+ * '#' starts a comment.  The name defaults to host:port.  Addresses
+ * after the name are replicas of the node holding the same log, asked
+ * in that order when the node is slow or down.
+ *
+ * @param path The file.
+ * @param peers Filled with a malloc'd array, free with querier_free_peers().
+ * @return The number of peers, or -1 if the file cannot be read.
+ */
+int querier_load_peers(const char *path, peer_t **peers)
+{
+	FILE *f = fopen(path, "r");
+	char line[512];
+	int n = 0, cap = 8;
+
+	if(f == NULL)
+		return -1;
+
+	*peers = malloc(cap * sizeof(peer_t));
+	while(fgets(line, sizeof(line), f)){
+		char *save, *addr, *name, *more;
+		peer_t **tail;
+
+		line[strcspn(line, "#\r\n")] = 0;
+		if((addr = strtok_r(line, " \t", &save)) == NULL)
+			continue;
+		if((name = strtok_r(NULL, " \t", &save)) == NULL)
+			name = addr;
+
+		if(n == cap){
+			cap *= 2;
+			*peers = realloc(*peers, cap * sizeof(peer_t));
+		}
+		if(peer_parse(&(*peers)[n], addr, name) < 0)
+			continue;
+
+		tail = &(*peers)[n].replica;
+		while((more = strtok_r(NULL, " \t", &save)) != NULL){
+			peer_t *r = malloc(sizeof(peer_t));
+			if(peer_parse(r, more, name) < 0){
+				free(r);
+				continue;
+			}
+			*tail = r;
+			tail = &r->replica;
+		}
+		n++;
+	}
+	fclose(f);
+	return n;
+}
+
+/**
+ * Frees a peer list read by querier_load_peers().
+ *
+ * @param peers The peers.
+ * @param n Number of peers.
+ * @return void
+ */
+void querier_free_peers(peer_t *peers, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++){
+		peer_t *r = peers[i].replica;
+		while(r != NULL){
+			peer_t *next = r->replica;
+			free(r->host);
+			free(r->port);
+			free(r->name);
+			free(r);
+			r = next;
+		}
+		free(peers[i].host);
+		free(peers[i].port);
+		free(peers[i].name);
+	}
+	free(peers);
+}
+
+/**
+ * Sends a grep query to every peer at once, one thread each, and prints
+ * the matching lines prefixed with the peer name.  The whole query
+ * takes as long as the slowest peer, not the sum of them.
+ *
+ * Merged, the lines of all peers come out as one sequence ordered by
+ * their leading timestamps.  Each peer thread hands batches of lines to
+ * a bounded queue, and the calling thread merges the queues.  A peer
+ * ahead of the merge is held back by TCP flow control once its queue is
+ * full, so memory stays within about QUERIER_STREAM_BATCHES + 2 batches
+ * per peer however large the result.  Otherwise each peer's lines are
+ * printed as they arrive.
+ *
+ * Connections to the peers are kept alive in the connection pool, so
+ * back-to-back queries skip the TCP handshake and slow start.
+ *
+ * No peer can hold the query up past the deadline: a peer still
+ * sending then is cut short and flagged late in its result, and the
+ * lines it sent in time are kept.  A peer with replicas that stays
+ * silent for the hedge delay, or is down, is asked through its
+ * replicas as well, and the first to answer is used.
+ *
+ * Counts, limits and offsets are pushed down to the peers, which stop
+ * scanning early and send only what is needed.  The offset and limit
+ * apply to all lines together: each peer is asked for its first
+ * offset + limit lines, and the first offset lines of the merged
+ * sequence are left out.  A count query adds up the counts of the
+ * peers, in results[].lines, and prints nothing.
+ *
+ * @param peers The nodes to ask.
+ * @param n Number of peers.
+ * @param q The query.
+ * @param opts Merging, deadline and hedge delay.
+ * @param out Where matching lines are printed.
+ * @param results Array of n entries, filled with what each peer answered.
+ * @return The number of lines printed, or for a count query the number
+ * of matching lines.
+ */
+long querier_grep(peer_t *peers, int n, const query_t *q, const querier_opts_t *opts, FILE *out,
+                  peer_result_t *results)
+{
+	int merge = opts->merge;
+	peer_job_t *jobs = calloc(n, sizeof(peer_job_t));
+	pthread_t *threads = calloc(n, sizeof(pthread_t));
+	int *started = calloc(n, sizeof(int));
+	stream_t *streams = merge ? calloc(n, sizeof(stream_t)) : NULL;
+	pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+	struct timespec start;
+	query_t node_q = *q;
+	output_t output;
+	long total = 0;
+	int i;
+
+	// no peer can know the global offset, each sends all lines up to it
+	node_q.offset = 0;
+	if(q->limit > 0)
+		node_q.limit = q->offset + q->limit;
+	output.skip = q->offset;
+	output.left = q->limit > 0 ? q->limit : -1;
+	output.printed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < n; i++){
+		jobs[i].peer = &peers[i];
+		jobs[i].q = &node_q;
+		jobs[i].out = out;
+		jobs[i].out_lock = &out_lock;
+		jobs[i].output = &output;
+		jobs[i].result = &results[i];
+		jobs[i].start = start;
+		jobs[i].deadline_ms = opts->deadline_ms;
+		jobs[i].hedge_ms = opts->hedge_ms;
+		if(merge){
+			streams[i].name = peers[i].name;
+			bqueue_init(&streams[i].queue, QUERIER_STREAM_BATCHES);
+			jobs[i].stream = &streams[i];
+		}
+		int rc = pthread_create(&threads[i], NULL, merge ? peer_stream_run : peer_run, &jobs[i]);
+		if(rc){
+			fprintf(stderr, "---ERROR; pthread_create failed, return code is %d\n", rc);
+			// nothing merges yet, this peer's lines are printed unordered
+			if(merge){
+				jobs[i].stream = NULL;
+				bqueue_close(&streams[i].queue);
+			}
+			peer_run(&jobs[i]);
+		}else{
+			started[i] = 1;
+		}
+	}
+
+	if(merge)
+		merge_streams(streams, n, out, &output);
+
+	for(i = 0; i < n; i++){
+		if(started[i])
+			pthread_join(threads[i], NULL);
+		if(merge){
+			// batches queued after the limit was reached
+			batch_t *batch;
+			while((batch = bqueue_take(&streams[i].queue)) != NULL)
+				free(batch);
+			bqueue_destroy(&streams[i].queue);
+		}
+		total += results[i].lines;
+	}
+
+	if(q->count){
+		total = total > q->offset ? total - q->offset : 0;
+		if(q->limit > 0 && total > q->limit)
+			total = q->limit;
+	}else{
+		total = output.printed;
+	}
+
+	pthread_mutex_destroy(&out_lock);
+	free(streams);
+	free(started);
+	free(threads);
+	free(jobs);
+	return total;
+}
+
+/**
+ * Follows the logs of every peer at once, like tail -f on each node,
+ * and prints the matching lines appended to them, prefixed with the
+ * peer name.  Each node pushes its lines over one long-lived chunked
+ * response as they are written, and each peer thread prints them as
+ * they arrive, so the live streams of all nodes are interleaved in the
+ * order they come in.  Ordering them by time would hold every line
+ * back until the quietest node said something.
+ *
+ * A follow query has no deadline, and only a node that cannot be
+ * reached is replaced by its replica.
+ *
+ * Runs until stop_fd becomes readable, e.g. the user pressed Enter on
+ * stdin, the limit of the query is reached or every peer ended its
+ * stream.  Nothing is read from stop_fd.  The offset and limit apply to
+ * all lines together, as in querier_grep().
+ *
+ * @param peers The nodes to ask.
+ * @param n Number of peers.
+ * @param q The query, with follow set.
+ * @param out Where matching lines are printed.
+ * @param stop_fd Descriptor polled for the end, or -1 to wait for the peers.
+ * @param results Array of n entries, filled with what each peer answered.
+ * @return The number of lines printed.
+ */
+long querier_follow(peer_t *peers, int n, const query_t *q, FILE *out, int stop_fd, peer_result_t *results)
+{
+	peer_job_t *jobs = calloc(n, sizeof(peer_job_t));
+	pthread_t *threads = calloc(n, sizeof(pthread_t));
+	int *started = calloc(n, sizeof(int));
+	pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+	struct timespec start;
+	struct pollfd pfd;
+	query_t node_q = *q;
+	output_t output;
+	long total;
+	int i, running;
+
+	node_q.offset = 0;
+	if(q->limit > 0)
+		node_q.limit = q->offset + q->limit;
+	output.skip = q->offset;
+	output.left = q->limit > 0 ? q->limit : -1;
+	output.printed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < n; i++){
+		jobs[i].peer = &peers[i];
+		jobs[i].q = &node_q;
+		jobs[i].out = out;
+		jobs[i].out_lock = &out_lock;
+		jobs[i].output = &output;
+		jobs[i].result = &results[i];
+		jobs[i].start = start;
+		jobs[i].fd = -1;
+		jobs[i].running = 1;
+		int rc = pthread_create(&threads[i], NULL, peer_follow_run, &jobs[i]);
+		if(rc){
+			fprintf(stderr, "---ERROR; pthread_create failed, return code is %d\n", rc);
+			jobs[i].running = 0;
+			results[i].status = 0;
+		}else{
+			started[i] = 1;
+		}
+	}
+
+	// the peer threads print, this one only waits for the end
+	pfd.fd = stop_fd;
+	pfd.events = POLLIN;
+	do{
+		if(poll(&pfd, stop_fd >= 0 ? 1 : 0, QUERIER_FOLLOW_CHECK_MS) > 0)
+			break;
+		pthread_mutex_lock(&out_lock);
+		for(running = 0, i = 0; i < n; i++)
+			running += jobs[i].running;
+		if(output.left == 0)
+			running = 0;
+		pthread_mutex_unlock(&out_lock);
+	}while(running > 0);
+
+	// a shut down socket reads as the end of the stream
+	pthread_mutex_lock(&out_lock);
+	for(i = 0; i < n; i++){
+		jobs[i].stopped = 1;
+		if(jobs[i].fd >= 0)
+			shutdown(jobs[i].fd, SHUT_RDWR);
+	}
+	pthread_mutex_unlock(&out_lock);
+
+	for(i = 0; i < n; i++){
+		if(started[i])
+			pthread_join(threads[i], NULL);
+	}
+	total = output.printed;
+
+	pthread_mutex_destroy(&out_lock);
+	free(started);
+	free(threads);
+	free(jobs);
+	return total;
+}
@@ -0,0 +1,68 @@
+/** @file querier.h */
+#ifndef __QUERIER_H__
+#define __QUERIER_H__
+
+#include <stdio.h>
+
+#include "query.h"
+
+/* Peer list read by menu option 4 unless -p says otherwise */
+#define QUERIER_DEFAULT_PEERS "peers.conf"
+
+/* Lines a peer thread hands to the time merge at once */
+#define QUERIER_BATCH_SIZE (64 * 1024)
+/* Batches of a peer waiting for the merge before its thread stops reading */
+#define QUERIER_STREAM_BATCHES 4
+/* Longest timestamp compared by the merge */
+#define QUERIER_KEY_SIZE 32
+/* How often querier_follow() checks whether every peer is done */
+#define QUERIER_FOLLOW_CHECK_MS 200
+/* Longest a query waits for the peers unless -d says otherwise */
+#define QUERIER_DEFAULT_DEADLINE_MS 30000
+/* A peer silent this long gets a copy of the query sent to a replica */
+#define QUERIER_DEFAULT_HEDGE_MS 500
+/* Copies of a query in flight for one peer, itself and its replicas */
+#define QUERIER_MAX_COPIES 4
+
+/**
+ * A node running the dlq server.
+ */
+typedef struct peer {
+	char *host; ///<Host name or address
+	char *port; ///<Port of its HTTP server
+	char *name; ///<Label printed in front of its lines
+	struct peer *replica; ///<Next node holding the same log, or NULL
+} peer_t;
+
+/**
+ * How querier_grep() waits for the peers.
+ */
+typedef struct {
+	int merge; ///<Print the lines of all peers ordered by time
+	unsigned long deadline_ms; ///<Give up on peers still sending after this long, 0 for never
+	unsigned long hedge_ms; ///<Ask a replica of a peer silent this long, 0 for never
+} querier_opts_t;
+
+/**
+ * What one peer answered, filled in by querier_grep().
+ */
+typedef struct {
+	long lines; ///<Matching lines received
+	int status; ///<HTTP status, 0 if the peer could not be reached
+	int complete; ///<The whole body arrived, 0 if it was cut short
+	int reused; ///<Asked over a kept-alive connection, without connecting
+	int late; ///<Missed the deadline, lines holds what arrived in time
+	int hedged; ///<Copies of the query sent to replicas
+	int skipped; ///<The node or replicas left out as dead to the failure detector
+	int down; ///<The node and all its replicas were dead, none was asked
+	const peer_t *source; ///<The node or replica that answered, NULL if none did
+	double ms; ///<Time until its last line arrived
+} peer_result_t;
+
+int querier_load_peers(const char *path, peer_t **peers);
+void querier_free_peers(peer_t *peers, int n);
+long querier_grep(peer_t *peers, int n, const query_t *q, const querier_opts_t *opts, FILE *out,
+                  peer_result_t *results);
+long querier_follow(peer_t *peers, int n, const query_t *q, FILE *out, int stop_fd, peer_result_t *results);
+
+#endif
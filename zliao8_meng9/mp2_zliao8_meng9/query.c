@@ -0,0 +1,248 @@
+/** @file query.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "matcher.h"
+#include "query.h"
+
+/** Internal use only.  Value of one hex digit, or -1. */
+static int hex_value(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * Internal use only.  Decodes len bytes of a URL query value
+ * ("%41" and '+' escapes) into a new null-terminated string.
+ */
+static char *url_decode(const char *s, size_t len)
+{
+	char *out = malloc(len + 1);
+	size_t i, n = 0;
+
+	for(i = 0; i < len; i++){
+		if(s[i] == '%' && i + 2 < len &&
+		   hex_value(s[i + 1]) >= 0 && hex_value(s[i + 2]) >= 0){
+			out[n++] = hex_value(s[i + 1]) * 16 + hex_value(s[i + 2]);
+			i += 2;
+		}else if(s[i] == '+'){
+			out[n++] = ' ';
+		}else{
+			out[n++] = s[i];
+		}
+	}
+	out[n] = 0;
+	return out;
+}
+
+/**
+ * Internal use only.  Appends s percent-encoded, leaving only
+ * unreserved characters as they are.
+ */
+static int url_encode(char *buf, size_t size, size_t len, const char *s)
+{
+	static const char hex[] = "0123456789ABCDEF";
+
+	for(; *s; s++){
+		unsigned char c = *s;
+		if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		   (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '~'){
+			if(len + 1 >= size)
+				return -1;
+			buf[len++] = c;
+		}else{
+			if(len + 3 >= size)
+				return -1;
+			buf[len++] = '%';
+			buf[len++] = hex[c >> 4];
+			buf[len++] = hex[c & 15];
+		}
+	}
+	buf[len] = 0;
+	return len;
+}
+
+/**
+ * Initializes an empty query.
+ *
+ * @param q The query.
+ * @return void
+ */
+void query_init(query_t *q)
+{
+	memset(q, 0, sizeof(*q));
+}
+
+/**
+ * Frees the strings held by a query.
+ *
+ * @param q The query.
+ * @return void
+ */
+void query_free(query_t *q)
+{
+	free(q->pattern);
+	free(q->field);
+	q->pattern = NULL;
+	q->field = NULL;
+	if(q->matcher != NULL)
+		matcher_release(q->matcher);
+	q->matcher = NULL;
+}
+
+/** Internal use only.  Reads a count out of a URL query value, 0 if invalid. */
+static long parse_count(const char *s, size_t len)
+{
+	long n = 0;
+	size_t i;
+
+	for(i = 0; i < len; i++){
+		if(s[i] < '0' || s[i] > '9' || n > (LONG_MAX - 9) / 10)
+			return 0;
+		n = n * 10 + (s[i] - '0');
+	}
+	return n;
+}
+
+/**
+ * Reads a query out of a request target such as "/grep?q=ERROR",
+ * "/grep?q=ERR%5BO%5D%2B&re=1", "/grep?f=level%3AERROR&count=1",
+ * "/grep?q=ERROR&limit=100&offset=200" or "/grep?q=ERROR&follow=1".
+ * Unknown parameters are ignored.
+ *
+ * @param q An initialized query, filled in.
+ * @param target The path and query string of the request.
+ * @return 0 on success.
+ * @return -1 if target is not QUERY_PATH or has neither pattern nor field.
+ */
+int query_parse(query_t *q, const char *target)
+{
+	size_t plen = strlen(QUERY_PATH);
+	const char *p;
+
+	if(strncmp(target, QUERY_PATH, plen) != 0 || (target[plen] != '?' && target[plen] != 0))
+		return -1;
+
+	p = target + plen;
+	while(*p == '?' || *p == '&'){
+		const char *key = p + 1;
+		const char *eq = strchr(key, '=');
+		const char *end = key + strcspn(key, "&");
+
+		p = end;
+		if(eq == NULL || eq > end)
+			continue;
+		if(eq - key == 1 && key[0] == 'q'){
+			free(q->pattern);
+			q->pattern = url_decode(eq + 1, end - eq - 1);
+		}else if(eq - key == 2 && strncmp(key, "re", 2) == 0){
+			q->regex = eq[1] == '1';
+		}else if(eq - key == 1 && key[0] == 'f'){
+			free(q->field);
+			q->field = url_decode(eq + 1, end - eq - 1);
+		}else if(eq - key == 5 && strncmp(key, "count", 5) == 0){
+			q->count = eq[1] == '1';
+		}else if(eq - key == 5 && strncmp(key, "limit", 5) == 0){
+			q->limit = parse_count(eq + 1, end - eq - 1);
+		}else if(eq - key == 6 && strncmp(key, "offset", 6) == 0){
+			q->offset = parse_count(eq + 1, end - eq - 1);
+		}else if(eq - key == 6 && strncmp(key, "follow", 6) == 0){
+			q->follow = eq[1] == '1';
+		}
+	}
+
+	// a count is a single number, there is nothing to follow
+	if(q->count)
+		q->follow = 0;
+
+	// an empty value is no value
+	if(q->pattern != NULL && q->pattern[0] == 0){
+		free(q->pattern);
+		q->pattern = NULL;
+	}
+	if(q->field != NULL && q->field[0] == 0){
+		free(q->field);
+		q->field = NULL;
+	}
+	if(q->pattern == NULL && q->field == NULL)
+		return -1;
+	return 0;
+}
+
+/**
+ * Compiles the pattern of a regular expression query, once per
+ * pattern thanks to the matcher cache.  Fixed strings need nothing.
+ *
+ * @param q A parsed query.
+ * @return 0 on success, -1 if the pattern is not a valid expression.
+ */
+int query_compile(query_t *q)
+{
+	if(!q->regex || q->pattern == NULL || q->matcher != NULL)
+		return 0;
+	return (q->matcher = matcher_get(q->pattern)) != NULL ? 0 : -1;
+}
+
+/**
+ * Writes the request target for a query, the inverse of query_parse().
+ *
+ * @param q The query.
+ * @param buf Where to write, null-terminated.
+ * @param size Size of buf.
+ * @return The length written, or -1 if buf is too small.
+ */
+int query_format(const query_t *q, char *buf, size_t size)
+{
+	int len = snprintf(buf, size, "%s?", QUERY_PATH);
+
+	if(len < 0 || (size_t)len >= size)
+		return -1;
+	if(q->pattern != NULL){
+		if((size_t)len + 2 >= size)
+			return -1;
+		strcpy(buf + len, "q=");
+		len = url_encode(buf, size, len + 2, q->pattern);
+	}
+	if(len >= 0 && q->field != NULL){
+		if((size_t)len + 3 >= size)
+			return -1;
+		strcpy(buf + len, q->pattern ? "&f=" : "f=");
+		len = url_encode(buf, size, len + strlen(buf + len), q->field);
+	}
+	if(len >= 0 && q->regex && q->pattern != NULL){
+		if((size_t)len + 5 >= size)
+			return -1;
+		strcpy(buf + len, "&re=1");
+		len += 5;
+	}
+	if(len >= 0 && q->count){
+		if((size_t)len + 8 >= size)
+			return -1;
+		strcpy(buf + len, "&count=1");
+		len += 8;
+	}
+	if(len >= 0 && q->limit > 0){
+		int n = snprintf(buf + len, size - len, "&limit=%ld", q->limit);
+		len = n < 0 || (size_t)(len + n) >= size ? -1 : len + n;
+	}
+	if(len >= 0 && q->offset > 0){
+		int n = snprintf(buf + len, size - len, "&offset=%ld", q->offset);
+		len = n < 0 || (size_t)(len + n) >= size ? -1 : len + n;
+	}
+	if(len >= 0 && q->follow && !q->count){
+		if((size_t)len + 9 >= size)
+			return -1;
+		strcpy(buf + len, "&follow=1");
+		len += 9;
+	}
+	return len;
+}
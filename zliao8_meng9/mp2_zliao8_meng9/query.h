@@ -0,0 +1,36 @@
+/** @file query.h */
+#ifndef __QUERY_H__
+#define __QUERY_H__
+
+#include <stddef.h>
+
+/* Path of the grep endpoint every node serves */
+#define QUERY_PATH "/grep"
+/* Room for the longest request target query_format() writes */
+#define QUERY_MAX_TARGET 4096
+
+struct matcher;
+
+/**
+ * A grep query, as carried in the URL of
+ * GET /grep?q=...[&re=1][&f=key:value][&count=1][&limit=n][&offset=n][&follow=1].
+ * At least one of pattern and field is set.
+ */
+typedef struct {
+	char *pattern; ///<What to look for, malloc'd, or NULL
+	char *field; ///<key:value token matching lines hold, malloc'd, or NULL
+	int regex; ///<pattern is an extended regular expression, not a fixed string
+	int count; ///<Answer with the number of matching lines, not the lines
+	long limit; ///<Stop after this many matching lines, 0 for no limit
+	long offset; ///<Leave out this many matching lines first
+	int follow; ///<Keep sending the matching lines appended to the log, never set with count
+	struct matcher *matcher; ///<Compiled pattern, set by query_compile()
+} query_t;
+
+void query_init(query_t *q);
+void query_free(query_t *q);
+int query_parse(query_t *q, const char *target);
+int query_compile(query_t *q);
+int query_format(const query_t *q, char *buf, size_t size);
+
+#endif
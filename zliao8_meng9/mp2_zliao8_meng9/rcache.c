@@ -0,0 +1,306 @@
+/** @file rcache.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rcache.h"
+
+#define RCACHE_BUCKETS 256
+
+static pthread_mutex_t rcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static rcache_entry_t *buckets[RCACHE_BUCKETS];
+static rcache_entry_t *lru_head;
+static rcache_entry_t *lru_tail;
+static rcache_stats_t stats;
+
+/** Internal use only. */
+static unsigned int hash(const char *s)
+{
+	unsigned int h = 5381;
+	while(*s)
+		h = (h << 5) + h + (unsigned char)*s++;
+	return h % RCACHE_BUCKETS;
+}
+
+/** Internal use only.  FNV-1a over len bytes. */
+static uint64_t hash_bytes(const char *p, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for(i = 0; i < len; i++){
+		h ^= (unsigned char)p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/** Internal use only.  Hash of the first bytes of a log. */
+static uint64_t head_hash(const char *map, uint64_t covered)
+{
+	return hash_bytes(map, covered < RCACHE_FINGERPRINT ? covered : RCACHE_FINGERPRINT);
+}
+
+/** Internal use only.  Hash of the bytes just before covered. */
+static uint64_t tail_hash(const char *map, uint64_t covered)
+{
+	uint64_t len = covered < RCACHE_FINGERPRINT ? covered : RCACHE_FINGERPRINT;
+	return hash_bytes(map + covered - len, len);
+}
+
+/** Internal use only.  Bytes charged to the capacity for an entry. */
+static size_t entry_cost(rcache_entry_t *e)
+{
+	return e->len + strlen(e->key) + sizeof(rcache_entry_t);
+}
+
+/** Internal use only. */
+static void entry_free(rcache_entry_t *e)
+{
+	free(e->key);
+	free(e->data);
+	free(e);
+}
+
+/** Internal use only.  Takes e out of the table, lock held. */
+static void entry_unlink(rcache_entry_t *e)
+{
+	rcache_entry_t **pp = &buckets[hash(e->key)];
+
+	while(*pp != e)
+		pp = &(*pp)->hnext;
+	*pp = e->hnext;
+
+	if(e->prev)
+		e->prev->next = e->next;
+	else
+		lru_head = e->next;
+	if(e->next)
+		e->next->prev = e->prev;
+	else
+		lru_tail = e->prev;
+
+	stats.bytes -= entry_cost(e);
+	stats.entries--;
+
+	if(--e->refs == 0)
+		entry_free(e);
+}
+
+/** Internal use only.  Finds an entry, lock held. */
+static rcache_entry_t *entry_find(const char *key)
+{
+	rcache_entry_t *e;
+
+	for(e = buckets[hash(key)]; e != NULL; e = e->hnext){
+		if(strcmp(e->key, key) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/**
+ * Initializes the cache.  Should always be called first.
+ *
+ * @param capacity Maximum number of bytes held, 0 disables the cache.
+ * @return 0
+ */
+int rcache_init(size_t capacity)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.capacity = capacity;
+	return 0;
+}
+
+/**
+ * Frees every entry not referenced by a reader.  Should always be
+ * called last.
+ */
+void rcache_destroy(void)
+{
+	pthread_mutex_lock(&rcache_lock);
+	while(lru_head != NULL)
+		entry_unlink(lru_head);
+	stats.capacity = 0;
+	pthread_mutex_unlock(&rcache_lock);
+}
+
+/**
+ * Returns the largest result worth caching.  Bigger ones are computed
+ * every time so one of them cannot flush the whole cache.
+ */
+size_t rcache_max_entry(void)
+{
+	return stats.capacity / 16;
+}
+
+/**
+ * Looks up the result of a query on a log.  The entry is only returned
+ * if it was computed on this very file and the bytes it covers are
+ * still there: a rotated log is another inode, and a log truncated or
+ * rewritten in place no longer has the same first bytes, or the same
+ * bytes where the result ends.  Such an entry is dropped.
+ *
+ * @param key The query and the log, see rcache_insert().
+ * @param dev Device of the log.
+ * @param ino Inode of the log.
+ * @param map The log, mapped.
+ * @param size Current size of the log.
+ * @return The entry, to be given back with rcache_release().  Only the
+ *         bytes from e->covered on have to be scanned.
+ * @return NULL on a miss.
+ */
+rcache_entry_t *rcache_lookup(const char *key, dev_t dev, ino_t ino, const char *map, uint64_t size)
+{
+	rcache_entry_t *e;
+
+	if(stats.capacity == 0)
+		return NULL;
+
+	pthread_mutex_lock(&rcache_lock);
+	e = entry_find(key);
+	if(e != NULL && (e->dev != dev || e->ino != ino || e->covered > size)){
+		entry_unlink(e);
+		stats.invalidations++;
+		e = NULL;
+	}
+	if(e == NULL){
+		stats.misses++;
+		pthread_mutex_unlock(&rcache_lock);
+		return NULL;
+	}
+	e->refs++;
+	pthread_mutex_unlock(&rcache_lock);
+
+	// hashing touches the log, which may have to come from the disk
+	int same = head_hash(map, e->covered) == e->head_hash &&
+	           tail_hash(map, e->covered) == e->tail_hash;
+
+	pthread_mutex_lock(&rcache_lock);
+	if(!same){
+		if(entry_find(key) == e){
+			entry_unlink(e);
+			stats.invalidations++;
+		}
+		stats.misses++;
+		if(--e->refs == 0)
+			entry_free(e);
+		pthread_mutex_unlock(&rcache_lock);
+		return NULL;
+	}
+
+	// move to the front of the LRU list, unless another query
+	// replaced it meanwhile
+	if(entry_find(key) == e && e != lru_head){
+		e->prev->next = e->next;
+		if(e->next)
+			e->next->prev = e->prev;
+		else
+			lru_tail = e->prev;
+		e->prev = NULL;
+		e->next = lru_head;
+		lru_head->prev = e;
+		lru_head = e;
+	}
+	stats.hits++;
+	stats.bytes_saved += e->covered;
+	pthread_mutex_unlock(&rcache_lock);
+	return e;
+}
+
+/**
+ * Gives back an entry obtained from rcache_lookup().
+ *
+ * @param e The entry.
+ */
+void rcache_release(rcache_entry_t *e)
+{
+	pthread_mutex_lock(&rcache_lock);
+	if(--e->refs == 0)
+		entry_free(e);
+	pthread_mutex_unlock(&rcache_lock);
+}
+
+/**
+ * Stores the result of a query over the first covered bytes of a log,
+ * evicting the least recently used entries to make room.  A result
+ * covering less of the same log than the one already stored, e.g. from
+ * a slower concurrent query, is dropped.
+ *
+ * @param key The query and the log, e.g. the request target and path.
+ * @param dev Device of the log.
+ * @param ino Inode of the log.
+ * @param map The log, mapped.
+ * @param covered Bytes of the log searched, at the end of a line.
+ * @param data The matching lines, malloc'd.  Always owned by the cache.
+ * @param len Length of data in bytes.
+ * @param lines Number of lines in data.
+ * @return void
+ */
+void rcache_insert(const char *key, dev_t dev, ino_t ino, const char *map, uint64_t covered,
+                   char *data, size_t len, long lines)
+{
+	rcache_entry_t *e, *old;
+
+	if(stats.capacity == 0 || len > rcache_max_entry()){
+		free(data);
+		return;
+	}
+
+	e = calloc(1, sizeof(rcache_entry_t));
+	e->key = strdup(key);
+	e->dev = dev;
+	e->ino = ino;
+	e->covered = covered;
+	e->head_hash = head_hash(map, covered);
+	e->tail_hash = tail_hash(map, covered);
+	e->data = data;
+	e->len = len;
+	e->lines = lines;
+	e->refs = 1;
+
+	pthread_mutex_lock(&rcache_lock);
+	if((old = entry_find(key)) != NULL){
+		if(old->dev == dev && old->ino == ino && old->covered >= covered){
+			pthread_mutex_unlock(&rcache_lock);
+			entry_free(e);
+			return;
+		}
+		entry_unlink(old);
+	}
+
+	while(lru_tail != NULL && stats.bytes + entry_cost(e) > stats.capacity){
+		entry_unlink(lru_tail);
+		stats.evictions++;
+	}
+
+	unsigned int h = hash(key);
+	e->hnext = buckets[h];
+	buckets[h] = e;
+	e->prev = NULL;
+	e->next = lru_head;
+	if(lru_head)
+		lru_head->prev = e;
+	else
+		lru_tail = e;
+	lru_head = e;
+
+	stats.bytes += entry_cost(e);
+	stats.entries++;
+	stats.inserts++;
+	pthread_mutex_unlock(&rcache_lock);
+}
+
+/**
+ * Copies the counters.
+ *
+ * @param out Filled with the current values.
+ */
+void rcache_get_stats(rcache_stats_t *out)
+{
+	pthread_mutex_lock(&rcache_lock);
+	*out = stats;
+	pthread_mutex_unlock(&rcache_lock);
+}
@@ -0,0 +1,59 @@
+/** @file rcache.h */
+#ifndef __RCACHE_H__
+#define __RCACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RCACHE_DEFAULT_CAPACITY (64 * 1024 * 1024)
+/* Bytes hashed at the start of the log and before the end of a result */
+#define RCACHE_FINGERPRINT 4096
+
+/**
+ * The matching lines of one query over the first covered bytes of a
+ * log.  Entries handed out by rcache_lookup() stay valid until
+ * rcache_release().
+ */
+typedef struct rcache_entry {
+	char *key; ///<The query and the log it ran on
+	dev_t dev; ///<Device of the log
+	ino_t ino; ///<Inode of the log, a rotated log is another file
+	uint64_t covered; ///<Log bytes the result covers, up to the end of a line
+	uint64_t head_hash; ///<Hash of the first bytes of the log
+	uint64_t tail_hash; ///<Hash of the bytes just before covered
+	char *data; ///<Matching lines, each terminated by '\n'
+	size_t len; ///<Length of data in bytes
+	long lines; ///<Number of lines in data
+	int refs; ///<References held by readers, plus one while in the table
+	struct rcache_entry *hnext; ///<Next entry in the same hash bucket
+	struct rcache_entry *prev; ///<LRU neighbours, most recently used first
+	struct rcache_entry *next;
+} rcache_entry_t;
+
+/**
+ * Counters, see rcache_get_stats().
+ */
+typedef struct {
+	unsigned long hits; ///<Queries that only scanned what was appended
+	unsigned long misses; ///<Queries that scanned the whole log
+	unsigned long inserts; ///<Results stored or extended
+	unsigned long evictions; ///<Entries dropped to stay under capacity
+	unsigned long invalidations; ///<Entries dropped because the log was replaced
+	unsigned long long bytes_saved; ///<Log bytes hits did not have to scan
+	size_t bytes; ///<Bytes currently held
+	size_t capacity; ///<Maximum bytes held
+	unsigned int entries; ///<Number of cached results
+} rcache_stats_t;
+
+int rcache_init(size_t capacity);
+void rcache_destroy(void);
+
+size_t rcache_max_entry(void);
+rcache_entry_t *rcache_lookup(const char *key, dev_t dev, ino_t ino, const char *map, uint64_t size);
+void rcache_release(rcache_entry_t *e);
+void rcache_insert(const char *key, dev_t dev, ino_t ino, const char *map, uint64_t covered,
+                   char *data, size_t len, long lines);
+void rcache_get_stats(rcache_stats_t *stats);
+
+#endif
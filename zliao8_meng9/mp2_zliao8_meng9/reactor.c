@@ -0,0 +1,851 @@
+/** @file reactor.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "netio.h"
+#include "listener.h"
+#include "wheel.h"
+#include "reactor.h"
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+#define REACTOR_MAX_EVENTS 256
+#define CONN_INITIAL_BUFFER 1024
+#define CONN_MAX_PENDING (64 * 1024)
+/* Output queued on a connection above which its requests wait */
+#define CONN_MAX_QUEUED (256 * 1024)
+#define REACTOR_TICK_MS 100
+
+/**
+ * Private.  One edge-triggered epoll loop running on its own thread.
+ */
+struct reactor {
+	int epfd; ///<epoll instance holding the listener and all owned clients
+	int wakefd; ///<eventfd used to interrupt epoll_wait()
+	int listen_fd; ///<Listening socket, shared or owned by this reactor
+	request_handler_t handler; ///<Application callback
+	pthread_t thread; ///<Thread running reactor_run()
+	conn_t *conns; ///<Open connections, for shutdown
+	pool_t *pool; ///<Workers for conn_defer(), may be NULL
+	queue_t done; ///<Deferred connections handed back by the workers
+	pthread_mutex_t done_lock; ///<Guards done
+	unsigned long accepted; ///<Connections accepted by this reactor
+	unsigned int queue_peak; ///<Longest accept queue seen on listen_fd
+	unsigned int queue_max; ///<Backlog of listen_fd
+	wheel_t wheel; ///<Deadlines of the owned connections
+	unsigned long timeouts[CONN_PHASES]; ///<Connections closed per expired phase
+};
+
+static reactor_t *reactors;
+static int reactor_count;
+static int listener_count;
+static unsigned long phase_timeout[CONN_PHASES] = {
+	REACTOR_DEFAULT_IDLE_TIMEOUT,
+	REACTOR_DEFAULT_HEADER_TIMEOUT,
+	REACTOR_DEFAULT_BODY_TIMEOUT
+};
+static volatile int reactor_exit;
+/* Readable once reactor_cancel_jobs() was called, ends the jobs' sends */
+static int cancel_fd = -1;
+
+/* Sentinels stored in epoll_event.data.ptr for the non-client fds */
+static char listen_tag;
+static char wake_tag;
+
+/** Internal use only. */
+static int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if(flags < 0)
+		return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/** Internal use only.  Makes room for at least want more bytes. */
+static int buffer_reserve(char **buf, size_t *cap, size_t len, size_t want)
+{
+	size_t size = *cap ? *cap : CONN_INITIAL_BUFFER;
+	char *p;
+
+	while(size - len < want)
+		size <<= 1;
+	if(size == *cap)
+		return 0;
+	if((p = realloc(*buf, size)) == NULL)
+		return -1;
+	*buf = p;
+	*cap = size;
+	return 0;
+}
+
+/** Internal use only.  Unregisters, closes and frees a connection. */
+static void conn_close(conn_t *c)
+{
+	reactor_t *r = c->reactor;
+
+	epoll_ctl(r->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	wheel_del(&r->wheel, &c->timer);
+
+	if(c->prev)
+		c->prev->next = c->next;
+	else
+		r->conns = c->next;
+	if(c->next)
+		c->next->prev = c->prev;
+
+	http_free(&c->req);
+	http_buf_free(&c->in);
+	free(c->out);
+	free(c);
+}
+
+/**
+ * Sends as much of the pending output as the socket accepts.
+ *
+ * @param c The connection.
+ * @return 0 when everything queued has been sent or the socket is full.
+ * @return -1 if the peer is gone.
+ */
+static int conn_flush(conn_t *c)
+{
+	while(c->out_off < c->out_len){
+		ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+		if(n > 0){
+			c->out_off += n;
+		}else if(n < 0 && errno == EINTR){
+			continue;
+		}else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+			// EPOLLOUT will tell us when to continue
+			return 0;
+		}else{
+			return -1;
+		}
+	}
+	c->out_off = 0;
+	c->out_len = 0;
+	return 0;
+}
+
+/**
+ * Queues bytes for sending on the connection and tries to send them
+ * right away.  Safe to call only from the owning reactor thread.
+ *
+ * @param c The connection.
+ * @param buf The data to send.
+ * @param len Length of that data in bytes.
+ * @return 0 on success.
+ * @return -1 if the connection is broken.
+ */
+int conn_write(conn_t *c, const void *buf, size_t len)
+{
+	if(buffer_reserve(&c->out, &c->out_cap, c->out_len, len) < 0)
+		return -1;
+	memcpy(c->out + c->out_len, buf, len);
+	c->out_len += len;
+	return conn_flush(c);
+}
+
+/**
+ * Sends several buffers with one system call, copying into the output
+ * queue only what the socket does not take right away.  Safe to call
+ * only from the owning reactor thread.
+ *
+ * @param c The connection.
+ * @param iov The buffers to send, in order.
+ * @param iovcnt Number of buffers.
+ * @return 0 on success.
+ * @return -1 if the connection is broken.
+ */
+int conn_writev(conn_t *c, const struct iovec *iov, int iovcnt)
+{
+	size_t sent = 0;
+	int i;
+
+	if(c->out_len == 0){
+		struct msghdr msg;
+		ssize_t n;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = (struct iovec *)iov;
+		msg.msg_iovlen = iovcnt;
+		while((n = sendmsg(c->fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+			;
+		if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		if(n > 0)
+			sent = n;
+	}
+
+	for(i = 0; i < iovcnt; i++){
+		size_t len = iov[i].iov_len;
+		const char *base = iov[i].iov_base;
+		if(sent >= len){
+			sent -= len;
+			continue;
+		}
+		if(buffer_reserve(&c->out, &c->out_cap, c->out_len, len - sent) < 0)
+			return -1;
+		memcpy(c->out + c->out_len, base + sent, len - sent);
+		c->out_len += len - sent;
+		sent = 0;
+	}
+	return 0;
+}
+
+/**
+ * Reads everything the kernel has for the connection.  With
+ * edge-triggered notifications we must drain the socket until EAGAIN.
+ *
+ * @return 1 if the peer closed its side, 0 if more data may come,
+ *         2 if CONN_MAX_PENDING bytes wait to be parsed, -1 on error.
+ */
+static int conn_fill(conn_t *c)
+{
+	while(1){
+		ssize_t n = http_buf_fill(&c->in, c->fd);
+		if(n > 0){
+			if(http_buf_pending(&c->in) >= CONN_MAX_PENDING)
+				return 2;
+			continue;
+		}else if(n == 0){
+			return 1;
+		}else if(errno == EINTR){
+			continue;
+		}else if(errno == EAGAIN || errno == EWOULDBLOCK){
+			return 0;
+		}else{
+			return -1;
+		}
+	}
+}
+
+/**
+ * Internal use only.  Says whether so much output waits for the client
+ * that no more requests should be answered until it reads some.
+ */
+static int conn_backlogged(const conn_t *c)
+{
+	return c->out_len - c->out_off > CONN_MAX_QUEUED;
+}
+
+/**
+ * Hands every complete request in the input buffer to the handler, in
+ * the order they arrived.  Stops early while a deferred job runs so a
+ * later pipelined response cannot overtake it, and while the client
+ * leaves CONN_MAX_QUEUED bytes of responses unread, so a client that
+ * pipelines requests and never reads cannot grow the output queue
+ * without bound.
+ *
+ * @return 0 to keep the connection, -1 if it must be dropped now.
+ */
+static int conn_process(conn_t *c)
+{
+	reactor_t *r = c->reactor;
+
+	while(!c->closing && !c->busy && !conn_backlogged(c)){
+		// a partial request keeps its parser state in c->req
+		int len = http_next(&c->req, &c->in);
+		if(len == 0)
+			break;
+		if(len < 0){
+			printf("No HTTP request could be processed... \n");
+			return -1;
+		}
+
+		if(r->handler(c, &c->req))
+			c->closing = 1;
+		http_free(&c->req);
+		http_init(&c->req);
+		// the next request gets deadlines of its own, see conn_arm()
+		wheel_del(&r->wheel, &c->timer);
+	}
+	return 0;
+}
+
+/** Internal use only.  A deadline passed, drop the connection. */
+static void conn_expire(void *arg)
+{
+	conn_t *c = arg;
+
+	c->reactor->timeouts[c->phase]++;
+	conn_close(c);
+}
+
+/**
+ * Internal use only.  Arms the deadline that matches what the
+ * connection waits for.  The idle deadline moves with every event,
+ * while a request must arrive within the header and body deadlines
+ * counted from its first byte, however slowly it trickles in.  A
+ * pipelined request is counted from the end of the one before it,
+ * conn_process() drops the deadline whenever a request is complete.
+ * Requests held back while the client does not read its responses
+ * wait under the idle deadline, like any unread output.
+ */
+static void conn_arm(conn_t *c)
+{
+	reactor_t *r = c->reactor;
+	int phase;
+
+	if(c->closing || c->throttled || http_buf_pending(&c->in) == 0)
+		phase = CONN_IDLE;
+	else if(c->req.state == HTTP_STATE_BODY)
+		phase = CONN_BODY;
+	else
+		phase = CONN_HEADER;
+
+	if(phase == c->phase && phase != CONN_IDLE && wheel_pending(&c->timer))
+		return;
+	c->phase = phase;
+	if(phase_timeout[phase] > 0)
+		wheel_add(&r->wheel, &c->timer, phase_timeout[phase]);
+	else
+		wheel_del(&r->wheel, &c->timer);
+}
+
+/** Internal use only. */
+static void conn_event(conn_t *c, uint32_t events)
+{
+	int eof = 0;
+
+	if(c->busy){
+		// a pool worker owns the socket, just remember errors
+		if(events & (EPOLLERR | EPOLLHUP))
+			c->dead = 1;
+		return;
+	}
+
+	// output first, it may let a throttled connection go on
+	if((events & EPOLLOUT) && conn_flush(c) < 0){
+		conn_close(c);
+		return;
+	}
+	if((events & EPOLLIN) || (c->throttled && !conn_backlogged(c))){
+		// parse as we go so a flood of pipelined requests does not
+		// have to fit in memory at once
+		do{
+			if((eof = conn_fill(c)) < 0 || conn_process(c) < 0){
+				conn_close(c);
+				return;
+			}
+		}while(eof == 2 && !c->busy && !c->closing && !conn_backlogged(c));
+
+		// anything the peer sent meanwhile is picked up on resume,
+		// or once the client read enough of its responses
+		if(c->busy)
+			return;
+		c->throttled = conn_backlogged(c);
+		if(eof == 2)
+			eof = 0;
+	}
+	if(events & (EPOLLERR | EPOLLHUP)){
+		conn_close(c);
+		return;
+	}
+	if((c->closing || eof) && c->out_len == 0){
+		conn_close(c);
+		return;
+	}
+	conn_arm(c);
+}
+
+/**
+ * Internal use only.  How long a job's send may wait for a full
+ * socket: a client that stops reading is dropped after the idle
+ * deadline, as on the reactor.  Sets stalled if the send gave up.
+ */
+static int conn_job_send(conn_t *c, int rc)
+{
+	if(rc < 0 && errno == ETIMEDOUT)
+		c->stalled = 1;
+	return rc;
+}
+
+/** Internal use only.  The limit of a job's sends, see conn_job_send(). */
+static void conn_job_limit(net_limit_t *limit)
+{
+	unsigned long ms = phase_timeout[CONN_IDLE];
+
+	limit->timeout_ms = ms == 0 ? -1 : ms > INT_MAX ? INT_MAX : (int)ms;
+	limit->cancel_fd = cancel_fd;
+}
+
+/**
+ * Sends the whole buffer, waiting whenever the socket is full, but no
+ * longer than the idle deadline without progress.  For conn_defer()
+ * jobs only, the reactor itself never blocks.
+ *
+ * @param c The connection.
+ * @param buf The data to send.
+ * @param len Length of that data in bytes.
+ * @param flags Extra send() flags, e.g. MSG_MORE when a body follows.
+ * @return 0 on success.
+ * @return -1 if the connection is broken or the client stopped reading.
+ */
+int conn_send_all(conn_t *c, const void *buf, size_t len, int flags)
+{
+	net_limit_t limit;
+
+	conn_job_limit(&limit);
+	return conn_job_send(c, net_send_all(c->fd, buf, len, flags, &limit));
+}
+
+/**
+ * Sends several buffers with one sendmsg(), waiting for the socket as
+ * conn_send_all() does.  For conn_defer() jobs only.
+ *
+ * @param c The connection.
+ * @param iov The buffers to send, in order.
+ * @param iovcnt Number of buffers, at most NETIO_MAX_IOV.
+ * @param flags Extra sendmsg() flags, e.g. MSG_MORE.
+ * @return 0 on success.
+ * @return -1 if the connection is broken or the client stopped reading.
+ */
+int conn_sendv_all(conn_t *c, const struct iovec *iov, int iovcnt, int flags)
+{
+	net_limit_t limit;
+
+	conn_job_limit(&limit);
+	return conn_job_send(c, net_sendv_all(c->fd, iov, iovcnt, flags, &limit));
+}
+
+/**
+ * Streams part of a file to the connection without copying it through
+ * user space, waiting for the socket as conn_send_all() does.  For
+ * conn_defer() jobs only.
+ *
+ * @param c The connection.
+ * @param fd A file opened for reading.
+ * @param offset Where in the file to start.
+ * @param count Number of bytes to send.
+ * @return 0 on success.
+ * @return -1 if the connection is broken, the client stopped reading
+ *         or the file ended early.
+ */
+int conn_send_file(conn_t *c, int fd, off_t offset, size_t count)
+{
+	net_limit_t limit;
+
+	conn_job_limit(&limit);
+	return conn_job_send(c, net_sendfile_all(c->fd, fd, offset, count, &limit));
+}
+
+/** Internal use only.  Runs a deferred job on a pool worker. */
+static void conn_run_job(void *ptr)
+{
+	conn_t *c = ptr;
+	reactor_t *r = c->reactor;
+	uint64_t one = 1;
+
+	// responses to earlier pipelined requests go out first
+	c->job_result = -1;
+	if(conn_send_all(c, c->out + c->out_off, c->out_len - c->out_off, 0) == 0){
+		c->out_off = 0;
+		c->out_len = 0;
+		c->job_result = c->job(c, c->job_arg);
+	}
+
+	pthread_mutex_lock(&r->done_lock);
+	queue_enqueue(&r->done, c);
+	pthread_mutex_unlock(&r->done_lock);
+	if(write(r->wakefd, &one, sizeof(one)) < 0)
+		perror("write");
+}
+
+/**
+ * Moves the rest of the current request to a pool worker, for work
+ * that may block such as disk reads.  The reactor stops serving the
+ * connection until job returns, so pipelined responses stay in order.
+ * On success the caller must not touch c again.
+ *
+ * @param c The connection.
+ * @param job Function run on the worker.
+ * @param arg Pass through variable to job, owned by job.
+ * @return 0 if the job was queued.
+ * @return -1 if there is no pool or its queue is full.
+ */
+int conn_defer(conn_t *c, conn_job_t job, void *arg)
+{
+	return conn_defer_on(c, c->reactor->pool, job, arg);
+}
+
+/**
+ * Like conn_defer(), on a pool of the caller's choosing.  Jobs that
+ * hold their connection for a long time, such as responses that never
+ * end by themselves, get a pool of their own so they cannot take every
+ * worker the short requests need.  The pool must be destroyed before
+ * reactor_stop_all().
+ *
+ * @param c The connection.
+ * @param pool Workers to run job on.
+ * @param job Function run on the worker.
+ * @param arg Pass through variable to job, owned by job.
+ * @return 0 if the job was queued.
+ * @return -1 if there is no pool or its queue is full.
+ */
+int conn_defer_on(conn_t *c, pool_t *pool, conn_job_t job, void *arg)
+{
+	reactor_t *r = c->reactor;
+
+	if(pool == NULL)
+		return -1;
+
+	// the worker may take as long as it needs, only its sends have a
+	// deadline meanwhile, see conn_send_all()
+	wheel_del(&r->wheel, &c->timer);
+	c->busy = 1;
+	c->job = job;
+	c->job_arg = arg;
+	if(pool_try_submit(pool, conn_run_job, c) < 0){
+		c->busy = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/** Internal use only.  Takes back connections whose job has finished. */
+static void reactor_resume(reactor_t *r)
+{
+	conn_t *c;
+
+	while(1){
+		pthread_mutex_lock(&r->done_lock);
+		c = queue_dequeue(&r->done);
+		pthread_mutex_unlock(&r->done_lock);
+		if(c == NULL)
+			break;
+
+		c->busy = 0;
+		c->job = NULL;
+		c->job_arg = NULL;
+		if(c->stalled){
+			// the client stopped reading, as with unread output on
+			// the reactor
+			r->timeouts[CONN_IDLE]++;
+			conn_close(c);
+			continue;
+		}
+		if(c->job_result < 0 || c->dead){
+			conn_close(c);
+			continue;
+		}
+		if(c->job_result)
+			c->closing = 1;
+
+		// events that arrived meanwhile were ignored, look again
+		conn_event(c, EPOLLIN | EPOLLOUT);
+	}
+}
+
+/** Internal use only.  Accepts every pending connection on the listener. */
+static void reactor_accept(reactor_t *r)
+{
+	unsigned int len, max;
+
+	// sample the queue before draining it, for reactor_get_stats()
+	if(listener_queue(r->listen_fd, &len, &max) == 0){
+		if(len > r->queue_peak)
+			r->queue_peak = len;
+		r->queue_max = max;
+	}
+
+	while(1){
+		int fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0){
+			if(errno == EINTR)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("accept");
+			return;
+		}
+
+		r->accepted++;
+		conn_t *c = calloc(1, sizeof(conn_t));
+		c->fd = fd;
+		c->reactor = r;
+		http_init(&c->req);
+		wheel_timer_init(&c->timer, conn_expire, c);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = c;
+		if(epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0){
+			perror("epoll_ctl");
+			close(fd);
+			free(c);
+			continue;
+		}
+		c->next = r->conns;
+		if(r->conns)
+			r->conns->prev = c;
+		r->conns = c;
+		conn_arm(c);
+	}
+}
+
+/** Internal use only.  Thread body of one reactor. */
+static void *reactor_run(void *ptr)
+{
+	reactor_t *r = ptr;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	while(!reactor_exit){
+		int n = epoll_wait(r->epfd, events, REACTOR_MAX_EVENTS,
+		                   wheel_next_timeout(&r->wheel, wheel_now_ms()));
+		if(n < 0){
+			if(errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		int i, woken = 0;
+		for(i = 0; i < n; i++){
+			void *tag = events[i].data.ptr;
+			if(tag == &listen_tag){
+				reactor_accept(r);
+			}else if(tag == &wake_tag){
+				woken = 1;
+			}else{
+				conn_event(tag, events[i].events);
+			}
+		}
+
+		// resuming may close a connection that still has an entry
+		// in events, so only do it once the batch is done
+		if(woken){
+			uint64_t v;
+			if(read(r->wakefd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+				perror("read");
+			reactor_resume(r);
+		}
+
+		// expired connections are closed only now, for the same reason
+		wheel_advance(&r->wheel, wheel_now_ms());
+	}
+
+	while(r->conns != NULL)
+		conn_close(r->conns);
+	return NULL;
+}
+
+/**
+ * Starts the reactor threads.
+ *
+ * With one listening socket, n reactors share it: every reactor
+ * registers it with EPOLLEXCLUSIVE so a new connection wakes only one
+ * of them.  With several sockets (SO_REUSEPORT on the same port), each
+ * reactor owns one of them and is pinned to a core, so the kernel
+ * shards connections across cores and nothing is shared on accept.
+ * Either way the reactor that accepts a connection serves it until it
+ * is closed.
+ *
+ * @param listen_fds Sockets already in the listening state.
+ * @param nlisten Number of sockets; if more than one, n is ignored and
+ *                one reactor is started per socket.
+ * @param n Number of reactors, or <= 0 for one per online core.
+ * @param handler Callback invoked for every complete request.
+ * @param pool Workers for conn_defer(), or NULL if jobs are not used.
+ *             Must be destroyed before reactor_stop_all().
+ * @return The number of reactors started, or -1 on error, including
+ *         when they already run; on error none is left running.
+ */
+int reactor_start_all(const int *listen_fds, int nlisten, int n, request_handler_t handler, pool_t *pool)
+{
+	int i;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(cores <= 0)
+		cores = 1;
+	if(nlisten > 1)
+		n = nlisten;
+	if(n <= 0)
+		n = cores;
+
+	for(i = 0; i < nlisten; i++){
+		if(set_nonblocking(listen_fds[i]) < 0){
+			perror("fcntl");
+			return -1;
+		}
+	}
+
+	// the threads of a running set still use the array
+	if(reactors != NULL){
+		fprintf(stderr, "---ERROR; the reactors are already running\n");
+		return -1;
+	}
+	if((cancel_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0){
+		perror("eventfd");
+		return -1;
+	}
+	reactors = calloc(n, sizeof(reactor_t));
+	reactor_exit = 0;
+	reactor_count = 0;
+	listener_count = nlisten;
+
+	for(i = 0; i < n; i++){
+		reactor_t *r = &reactors[i];
+		struct epoll_event ev;
+
+		r->listen_fd = nlisten > 1 ? listen_fds[i] : listen_fds[0];
+		r->handler = handler;
+		r->conns = NULL;
+		r->pool = pool;
+		queue_init(&r->done);
+		pthread_mutex_init(&r->done_lock, NULL);
+		wheel_init(&r->wheel, wheel_now_ms(), REACTOR_TICK_MS);
+
+		if((r->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+			perror("epoll_create1");
+			reactor_stop_all();
+			return -1;
+		}
+		if((r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0){
+			perror("eventfd");
+			close(r->epfd);
+			reactor_stop_all();
+			return -1;
+		}
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = &wake_tag;
+		epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev);
+
+		// a shared listener must not wake every reactor at once
+		ev.events = nlisten > 1 ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.ptr = &listen_tag;
+		if(epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->listen_fd, &ev) < 0){
+			perror("epoll_ctl");
+			close(r->epfd);
+			close(r->wakefd);
+			reactor_stop_all();
+			return -1;
+		}
+
+		int rc = pthread_create(&r->thread, NULL, reactor_run, r);
+		if(rc){
+			fprintf(stderr, "---ERROR; pthread_create failed, return code is %d\n", rc);
+			close(r->epfd);
+			close(r->wakefd);
+			reactor_stop_all();
+			return -1;
+		}
+		reactor_count++;
+
+		if(nlisten > 1){
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(i % cores, &set);
+			if((rc = pthread_setaffinity_np(r->thread, sizeof(set), &set)) != 0)
+				fprintf(stderr, "---WARNING; pinning reactor %d failed, return code is %d\n", i, rc);
+		}
+	}
+
+	return reactor_count;
+}
+
+/**
+ * Sets the connection deadlines.  Call before reactor_start_all().
+ *
+ * @param idle_ms How long a connection may sit between requests, or
+ *                with a response the client does not read, on the
+ *                reactor or in a conn_defer() job.
+ * @param header_ms How long a request may take to send its headers.
+ * @param body_ms How long a request may take to send its body.
+ *                A value of 0 disables that deadline.
+ * @return void
+ */
+void reactor_set_timeouts(unsigned long idle_ms, unsigned long header_ms, unsigned long body_ms)
+{
+	phase_timeout[CONN_IDLE] = idle_ms;
+	phase_timeout[CONN_HEADER] = header_ms;
+	phase_timeout[CONN_BODY] = body_ms;
+}
+
+/**
+ * Makes every send of a deferred job fail at once, now and later, so
+ * the pools can be destroyed without waiting for clients that do not
+ * read.  Call on shutdown, before the pools are destroyed.
+ *
+ * @return void
+ */
+void reactor_cancel_jobs(void)
+{
+	uint64_t one = 1;
+
+	if(cancel_fd >= 0 && write(cancel_fd, &one, sizeof(one)) < 0)
+		perror("write");
+}
+
+/**
+ * Sums the accept and timeout counters of all reactors.  The values are read
+ * without locking and may be slightly stale.
+ *
+ * @param stats Filled with the counters.
+ * @return void
+ */
+void reactor_get_stats(reactor_stats_t *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->reactors = reactor_count;
+	stats->listeners = listener_count;
+	for(i = 0; i < reactor_count; i++){
+		stats->accepted += reactors[i].accepted;
+		if(reactors[i].queue_peak > stats->queue_peak)
+			stats->queue_peak = reactors[i].queue_peak;
+		if(reactors[i].queue_max > stats->queue_max)
+			stats->queue_max = reactors[i].queue_max;
+		stats->timeouts_idle += reactors[i].timeouts[CONN_IDLE];
+		stats->timeouts_header += reactors[i].timeouts[CONN_HEADER];
+		stats->timeouts_body += reactors[i].timeouts[CONN_BODY];
+	}
+}
+
+/**
+ * Stops all reactors, closes their connections and waits for the
+ * threads to finish.
+ */
+void reactor_stop_all(void)
+{
+	int i;
+	uint64_t one = 1;
+
+	reactor_exit = 1;
+	for(i = 0; i < reactor_count; i++){
+		if(write(reactors[i].wakefd, &one, sizeof(one)) < 0)
+			perror("write");
+	}
+
+	for(i = 0; i < reactor_count; i++){
+		pthread_join(reactors[i].thread, NULL);
+		close(reactors[i].epfd);
+		close(reactors[i].wakefd);
+		queue_destroy(&reactors[i].done);
+		pthread_mutex_destroy(&reactors[i].done_lock);
+	}
+
+	free(reactors);
+	reactors = NULL;
+	reactor_count = 0;
+	listener_count = 0;
+	if(cancel_fd >= 0)
+		close(cancel_fd);
+	cancel_fd = -1;
+}
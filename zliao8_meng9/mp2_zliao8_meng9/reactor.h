@@ -0,0 +1,98 @@
+/** @file reactor.h */
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "libhttp.h"
+#include "pool.h"
+#include "wheel.h"
+
+/* Default deadlines in milliseconds, see reactor_set_timeouts() */
+#define REACTOR_DEFAULT_IDLE_TIMEOUT 60000
+#define REACTOR_DEFAULT_HEADER_TIMEOUT 10000
+#define REACTOR_DEFAULT_BODY_TIMEOUT 30000
+
+/* What a connection is waiting for, each with its own deadline */
+#define CONN_IDLE 0
+#define CONN_HEADER 1
+#define CONN_BODY 2
+#define CONN_PHASES 3
+
+typedef struct reactor reactor_t;
+typedef struct conn conn_t;
+
+/**
+ * Blocking part of a request, run on a pool worker by conn_defer().
+ * Writes its response with conn_send_all() and conn_send_file().
+ *
+ * @return 1 if the connection must be closed afterwards, 0 to keep it,
+ *         -1 if the connection is broken.
+ */
+typedef int (*conn_job_t)(conn_t *c, void *arg);
+
+/**
+ * Client connection.  Owned by exactly one reactor for its whole life.
+ */
+struct conn {
+	int fd; ///<Non-blocking client socket
+	reactor_t *reactor; ///<Reactor whose epoll set holds fd
+	http_buf_t in; ///<Bytes received, kept across pipelined requests
+	http_t req; ///<Request being parsed, points into in
+	char *out; ///<Bytes queued for sending
+	size_t out_off; ///<Bytes of out already sent
+	size_t out_len; ///<Number of valid bytes in out
+	size_t out_cap; ///<Allocated size of out
+	int closing; ///<Close once out has drained
+	int throttled; ///<Requests left unparsed until out drains below CONN_MAX_QUEUED
+	int busy; ///<A pool worker owns the socket, the reactor leaves it alone
+	int dead; ///<Error reported while busy, close when the job returns
+	conn_job_t job; ///<Deferred job, valid while busy
+	void *job_arg; ///<Pass through variable to job
+	int job_result; ///<What job returned
+	int stalled; ///<A send of the job waited out the idle deadline
+	wheel_timer_t timer; ///<Deadline of the current phase
+	int phase; ///<CONN_IDLE, CONN_HEADER or CONN_BODY
+	struct conn *prev; ///<Neighbours in the reactor's connection list
+	struct conn *next;
+};
+
+/**
+ * Called on the reactor thread for every complete request.
+ * Queues the response with conn_write().
+ *
+ * @return 1 if the connection must be closed after the response, 0 otherwise.
+ */
+typedef int (*request_handler_t)(conn_t *c, http_t *req);
+
+/**
+ * Accept counters, see reactor_get_stats().
+ */
+typedef struct {
+	unsigned long accepted; ///<Connections accepted
+	unsigned int queue_peak; ///<Longest accept queue seen by any reactor
+	unsigned int queue_max; ///<Effective backlog of the listeners
+	int reactors; ///<Running reactors
+	int listeners; ///<Listening sockets, more than one with SO_REUSEPORT
+	unsigned long timeouts_idle; ///<Connections closed after the idle deadline
+	unsigned long timeouts_header; ///<Connections closed after the header deadline
+	unsigned long timeouts_body; ///<Connections closed after the body deadline
+} reactor_stats_t;
+
+int reactor_start_all(const int *listen_fds, int nlisten, int n, request_handler_t handler, pool_t *pool);
+void reactor_stop_all(void);
+void reactor_set_timeouts(unsigned long idle_ms, unsigned long header_ms, unsigned long body_ms);
+void reactor_cancel_jobs(void);
+void reactor_get_stats(reactor_stats_t *stats);
+
+int conn_write(conn_t *c, const void *buf, size_t len);
+int conn_writev(conn_t *c, const struct iovec *iov, int iovcnt);
+int conn_defer(conn_t *c, conn_job_t job, void *arg);
+int conn_defer_on(conn_t *c, pool_t *pool, conn_job_t job, void *arg);
+int conn_send_all(conn_t *c, const void *buf, size_t len, int flags);
+int conn_sendv_all(conn_t *c, const struct iovec *iov, int iovcnt, int flags);
+int conn_send_file(conn_t *c, int fd, off_t offset, size_t count);
+
+#endif
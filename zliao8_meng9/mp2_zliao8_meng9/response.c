@@ -0,0 +1,226 @@
+/** @file response.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "response.h"
+
+/**
+ * Internal use only.  Appends len bytes to the header, if they fit,
+ * keeping it null-terminated.
+ */
+static void response_append(response_t *r, const char *s, size_t len)
+{
+	if(r->overflow || r->header_len + len >= sizeof(r->header)){
+		r->overflow = 1;
+		return;
+	}
+	memcpy(r->header + r->header_len, s, len);
+	r->header_len += len;
+	r->header[r->header_len] = 0;
+}
+
+/** Internal use only.  Appends a null-terminated string. */
+static void response_puts(response_t *r, const char *s)
+{
+	response_append(r, s, strlen(s));
+}
+
+/** Internal use only.  Appends a decimal number. */
+static void response_putnum(response_t *r, long long value)
+{
+	char digits[24];
+	char *p = digits + sizeof(digits);
+	unsigned long long v = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while(v);
+	if(value < 0)
+		*--p = '-';
+	response_append(r, p, digits + sizeof(digits) - p);
+}
+
+/**
+ * Starts a response with its status line, e.g. "HTTP/1.1 200 OK".
+ *
+ * @param r The response, usually on the caller's stack.
+ * @param code Status code.
+ * @param reason Reason phrase.
+ * @return void
+ */
+void response_init(response_t *r, int code, const char *reason)
+{
+	r->header_len = 0;
+	r->overflow = 0;
+	r->iovcnt = 0;
+	response_puts(r, "HTTP/1.1 ");
+	response_putnum(r, code);
+	response_append(r, " ", 1);
+	response_puts(r, reason);
+	response_append(r, "\r\n", 2);
+}
+
+/**
+ * Adds "name: value" to the header.
+ *
+ * @param r The response.
+ * @param name Header name.
+ * @param value Header value.
+ * @return void
+ */
+void response_header(response_t *r, const char *name, const char *value)
+{
+	response_puts(r, name);
+	response_append(r, ": ", 2);
+	response_puts(r, value);
+	response_append(r, "\r\n", 2);
+}
+
+/**
+ * Adds a header with a numeric value, such as Content-Length.
+ *
+ * @param r The response.
+ * @param name Header name.
+ * @param value Header value.
+ * @return void
+ */
+void response_header_num(response_t *r, const char *name, long long value)
+{
+	response_puts(r, name);
+	response_append(r, ": ", 2);
+	response_putnum(r, value);
+	response_append(r, "\r\n", 2);
+}
+
+/**
+ * Adds the Connection header.
+ *
+ * @param r The response.
+ * @param keep_alive Nonzero for "Keep-Alive", zero for "close".
+ * @return void
+ */
+void response_connection(response_t *r, int keep_alive)
+{
+	response_header(r, "Connection", keep_alive ? "Keep-Alive" : "close");
+}
+
+/**
+ * Terminates the header and points iov at the header and the body.
+ * The body is not copied and must stay valid until the response is sent.
+ *
+ * @param r The response.
+ * @param body The body, or NULL when it is sent separately (sendfile).
+ * @param body_len Length of body in bytes.
+ * @return Number of valid iov entries.
+ * @return -1 if the header did not fit in RESPONSE_HEADER_SIZE.
+ */
+int response_end(response_t *r, const void *body, size_t body_len)
+{
+	response_append(r, "\r\n", 2);
+	if(r->overflow)
+		return -1;
+
+	r->iov[0].iov_base = r->header;
+	r->iov[0].iov_len = r->header_len;
+	r->iovcnt = 1;
+	if(body != NULL && body_len > 0){
+		r->iov[1].iov_base = (void *)body;
+		r->iov[1].iov_len = body_len;
+		r->iovcnt = 2;
+	}
+	return r->iovcnt;
+}
+
+/**
+ * Private.  A complete response built once at startup, in both its
+ * "Connection: close" and Keep-Alive variants.
+ */
+typedef struct {
+	int code; ///<Status code, 0 for a free slot
+	char *data[2]; ///<Header plus body, [0] close and [1] Keep-Alive
+	size_t len[2]; ///<Lengths of the two variants
+} canned_t;
+
+static canned_t canned[RESPONSE_MAX_CANNED];
+
+/**
+ * Preassembles the full response for a status code whose body never
+ * changes, such as 404.  Must be called before any thread uses
+ * response_canned(); the table is read-only afterwards.
+ *
+ * @param code Status code.
+ * @param reason Reason phrase.
+ * @param content_type Value of the Content-Type header.
+ * @param body The constant body.
+ * @return 0 on success.
+ * @return -1 if the table is full or the header does not fit.
+ */
+int response_canned_add(int code, const char *reason, const char *content_type, const char *body)
+{
+	size_t body_len = strlen(body);
+	int i, k;
+
+	for(i = 0; i < RESPONSE_MAX_CANNED && canned[i].code != 0 && canned[i].code != code; i++)
+		;
+	if(i == RESPONSE_MAX_CANNED)
+		return -1;
+
+	for(k = 0; k < 2; k++){
+		response_t r;
+		response_init(&r, code, reason);
+		response_header(&r, "Content-Type", content_type);
+		response_header_num(&r, "Content-Length", body_len);
+		response_connection(&r, k);
+		if(response_end(&r, NULL, 0) < 0)
+			return -1;
+
+		free(canned[i].data[k]);
+		canned[i].data[k] = malloc(r.header_len + body_len);
+		memcpy(canned[i].data[k], r.header, r.header_len);
+		memcpy(canned[i].data[k] + r.header_len, body, body_len);
+		canned[i].len[k] = r.header_len + body_len;
+	}
+	canned[i].code = code;
+	return 0;
+}
+
+/**
+ * Looks up a response added with response_canned_add().
+ *
+ * @param code Status code.
+ * @param keep_alive Nonzero for the Keep-Alive variant.
+ * @param len Filled with the length of the response in bytes.
+ * @return The complete response, ready for a single write.
+ * @return NULL if code was never added.
+ */
+const char *response_canned(int code, int keep_alive, size_t *len)
+{
+	int i;
+
+	for(i = 0; i < RESPONSE_MAX_CANNED && canned[i].code != 0; i++){
+		if(canned[i].code == code){
+			*len = canned[i].len[keep_alive != 0];
+			return canned[i].data[keep_alive != 0];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Frees every canned response.  Should be called last.
+ *
+ * @return void
+ */
+void response_canned_free(void)
+{
+	int i;
+
+	for(i = 0; i < RESPONSE_MAX_CANNED; i++){
+		free(canned[i].data[0]);
+		free(canned[i].data[1]);
+		memset(&canned[i], 0, sizeof(canned_t));
+	}
+}
@@ -0,0 +1,39 @@
+/** @file response.h */
+#ifndef __RESPONSE_H__
+#define __RESPONSE_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Room for the status line and every header of one response */
+#define RESPONSE_HEADER_SIZE 512
+
+/* Status codes that can have a canned response */
+#define RESPONSE_MAX_CANNED 8
+
+/**
+ * One HTTP response, assembled without touching the heap: the header
+ * text is built in place and the body is only referenced, so the whole
+ * response can go out with a single writev()/sendmsg().  Usually lives
+ * on the stack of whoever answers the request.
+ */
+typedef struct {
+	char header[RESPONSE_HEADER_SIZE]; ///<Status line and headers, null-terminated
+	size_t header_len; ///<Bytes used in header
+	int overflow; ///<Set when a header did not fit, the response is invalid
+	struct iovec iov[2]; ///<Header and body, ready for sendmsg()
+	int iovcnt; ///<Valid entries of iov, set by response_end()
+} response_t;
+
+void response_init(response_t *r, int code, const char *reason);
+void response_header(response_t *r, const char *name, const char *value);
+void response_header_num(response_t *r, const char *name, long long value);
+void response_connection(response_t *r, int keep_alive);
+int response_end(response_t *r, const void *body, size_t body_len);
+
+int response_canned_add(int code, const char *reason, const char *content_type, const char *body);
+const char *response_canned(int code, int keep_alive, size_t *len);
+void response_canned_free(void);
+
+#endif
@@ -0,0 +1,803 @@
+/** @file segment.c */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "segment.h"
+#include "mapguard.h"
+
+#define SEGMENT_MAGIC "DLQSEG2\n"
+
+/* Bytes hashed at each end of the converted part to tell if the log changed */
+#define FINGERPRINT_SIZE 4096
+
+/* Bytes of trigram filter per block, and bits of one filter position */
+#define BLOOM_BYTES (SEGMENT_BLOOM_BITS / 8)
+#define BLOOM_SHIFT 14
+#if (1 << BLOOM_SHIFT) != SEGMENT_BLOOM_BITS
+#error "SEGMENT_BLOOM_BITS must be 1 << BLOOM_SHIFT"
+#endif
+
+/**
+ * Private.  Start of a segment file.  Parts follow, one per conversion:
+ * the compressed blocks of the lines it added, in log order, then its
+ * footer: the index and the trigram filters of those blocks and the
+ * trailer.  Parts are only ever appended, a file is whole up to size
+ * and an append cut short past it is written over by the next one.
+ */
+typedef struct {
+	char magic[8]; ///<SEGMENT_MAGIC
+	uint32_t block_size; ///<SEGMENT_BLOCK_SIZE when it was built
+	uint32_t bloom_bits; ///<SEGMENT_BLOOM_BITS when it was built
+	uint64_t size; ///<End of the trailer of the last whole part
+} seg_header_t;
+
+/**
+ * Private.  End of a part, the one of the last part is read first.
+ */
+typedef struct {
+	uint64_t index_off; ///<Offset of the index of the part, right after its last block
+	uint64_t prev_end; ///<End of the trailer of the part before, 0 for the first
+	uint64_t covered; ///<Bytes of log held, always whole lines
+	uint64_t lines; ///<Lines of log held
+	uint64_t head_hash; ///<Hash of the first bytes of the log
+	uint64_t tail_hash; ///<Hash of the last bytes before covered
+	uint64_t log_dev; ///<Device of the log
+	uint64_t log_ino; ///<Inode of the log, a log replaced by another is converted anew
+	uint32_t nblocks; ///<Number of blocks, in this part and the ones before
+	uint32_t part_blocks; ///<Number of blocks in this part
+	uint32_t bloom_bits; ///<SEGMENT_BLOOM_BITS when it was built
+	char magic[8]; ///<SEGMENT_MAGIC
+} seg_trailer_t;
+
+/**
+ * Private.  One block being built, by whichever builder thread takes it.
+ */
+typedef struct {
+	const char *raw; ///<Its lines, in the mapped log
+	uint32_t raw_len; ///<Bytes of them
+	uint32_t lines; ///<Number of them
+	char *comp; ///<Compressed bytes, malloc'd
+	uLongf comp_len; ///<Number of them
+	uint8_t bloom[BLOOM_BYTES]; ///<Trigram filter
+	int failed; ///<Could not be compressed
+} build_block_t;
+
+/**
+ * Private.  A batch of blocks shared by the builder threads.
+ */
+typedef struct {
+	build_block_t *blocks;
+	int n; ///<Blocks in the batch
+	int next; ///<Next block to build, taken atomically
+} build_batch_t;
+
+/* segment_lock guards current, the references and the counters and is
+   only ever held for a moment, /stats takes it on a reactor.
+   build_lock lets one query at a time bring the segment up to date,
+   which reads and compresses the new lines without segment_lock. */
+static pthread_mutex_t segment_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t build_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *log_file; ///<The converted log, NULL before segment_init()
+static char *seg_file; ///<Its segment
+static segment_t *current; ///<Open segment, NULL if there is none
+static segment_stats_t stats;
+
+/** Internal use only.  FNV-1a. */
+static uint64_t hash_bytes(const char *s, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+
+	for(i = 0; i < len; i++){
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/** Internal use only.  Hashes both ends of the first covered bytes. */
+static void fingerprint(const char *map, uint64_t covered, uint64_t *head, uint64_t *tail)
+{
+	size_t n = covered < FINGERPRINT_SIZE ? covered : FINGERPRINT_SIZE;
+
+	*head = hash_bytes(map, n);
+	*tail = hash_bytes(map + covered - n, n);
+}
+
+/** Internal use only.  Writes all of buf at off. */
+static int pwrite_all(int fd, const void *buf, size_t len, uint64_t off)
+{
+	const char *p = buf;
+
+	while(len > 0){
+		ssize_t n = pwrite(fd, p, len, off);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			return -1;
+		p += n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+/** Internal use only.  Reads all of len bytes at off. */
+static int pread_all(int fd, void *buf, size_t len, uint64_t off)
+{
+	char *p = buf;
+
+	while(len > 0){
+		ssize_t n = pread(fd, p, len, off);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+/*
+ * Trigram filters
+ */
+
+/** Internal use only.  Sets pos to the filter bits of the trigram at t. */
+static void bloom_positions(const char *t, uint32_t *pos)
+{
+	uint64_t h = (uint64_t)(unsigned char)t[0] << 16 | (uint64_t)(unsigned char)t[1] << 8 |
+	             (unsigned char)t[2];
+	int i;
+
+	// splitmix64 finalizer, each position takes its own high bits
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	for(i = 0; i < SEGMENT_BLOOM_HASHES; i++)
+		pos[i] = (uint32_t)(h >> (64 - BLOOM_SHIFT * (i + 1))) & (SEGMENT_BLOOM_BITS - 1);
+}
+
+/** Internal use only.  Adds every trigram of [p, p + len) to a filter. */
+static void bloom_add(uint8_t *bloom, const char *p, size_t len)
+{
+	uint32_t pos[SEGMENT_BLOOM_HASHES];
+	size_t i;
+	int k;
+
+	for(i = 0; i + 3 <= len; i++){
+		bloom_positions(p + i, pos);
+		for(k = 0; k < SEGMENT_BLOOM_HASHES; k++)
+			bloom[pos[k] >> 3] |= 1 << (pos[k] & 7);
+	}
+}
+
+/*
+ * Reading a segment
+ */
+
+/** Internal use only.  Frees a segment nobody uses any more. */
+static void segment_free(segment_t *seg)
+{
+	close(seg->fd);
+	free(seg->blocks);
+	free(seg->blooms);
+	free(seg);
+}
+
+/** Internal use only.  Drops one reference, lock held. */
+static void segment_put(segment_t *seg)
+{
+	if(--seg->refs == 0)
+		segment_free(seg);
+}
+
+/** Internal use only.  Takes a reference to current, or returns NULL. */
+static segment_t *segment_get(void)
+{
+	segment_t *seg;
+
+	pthread_mutex_lock(&segment_lock);
+	if((seg = current) != NULL)
+		seg->refs++;
+	pthread_mutex_unlock(&segment_lock);
+	return seg;
+}
+
+/**
+ * Internal use only.  Tells whether a segment holds the first lines of
+ * the log mapped at map, and not those of a log since truncated,
+ * replaced or generated anew.
+ */
+static int segment_matches(const segment_t *seg, const struct stat *st, const char *map)
+{
+	uint64_t head, tail;
+
+	if(seg->covered > (uint64_t)st->st_size ||
+	   (uint64_t)st->st_dev != seg->log_dev || (uint64_t)st->st_ino != seg->log_ino)
+		return 0;
+	fingerprint(map, seg->covered, &head, &tail);
+	return head == seg->head_hash && tail == seg->tail_hash;
+}
+
+/**
+ * Internal use only.  Reads the trailer of a part ending at end, and
+ * checks it fits before it.
+ *
+ * @return 0, or -1 if there is no whole part there.
+ */
+static int trailer_read(int fd, uint64_t end, seg_trailer_t *t)
+{
+	if(end < sizeof(seg_header_t) + sizeof(*t) || pread_all(fd, t, sizeof(*t), end - sizeof(*t)) < 0)
+		return -1;
+	if(memcmp(t->magic, SEGMENT_MAGIC, 8) != 0 || t->bloom_bits != SEGMENT_BLOOM_BITS ||
+	   t->part_blocks > t->nblocks || t->prev_end > t->index_off ||
+	   t->index_off + (uint64_t)t->part_blocks * (sizeof(segment_block_t) + BLOOM_BYTES) + sizeof(*t) != end)
+		return -1;
+	return 0;
+}
+
+/**
+ * Internal use only.  Opens a segment file and reads the footers of its
+ * parts into memory, from the last one back to the first.
+ *
+ * @return The segment, or NULL if there is no whole one.
+ */
+static segment_t *segment_open(const char *path)
+{
+	struct stat st;
+	seg_header_t h;
+	seg_trailer_t t;
+	segment_t *seg;
+	uint32_t i;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		return NULL;
+	if(fstat(fd, &st) < 0 || pread_all(fd, &h, sizeof(h), 0) < 0 ||
+	   memcmp(h.magic, SEGMENT_MAGIC, 8) != 0 || h.size > (uint64_t)st.st_size ||
+	   trailer_read(fd, h.size, &t) < 0){
+		close(fd);
+		return NULL;
+	}
+
+	seg = calloc(1, sizeof(segment_t));
+	seg->fd = fd;
+	seg->covered = t.covered;
+	seg->lines = t.lines;
+	seg->nblocks = t.nblocks;
+	seg->file_size = h.size;
+	seg->head_hash = t.head_hash;
+	seg->tail_hash = t.tail_hash;
+	seg->log_dev = t.log_dev;
+	seg->log_ino = t.log_ino;
+	seg->refs = 1;
+	seg->blocks = malloc(seg->nblocks * sizeof(segment_block_t) + 1);
+	seg->blooms = malloc((size_t)seg->nblocks * BLOOM_BYTES + 1);
+	// each part ends before the next starts, so this always ends
+	for(i = seg->nblocks; ; ){
+		i -= t.part_blocks;
+		if(pread_all(fd, seg->blocks + i, t.part_blocks * sizeof(segment_block_t), t.index_off) < 0 ||
+		   pread_all(fd, seg->blooms + (size_t)i * BLOOM_BYTES, (size_t)t.part_blocks * BLOOM_BYTES,
+		             t.index_off + t.part_blocks * sizeof(segment_block_t)) < 0){
+			segment_free(seg);
+			return NULL;
+		}
+		if(t.prev_end == 0)
+			break;
+		if(trailer_read(fd, t.prev_end, &t) < 0 || t.nblocks != i){
+			segment_free(seg);
+			return NULL;
+		}
+	}
+	if(i != 0){
+		segment_free(seg);
+		return NULL;
+	}
+	for(i = 0; i < seg->nblocks; i++){
+		if(seg->blocks[i].raw_len > seg->max_raw)
+			seg->max_raw = seg->blocks[i].raw_len;
+		if(seg->blocks[i].comp_len > seg->max_comp)
+			seg->max_comp = seg->blocks[i].comp_len;
+	}
+	return seg;
+}
+
+/*
+ * Building a segment
+ */
+
+/** Internal use only.  Builder thread: compresses and filters blocks. */
+static void *build_run(void *ptr)
+{
+	build_batch_t *batch = ptr;
+	int i;
+
+	while((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->n){
+		build_block_t *b = &batch->blocks[i];
+		const char *p = b->raw, *end = b->raw + b->raw_len;
+
+		while((p = memchr(p, '\n', end - p)) != NULL){
+			b->lines++;
+			p++;
+		}
+		bloom_add(b->bloom, b->raw, b->raw_len);
+		b->comp_len = compressBound(b->raw_len);
+		b->comp = malloc(b->comp_len);
+		b->failed = compress2((Bytef *)b->comp, &b->comp_len, (const Bytef *)b->raw, b->raw_len,
+		                      SEGMENT_LEVEL) != Z_OK;
+	}
+	return NULL;
+}
+
+/** Internal use only.  Returns the end of the block starting at start. */
+static uint64_t block_end(const char *map, uint64_t start, uint64_t whole)
+{
+	const char *nl;
+
+	if(whole - start <= SEGMENT_BLOCK_SIZE)
+		return whole;
+	nl = memchr(map + start + SEGMENT_BLOCK_SIZE, '\n', whole - start - SEGMENT_BLOCK_SIZE);
+	return nl ? (uint64_t)(nl + 1 - map) : whole;
+}
+
+/**
+ * Internal use only.  Adds the lines of [old covered, whole) to the
+ * segment, or writes a new one when there is no old one.
+ *
+ * New blocks are compressed SEGMENT_BATCH_BLOCKS at a time by one
+ * thread per core, then written in order, with the footer of their part
+ * after them.  An old segment is extended past its end, so nothing of
+ * it is written over: its size in the header only grows once the new
+ * part is on disk, and an append that fails or is cut short by a crash
+ * leaves it as it was.  A new segment is written to a temporary file
+ * and renamed.
+ *
+ * @param old The segment to extend, or NULL.
+ * @param st The log.
+ * @param map The log, mapped.
+ * @param whole Bytes of log to hold afterwards, whole lines.
+ * @return 0, or -1 if the segment could not be written.
+ */
+static int segment_write(const segment_t *old, const struct stat *st, const char *map, uint64_t whole)
+{
+	uint32_t nblocks = 0, cap = 16;
+	segment_block_t *blocks = malloc(cap * sizeof(segment_block_t));
+	uint8_t *blooms = malloc((size_t)cap * BLOOM_BYTES);
+	uint64_t covered = old ? old->covered : 0, lines = old ? old->lines : 0, pos;
+	build_block_t *batch_blocks = malloc(SEGMENT_BATCH_BLOCKS * sizeof(build_block_t));
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *threads;
+	seg_header_t h;
+	seg_trailer_t trailer;
+	char *tmp = NULL;
+	int fd, rc = 0, i;
+
+	if(nthreads <= 0)
+		nthreads = 1;
+	if(nthreads > SEGMENT_BATCH_BLOCKS)
+		nthreads = SEGMENT_BATCH_BLOCKS;
+	threads = malloc(nthreads * sizeof(pthread_t));
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SEGMENT_MAGIC, 8);
+	h.block_size = SEGMENT_BLOCK_SIZE;
+	h.bloom_bits = SEGMENT_BLOOM_BITS;
+	if(old != NULL){
+		pos = old->file_size;
+		fd = open(seg_file, O_WRONLY | O_CLOEXEC);
+	}else{
+		pos = sizeof(h);
+		tmp = malloc(strlen(seg_file) + 5);
+		sprintf(tmp, "%s.tmp", seg_file);
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+	if(fd < 0)
+		rc = -1;
+
+	while(rc == 0 && covered < whole){
+		build_batch_t batch;
+		memset(batch_blocks, 0, SEGMENT_BATCH_BLOCKS * sizeof(build_block_t));
+		batch.blocks = batch_blocks;
+		batch.n = 0;
+		batch.next = 0;
+		while(batch.n < SEGMENT_BATCH_BLOCKS && covered < whole){
+			uint64_t end = block_end(map, covered, whole);
+			batch_blocks[batch.n].raw = map + covered;
+			batch_blocks[batch.n].raw_len = end - covered;
+			batch.n++;
+			covered = end;
+		}
+
+		int started = 0;
+		for(i = 0; i < nthreads && i < batch.n; i++){
+			if(pthread_create(&threads[i], NULL, build_run, &batch) != 0)
+				break;
+			started++;
+		}
+		if(started == 0)
+			build_run(&batch);
+		for(i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+
+		for(i = 0; i < batch.n; i++){
+			build_block_t *b = &batch_blocks[i];
+			if(rc == 0 && (b->failed || pwrite_all(fd, b->comp, b->comp_len, pos) < 0))
+				rc = -1;
+			if(rc == 0){
+				if(nblocks == cap){
+					cap *= 2;
+					blocks = realloc(blocks, cap * sizeof(segment_block_t));
+					blooms = realloc(blooms, (size_t)cap * BLOOM_BYTES);
+				}
+				segment_block_t *e = &blocks[nblocks];
+				memset(e, 0, sizeof(*e));
+				e->raw_off = b->raw - map;
+				e->comp_off = pos;
+				e->first_line = lines;
+				e->raw_len = b->raw_len;
+				e->comp_len = b->comp_len;
+				e->lines = b->lines;
+				memcpy(blooms + (size_t)nblocks * BLOOM_BYTES, b->bloom, BLOOM_BYTES);
+				nblocks++;
+				pos += b->comp_len;
+				lines += b->lines;
+			}
+			free(b->comp);
+		}
+	}
+
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.index_off = pos;
+	trailer.prev_end = old ? old->file_size : 0;
+	trailer.covered = whole;
+	trailer.lines = lines;
+	fingerprint(map, whole, &trailer.head_hash, &trailer.tail_hash);
+	trailer.log_dev = st->st_dev;
+	trailer.log_ino = st->st_ino;
+	trailer.nblocks = (old ? old->nblocks : 0) + nblocks;
+	trailer.part_blocks = nblocks;
+	trailer.bloom_bits = SEGMENT_BLOOM_BITS;
+	memcpy(trailer.magic, SEGMENT_MAGIC, 8);
+	if(rc == 0 && mapguard_cut(map)){
+		// the log was truncated under us, what was read of it is zeros
+		fprintf(stderr, "-- %s: truncated while it was converted\n", log_file);
+		rc = -2;
+	}
+	if(rc == 0){
+		uint64_t bloom_off = pos + nblocks * sizeof(segment_block_t);
+		uint64_t trailer_off = bloom_off + (uint64_t)nblocks * BLOOM_BYTES;
+		// the new part must be on disk before the header points past it
+		h.size = trailer_off + sizeof(trailer);
+		if(pwrite_all(fd, blocks, nblocks * sizeof(segment_block_t), pos) < 0 ||
+		   pwrite_all(fd, blooms, (size_t)nblocks * BLOOM_BYTES, bloom_off) < 0 ||
+		   pwrite_all(fd, &trailer, sizeof(trailer), trailer_off) < 0 ||
+		   ftruncate(fd, h.size) < 0 || fdatasync(fd) < 0 ||
+		   pwrite_all(fd, &h, sizeof(h), 0) < 0 ||
+		   (tmp != NULL && (fdatasync(fd) < 0 || rename(tmp, seg_file) < 0)))
+			rc = -1;
+	}
+	if(rc < 0){
+		if(rc == -1)
+			perror("-- writing the log segment failed");
+		if(tmp != NULL)
+			unlink(tmp);
+	}
+	if(fd >= 0)
+		close(fd);
+
+	free(tmp);
+	free(threads);
+	free(batch_blocks);
+	free(blocks);
+	free(blooms);
+	return rc < 0 ? -1 : 0;
+}
+
+/**
+ * Internal use only.  Keeps the file of a segment whose log was
+ * replaced by another one, under the inode of the old log, e.g.
+ * dlq.log.seg.1234.  The old log may be gone, its lines are then only
+ * there.  The file is linked under its new name, so the segment of the
+ * new log can be renamed over the old name as usual.
+ *
+ * @return 0, or -1 if it could not be kept.
+ */
+static int segment_keep(const segment_t *seg)
+{
+	char *kept = malloc(strlen(seg_file) + 48);
+	int n = 0, rc;
+
+	do{
+		if(n == 0)
+			sprintf(kept, "%s.%llu", seg_file, (unsigned long long)seg->log_ino);
+		else
+			sprintf(kept, "%s.%llu.%d", seg_file, (unsigned long long)seg->log_ino, n);
+		n++;
+	}while((rc = link(seg_file, kept)) < 0 && errno == EEXIST);
+	if(rc == 0)
+		fprintf(stderr, "-- %s was replaced, the segment of the old one is kept in %s\n", log_file, kept);
+	else if(errno == ENOENT)
+		rc = 0;
+	else
+		perror("-- keeping the segment of the replaced log failed");
+	free(kept);
+	return rc;
+}
+
+/**
+ * Internal use only.  Brings the segment up to date with the log mapped
+ * at map.  If the converted part of the log changed, e.g. it was
+ * truncated or generated anew, the segment is built again from
+ * scratch; if the log was replaced by another file, the old segment is
+ * kept aside first.  New lines are only added once there are at least
+ * min_new bytes of them.
+ *
+ * Called with build_lock held.  The lines are read and compressed
+ * without segment_lock, queries go on with the segment as it was, and
+ * the new one replaces it only once it is written.
+ */
+static void segment_sync(const struct stat *st, const char *map, uint64_t min_new)
+{
+	segment_t *base = segment_get(), *next;
+	uint64_t covered = base ? base->covered : 0, size = st->st_size, whole;
+
+	if(base != NULL && !segment_matches(base, st, map)){
+		if(((uint64_t)st->st_dev != base->log_dev || (uint64_t)st->st_ino != base->log_ino) &&
+		   segment_keep(base) < 0){
+			// queries scan the log until the old segment is kept
+			segment_release(base);
+			return;
+		}
+		// no query may be answered from it while the new one is built
+		pthread_mutex_lock(&segment_lock);
+		if(current == base){
+			segment_put(current);
+			current = NULL;
+		}
+		segment_put(base);
+		pthread_mutex_unlock(&segment_lock);
+		base = NULL;
+		covered = 0;
+	}
+
+	// only whole lines are converted
+	const char *nl = size > covered ? memrchr(map + covered, '\n', size - covered) : NULL;
+	whole = nl ? (uint64_t)(nl + 1 - map) : covered;
+	if(whole == covered || whole - covered < min_new){
+		if(base != NULL)
+			segment_release(base);
+		return;
+	}
+
+	next = NULL;
+	if(segment_write(base, st, map, whole) == 0)
+		next = segment_open(seg_file);
+	pthread_mutex_lock(&segment_lock);
+	// otherwise an old segment is still whole and goes on serving
+	if(next != NULL){
+		if(current != NULL)
+			segment_put(current);
+		current = next;
+		if(base != NULL)
+			stats.appends++;
+		else
+			stats.builds++;
+	}
+	if(base != NULL)
+		segment_put(base);
+	pthread_mutex_unlock(&segment_lock);
+}
+
+/**
+ * Converts a log into its segment, or adds the lines written since it
+ * was last converted.  Queries for other logs are not answered from a
+ * segment.  Once converted, the log itself may be removed: its lines
+ * are then answered from the segment alone, and when another log takes
+ * its place the segment is kept beside the new one.
+ *
+ * @param log_path The log.
+ * @return 0 on success, -1 if neither the log nor its segment can be read.
+ */
+int segment_init(const char *log_path)
+{
+	struct stat st;
+	char *map;
+	int fd, rc = 0;
+
+	pthread_mutex_lock(&build_lock);
+	pthread_mutex_lock(&segment_lock);
+	log_file = strdup(log_path);
+	seg_file = malloc(strlen(log_path) + strlen(SEGMENT_SUFFIX) + 1);
+	sprintf(seg_file, "%s%s", log_path, SEGMENT_SUFFIX);
+	current = segment_open(seg_file);
+	pthread_mutex_unlock(&segment_lock);
+
+	if((fd = open(log_path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0){
+		rc = current ? 0 : -1;
+	}else if(st.st_size > 0){
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map != MAP_FAILED){
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			mapguard_add(map, st.st_size);
+			segment_sync(&st, map, 0);
+			mapguard_remove(map);
+			munmap(map, st.st_size);
+		}else{
+			rc = -1;
+		}
+	}
+	if(fd >= 0)
+		close(fd);
+	pthread_mutex_unlock(&build_lock);
+	return rc;
+}
+
+/**
+ * Closes the segment.  Queries still holding it keep it until they
+ * release it.
+ *
+ * @return void
+ */
+void segment_destroy(void)
+{
+	pthread_mutex_lock(&segment_lock);
+	if(current != NULL)
+		segment_put(current);
+	current = NULL;
+	free(log_file);
+	free(seg_file);
+	log_file = seg_file = NULL;
+	pthread_mutex_unlock(&segment_lock);
+}
+
+/**
+ * Returns the segment holding the first lines of a log, for one query.
+ * It is first brought up to date with the log, unless the log was
+ * removed.
+ *
+ * @param log_path The log, must be the one given to segment_init().
+ * @param st The log, or NULL if it is gone.
+ * @param map The log, mapped by the caller, or NULL if it is gone.
+ * @return The segment, to be given back with segment_release(), or
+ *         NULL if there is none: the whole log must then be scanned.
+ */
+segment_t *segment_acquire(const char *log_path, const struct stat *st, const char *map)
+{
+	segment_t *seg;
+
+	if(log_file == NULL || strcmp(log_path, log_file) != 0)
+		return NULL;
+
+	// while another query converts new lines, this one scans them
+	if(st != NULL && map != NULL && pthread_mutex_trylock(&build_lock) == 0){
+		segment_sync(st, map, SEGMENT_SYNC_MIN);
+		pthread_mutex_unlock(&build_lock);
+	}
+	if((seg = segment_get()) != NULL && st != NULL && map != NULL && !segment_matches(seg, st, map)){
+		// the log changed and has not been converted again yet
+		segment_release(seg);
+		return NULL;
+	}
+	if(seg != NULL){
+		pthread_mutex_lock(&segment_lock);
+		stats.queries++;
+		stats.bytes_covered += seg->covered;
+		pthread_mutex_unlock(&segment_lock);
+	}
+	return seg;
+}
+
+/**
+ * Tells how much of a log its segment holds, without bringing it up to
+ * date, e.g. to know whether a removed log can still be searched.
+ *
+ * @param log_path The log.
+ * @return Bytes of log held, 0 if there is no segment for it.
+ */
+uint64_t segment_covered(const char *log_path)
+{
+	uint64_t covered = 0;
+
+	if(log_file == NULL || strcmp(log_path, log_file) != 0)
+		return 0;
+	pthread_mutex_lock(&segment_lock);
+	if(current != NULL)
+		covered = current->covered;
+	pthread_mutex_unlock(&segment_lock);
+	return covered;
+}
+
+/**
+ * Gives back a segment returned by segment_acquire().
+ *
+ * @param seg The segment.
+ * @return void
+ */
+void segment_release(segment_t *seg)
+{
+	pthread_mutex_lock(&segment_lock);
+	segment_put(seg);
+	pthread_mutex_unlock(&segment_lock);
+}
+
+/**
+ * Tells whether a block may hold a string, from its trigram filter.
+ * Strings shorter than a trigram may be anywhere.
+ *
+ * @param seg The segment.
+ * @param block Number of the block.
+ * @param s The string.
+ * @param len Its length.
+ * @return 1 if it may, 0 if it surely does not: the block is skipped.
+ */
+int segment_may_hold(const segment_t *seg, uint32_t block, const char *s, size_t len)
+{
+	const uint8_t *bloom = seg->blooms + (size_t)block * BLOOM_BYTES;
+	uint32_t pos[SEGMENT_BLOOM_HASHES];
+	size_t i;
+	int k;
+
+	for(i = 0; i + 3 <= len; i++){
+		bloom_positions(s + i, pos);
+		for(k = 0; k < SEGMENT_BLOOM_HASHES; k++){
+			if(!(bloom[pos[k] >> 3] & (1 << (pos[k] & 7)))){
+				__atomic_fetch_add(&stats.blocks_skipped, 1, __ATOMIC_RELAXED);
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/**
+ * Reads and decompresses one block.
+ *
+ * @param seg The segment.
+ * @param block Number of the block.
+ * @param raw Room for seg->max_raw bytes, filled with its lines.
+ * @param comp Room for seg->max_comp bytes, used for the compressed ones.
+ * @return The number of bytes in raw, or -1 if the block is damaged.
+ */
+ssize_t segment_read(const segment_t *seg, uint32_t block, char *raw, char *comp)
+{
+	const segment_block_t *b = &seg->blocks[block];
+	uLongf len = b->raw_len;
+
+	if(pread_all(seg->fd, comp, b->comp_len, b->comp_off) < 0)
+		return -1;
+	__atomic_fetch_add(&stats.blocks_read, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats.bytes_read, b->comp_len, __ATOMIC_RELAXED);
+	if(uncompress((Bytef *)raw, &len, (const Bytef *)comp, b->comp_len) != Z_OK || len != b->raw_len)
+		return -1;
+	return len;
+}
+
+/**
+ * Reads the segment counters.
+ *
+ * @param s Filled with a copy of the counters.
+ * @return void
+ */
+void segment_get_stats(segment_stats_t *s)
+{
+	pthread_mutex_lock(&segment_lock);
+	*s = stats;
+	s->blocks_read = __atomic_load_n(&stats.blocks_read, __ATOMIC_RELAXED);
+	s->blocks_skipped = __atomic_load_n(&stats.blocks_skipped, __ATOMIC_RELAXED);
+	s->bytes_read = __atomic_load_n(&stats.bytes_read, __ATOMIC_RELAXED);
+	s->covered = current ? current->covered : 0;
+	s->file_size = current ? current->file_size : 0;
+	s->blocks = current ? current->nblocks : 0;
+	pthread_mutex_unlock(&segment_lock);
+}
@@ -0,0 +1,85 @@
+/** @file segment.h */
+#ifndef __SEGMENT_H__
+#define __SEGMENT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* The segment of a log lives next to it, in <log><SEGMENT_SUFFIX> */
+#define SEGMENT_SUFFIX ".seg"
+/* Logs are cut into line-aligned blocks of about this size, each
+   compressed on its own */
+#define SEGMENT_BLOCK_SIZE (64 * 1024)
+/* zlib level the blocks are compressed with */
+#define SEGMENT_LEVEL 6
+/* Bits of the trigram filter of each block, and hashes per trigram */
+#define SEGMENT_BLOOM_BITS (16 * 1024)
+#define SEGMENT_BLOOM_HASHES 3
+/* Blocks compressed at once by the threads building a segment */
+#define SEGMENT_BATCH_BLOCKS 256
+/* Lines appended to the log are added once there are this many bytes
+   of them, until then queries scan them in the log */
+#define SEGMENT_SYNC_MIN (4 * 1024 * 1024)
+
+/**
+ * Where one block is, in the log and in the segment.
+ */
+typedef struct {
+	uint64_t raw_off; ///<Offset of its first line in the log
+	uint64_t comp_off; ///<Offset of its compressed bytes in the segment
+	uint64_t first_line; ///<Number of its first line in the log, from 0
+	uint32_t raw_len; ///<Bytes of log it holds, whole lines
+	uint32_t comp_len; ///<Bytes it takes in the segment
+	uint32_t lines; ///<Lines it holds
+	uint32_t pad;
+} segment_block_t;
+
+/**
+ * An open segment, see segment_acquire().  The block index and the
+ * filters are held in memory, the blocks are read when scanned.
+ */
+typedef struct segment {
+	int fd; ///<The segment file
+	uint64_t covered; ///<Bytes of log it holds, always whole lines
+	uint64_t lines; ///<Lines of log it holds
+	uint32_t nblocks; ///<Number of blocks
+	uint32_t max_raw; ///<Largest raw_len of a block
+	uint32_t max_comp; ///<Largest comp_len of a block
+	segment_block_t *blocks; ///<The block index, in log order
+	uint8_t *blooms; ///<SEGMENT_BLOOM_BITS / 8 bytes of trigram filter per block
+	uint64_t file_size; ///<Bytes of the segment file that are whole
+	uint64_t head_hash; ///<Hash of the first bytes of the log it holds
+	uint64_t tail_hash; ///<Hash of the last bytes before covered
+	uint64_t log_dev; ///<Device and inode of the log it holds
+	uint64_t log_ino;
+	int refs; ///<Users, see segment_release()
+} segment_t;
+
+/**
+ * Counters reported by /stats.
+ */
+typedef struct {
+	unsigned long builds; ///<Segments written from scratch
+	unsigned long appends; ///<Times new lines were added
+	unsigned long queries; ///<Queries answered from the segment
+	unsigned long long blocks_read; ///<Blocks read and decompressed
+	unsigned long long blocks_skipped; ///<Blocks the filters ruled out
+	unsigned long long bytes_read; ///<Compressed bytes read
+	unsigned long long bytes_covered; ///<Log bytes the queries answered from the segment
+	unsigned long long covered; ///<Bytes of log the segment holds
+	unsigned long long file_size; ///<Bytes of the segment file
+	unsigned int blocks; ///<Blocks in the segment
+} segment_stats_t;
+
+int segment_init(const char *log_path);
+void segment_destroy(void);
+segment_t *segment_acquire(const char *log_path, const struct stat *st, const char *map);
+uint64_t segment_covered(const char *log_path);
+void segment_release(segment_t *seg);
+int segment_may_hold(const segment_t *seg, uint32_t block, const char *s, size_t len);
+ssize_t segment_read(const segment_t *seg, uint32_t block, char *raw, char *comp);
+void segment_get_stats(segment_stats_t *stats);
+
+#endif
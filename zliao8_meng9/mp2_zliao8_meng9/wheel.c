@@ -0,0 +1,233 @@
+/** @file wheel.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "wheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+/** Internal use only.  Appends t to the list headed by head. */
+static void list_add(wheel_timer_t *head, wheel_timer_t *t)
+{
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+/** Internal use only.  Unlinks t from whatever list holds it. */
+static void list_del(wheel_timer_t *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->prev = t->next = NULL;
+}
+
+/** Internal use only.  Files t in the slot matching its expiry. */
+static void wheel_place(wheel_t *w, wheel_timer_t *t)
+{
+	unsigned long delta = t->expires - w->now;
+	int level = 0;
+
+	// delta is 0 only while cascading, for a timer due on this very tick
+	while(level < WHEEL_LEVELS - 1 && delta >= 1UL << (WHEEL_BITS * (level + 1)))
+		level++;
+	// beyond the last level, clamp to the longest delay it can hold
+	if(delta >= 1UL << (WHEEL_BITS * WHEEL_LEVELS))
+		t->expires = w->now + (1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+	list_add(&w->slots[level][(t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK], t);
+}
+
+/**
+ * Internal use only.  Moves every timer of one slot of a coarse level
+ * to the finer levels.
+ */
+static void wheel_cascade(wheel_t *w, int level)
+{
+	wheel_timer_t *head = &w->slots[level][(w->now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+	while(head->next != head){
+		wheel_timer_t *t = head->next;
+		list_del(t);
+		wheel_place(w, t);
+	}
+}
+
+/**
+ * Returns a monotonic clock in milliseconds, for the now_ms arguments.
+ *
+ * @return Milliseconds since an arbitrary point.
+ */
+unsigned long wheel_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Initializes an empty wheel.
+ * Should always be called first.
+ *
+ * @param w A pointer to the wheel.
+ * @param now_ms Current time, from wheel_now_ms().
+ * @param tick_ms Resolution; timeouts are rounded up to whole ticks.
+ * @return void
+ */
+void wheel_init(wheel_t *w, unsigned long now_ms, unsigned int tick_ms)
+{
+	int l, i;
+
+	for(l = 0; l < WHEEL_LEVELS; l++){
+		for(i = 0; i < WHEEL_SLOTS; i++){
+			w->slots[l][i].prev = &w->slots[l][i];
+			w->slots[l][i].next = &w->slots[l][i];
+		}
+	}
+	w->now = 0;
+	w->start_ms = now_ms;
+	w->tick_ms = tick_ms > 0 ? tick_ms : 1;
+	w->count = 0;
+}
+
+/**
+ * Initializes a timer that is not armed yet.
+ *
+ * @param t The timer.
+ * @param func Called with arg when the timer expires.
+ * @param arg Pass through variable to func.
+ * @return void
+ */
+void wheel_timer_init(wheel_timer_t *t, void (*func)(void *), void *arg)
+{
+	t->prev = t->next = NULL;
+	t->expires = 0;
+	t->func = func;
+	t->arg = arg;
+}
+
+/**
+ * Checks whether a timer is armed.
+ *
+ * @param t The timer.
+ * @return 1 if armed, 0 otherwise.
+ */
+int wheel_pending(wheel_timer_t *t)
+{
+	return t->next != NULL;
+}
+
+/**
+ * Arms a timer to fire timeout_ms from the last wheel_advance(),
+ * replacing any earlier deadline.
+ *
+ * @param w The wheel.
+ * @param t The timer.
+ * @param timeout_ms Delay, rounded up to whole ticks.
+ * @return void
+ */
+void wheel_add(wheel_t *w, wheel_timer_t *t, unsigned long timeout_ms)
+{
+	unsigned long ticks = (timeout_ms + w->tick_ms - 1) / w->tick_ms;
+
+	if(wheel_pending(t))
+		list_del(t);
+	else
+		w->count++;
+	t->expires = w->now + (ticks > 0 ? ticks : 1);
+	wheel_place(w, t);
+}
+
+/**
+ * Cancels a timer.  Does nothing if it is not armed.
+ *
+ * @param w The wheel.
+ * @param t The timer.
+ * @return void
+ */
+void wheel_del(wheel_t *w, wheel_timer_t *t)
+{
+	if(!wheel_pending(t))
+		return;
+	list_del(t);
+	w->count--;
+}
+
+/**
+ * Processes every tick up to now_ms, calling func for each timer that
+ * expires.  func may arm or cancel any timer, including its own.
+ *
+ * @param w The wheel.
+ * @param now_ms Current time, from wheel_now_ms().
+ * @return void
+ */
+void wheel_advance(wheel_t *w, unsigned long now_ms)
+{
+	unsigned long target = (now_ms - w->start_ms) / w->tick_ms;
+
+	while(w->now < target){
+		wheel_timer_t expired;
+		int level;
+
+		w->now++;
+		// a finer ring wrapped around, pull the next slot down
+		for(level = 1; level < WHEEL_LEVELS; level++){
+			if((w->now & ((1UL << (WHEEL_BITS * level)) - 1)) != 0)
+				break;
+			wheel_cascade(w, level);
+		}
+
+		// detach the slot first so func can touch the wheel freely
+		wheel_timer_t *head = &w->slots[0][w->now & WHEEL_MASK];
+		if(head->next == head)
+			continue;
+		expired.next = head->next;
+		expired.prev = head->prev;
+		expired.next->prev = &expired;
+		expired.prev->next = &expired;
+		head->next = head->prev = head;
+
+		while(expired.next != &expired){
+			wheel_timer_t *t = expired.next;
+			list_del(t);
+			w->count--;
+			t->func(t->arg);
+		}
+	}
+}
+
+/**
+ * Tells how long a poll may sleep before wheel_advance() has work.
+ *
+ * @param w The wheel.
+ * @param now_ms Current time, from wheel_now_ms().
+ * @return Milliseconds to wait, or -1 if no timer is armed.
+ */
+int wheel_next_timeout(wheel_t *w, unsigned long now_ms)
+{
+	unsigned long tick, due_ms;
+	int i;
+
+	if(w->count == 0)
+		return -1;
+
+	// the nearest busy slot of the finest ring, or else its wrap-around
+	tick = ((w->now >> WHEEL_BITS) + 1) << WHEEL_BITS;
+	for(i = 1; i <= WHEEL_SLOTS; i++){
+		wheel_timer_t *head = &w->slots[0][(w->now + i) & WHEEL_MASK];
+		if(head->next != head){
+			if(w->now + i < tick)
+				tick = w->now + i;
+			break;
+		}
+	}
+
+	due_ms = w->start_ms + tick * w->tick_ms;
+	if(due_ms <= now_ms)
+		return 0;
+	return (int)(due_ms - now_ms);
+}
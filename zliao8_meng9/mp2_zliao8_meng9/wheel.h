@@ -0,0 +1,44 @@
+/** @file wheel.h */
+#ifndef __WHEEL_H__
+#define __WHEEL_H__
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+/**
+ * A timeout, normally embedded in the object it guards.  Arming and
+ * cancelling only relink it, so both are O(1).
+ */
+typedef struct wheel_timer {
+	struct wheel_timer *prev; ///<Neighbours in a slot, NULL when not armed
+	struct wheel_timer *next;
+	unsigned long expires; ///<Tick at which it fires
+	void (*func)(void *arg); ///<Called once the timer expires
+	void *arg; ///<Pass through variable to func
+} wheel_timer_t;
+
+/**
+ * A hierarchical timing wheel: WHEEL_LEVELS rings of WHEEL_SLOTS lists,
+ * each level WHEEL_SLOTS times coarser than the one below.  Timers move
+ * down a level when the lower ring wraps around.  Not thread-safe, use
+ * one per thread.
+ */
+typedef struct {
+	wheel_timer_t slots[WHEEL_LEVELS][WHEEL_SLOTS]; ///<List heads
+	unsigned long now; ///<Last tick processed
+	unsigned long start_ms; ///<Clock value of tick 0
+	unsigned int tick_ms; ///<Length of one tick
+	unsigned int count; ///<Armed timers
+} wheel_t;
+
+void wheel_init(wheel_t *w, unsigned long now_ms, unsigned int tick_ms);
+void wheel_timer_init(wheel_timer_t *t, void (*func)(void *), void *arg);
+void wheel_add(wheel_t *w, wheel_timer_t *t, unsigned long timeout_ms);
+void wheel_del(wheel_t *w, wheel_timer_t *t);
+int wheel_pending(wheel_timer_t *t);
+void wheel_advance(wheel_t *w, unsigned long now_ms);
+int wheel_next_timeout(wheel_t *w, unsigned long now_ms);
+unsigned long wheel_now_ms(void);
+
+#endif